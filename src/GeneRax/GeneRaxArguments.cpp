@@ -2,6 +2,7 @@
 #include "GeneRaxArguments.hpp"
 #include <IO/Logger.hpp>
 #include <parallelization/ParallelContext.hpp>
+#include <likelihoods/reconciliation_models/FixedPointIterations.hpp>
 #include <algorithm>
 #include <vector>
 
@@ -28,6 +29,14 @@ GeneRaxArguments::GeneRaxArguments(int iargc, char * iargv[]):
   buildSuperMatrix(false),
   reconciliationSamples(0),
   maxSPRRadius(5),
+  geneSearchThreads(1),
+  sprScreeningTopK(0),
+  sprScreeningDelta(-1.0),
+  sprMoveCache(false),
+  sprBatchMoves(false),
+  safeMode(false),
+  dtlMaxIterations(FixedPointIterations().getMaxIterations()),
+  dtlEpsilon(FixedPointIterations().getEpsilon()),
   recWeight(1.0), 
   seed(123),
   filterFamilies(true),
@@ -36,6 +45,7 @@ GeneRaxArguments::GeneRaxArguments(int iargc, char * iargv[]):
   optimizeSpeciesTree(false),
   speciesFastRadius(5),
   speciesSlowRadius(0),
+  speciesApproxSamples(20),
   speciesInitialFamiliesSubsamples(-1)
 {
   if (argc == 1) {
@@ -91,6 +101,22 @@ void GeneRaxArguments::init() {
       userDTLRates = true;
     } else if (arg == "--max-spr-radius") {
       maxSPRRadius = static_cast<unsigned int>(atoi(argv[++i]));
+    } else if (arg == "--gene-search-threads") {
+      geneSearchThreads = static_cast<unsigned int>(atoi(argv[++i]));
+    } else if (arg == "--spr-screening-k") {
+      sprScreeningTopK = static_cast<unsigned int>(atoi(argv[++i]));
+    } else if (arg == "--spr-screening-delta") {
+      sprScreeningDelta = atof(argv[++i]);
+    } else if (arg == "--spr-move-cache") {
+      sprMoveCache = true;
+    } else if (arg == "--spr-batch-moves") {
+      sprBatchMoves = true;
+    } else if (arg == "--safe-mode") {
+      safeMode = true;
+    } else if (arg == "--dtl-max-iterations") {
+      dtlMaxIterations = static_cast<unsigned int>(atoi(argv[++i]));
+    } else if (arg == "--dtl-epsilon") {
+      dtlEpsilon = atof(argv[++i]);
     } else if (arg == "--rec-weight") {
       recWeight = atof(argv[++i]);
     } else if (arg == "--seed") {
@@ -101,6 +127,8 @@ void GeneRaxArguments::init() {
       speciesFastRadius = static_cast<unsigned int>(atoi(argv[++i]));
     } else if (arg == "--species-slow-radius") {
       speciesSlowRadius = static_cast<unsigned int>(atoi(argv[++i]));
+    } else if (arg == "--species-approx-samples") {
+      speciesApproxSamples = static_cast<unsigned int>(atoi(argv[++i]));
     } else if (arg == "--species-initial-samples") {
       speciesInitialFamiliesSubsamples = static_cast<unsigned int>(atoi(argv[++i]));
     } else if (arg == "--reroot-species-tree") {
@@ -156,6 +184,14 @@ void GeneRaxArguments::checkInputs() {
     Logger::info << "[Error] You cannot use per-family and per-species rates at the same time" << std::endl;
     ok = false;
   }
+  if (geneSearchThreads == 0) {
+    Logger::info << "[Error] The number of gene search threads must be at least 1" << std::endl;
+    ok = false;
+  }
+  if (dtlMaxIterations == 0) {
+    Logger::info << "[Error] The maximum number of DTL fixed-point iterations must be at least 1" << std::endl;
+    ok = false;
+  }
   if (!ArgumentsHelper::isValidRecModel(reconciliationModelStr)) {
     Logger::info << "[Error] Invalid reconciliation model string " << reconciliationModelStr << std::endl;
     ok = false;
@@ -184,6 +220,15 @@ void GeneRaxArguments::printHelp() {
   Logger::info << "--loss-rate <loss rate>" << std::endl;
   Logger::info << "--transfer-rate <transfer rate>" << std::endl;
   Logger::info << "--max-spr-radius <max SPR radius>" << std::endl;
+  Logger::info << "--gene-search-threads <threads per rank to test the gene tree moves>" << std::endl;
+  Logger::info << "--spr-screening-k <only optimize the branches of the k best moves without optimization>" << std::endl;
+  Logger::info << "--spr-screening-delta <also optimize the branches of the moves within delta of the best one>" << std::endl;
+  Logger::info << "--spr-move-cache (do not test again the moves that did not improve the likelihood in their unchanged neighbourhood)" << std::endl;
+  Logger::info << "--dtl-max-iterations <maximum number of fixed-point iterations per DTL CLV update>" << std::endl;
+  Logger::info << "--dtl-epsilon <relative change under which the DTL fixed-point iterations stop>" << std::endl;
+  Logger::info << "--spr-batch-moves (apply together the improving moves that do not overlap)" << std::endl;
+  Logger::info << "--safe-mode (check the incremental likelihoods of the gene tree search, slow)" << std::endl;
+  Logger::info << "--species-approx-samples <number of species tree SPR moves sampled to measure the error of the approximated likelihood, added as a margin when screening the species tree moves (default 20, 0 disables the margin)>" << std::endl;
   Logger::info << "--rec-weight <reconciliation likelihood weight>" << std::endl;
   Logger::info << "--do-not-reconcile" << std::endl;
   Logger::info << "--reconciliation-samples <number of samples>" << std::endl;
@@ -227,6 +272,16 @@ void GeneRaxArguments::printSummary() {
   Logger::info << "You are running GeneRax without MPI (no parallelization)" << std::endl;
 #endif
   Logger::info << "Max gene SPR radius: " << maxSPRRadius << std::endl;
+  Logger::info << "Gene search threads per rank: " << geneSearchThreads << std::endl;
+  if (sprScreeningTopK > 0 || sprScreeningDelta >= 0.0) {
+    Logger::info << "Gene SPR moves screening: k=" << sprScreeningTopK 
+      << " delta=" << sprScreeningDelta << std::endl;
+  }
+  Logger::info << "Gene SPR moves cache: " << boolStr[sprMoveCache] << std::endl;
+  Logger::info << "Gene SPR moves batches: " << boolStr[sprBatchMoves] << std::endl;
+  Logger::info << "Safe mode: " << boolStr[safeMode] << std::endl;
+  Logger::info << "DTL fixed-point iterations: at most " << dtlMaxIterations 
+    << ", epsilon=" << dtlEpsilon << std::endl;
   Logger::info << "Gene support threshold: " << supportThreshold << std::endl;
   Logger::info << "Reconciliation likelihood weight: " << recWeight << std::endl;
   Logger::info << "Random seed: " << seed << std::endl;
@@ -40,6 +40,14 @@ public:
    bool buildSuperMatrix;
    unsigned int reconciliationSamples;
    unsigned int maxSPRRadius;
+   unsigned int geneSearchThreads;
+   unsigned int sprScreeningTopK;
+   double sprScreeningDelta;
+   bool sprMoveCache;
+   bool sprBatchMoves;
+   bool safeMode;
+   unsigned int dtlMaxIterations;
+   double dtlEpsilon;
    double recWeight;
    int seed;
    bool filterFamilies;
@@ -50,6 +58,7 @@ public:
    bool optimizeSpeciesTree;
    unsigned int speciesFastRadius;
    unsigned int speciesSlowRadius;
+   unsigned int speciesApproxSamples;
    int speciesInitialFamiliesSubsamples;
 private:
 
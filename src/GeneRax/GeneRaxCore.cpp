@@ -144,6 +144,7 @@ void GeneRaxCore::rerootSpeciesTree(GeneRaxInstance &instance)
   }
   SpeciesTreeOptimizer speciesTreeOptimizer(instance.speciesTree, instance.currentFamilies, 
       instance.recModel, startingRates, instance.args.perFamilyDTLRates, instance.args.userDTLRates, instance.args.pruneSpeciesTree, instance.args.supportThreshold, 
+      instance.args.speciesApproxSamples, instance.args.dtlMaxIterations, instance.args.dtlEpsilon,
       instance.args.output, instance.args.exec);
   if (instance.args.rerootSpeciesTree) {
     Logger::info << "Rerooting the species tree..." << std::endl;
@@ -178,6 +179,7 @@ static void speciesTreeSearchAux(GeneRaxInstance &instance, int samples)
   }
   SpeciesTreeOptimizer speciesTreeOptimizer(instance.speciesTree, instance.currentFamilies, 
       instance.recModel, startingRates, instance.args.perFamilyDTLRates, instance.args.userDTLRates, instance.args.pruneSpeciesTree, instance.args.supportThreshold, 
+      instance.args.speciesApproxSamples, instance.args.dtlMaxIterations, instance.args.dtlEpsilon,
       instance.args.output, instance.args.exec);
   if (instance.args.speciesFastRadius > 0) {
     Logger::info << std::endl;
@@ -271,7 +273,8 @@ void GeneRaxCore::reconcile(GeneRaxInstance &instance)
     ModelParameters modelRates(instance.rates, instance.recModel, false, 1);
     instance.readModelParameters(modelRates);
     Routines::inferReconciliation(instance.speciesTree, instance.currentFamilies, 
-      modelRates, instance.args.output, instance.args.reconcile,
+      modelRates, instance.args.dtlMaxIterations, instance.args.dtlEpsilon, 
+      instance.args.output, instance.args.reconcile,
       instance.args.reconciliationSamples);
     if (instance.args.buildSuperMatrix) {
       /*
@@ -374,6 +377,7 @@ void GeneRaxCore::optimizeRatesAndGeneTrees(GeneRaxInstance &instance,
     Logger::timed << "Reconciliation rates optimization... " << std::endl;
     Routines::optimizeRates(instance.args.userDTLRates, instance.speciesTree, instance.recModel,
       instance.args.rootedGeneTree, instance.args.pruneSpeciesTree, 
+      instance.args.dtlMaxIterations, instance.args.dtlEpsilon,
       instance.currentFamilies, perSpeciesDTLRates, instance.rates, instance.elapsedRates);
     if (instance.rates.dimensions() <= 3) {
       Logger::info << instance.rates << std::endl;
@@ -392,6 +396,11 @@ void GeneRaxCore::optimizeRatesAndGeneTrees(GeneRaxInstance &instance,
       RecOpt::Grid, instance.args.perFamilyDTLRates, 
       instance.args.rootedGeneTree, instance.args.supportThreshold, 
       instance.args.recWeight, true, enableLibpll, sprRadius, 
+      instance.args.geneSearchThreads, instance.args.sprScreeningTopK, instance.args.sprScreeningDelta,
+      instance.args.sprMoveCache,
+      instance.args.sprBatchMoves,
+      instance.args.safeMode,
+      instance.args.dtlMaxIterations, instance.args.dtlEpsilon,
       instance.currentIteration++, ParallelContext::allowSchedulerSplitImplementation(), elapsed);
   instance.elapsedSPR += elapsed;
   Routines::gatherLikelihoods(instance.currentFamilies, instance.totalLibpllLL, instance.totalRecLL);
@@ -30,7 +30,7 @@ static void printEvent(const Scenario::Event &event, pll_rtree_t *speciesTree, p
 static void recursivelySaveReconciliationsNHX(pll_rtree_t *speciesTree, 
     pll_unode_t *node, 
     bool isVirtualRoot, 
-    std::vector<std::vector<Scenario::Event> > &geneToEvents, 
+    const Scenario &scenario, 
     ParallelOfstream &os)
 {
   
@@ -42,9 +42,9 @@ static void recursivelySaveReconciliationsNHX(pll_rtree_t *speciesTree,
       right = node->next->back;
     }
     os << "(";
-    recursivelySaveReconciliationsNHX(speciesTree, left, false, geneToEvents, os);
+    recursivelySaveReconciliationsNHX(speciesTree, left, false, scenario, os);
     os << ",";
-    recursivelySaveReconciliationsNHX(speciesTree, right, false, geneToEvents, os);
+    recursivelySaveReconciliationsNHX(speciesTree, right, false, scenario, os);
     os << ")";
   } 
   if (node->label) {
@@ -55,13 +55,13 @@ static void recursivelySaveReconciliationsNHX(pll_rtree_t *speciesTree,
   if (!isVirtualRoot) {
     os << ":" << node->length;
   }
-  printEvent(geneToEvents[node->node_index].back(), speciesTree, node, os);
+  printEvent(scenario.getGeneEvents(node->node_index).back(), speciesTree, node, os);
 }
   
 void ReconciliationWriter::saveReconciliationNHX(pll_rtree_t *speciesTree, 
     pll_unode_t *geneRoot, 
     unsigned int virtualRootIndex,
-    std::vector<std::vector<Scenario::Event> > &geneToEvents, 
+    const Scenario &scenario, 
     ParallelOfstream &os) 
 {
   pll_unode_t virtualRoot;
@@ -69,7 +69,7 @@ void ReconciliationWriter::saveReconciliationNHX(pll_rtree_t *speciesTree,
   virtualRoot.node_index = virtualRootIndex;
   virtualRoot.label = nullptr;
   virtualRoot.length = 0.0;
-  recursivelySaveReconciliationsNHX(speciesTree, &virtualRoot, true, geneToEvents, os);
+  recursivelySaveReconciliationsNHX(speciesTree, &virtualRoot, true, scenario, os);
   os << ";";
 }
 
@@ -101,7 +101,7 @@ static void saveSpeciesTreeRecPhyloXML(pll_rtree_t *speciesTree, ParallelOfstrea
 
 static void writeEventRecPhyloXML(pll_unode_t *geneTree,
     pll_rtree_t *speciesTree, 
-    Scenario::Event  &event,
+    const Scenario::Event &event,
     const Scenario::Event *previousEvent,
     std::string &indent, 
     ParallelOfstream &os)
@@ -146,7 +146,7 @@ static void writeEventRecPhyloXML(pll_unode_t *geneTree,
 static void recursivelySaveGeneTreeRecPhyloXML(pll_unode_t *geneTree, 
     bool isVirtualRoot,
     pll_rtree_t *speciesTree, 
-    std::vector<std::vector<Scenario::Event> > &geneToEvents,
+    const Scenario &scenario,
     const Scenario::Event *previousEvent,
     std::string &indent,
     ParallelOfstream &os)
@@ -154,7 +154,7 @@ static void recursivelySaveGeneTreeRecPhyloXML(pll_unode_t *geneTree,
   if (!geneTree) {
     return;
   }
-  auto &events = geneToEvents[geneTree->node_index];
+  auto events = scenario.getGeneEvents(geneTree->node_index);
   for (unsigned int i = 0; i < events.size() - 1; ++i) {
     os << indent << "<clade>" << std::endl;
     indent += "\t";
@@ -186,7 +186,7 @@ static void recursivelySaveGeneTreeRecPhyloXML(pll_unode_t *geneTree,
 
   os << indent << "<clade>" << std::endl;
   indent += "\t";
-  Scenario::Event &event = geneToEvents[geneTree->node_index].back();
+  const Scenario::Event &event = events.back();
   os << indent << "<name>" << (geneTree->label ? geneTree->label : "NULL") << "</name>" << std::endl;
   writeEventRecPhyloXML(geneTree, speciesTree, event, previousEvent, indent, os);  
 
@@ -197,8 +197,8 @@ static void recursivelySaveGeneTreeRecPhyloXML(pll_unode_t *geneTree,
       left = geneTree->next;
       right = geneTree->next->back;
     }
-    recursivelySaveGeneTreeRecPhyloXML(left, false, speciesTree, geneToEvents, &event, indent, os);
-    recursivelySaveGeneTreeRecPhyloXML(right, false, speciesTree, geneToEvents, &event, indent, os);
+    recursivelySaveGeneTreeRecPhyloXML(left, false, speciesTree, scenario, &event, indent, os);
+    recursivelySaveGeneTreeRecPhyloXML(right, false, speciesTree, scenario, &event, indent, os);
   }
   for (unsigned int i = 0; i < events.size() - 1; ++i) {
     indent.pop_back();
@@ -211,7 +211,7 @@ static void recursivelySaveGeneTreeRecPhyloXML(pll_unode_t *geneTree,
 static void saveGeneTreeRecPhyloXML(pll_unode_t *geneTree,
     unsigned int virtualRootIndex,
     pll_rtree_t *speciesTree,
-    std::vector<std::vector<Scenario::Event> > &geneToEvents, 
+    const Scenario &scenario, 
     ParallelOfstream &os)
 {
   os << "<recGeneTree>" << std::endl;
@@ -223,7 +223,7 @@ static void saveGeneTreeRecPhyloXML(pll_unode_t *geneTree,
   virtualRoot.next = geneTree;
   virtualRoot.node_index = virtualRootIndex;
   virtualRoot.label = 0;
-  recursivelySaveGeneTreeRecPhyloXML(&virtualRoot, true, speciesTree, geneToEvents, &noEvent, indent, os); 
+  recursivelySaveGeneTreeRecPhyloXML(&virtualRoot, true, speciesTree, scenario, &noEvent, indent, os); 
   os << "</phylogeny>" << std::endl;
   os << "</recGeneTree>" << std::endl;
 }
@@ -231,7 +231,7 @@ static void saveGeneTreeRecPhyloXML(pll_unode_t *geneTree,
 void ReconciliationWriter::saveReconciliationRecPhyloXML(pll_rtree_t *speciesTree, 
     pll_unode_t *geneRoot, 
     unsigned int virtualRootIndex,
-    std::vector<std::vector<Scenario::Event> > &geneToEvents, 
+    const Scenario &scenario, 
     ParallelOfstream &os)
 {
   os << "<recPhylo " << std::endl;
@@ -239,7 +239,7 @@ void ReconciliationWriter::saveReconciliationRecPhyloXML(pll_rtree_t *speciesTre
   os << "\txsi:schemaLocation=\"http://www.recg.org ./recGeneTreeXML.xsd\"" << std::endl;
   os << "\txmlns=\"http://www.recg.org\">" << std::endl;
   saveSpeciesTreeRecPhyloXML(speciesTree, os);
-  saveGeneTreeRecPhyloXML(geneRoot, virtualRootIndex, speciesTree, geneToEvents, os);
+  saveGeneTreeRecPhyloXML(geneRoot, virtualRootIndex, speciesTree, scenario, os);
   os << "</recPhylo>";
 
 }
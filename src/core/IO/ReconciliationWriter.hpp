@@ -15,13 +15,13 @@ public:
   static void saveReconciliationNHX(pll_rtree_t *speciesTree,  
       pll_unode_t *geneRoot, 
       unsigned int virtualRootIndex,
-      std::vector<std::vector<Scenario::Event> > &geneToEvent, 
+      const Scenario &scenario, 
       ParallelOfstream &os);
 
   static void saveReconciliationRecPhyloXML(pll_rtree_t *speciesTree,  
       pll_unode_t *geneRoot, 
       unsigned int virtualRootIndex,
-      std::vector<std::vector<Scenario::Event> > &geneToEvent, 
+      const Scenario &scenario, 
       ParallelOfstream &os);
 };
 
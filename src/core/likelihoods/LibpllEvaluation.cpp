@@ -214,7 +214,36 @@ double LibpllEvaluation::optimizeAllParametersOnce(pllmod_treeinfo_t *treeinfo,
 
 void LibpllEvaluation::invalidateCLV(unsigned int nodeIndex)
 {
-  pllmod_treeinfo_invalidate_clv(_treeInfo->getTreeInfo(), getNode(nodeIndex));
-  pllmod_treeinfo_invalidate_pmatrix(_treeInfo->getTreeInfo(), getNode(nodeIndex));
+  auto treeinfo = _treeInfo->getTreeInfo();
+  auto node = getNode(nodeIndex);
+  // the three directions of an inner node share the same CLV:
+  // its content changes in all of them
+  pllmod_treeinfo_invalidate_clv(treeinfo, node);
+  if (node->next) {
+    pllmod_treeinfo_invalidate_clv(treeinfo, node->next);
+    pllmod_treeinfo_invalidate_clv(treeinfo, node->next->next);
+  }
+  pllmod_treeinfo_invalidate_pmatrix(treeinfo, node);
 }
 
+void LibpllEvaluation::copyStateFrom(LibpllEvaluation &other)
+{
+  auto treeinfo = getTreeInfo();
+  auto otherTreeinfo = other.getTreeInfo();
+  assert(treeinfo->subnode_count == otherTreeinfo->subnode_count);
+  // the SPR moves only reconnect the nodes and move the pmatrix indices
+  for (unsigned int i = 0; i < treeinfo->subnode_count; ++i) {
+    auto node = getNode(i);
+    auto otherNode = other.getNode(i);
+    assert(node->node_index == otherNode->node_index);
+    node->back = getNode(otherNode->back->node_index);
+    node->length = otherNode->length;
+    node->pmatrix_index = otherNode->pmatrix_index;
+  }
+  pllmod_treeinfo_set_root(treeinfo, getNode(otherTreeinfo->root->node_index));
+  auto &model = _treeInfo->getModel();
+  assign(model, otherTreeinfo->partitions[0]);
+  assign(treeinfo->partitions[0], model);
+  treeinfo->alphas[0] = otherTreeinfo->alphas[0];
+  pllmod_treeinfo_invalidate_all(treeinfo);
+}
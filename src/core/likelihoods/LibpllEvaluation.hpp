@@ -81,11 +81,21 @@ public:
   const pllmod_treeinfo_t *getTreeInfo() const {return _treeInfo->getTreeInfo();}
 
   /**
-   *  Invalidate a CLV at a given node index
-   *  Relevant for computeLikelihood(true) calls
+   *  Invalidate the CLV (in all its directions) and the
+   *  p-matrix at a given node index.
+   *  Relevant for computeLikelihood(true) calls: those only
+   *  recompute the invalid CLVs on the way to the treeinfo root,
+   *  so the root must be next to the invalidated nodes
    */
   void invalidateCLV(unsigned int nodeIndex);
 
+  /**
+   *  Copy the topology, the branch lengths and the model parameters
+   *  of another evaluation built from the same inputs (and thus with
+   *  the same node indices), and invalidate all the CLVs
+   */
+  void copyStateFrom(LibpllEvaluation &other);
+
   static void createAndSaveRandomTree(const std::string &alignmentFiilename,
     const std::string &modelStrOrFile,
     const std::string &outputTreeFile);
@@ -4,7 +4,9 @@
 #include <likelihoods/reconciliation_models/UndatedDLModel.hpp>
 #include <likelihoods/reconciliation_models/UndatedDTLModel.hpp>
 #include <likelihoods/reconciliation_models/UndatedIDTLModel.hpp>
+#include <likelihoods/reconciliation_models/FixedPointIterations.hpp>
 #include <cmath>
+#include <cfloat>
 #include <IO/FileSystem.hpp>
 #include <likelihoods/reconciliation_models/AbstractReconciliationModel.hpp>
 
@@ -13,6 +15,10 @@ double log(ScaledValue v)
   return v.getLogValue();
 }
 
+// In double precision, the CLV entries get close to underflowing
+// when the log likelihood gets below this value
+static const double DOUBLE_SAFE_LL = log(DBL_MIN) / 2.0;
+
 
 ReconciliationEvaluation::ReconciliationEvaluation(PLLRootedTree  &speciesTree,
   PLLUnrootedTree &initialGeneTree,
@@ -26,14 +32,20 @@ ReconciliationEvaluation::ReconciliationEvaluation(PLLRootedTree  &speciesTree,
     _rootedGeneTree(rootedGeneTree),
     _pruneSpeciesTree(pruneSpeciesTree),
     _model(recModel),
-    _infinitePrecision(true)
+    _precision(getInitialPrecision()),
+    _partialLikelihoodMode(PartialLikelihoodMode::PartialGenes),
+    _family(0),
+    _fixedPointMaxIterations(FixedPointIterations().getMaxIterations()),
+    _fixedPointEpsilon(FixedPointIterations().getEpsilon()),
+    _gradientEvaluators(nullptr)
 {
-  _evaluators = buildRecModelObject(_model, _infinitePrecision);
+  _evaluators = buildRecModelObject(_model, _precision);
 }
   
 ReconciliationEvaluation::~ReconciliationEvaluation()
 {
   delete _evaluators;
+  delete _gradientEvaluators;
 }
 
 
@@ -54,6 +66,17 @@ void ReconciliationEvaluation::setRates(const Parameters &parameters)
   }
   _evaluators->setRates(_rates);
 }
+
+void ReconciliationEvaluation::setRatesForSpecies(unsigned int speciesNodeIndex, 
+    const Parameters &speciesRates)
+{
+  assert(_rates.size() == speciesRates.dimensions());
+  assert(speciesNodeIndex < _speciesTree.getNodesNumber());
+  for (unsigned int d = 0; d < _rates.size(); ++d) {
+    _rates[d][speciesNodeIndex] = speciesRates[d];
+  }
+  _evaluators->setRatesForSpecies(_rates, speciesNodeIndex);
+}
   
 pll_unode_t *ReconciliationEvaluation::getRoot() 
 {
@@ -65,14 +88,38 @@ void ReconciliationEvaluation::setRoot(pll_unode_t * root)
   _evaluators->setRoot(root);
 }
 
+CLVPrecision ReconciliationEvaluation::getInitialPrecision() const
+{
+  // rough lower bound of the family log likelihood: each gene
+  // leaf costs at most the choice of its species
+  double expectedLL = -static_cast<double>(_initialGeneTree.getLeavesNumber()) 
+    * log(static_cast<double>(_speciesTree.getNodesNumber()));
+  return expectedLL > DOUBLE_SAFE_LL ? CLVPrecision::Double : CLVPrecision::BlockScaled;
+}
+
+bool ReconciliationEvaluation::needsMorePrecision(double ll) const
+{
+  switch (_precision) {
+  case CLVPrecision::Double:
+    return !std::isnormal(ll) || ll < DOUBLE_SAFE_LL;
+  case CLVPrecision::BlockScaled:
+    return !std::isnormal(ll);
+  case CLVPrecision::Scaled:
+    return false;
+  }
+  return false;
+}
+
 double ReconciliationEvaluation::evaluate(bool fastMode)
 {
-  fastMode = false;
   double res = _evaluators->computeLogLikelihood(fastMode);
-  if (!_infinitePrecision && !std::isnormal(res)) {
-    updatePrecision(true);  
-    res = _evaluators->computeLogLikelihood(fastMode);
-    updatePrecision(false);  
+  if (fastMode && needsMorePrecision(res)) {
+    // do not change the precision on an approximated value
+    res = _evaluators->computeLogLikelihood(false);
+  }
+  while (needsMorePrecision(res)) {
+    updatePrecision(CLVPrecision(static_cast<int>(_precision) + 1));
+    res = _evaluators->computeLogLikelihood(false);
   }
   if (!std::isnormal(res)) {
     std::cerr << "wrong reconciliation ll " << res << std::endl;
@@ -81,6 +128,24 @@ double ReconciliationEvaluation::evaluate(bool fastMode)
   return res;
 }
 
+double ReconciliationEvaluation::evaluateWithGradient(std::vector<double> &gradient)
+{
+  if (!_gradientEvaluators) {
+    _gradientEvaluators = buildGradientModelObject(_model, _precision != CLVPrecision::Double);
+  }
+  _gradientEvaluators->setRates(_rates);
+  double res = _gradientEvaluators->computeLogLikelihood();
+  if (!std::isnormal(res) && _precision == CLVPrecision::Double) {
+    resetGradientModelObject();
+    _gradientEvaluators = buildGradientModelObject(_model, true);
+    _gradientEvaluators->setRates(_rates);
+    res = _gradientEvaluators->computeLogLikelihood();
+  }
+  gradient = _gradientEvaluators->getLogLikelihoodGradient();
+  gradient.resize(Enums::freeParameters(_model));
+  return res;
+}
+
 void ReconciliationEvaluation::invalidateCLV(unsigned int nodeIndex)
 {
   _evaluators->invalidateCLV(nodeIndex);
@@ -96,10 +161,21 @@ void ReconciliationEvaluation::invalidateAllSpeciesCLVs()
   _evaluators->invalidateAllSpeciesCLVs();
 }
 
+void ReconciliationEvaluation::beginCLVJournal()
+{
+  _evaluators->beginCLVJournal();
+}
+
+bool ReconciliationEvaluation::rollbackCLVJournal()
+{
+  return _evaluators->rollbackCLVJournal();
+}
+
 ReconciliationModelInterface *ReconciliationEvaluation::buildRecModelObject(RecModel recModel, 
-    bool infinitePrecision)
+    CLVPrecision precision)
 {
   ReconciliationModelInterface *res(nullptr);
+  bool infinitePrecision = (precision == CLVPrecision::Scaled);
   switch(recModel) {
   case RecModel::UndatedDL:
     if (infinitePrecision) {
@@ -123,42 +199,127 @@ ReconciliationModelInterface *ReconciliationEvaluation::buildRecModelObject(RecM
     }
     break;
   }
+  res->setBlockScaling(precision == CLVPrecision::BlockScaled);
+  res->setFixedPointParameters(_fixedPointMaxIterations, _fixedPointEpsilon);
   res->setInitialGeneTree(_initialGeneTree.getRawPtr());
+  res->setPartialLikelihoodMode(_partialLikelihoodMode);
+  if (_treeDuplicates) {
+    res->setTreeDuplicates(_treeDuplicates, _family);
+  }
   return res;
 }
   
-void ReconciliationEvaluation::updatePrecision(bool infinitePrecision)
+ReconciliationModelInterface *ReconciliationEvaluation::buildGradientModelObject(RecModel recModel, 
+    bool blockScaling)
 {
-  if (infinitePrecision != _infinitePrecision) {
-    _infinitePrecision = infinitePrecision;
+  // one derivative direction per free parameter
+  ReconciliationModelInterface *res(nullptr);
+  switch(recModel) {
+  case RecModel::UndatedDL:
+    res = new UndatedDLModel<DualValue<2> >(_speciesTree, _geneSpeciesMapping, _rootedGeneTree, _pruneSpeciesTree);
+    break;
+  case RecModel::UndatedDTL:
+    res = new UndatedDTLModel<DualValue<3> >(_speciesTree, _geneSpeciesMapping, _rootedGeneTree, _pruneSpeciesTree);
+    break;
+  case RecModel::UndatedIDTL:
+    res = new UndatedIDTLModel<DualValue<4> >(_speciesTree, _geneSpeciesMapping, _rootedGeneTree, _pruneSpeciesTree);
+    break;
+  }
+  res->setBlockScaling(blockScaling);
+  res->setFixedPointParameters(_fixedPointMaxIterations, _fixedPointEpsilon);
+  res->setInitialGeneTree(_initialGeneTree.getRawPtr());
+  return res;
+}
+
+void ReconciliationEvaluation::resetGradientModelObject()
+{
+  delete _gradientEvaluators;
+  _gradientEvaluators = nullptr;
+}
+  
+void ReconciliationEvaluation::raisePrecision(CLVPrecision precision)
+{
+  if (static_cast<int>(precision) > static_cast<int>(_precision)) {
+    updatePrecision(precision);
+  }
+}
+
+void ReconciliationEvaluation::setFixedPointParameters(unsigned int maxIterations, 
+    double epsilon)
+{
+  assert(maxIterations > 0);
+  _fixedPointMaxIterations = maxIterations;
+  _fixedPointEpsilon = epsilon;
+  _evaluators->setFixedPointParameters(maxIterations, epsilon);
+  if (_rates.size()) {
+    // recompute the extinction probabilities and the CLVs
+    _evaluators->setRates(_rates);
+  }
+  // rebuilt with the new parameters on the next gradient computation
+  resetGradientModelObject();
+}
+
+double ReconciliationEvaluation::getAverageCLVIterations() const
+{
+  return _evaluators->getAverageCLVIterations();
+}
+
+double ReconciliationEvaluation::getAverageExtinctionIterations() const
+{
+  return _evaluators->getAverageExtinctionIterations();
+}
+
+void ReconciliationEvaluation::updatePrecision(CLVPrecision precision)
+{
+  if (precision != _precision) {
+    _precision = precision;
+    auto root = _evaluators->getRoot();
     delete _evaluators;
-    _evaluators = buildRecModelObject(_model, _infinitePrecision);
+    _evaluators = buildRecModelObject(_model, _precision);
     _evaluators->setRates(_rates);
- }
+    if (root) {
+      _evaluators->setRoot(root);
+    }
+  }
 }
 
-void ReconciliationEvaluation::inferMLScenario(Scenario &scenario, bool stochastic) {
-  auto infinitePrecision = _infinitePrecision;
-  updatePrecision(true);
-  auto ll = evaluate();
+ReconciliationModelInterface *ReconciliationEvaluation::getScaledEvaluators(
+    std::unique_ptr<ReconciliationModelInterface> &temporary)
+{
+  if (_precision == CLVPrecision::Scaled) {
+    auto ll = evaluate();
+    assert(std::isfinite(ll) && ll < 0.0);
+    return _evaluators;
+  }
+  temporary.reset(buildRecModelObject(_model, CLVPrecision::Scaled));
+  temporary->setRates(_rates);
+  auto root = _evaluators->getRoot();
+  if (root) {
+    temporary->setRoot(root);
+  }
+  auto ll = temporary->computeLogLikelihood();
   assert(std::isfinite(ll) && ll < 0.0);
-  _evaluators->inferMLScenario(scenario, stochastic);
-  updatePrecision(infinitePrecision);
+  return temporary.get();
 }
-  
-pll_unode_t *ReconciliationEvaluation::computeMLRoot() 
+
+void ReconciliationEvaluation::inferMLScenario(Scenario &scenario, bool stochastic) {
+  std::unique_ptr<ReconciliationModelInterface> temporary;
+  getScaledEvaluators(temporary)->inferMLScenario(scenario, stochastic);
+}
+
+void ReconciliationEvaluation::sampleScenarios(unsigned int samples, 
+    unsigned int seed,
+    ScenarioBatch &batch,
+    unsigned int threads)
 {
-  return  _evaluators->computeMLRoot();
+  std::unique_ptr<ReconciliationModelInterface> temporary;
+  getScaledEvaluators(temporary)->sampleScenarios(samples, seed, batch, threads);
 }
   
 pll_unode_t *ReconciliationEvaluation::inferMLRoot()
 {
-  auto infinitePrecision = _infinitePrecision;
-  updatePrecision(true);
-  auto ll = evaluate(); 
-  assert(std::isfinite(ll) && ll < 0.0);
-  auto res = computeMLRoot();
-  updatePrecision(infinitePrecision);
+  std::unique_ptr<ReconciliationModelInterface> temporary;
+  auto res = getScaledEvaluators(temporary)->computeMLRoot();
   assert(res);
   return res;
 }
@@ -167,15 +328,31 @@ void ReconciliationEvaluation::onSpeciesTreeChange(const std::unordered_set<pll_
 {
   assert(_evaluators);
   _evaluators->onSpeciesTreeChange(nodesToInvalidate);
+  // rebuilt for the new species tree on the next gradient computation
+  resetGradientModelObject();
 }
 
 void ReconciliationEvaluation::setPartialLikelihoodMode(PartialLikelihoodMode mode) 
 { 
+  _partialLikelihoodMode = mode;
   _evaluators->setPartialLikelihoodMode(mode);
 }
   
-void ReconciliationEvaluation::rollbackToLastState() 
+void ReconciliationEvaluation::setTreeDuplicates(const std::shared_ptr<const TreeDuplicates> &duplicates,
+    unsigned int family)
+{
+  _treeDuplicates = duplicates;
+  _family = family;
+  _evaluators->setTreeDuplicates(duplicates, family);
+}
+
+void ReconciliationEvaluation::beginSpeciesTreeTrial()
+{
+  _evaluators->beginSpeciesTreeTrial();
+}
+
+void ReconciliationEvaluation::endSpeciesTreeTrial(bool revert)
 {
-  _evaluators->rollbackToLastState();
+  _evaluators->endSpeciesTreeTrial(revert);
 }
 
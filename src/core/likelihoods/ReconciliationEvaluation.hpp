@@ -11,6 +11,8 @@
 
 class ReconciliationModelInterface;
 class Scenario;
+class ScenarioBatch;
+struct TreeDuplicates;
 
 /**
  *  Wrapper around the reconciliation likelihood classes
@@ -43,6 +45,15 @@ public:
   ~ReconciliationEvaluation();
   void setRates(const Parameters &parameters);
 
+  /**
+   *  Only change the rates of one species node. Cheaper than
+   *  setRates for the models without transfers, that only recompute 
+   *  this species node and its ancestors.
+   *  @param speciesNodeIndex the node_index of the species node
+   *  @param speciesRates the rates of this node (one per free parameter)
+   */
+  void setRatesForSpecies(unsigned int speciesNodeIndex, const Parameters &speciesRates);
+
 
   /**
    * Get the current root of the gene tree. Return null if the tree does not have a 
@@ -54,10 +65,22 @@ public:
   void setRoot(pll_unode_t * root);
 
   /**
-   *  @param input geneTree
+   *  @param fastMode approximate the likelihood from the CLVs of the
+   *  last exact evaluation (see ReconciliationModelInterface), 
+   *  for the models that implement it
    */
   double evaluate(bool fastMode = false);
 
+  /**
+   *  Same as evaluate, and fill gradient with the exact derivatives
+   *  of the log likelihood with respect to the global rates (the 
+   *  parameters of the last setRates call must be global rates).
+   *  The derivatives are propagated by a second model instance,
+   *  templated on dual numbers, built on the first call
+   *  @return the log likelihood (not normal if it underflowed)
+   */
+  double evaluateWithGradient(std::vector<double> &gradient);
+
   bool implementsTransfers() {return Enums::accountsForTransfers(_model);} 
 
   /*
@@ -67,6 +90,15 @@ public:
 
   void setPartialLikelihoodMode(PartialLikelihoodMode mode);
 
+  /**
+   *  Share the CLVs of the gene subtrees that also appear in the other
+   *  families of the rank (see ReconciliationModelInterface)
+   *  @param duplicates identifiers of the subtrees of the rank
+   *  @param family index of this gene tree in duplicates
+   */
+  void setTreeDuplicates(const std::shared_ptr<const TreeDuplicates> &duplicates,
+      unsigned int family);
+
   /**
    *  Invalidate the CLV at a given node index
    *  Must be called on the nodes affected by a move 
@@ -75,14 +107,65 @@ public:
  
   void invalidateAllCLVs();
   void invalidateAllSpeciesCLVs();
+
+  /**
+   *  Undo log of the reconciliation CLVs, to cancel a gene tree 
+   *  move without recomputing them (see ReconciliationModelInterface).
+   *  rollbackCLVJournal returns false if the CLVs could not be 
+   *  restored, for instance after a precision change: the caller
+   *  must then invalidate them
+   */
+  void beginCLVJournal();
+  bool rollbackCLVJournal();
  
   pll_unode_t *inferMLRoot();
   
   void inferMLScenario(Scenario &scenario, bool stochastic = false);
 
+  /**
+   *  Sample several scenarios from the same CLVs (see 
+   *  ReconciliationModelInterface::sampleScenarios)
+   */
+  void sampleScenarios(unsigned int samples, 
+      unsigned int seed,
+      ScenarioBatch &batch,
+      unsigned int threads = 1);
+
   RecModel getRecModel() const {return _model;}
+
+  /**
+   *  Current floating point representation of the CLVs. 
+   *  Starts with the cheapest precision that is unlikely to 
+   *  underflow for this family, and switches for good to a safer
+   *  one when a likelihood underflows or gets close to it
+   */
+  CLVPrecision getPrecision() const {return _precision;}
+
+  /**
+   *  Switch to precision if it is safer than the current one, 
+   *  for instance to match another evaluation of the same family
+   */
+  void raisePrecision(CLVPrecision precision);
+
+  /**
+   *  Stopping criterion of the fixed-point iterations of the models
+   *  with transfers (see ReconciliationModelInterface)
+   */
+  void setFixedPointParameters(unsigned int maxIterations, double epsilon);
+
+  /**
+   *  Average number of fixed-point iterations per CLV update and per
+   *  computation of the extinction probabilities, since the last
+   *  precision change (0 for the models without transfers)
+   */
+  double getAverageCLVIterations() const;
+  double getAverageExtinctionIterations() const;
   
-  void rollbackToLastState();
+  /**
+   *  Trial species tree changes (see ReconciliationModelInterface)
+   */
+  void beginSpeciesTreeTrial();
+  void endSpeciesTreeTrial(bool revert);
 private:
   PLLRootedTree &_speciesTree;
   PLLUnrootedTree &_initialGeneTree;
@@ -90,15 +173,33 @@ private:
   bool _rootedGeneTree;
   bool _pruneSpeciesTree;
   RecModel _model; 
-  bool _infinitePrecision;
+  CLVPrecision _precision;
+  PartialLikelihoodMode _partialLikelihoodMode;
   std::vector<std::vector<double> > _rates;
+  std::shared_ptr<const TreeDuplicates> _treeDuplicates;
+  unsigned int _family;
+  unsigned int _fixedPointMaxIterations;
+  double _fixedPointEpsilon;
   // we actually own this pointer, but we do not 
   // wrap it into a unique_ptr to allow forward definition
   ReconciliationModelInterface *_evaluators;
+  // same, for evaluateWithGradient (null until the first call)
+  ReconciliationModelInterface *_gradientEvaluators;
 private:
-  ReconciliationModelInterface *buildRecModelObject(RecModel recModel, bool infinitePrecision);
-  pll_unode_t *computeMLRoot();
-  void updatePrecision(bool infinitePrecision);
+  ReconciliationModelInterface *buildRecModelObject(RecModel recModel, CLVPrecision precision);
+  ReconciliationModelInterface *buildGradientModelObject(RecModel recModel, bool blockScaling);
+  void resetGradientModelObject();
+  void updatePrecision(CLVPrecision precision);
+  /**
+   *  Model in Scaled precision (that can not underflow) with 
+   *  up-to-date CLVs, for the backtraces. If the current precision 
+   *  is not Scaled, a temporary model is built in temporary, and
+   *  the state of the current model (CLVs, root, journal) is kept
+   */
+  ReconciliationModelInterface *getScaledEvaluators(
+      std::unique_ptr<ReconciliationModelInterface> &temporary);
+  CLVPrecision getInitialPrecision() const;
+  bool needsMorePrecision(double ll) const;
 };
   
 typedef std::vector<std::shared_ptr<ReconciliationEvaluation> > Evaluations;
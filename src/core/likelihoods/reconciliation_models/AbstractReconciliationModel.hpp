@@ -3,13 +3,20 @@
 #include <likelihoods/LibpllEvaluation.hpp>
 #include <IO/GeneSpeciesMapping.hpp>
 #include <util/Scenario.hpp>
+#include <util/ScenarioBatch.hpp>
 #include <IO/Logger.hpp>
 #include <util/enums.hpp>
+#include <util/IndexSet.hpp>
+#include <algorithm>
 #include <cmath>
 #include <unordered_set>
+#include <thread>
 #include <maths/ScaledValue.hpp>
 #include <trees/PLLRootedTree.hpp>
+#include <trees/TreeDuplicatesFinder.hpp>
 #include <maths/Random.hpp>
+#include <likelihoods/reconciliation_models/CLVArena.hpp>
+#include <likelihoods/reconciliation_models/SpeciesProbabilities.hpp>
 
 
 
@@ -20,8 +27,11 @@
 
 double log(ScaledValue v);
 
+// clade identifier of the gene nodes whose leaves span several species
+const unsigned int NO_CLADE = static_cast<unsigned int>(-1);
+// children ids of the gene leaves
+const unsigned int NO_GENE = static_cast<unsigned int>(-1);
 
-typedef std::vector< std::vector <double> > RatesVector;
 
 /**
  *  Interface and common implementations for 
@@ -38,17 +48,44 @@ public:
    * Set the per-species lineage rates
    */
   virtual void setRates(const RatesVector &rates) = 0;
+
+  /**
+   *  Same as setRates, when only the rates of one species node 
+   *  changed since the last call: the models can then only 
+   *  recompute what depends on this species node
+   */
+  virtual void setRatesForSpecies(const RatesVector &rates, unsigned int speciesNodeIndex) = 0;
   
   /**
    * (incrementally) compute and return the likelihood of the gene tree 
+   * In fast mode, only approximate the likelihood from the CLVs of the
+   * last exact computation, by recomputing once the entries of the 
+   * species nodes invalidated since then. The CLVs are left unchanged.
+   * Falls back to the exact computation if the model does not
+   * implement the approximation or has no exact CLVs to start from
    */
   virtual double computeLogLikelihood(bool fastMode = false) = 0;
 
   /**
-   * If implemented, rollback to the state before the
-   * last "computeLogLikelihood(false)" call
+   *  Derivatives of the log likelihood computed by the last
+   *  computeLogLikelihood call, with respect to the global D, L, T...
+   *  rates. Empty if the model does not propagate derivatives
    */
-  virtual void rollbackToLastState() = 0;
+  virtual const std::vector<double> &getLogLikelihoodGradient() const = 0;
+
+  /**
+   *  Trial species tree change, in PartialSpecies mode: keep a copy
+   *  of the species side of the model (invalid species nodes, species
+   *  probabilities, and the CLV entries that the next computations
+   *  overwrite) until endSpeciesTreeTrial is called.
+   *  Once the caller restored the species tree, endSpeciesTreeTrial(true)
+   *  swaps the copy back instead of recomputing the reverted entries.
+   *  endSpeciesTreeTrial(false) keeps the current state.
+   *  Only the species tree may change during a trial. Outside of 
+   *  PartialSpecies mode, the species tree changes are processed as usual
+   */
+  virtual void beginSpeciesTreeTrial() = 0;
+  virtual void endSpeciesTreeTrial(bool revert) = 0;
 
   /**
    *  Get/set the root of the gene tree (only relevant in rooted gene tree mode)
@@ -63,18 +100,84 @@ public:
   
 
   virtual void setPartialLikelihoodMode(PartialLikelihoodMode mode) = 0;
+
+  /**
+   *  Store one scaler per gene node CLV instead of relying on
+   *  the REAL type to avoid underflows (see CLVArena).
+   *  Must be called before the first likelihood computation
+   */
+  virtual void setBlockScaling(bool blockScaling) = 0;
   
+  /**
+   *  Share the CLVs of the gene subtrees that also appear in the 
+   *  other families of the rank: each unique subtree CLV is only 
+   *  computed once per species tree and rates, by the first model 
+   *  that needs it, and copied by the others. Only used in 
+   *  PartialSpecies mode, without species tree pruning.
+   *  Must be called after setInitialGeneTree and setBlockScaling
+   *  @param duplicates identifiers of the subtrees of the rank
+   *  @param family index of the gene tree of this model in duplicates
+   */
+  virtual void setTreeDuplicates(const std::shared_ptr<const TreeDuplicates> &duplicates,
+      unsigned int family) = 0;
+
+  /**
+   *  Stopping criterion of the fixed-point iterations of the models
+   *  with transfers (see FixedPointIterations): at most maxIterations
+   *  iterations per CLV update, and convergence threshold epsilon for
+   *  both the CLVs and the extinction probabilities.
+   *  Ignored by the models without transfers
+   */
+  virtual void setFixedPointParameters(unsigned int maxIterations, double epsilon) = 0;
+
+  /**
+   *  Average number of fixed-point iterations per CLV update and per
+   *  computation of the extinction probabilities (0 for the models
+   *  without transfers)
+   */
+  virtual double getAverageCLVIterations() const = 0;
+  virtual double getAverageExtinctionIterations() const = 0;
+
   /**
    * CLV invalidation for partial likelihood computation
    */
   virtual void invalidateAllCLVs() = 0;
   virtual void invalidateCLV(unsigned int geneNodeIndex) = 0;
   virtual void invalidateAllSpeciesCLVs() = 0;
+
+  /**
+   *  Start an undo log of the gene CLVs: from now on, the content of
+   *  each CLV is saved before being overwritten, so that 
+   *  rollbackCLVJournal can restore the current state after a gene
+   *  tree change. Discards the previous journal. Only available in
+   *  PartialGenes mode
+   */
+  virtual void beginCLVJournal() = 0;
+
+  /**
+   *  Restore the CLVs, the invalidated CLVs and the gene root of the
+   *  last beginCLVJournal call, without recomputing anything, and 
+   *  close the journal. The caller must have restored the gene tree.
+   *  @return false if there is no journal to restore (it was not 
+   *  started, or the rates, the species tree or the likelihood mode 
+   *  changed since then). The caller must then invalidate the CLVs
+   */
+  virtual bool rollbackCLVJournal() = 0;
   /**
    *  Fill scenario with the maximum likelihood set of 
    *  events that would lead to the  current tree
    **/
   virtual bool inferMLScenario(Scenario &scenario, bool stochastic = false) = 0;
+  /**
+   *  Fill the CLVs once, and sample scenarios from them. The
+   *  i-th scenario is drawn from the random stream (seed, i), so
+   *  that the samples do not depend on the number of threads
+   *  @return false if one of the scenarios is invalid
+   */
+  virtual bool sampleScenarios(unsigned int samples,
+      unsigned int seed,
+      ScenarioBatch &batch,
+      unsigned int threads = 1) = 0;
 
   virtual void onSpeciesTreeChange(const std::unordered_set<pll_rnode_t *> *nodesToInvalidate) = 0;
 };
@@ -83,8 +186,13 @@ public:
 /*
  * Introduce the REAL template (normal double or infinite precision) 
  * Implement util methods shared by its children
+ *
+ * Derived is the model class (CRTP): the hooks called for each
+ * gene node and each species node (updateCLV, computeProbability,
+ * getRootLikelihood...) are resolved at compile time, and 
+ * ReconciliationModelInterface is the only virtual boundary
  */
-template <class REAL>
+template <class REAL, class Derived>
 class AbstractReconciliationModel: public ReconciliationModelInterface {
 public:
   AbstractReconciliationModel(const AbstractReconciliationModel &) = delete;
@@ -102,10 +210,17 @@ public:
   virtual ~AbstractReconciliationModel() {}
   // overload from parent
   virtual void setRates(const RatesVector &rates) = 0;
+  // overload from parent. With transfers, the likelihood of each
+  // species node depends on the rates of all the others: update everything
+  virtual void setRatesForSpecies(const RatesVector &rates, unsigned int) {setRates(rates);}
   // overload from parent
   virtual double computeLogLikelihood(bool fastMode = false);
+  // overload from parent
+  virtual const std::vector<double> &getLogLikelihoodGradient() const {return _logLikelihoodGradient;}
+  // overload from parent 
+  virtual void beginSpeciesTreeTrial();
   // overload from parent 
-  virtual void rollbackToLastState() {assert(false);}
+  virtual void endSpeciesTreeTrial(bool revert);
   // overload from parent
   virtual void setRoot(pll_unode_t * root) {_geneRoot = root;}
   // overload from parent
@@ -115,39 +230,94 @@ public:
   // overload from parent
   virtual void invalidateCLV(unsigned int geneNodeIndex);
   // overload from parent
-  virtual void invalidateAllSpeciesCLVs() {_allSpeciesNodesInvalid = true;}
+  virtual void invalidateAllSpeciesCLVs() {
+    _allSpeciesNodesInvalid = true;
+    _onlySpeciesRatesChanged = false;
+    endSpeciesTreeTrial(false);
+  }
   // overload from parent
   virtual bool inferMLScenario(Scenario &scenario, bool stochastic = false);
   // overload from parent
-  virtual void setPartialLikelihoodMode(PartialLikelihoodMode mode) {_likelihoodMode = mode;};
+  virtual bool sampleScenarios(unsigned int samples,
+      unsigned int seed,
+      ScenarioBatch &batch,
+      unsigned int threads = 1);
+  // overload from parent
+  virtual void setPartialLikelihoodMode(PartialLikelihoodMode mode) {
+    _likelihoodMode = mode;
+    discardCLVJournal();
+    endSpeciesTreeTrial(false);
+  }
+  // overload from parent
+  virtual void beginCLVJournal();
+  // overload from parent
+  virtual bool rollbackCLVJournal();
+  // overload from parent
+  virtual void setBlockScaling(bool blockScaling) {_blockScaling = blockScaling;}
+  // overload from parent
+  virtual void setTreeDuplicates(const std::shared_ptr<const TreeDuplicates> &duplicates,
+      unsigned int family);
+  // overload from parent
+  virtual void setFixedPointParameters(unsigned int, double) {}
+  // overload from parent
+  virtual double getAverageCLVIterations() const {return 0.0;}
+  // overload from parent
+  virtual double getAverageExtinctionIterations() const {return 0.0;}
 protected:
   // called by the constructor
-  virtual void initSpeciesTree();
-  // Called when computeLogLikelihood is called for the first time
-  // Called by computeLogLikelihood
-  virtual void updateCLV(pll_unode_t *geneNode) = 0;
-  // Called by computeLogLikelihood
-  virtual void computeRootLikelihood(pll_unode_t *virtualRoot) = 0;
-  // Called by computeLogLikelihood
-  virtual REAL getRootLikelihood(pll_unode_t *root) const = 0;
-  virtual REAL getRootLikelihood(pll_unode_t *root, pll_rnode_t *speciesRoot) = 0;
-  virtual REAL getLikelihoodFactor() const = 0;
-  virtual void recomputeSpeciesProbabilities() = 0;
-  // Called by inferMLScenario
+  void initSpeciesTree();
+  /**
+   *  Hooks implemented by Derived, and called through derived():
+   *
+   *  void updateCLV(pll_unode_t *geneNode);
+   *  void computeRootLikelihood(pll_unode_t *virtualRoot);
+   *  REAL getRootLikelihood(pll_unode_t *root) const;
+   *  REAL getRootLikelihood(pll_unode_t *root, pll_rnode_t *speciesRoot);
+   *  REAL getLikelihoodFactor() const;
+   *  void recomputeSpeciesProbabilities();
+   *  // scaler of the CLV of a gene node (always 0 without block scaling)
+   *  int getCLVScaler(unsigned int geneId) const;
+   *  // CLV journal (see beginCLVJournal): save the CLV of a gene node
+   *  // before it is overwritten, write back all the saved CLVs, 
+   *  // and forget the saved CLVs
+   *  void saveCLV(unsigned int geneId);
+   *  void restoreSavedCLVs();
+   *  void clearSavedCLVs();
+   *  void computeProbability(pll_unode_t *geneNode, pll_rnode_t *speciesNode, 
+   *      REAL &proba, bool isVirtualRoot, Scenario *scenario, 
+   *      Scenario::Event *event, bool stochastic);
+   *
+   *  Derived can also hide the default hooks below 
+   *  (beforeComputeLogLikelihood...), calling the parent ones
+   */
+  Derived &derived() {return static_cast<Derived &>(*this);}
+  const Derived &derived() const {return static_cast<const Derived &>(*this);}
+  // Pending node of the iterative backtrace
+  struct BacktraceTask {
+    pll_unode_t *geneNode;
+    pll_rnode_t *speciesNode;
+    bool isVirtualRoot;
+  };
+  // Fill the CLVs and compute the ML roots of the scenarios
+  void prepareScenarioInference(pll_unode_t *&geneRoot, pll_rnode_t *&speciesRoot);
+  // Fill a new scenario from the roots given by prepareScenarioInference.
+  // Does not change the model, and can run on several threads, 
+  // each with its own tasks buffer
+  bool inferScenario(pll_unode_t *geneRoot, 
+      pll_rnode_t *speciesRoot,
+      Scenario &scenario,
+      std::vector<BacktraceTask> &tasks,
+      bool stochastic);
+  // Called by inferScenario
   // fills scenario with the best likelihood set of events that 
   // would lead to the subtree of geneNode under speciesNode
   // Can assume that all the CLVs are filled
-  virtual bool backtrace(pll_unode_t *geneNode, pll_rnode_t *speciesNode, 
+  // tasks is the (reused) stack of the traversal
+  bool backtrace(pll_unode_t *geneNode, pll_rnode_t *speciesNode, 
       Scenario &scenario,
+      std::vector<BacktraceTask> &tasks,
       bool isVirtualRoot = false,
       bool stochastic = false);
- 
-  virtual void computeProbability(pll_unode_t *geneNode, pll_rnode_t *speciesNode, 
-      REAL &proba,
-      bool isVirtualRoot = false,
-      Scenario *scenario = nullptr,
-      Scenario::Event *event = nullptr,
-      bool stochastic = false) = 0;
   
   void initFromUtree(pll_utree_t *tree);
   /**
@@ -172,6 +342,42 @@ protected:
   
   void updateCLVs();
   virtual pll_unode_t *computeMLRoot();
+  /**
+   *  Flat gene tree topology, indexed by gene id (virtual roots 
+   *  included): the children of a gene node are read from the 
+   *  libpll nodes each time its CLV is scheduled for an update,
+   *  and are valid as long as its CLV is
+   */
+  bool isGeneLeaf(unsigned int geneId) const {return _geneLeft[geneId] == NO_GENE;}
+  unsigned int getLeftId(unsigned int geneId) const {return _geneLeft[geneId];}
+  unsigned int getRightId(unsigned int geneId) const {return _geneRight[geneId];}
+  /**
+   *  Block scaling: sum of the scalers of the children CLVs of 
+   *  geneId, i.e. the scaler of its CLV before normalization
+   */
+  int getChildrenScaler(unsigned int geneId) const;
+  /**
+   *  Invalidate what depends on the rates of a species node, for the 
+   *  models in which the CLV entries of a species node only depend on 
+   *  the rates of its subtree: all the gene CLVs, but only the entries 
+   *  of this species node and of its ancestors. Falls back to a full 
+   *  invalidation if anything else changed since the last likelihood
+   *  computation
+   */
+  void invalidateSpeciesRates(unsigned int speciesNodeIndex);
+  /**
+   *  CLV of the subtree under a gene node, computed by a model of 
+   *  the rank from the species probabilities of this version and from
+   *  children CLVs with this scaler. Null if there is none yet.
+   *  When the CLVs are not shared with the rank, the single-species
+   *  clades (see updateCladeId) are still shared within the family
+   */
+  const SharedCLV<REAL> *getSharedCLV(unsigned int geneId, unsigned long version, int scaler) const;
+  /**
+   *  Shared CLV to fill with the CLV of a gene node, or null if
+   *  the CLV of this gene node cannot be shared
+   */
+  SharedCLV<REAL> *publishCLV(unsigned int geneId, unsigned long version, int scaler);
 protected:
   pll_unode_t *_geneRoot;
   unsigned int _allSpeciesNodesCount;
@@ -182,25 +388,73 @@ protected:
   std::vector<unsigned int> _geneIds;
   unsigned int _maxGeneId;
   bool _fastMode;
+  bool _blockScaling;
   PartialLikelihoodMode _likelihoodMode;
-  virtual void beforeComputeLogLikelihood(); 
-  virtual void afterComputeLogLikelihood() {};
+  // CLVs shared with the other families, acquired by the
+  // derived classes in setTreeDuplicates (null if not shared)
+  std::shared_ptr<SubtreeCache<SharedCLV<REAL> > > _sharedCLVs;
+  void beforeComputeLogLikelihood(); 
+  void afterComputeLogLikelihood() {};
+  /**
+   *  Can the next computeLogLikelihood call approximate the likelihood?
+   */
+  bool isApproxLikelihoodAvailable() const {return false;}
   pll_rnode_t *getSpeciesSon(pll_rnode_t *node, bool left) {return left ? getSpeciesLeft(node) : getSpeciesRight(node);}
   pll_rnode_t *getSpeciesLeft(pll_rnode_t *node) {return _speciesLeft[node->node_index];}
   pll_rnode_t *getSpeciesRight(pll_rnode_t *node) {return _speciesRight[node->node_index];}
   pll_rnode_t *getSpeciesParent(pll_rnode_t *node) {return _speciesParent[node->node_index];}
   pll_rnode_t *getPrunedRoot() {return _prunedRoot;}
+  PLLRootedTree &getSpeciesTree() {return _speciesTree;}
+  /**
+   *  Can the species probabilities be shared with the other 
+   *  families, i.e. is the species tree not pruned?
+   */
+  bool hasShareableSpeciesProbabilities() const {return !_pruneSpeciesTree;}
+  bool isSpeciesTreePruned() const {return _pruneSpeciesTree;}
+  bool isSpeciesTreeTrialOpen() const {return _speciesTreeTrial;}
+  /**
+   *  During a partial update after invalidateSpeciesRates, 
+   *  true if the CLV (or virtual root CLV) geneId was not computed
+   *  by the last exact computation: its entries that are not 
+   *  updated are not valid, and all of them must be computed
+   */
+  bool needsFullUpdate(unsigned int geneId) const {
+    return _speciesRatesUpdate && !_isCLVComplete[geneId];
+  }
 private:
   void mapGenesToSpecies();
   void computeMLRoot(pll_unode_t *&bestGeneRoot, pll_rnode_t *&bestSpeciesRoot);
-  virtual void computeLikelihoods();
+  void computeLikelihoods();
   double getSumLikelihood();
-  void updateCLVsRec(pll_unode_t *node);
+  int getRootScaler(pll_unode_t *root) const;
+  int getMinRootScaler(const std::vector<pll_unode_t *> &roots) const;
+  REAL rescale(REAL value, int scaler, int referenceScaler) const;
+  /**
+   *  Append to _updateSchedule, in postorder, the invalid CLVs
+   *  needed by the CLV of geneId, and mark them as updated
+   */
+  void scheduleCLVUpdates(unsigned int geneId);
+  void updateGeneChildren(unsigned int geneId);
+  /**
+   *  Identify the clade under a gene node whose children clades are 
+   *  up to date, if all its leaves map to the same species: two such 
+   *  clades get the same identifier if they have the same species and 
+   *  the same shape, and thus the same CLV. Large in-paralog expansions
+   *  then only compute each clade CLV once
+   */
+  void updateCladeId(unsigned int geneId);
+  unsigned int addClade(unsigned long key, unsigned int species);
+  // forget all the clades, except for the leaves
+  void resetClades();
   void markInvalidatedNodes();
   void markInvalidatedNodesRec(pll_unode_t *node);
   bool fillPrunedNodesPostOrder(pll_rnode_t *node, 
     std::vector<pll_rnode_t *> &nodes, 
-    std::unordered_set<pll_rnode_t *> *nodesToAdd = nullptr);  
+    const IndexSet *nodesToAdd = nullptr);  
+  void discardCLVJournal();
+  void clearCompleteVirtualRoots() {
+    std::fill(_isCLVComplete.begin() + (_maxGeneId + 1), _isCLVComplete.end(), false);
+  }
   
   
   bool _rootedGeneTree;
@@ -210,14 +464,39 @@ private:
   std::vector<unsigned int> _speciesCoverage;
   // set of invalid CLVs. All the CLVs from these CLVs to
   // the root(s) need to be recomputed
-  std::unordered_set<unsigned int> _invalidatedNodes;
-  
-  std::unordered_set<pll_rnode_t *> _invalidatedSpeciesNodes;
+  IndexSet _invalidatedNodes;
+  // node_index of the invalid species nodes
+  IndexSet _invalidatedSpeciesNodes;
   bool _allSpeciesNodesInvalid;
+  // true if the CLVs only changed through invalidateSpeciesRates
+  // since the last likelihood computation
+  bool _onlySpeciesRatesChanged;
+  // true if the current computation only updates the species
+  // nodes invalidated by invalidateSpeciesRates
+  bool _speciesRatesUpdate;
+  // per CLV and virtual root CLV (see computeLikelihoods), true if
+  // it holds the entries of the last exact computation for all 
+  // the species nodes. In rooted gene tree mode, the virtual roots
+  // (and the CLVs) computed depend on the current root
+  std::vector<bool> _isCLVComplete;
+  // virtual roots computed by the current computation
+  std::vector<unsigned int> _computedVirtualRoots;
 
   // is the CLV up to date?
   std::vector<bool> _isCLVUpdated;
   std::vector<pll_unode_t *> _allNodes;
+  // flat topology (see getLeftId)
+  std::vector<unsigned int> _geneLeft;
+  std::vector<unsigned int> _geneRight;
+  // gene ids of the CLVs to update, in postorder, and 
+  // traversal stack of scheduleCLVUpdates
+  std::vector<unsigned int> _updateSchedule;
+  std::vector<unsigned int> _scheduleStack;
+  // buffers of getRoots
+  std::vector<pll_unode_t *> _roots;
+  std::vector<bool> _isRootMarked;
+  // traversal stack of the backtraces of inferMLScenario
+  std::vector<BacktraceTask> _backtraceTasks;
  
   // left, right and parent species vectors, 
   // index with the species nodex_index
@@ -226,30 +505,83 @@ private:
   std::vector<pll_rnode_t *> _speciesParent;
   pll_rnode_t *_prunedRoot;
   bool _pruneSpeciesTree;
+  std::vector<double> _logLikelihoodGradient;
+  
+  // CLVs shared with the other families (see setTreeDuplicates)
+  std::shared_ptr<const TreeDuplicates> _treeDuplicates;
+  const std::vector<unsigned int> *_subtreeIds;
+
+  // single-species clades: clade of each gene node (NO_CLADE if its
+  // leaves span several species), species of each clade, clade of
+  // each key (species or children clades), and CLVs of the clades
+  std::vector<unsigned int> _cladeIds;
+  std::vector<unsigned int> _cladeSpecies;
+  std::unordered_map<unsigned long, unsigned int> _cladeKeys;
+  SubtreeCache<SharedCLV<REAL> > _cladeCLVs;
+
+  // CLV journal: state at the last beginCLVJournal call,
+  // and gene CLVs saved since then
+  bool _isJournalOpen;
+  std::vector<bool> _journalIsCLVUpdated;
+  IndexSet _journalInvalidatedNodes;
+  pll_unode_t *_journalGeneRoot;
+  bool _journalAllSpeciesNodesInvalid;
+  bool _journalOnlySpeciesRatesChanged;
+  std::vector<unsigned int> _journaledCLVs;
+  std::vector<unsigned int> _journaledCladeIds;
+  std::vector<bool> _isCLVJournaled;
+
+  // species tree trial: state at the last beginSpeciesTreeTrial call
+  bool _speciesTreeTrial;
+  IndexSet _trialInvalidatedSpeciesNodes;
+  bool _trialAllSpeciesNodesInvalid;
+  bool _trialOnlySpeciesRatesChanged;
+  pll_unode_t *_trialGeneRoot;
+  // true if nothing changed since the last exact computation 
+  // when the trial began, and then if the trial was reverted
+  bool _isTrialLogLikelihoodValid;
+  double _trialLogLikelihood;
+  // result of the last exact computation
+  double _lastLogLikelihood;
 };
 
 
   
-template <class REAL>
-AbstractReconciliationModel<REAL>::AbstractReconciliationModel(PLLRootedTree &speciesTree, 
+template <class REAL, class Derived>
+AbstractReconciliationModel<REAL, Derived>::AbstractReconciliationModel(PLLRootedTree &speciesTree, 
     const GeneSpeciesMapping &geneSpeciesMapping, 
     bool rootedGeneTree,
     bool pruneSpeciesTree):
   _geneRoot(0),
   _maxGeneId(1),
   _fastMode(false),
+  _blockScaling(false),
   _likelihoodMode(PartialLikelihoodMode::PartialGenes),
   _rootedGeneTree(rootedGeneTree),
   _speciesTree(speciesTree),
   _geneNameToSpeciesName(geneSpeciesMapping.getMap()),
   _allSpeciesNodesInvalid(true),
-  _pruneSpeciesTree(pruneSpeciesTree)
+  _onlySpeciesRatesChanged(false),
+  _speciesRatesUpdate(false),
+  _pruneSpeciesTree(pruneSpeciesTree),
+  _subtreeIds(nullptr),
+  _isJournalOpen(false),
+  _journalGeneRoot(nullptr),
+  _journalAllSpeciesNodesInvalid(false),
+  _journalOnlySpeciesRatesChanged(false),
+  _speciesTreeTrial(false),
+  _trialAllSpeciesNodesInvalid(false),
+  _trialOnlySpeciesRatesChanged(false),
+  _trialGeneRoot(nullptr),
+  _isTrialLogLikelihoodValid(false),
+  _trialLogLikelihood(0.0),
+  _lastLogLikelihood(0.0)
 {
   initSpeciesTree();
 }
 
-template <class REAL>
-void AbstractReconciliationModel<REAL>::initFromUtree(pll_utree_t *tree) {
+template <class REAL, class Derived>
+void AbstractReconciliationModel<REAL, Derived>::initFromUtree(pll_utree_t *tree) {
   auto treeSize = tree->tip_count + tree->inner_count;
   auto nodesNumber = tree->tip_count + 3 * tree->inner_count;
   _geneIds.clear();
@@ -272,8 +604,8 @@ void AbstractReconciliationModel<REAL>::initFromUtree(pll_utree_t *tree) {
 }
 
 
-template <class REAL>
-void AbstractReconciliationModel<REAL>::mapGenesToSpecies()
+template <class REAL, class Derived>
+void AbstractReconciliationModel<REAL, Derived>::mapGenesToSpecies()
 {
   _geneToSpecies.resize(_allNodes.size());
   for (auto node: _allNodes) {
@@ -290,23 +622,33 @@ void AbstractReconciliationModel<REAL>::mapGenesToSpecies()
   onSpeciesTreeChange(nullptr);
 }
 
-template <class REAL>
-void AbstractReconciliationModel<REAL>::setInitialGeneTree(pll_utree_t *tree)
+template <class REAL, class Derived>
+void AbstractReconciliationModel<REAL, Derived>::setInitialGeneTree(pll_utree_t *tree)
 {
   initFromUtree(tree);
   mapGenesToSpecies();
   _maxGeneId = static_cast<unsigned int>(_allNodes.size() - 1);
+  _isCLVJournaled = std::vector<bool>(_maxGeneId + 1, false);
+  _invalidatedNodes.resize(_maxGeneId + 1);
+  _journalInvalidatedNodes.resize(_maxGeneId + 1);
+  _journaledCLVs.clear();
+  _journaledCladeIds.clear();
+  _geneLeft.assign(2 * (_maxGeneId + 1), NO_GENE);
+  _geneRight.assign(2 * (_maxGeneId + 1), NO_GENE);
+  _isCLVComplete.assign(2 * (_maxGeneId + 1), false);
+  resetClades();
   invalidateAllCLVs();
+  endSpeciesTreeTrial(false);
 }
   
-template <class REAL>
-bool AbstractReconciliationModel<REAL>::fillPrunedNodesPostOrder(pll_rnode_t *node, 
+template <class REAL, class Derived>
+bool AbstractReconciliationModel<REAL, Derived>::fillPrunedNodesPostOrder(pll_rnode_t *node, 
     std::vector<pll_rnode_t *> &nodes, 
-    std::unordered_set<pll_rnode_t *> *nodesToAdd)
+    const IndexSet *nodesToAdd)
 {
   bool addMyself = true;
   if (nodesToAdd) {
-    addMyself = (nodesToAdd->find(node) != nodesToAdd->end());
+    addMyself = nodesToAdd->contains(node->node_index);
   }
   if (getSpeciesLeft(node)) {
     assert(getSpeciesRight(node));
@@ -340,10 +682,12 @@ static bool fillNodesPostOrder(pll_rnode_t *node,
 }
 
 
-template <class REAL>
-void AbstractReconciliationModel<REAL>::initSpeciesTree()
+template <class REAL, class Derived>
+void AbstractReconciliationModel<REAL, Derived>::initSpeciesTree()
 {
   _allSpeciesNodesCount = _speciesTree.getNodesNumber();
+  _invalidatedSpeciesNodes.resize(_allSpeciesNodesCount);
+  _trialInvalidatedSpeciesNodes.resize(_allSpeciesNodesCount);
   _speciesLeft = std::vector<pll_rnode_t *>(_allSpeciesNodesCount, nullptr);
   _speciesRight = std::vector<pll_rnode_t *>(_allSpeciesNodesCount, nullptr);
   _speciesParent = std::vector<pll_rnode_t *>(_allSpeciesNodesCount, nullptr);
@@ -356,20 +700,21 @@ void AbstractReconciliationModel<REAL>::initSpeciesTree()
   }
 }
 
-template <class REAL>
-void AbstractReconciliationModel<REAL>::onSpeciesTreeChange(const std::unordered_set<pll_rnode_t *> *nodesToInvalidate)
+template <class REAL, class Derived>
+void AbstractReconciliationModel<REAL, Derived>::onSpeciesTreeChange(const std::unordered_set<pll_rnode_t *> *nodesToInvalidate)
 {
+  _onlySpeciesRatesChanged = false;
+  discardCLVJournal();
   if (!nodesToInvalidate) {
     _allSpeciesNodesInvalid = true;
   } else {
     assert(nodesToInvalidate->size());
     for (auto node: *nodesToInvalidate) {
       while (node) {
-        _invalidatedSpeciesNodes.insert(node);
+        _invalidatedSpeciesNodes.insert(node->node_index);
         node = getSpeciesParent(node);
       }
     }
-    _invalidatedSpeciesNodes.insert(nodesToInvalidate->begin(), nodesToInvalidate->end());
   }
   _allSpeciesNodes.clear();
   fillNodesPostOrder(_speciesTree.getRoot(), _allSpeciesNodes);
@@ -411,10 +756,14 @@ void AbstractReconciliationModel<REAL>::onSpeciesTreeChange(const std::unordered
 }
 
 
-template <class REAL>
-void AbstractReconciliationModel<REAL>::beforeComputeLogLikelihood()
+template <class REAL, class Derived>
+void AbstractReconciliationModel<REAL, Derived>::beforeComputeLogLikelihood()
 {
-  if (_allSpeciesNodesInvalid) { // update everything
+  // after invalidateSpeciesRates, the other species entries are valid, 
+  // even in the modes that always update all the species nodes
+  bool speciesRatesUpdate = _onlySpeciesRatesChanged && _invalidatedSpeciesNodes.size();
+  _speciesRatesUpdate = speciesRatesUpdate;
+  if (_allSpeciesNodesInvalid && !speciesRatesUpdate) { // update everything
     _speciesNodesToUpdate = _allSpeciesNodes;
   } else if (_invalidatedSpeciesNodes.size()) { // partial update
     // here, fill _speciesNodesToUpdate with the invalid nodes
@@ -423,14 +772,18 @@ void AbstractReconciliationModel<REAL>::beforeComputeLogLikelihood()
   } else {
     _speciesNodesToUpdate.clear();
   } 
-  _allSpeciesNodesInvalid = false;
-  _invalidatedSpeciesNodes.clear();
+  // a fast computation does not change the CLVs: the species nodes
+  // stay invalid until the next exact computation
+  if (!_fastMode) {
+    _allSpeciesNodesInvalid = false;
+    _invalidatedSpeciesNodes.clear();
+  }
   //assert(!_speciesNodesToUpdate.size() || _speciesNodesToUpdate.back() == getPrunedRoot());
-  recomputeSpeciesProbabilities();
+  derived().recomputeSpeciesProbabilities();
 }
 
-template <class REAL>
-void AbstractReconciliationModel<REAL>::getRoots(std::vector<pll_unode_t *> &roots,
+template <class REAL, class Derived>
+void AbstractReconciliationModel<REAL, Derived>::getRoots(std::vector<pll_unode_t *> &roots,
     const std::vector<unsigned int> &geneIds)
 {
   roots.clear();
@@ -446,24 +799,35 @@ void AbstractReconciliationModel<REAL>::getRoots(std::vector<pll_unode_t *> &roo
     }
     return;
   }
-  std::vector<bool> marked(geneIds.size(), false);
+  _isRootMarked.assign(geneIds.size(), false);
   for (auto id: geneIds) {
     auto node = _allNodes[id];
-    if (marked[node->node_index] || marked[node->back->node_index]) {
+    if (_isRootMarked[node->node_index] || _isRootMarked[node->back->node_index]) {
       continue;
     }
     roots.push_back(node->back);
-    marked[node->node_index] = true;
+    _isRootMarked[node->node_index] = true;
   }
 }
   
-template <class REAL>
-double AbstractReconciliationModel<REAL>::computeLogLikelihood(bool fastMode)
+template <class REAL, class Derived>
+double AbstractReconciliationModel<REAL, Derived>::computeLogLikelihood(bool fastMode)
 {
-  _fastMode = fastMode;
+  if (!_speciesTreeTrial) {
+    if (!fastMode && _isTrialLogLikelihoodValid && _onlySpeciesRatesChanged) {
+      // a species tree trial was reverted and nothing changed since:
+      // the CLVs are those of the last exact computation
+      _isTrialLogLikelihoodValid = false;
+      _lastLogLikelihood = _trialLogLikelihood;
+      return _lastLogLikelihood;
+    }
+    _isTrialLogLikelihoodValid = false;
+  }
+  _fastMode = fastMode && derived().isApproxLikelihoodAvailable();
 
-  beforeComputeLogLikelihood();
+  derived().beforeComputeLogLikelihood();
   //Logger::info << "computeLikelihoods " << _fastMode << " " << _speciesNodesToUpdate.size() << std::endl;
+  _computedVirtualRoots.clear();
   auto root = getRoot();
   updateCLVs();
   computeLikelihoods();
@@ -478,13 +842,23 @@ double AbstractReconciliationModel<REAL>::computeLogLikelihood(bool fastMode)
   }
   
   auto res = getSumLikelihood();
-  afterComputeLogLikelihood();
+  derived().afterComputeLogLikelihood();
+  if (!_fastMode) {
+    _lastLogLikelihood = res;
+    // the virtual roots that were not computed are not valid anymore
+    clearCompleteVirtualRoots();
+    for (auto virtualRootId: _computedVirtualRoots) {
+      _isCLVComplete[virtualRootId] = true;
+    }
+  }
+  _speciesRatesUpdate = false;
+  _onlySpeciesRatesChanged = !_fastMode;
   _fastMode = false;
   return res;
 }
 
-template <class REAL>
-pll_unode_t *AbstractReconciliationModel<REAL>::getGeneSon(pll_unode_t *node, bool left, bool virtualRoot) const
+template <class REAL, class Derived>
+pll_unode_t *AbstractReconciliationModel<REAL, Derived>::getGeneSon(pll_unode_t *node, bool left, bool virtualRoot) const
 {
   if (left) {
     return getLeft(node, virtualRoot);
@@ -493,32 +867,41 @@ pll_unode_t *AbstractReconciliationModel<REAL>::getGeneSon(pll_unode_t *node, bo
   }
 }
 
-template <class REAL>
-pll_unode_t *AbstractReconciliationModel<REAL>::getLeft(pll_unode_t *node, bool virtualRoot) const
+template <class REAL, class Derived>
+pll_unode_t *AbstractReconciliationModel<REAL, Derived>::getLeft(pll_unode_t *node, bool virtualRoot) const
 {
   return virtualRoot ? node->next : node->next->back;
 }
 
-template <class REAL>
-pll_unode_t *AbstractReconciliationModel<REAL>::getRight(pll_unode_t *node, bool virtualRoot) const
+template <class REAL, class Derived>
+pll_unode_t *AbstractReconciliationModel<REAL, Derived>::getRight(pll_unode_t *node, bool virtualRoot) const
 {
   return virtualRoot ? node->next->back : node->next->next->back;
 }
 
-template <class REAL>
-pll_unode_t *AbstractReconciliationModel<REAL>::getLeftRepeats(pll_unode_t *node, bool virtualRoot)
+template <class REAL, class Derived>
+int AbstractReconciliationModel<REAL, Derived>::getChildrenScaler(unsigned int geneId) const
+{
+  if (isGeneLeaf(geneId)) {
+    return 0;
+  }
+  return derived().getCLVScaler(getLeftId(geneId)) + derived().getCLVScaler(getRightId(geneId));
+}
+
+template <class REAL, class Derived>
+pll_unode_t *AbstractReconciliationModel<REAL, Derived>::getLeftRepeats(pll_unode_t *node, bool virtualRoot)
 {
   return getLeft(node, virtualRoot);
 }
 
-template <class REAL>
-pll_unode_t *AbstractReconciliationModel<REAL>::getRightRepeats(pll_unode_t *node, bool virtualRoot)
+template <class REAL, class Derived>
+pll_unode_t *AbstractReconciliationModel<REAL, Derived>::getRightRepeats(pll_unode_t *node, bool virtualRoot)
 {
   return getRight(node, virtualRoot);
 }
 
-template <class REAL>
-void AbstractReconciliationModel<REAL>::markInvalidatedNodesRec(pll_unode_t *node)
+template <class REAL, class Derived>
+void AbstractReconciliationModel<REAL, Derived>::markInvalidatedNodesRec(pll_unode_t *node)
 {
   _isCLVUpdated[node->node_index] = false;
   if (node->back->next) {
@@ -527,8 +910,8 @@ void AbstractReconciliationModel<REAL>::markInvalidatedNodesRec(pll_unode_t *nod
   }
 }
 
-template <class REAL>
-void AbstractReconciliationModel<REAL>::markInvalidatedNodes()
+template <class REAL, class Derived>
+void AbstractReconciliationModel<REAL, Derived>::markInvalidatedNodes()
 {
   for (auto nodeIndex: _invalidatedNodes) {
     auto node = _allNodes[nodeIndex];
@@ -537,40 +920,47 @@ void AbstractReconciliationModel<REAL>::markInvalidatedNodes()
   _invalidatedNodes.clear();
 }
 
-template <class REAL>
-void AbstractReconciliationModel<REAL>::updateCLVsRec(pll_unode_t *node)
+template <class REAL, class Derived>
+void AbstractReconciliationModel<REAL, Derived>::updateGeneChildren(unsigned int geneId)
+{
+  auto node = _allNodes[geneId];
+  if (node->next) {
+    _geneLeft[geneId] = node->next->back->node_index;
+    _geneRight[geneId] = node->next->next->back->node_index;
+  }
+}
+
+template <class REAL, class Derived>
+void AbstractReconciliationModel<REAL, Derived>::scheduleCLVUpdates(unsigned int geneId)
 {
-  if (_isCLVUpdated[node->node_index]) {
+  if (_isCLVUpdated[geneId]) {
     return;
   }
-  std::stack<pll_unode_t *> nodes;
-  nodes.push(node);
-  while (!nodes.empty()) {
-    auto currentNode = nodes.top();
-    if (currentNode->next) {
+  _scheduleStack.push_back(geneId);
+  while (!_scheduleStack.empty()) {
+    auto gid = _scheduleStack.back();
+    if (_allNodes[gid]->next) {
+      // the children of an invalid CLV might have changed
+      updateGeneChildren(gid);
       bool waitForChildren = false;
-      auto left = getLeft(currentNode, false);
-      auto right = getRight(currentNode, false);
-      if (!_isCLVUpdated[left->node_index]) {
-        nodes.push(left);
-        waitForChildren = true;
-      }
-      if (!_isCLVUpdated[right->node_index]) {
-        nodes.push(right);
-        waitForChildren = true;
+      for (auto child: {getLeftId(gid), getRightId(gid)}) {
+        if (!_isCLVUpdated[child]) {
+          _scheduleStack.push_back(child);
+          waitForChildren = true;
+        }
       }
       if (waitForChildren) {
         continue;
       }
     }
-    updateCLV(currentNode);
-    nodes.pop();
-    _isCLVUpdated[currentNode->node_index] = true;
+    _scheduleStack.pop_back();
+    _isCLVUpdated[gid] = true;
+    _updateSchedule.push_back(gid);
   }
 }
 
-template <class REAL>
-void AbstractReconciliationModel<REAL>::updateCLVs()
+template <class REAL, class Derived>
+void AbstractReconciliationModel<REAL, Derived>::updateCLVs()
 {
   switch (_likelihoodMode) {
     case PartialLikelihoodMode::PartialGenes:
@@ -585,35 +975,280 @@ void AbstractReconciliationModel<REAL>::updateCLVs()
     break;
   }
   markInvalidatedNodes();
-  std::vector<pll_unode_t *> roots;
+  auto &roots = _roots;
   getRoots(roots, _geneIds);
+  _updateSchedule.clear();
   for (auto root: roots) {
-    updateCLVsRec(root);
-    updateCLVsRec(root->back);
+    scheduleCLVUpdates(root->node_index);
+    scheduleCLVUpdates(root->back->node_index);
+  }
+  for (auto gid: _updateSchedule) {
+    // the CLVs that were not valid when the journal 
+    // started do not need to be restored
+    if (_isJournalOpen && _journalIsCLVUpdated[gid] && !_isCLVJournaled[gid]) {
+      derived().saveCLV(gid);
+      _isCLVJournaled[gid] = true;
+      _journaledCLVs.push_back(gid);
+      _journaledCladeIds.push_back(_cladeIds[gid]);
+    }
+    updateCladeId(gid);
+    derived().updateCLV(_allNodes[gid]);
   }
 }
 
-template <class REAL>
-void AbstractReconciliationModel<REAL>::invalidateCLV(unsigned int nodeIndex)
+template <class REAL, class Derived>
+void AbstractReconciliationModel<REAL, Derived>::invalidateCLV(unsigned int nodeIndex)
 {
   _invalidatedNodes.insert(nodeIndex);
+  _onlySpeciesRatesChanged = false;
 }
   
-template <class REAL>
-void AbstractReconciliationModel<REAL>::invalidateAllCLVs()
+template <class REAL, class Derived>
+void AbstractReconciliationModel<REAL, Derived>::invalidateAllCLVs()
+{
+  _isCLVUpdated.assign(_maxGeneId + 1, false);
+  _onlySpeciesRatesChanged = false;
+  // the rates might have changed: the saved CLVs are not valid anymore
+  discardCLVJournal();
+}
+
+template <class REAL, class Derived>
+void AbstractReconciliationModel<REAL, Derived>::beginCLVJournal()
+{
+  discardCLVJournal();
+  // in the other modes, the species entries of all the CLVs
+  // change at each computation
+  if (_likelihoodMode != PartialLikelihoodMode::PartialGenes
+      || _invalidatedSpeciesNodes.size()) {
+    return;
+  }
+  _isJournalOpen = true;
+  _journalIsCLVUpdated = _isCLVUpdated;
+  _journalInvalidatedNodes = _invalidatedNodes;
+  _journalGeneRoot = _geneRoot;
+  _journalAllSpeciesNodesInvalid = _allSpeciesNodesInvalid;
+  _journalOnlySpeciesRatesChanged = _onlySpeciesRatesChanged;
+}
+
+template <class REAL, class Derived>
+bool AbstractReconciliationModel<REAL, Derived>::rollbackCLVJournal()
+{
+  if (!_isJournalOpen) {
+    return false;
+  }
+  derived().restoreSavedCLVs();
+  // the caller restored the gene tree
+  for (unsigned int i = 0; i < _journaledCLVs.size(); ++i) {
+    _cladeIds[_journaledCLVs[i]] = _journaledCladeIds[i];
+    updateGeneChildren(_journaledCLVs[i]);
+  }
+  std::swap(_isCLVUpdated, _journalIsCLVUpdated);
+  std::swap(_invalidatedNodes, _journalInvalidatedNodes);
+  _geneRoot = _journalGeneRoot;
+  _allSpeciesNodesInvalid = _journalAllSpeciesNodesInvalid;
+  _onlySpeciesRatesChanged = _journalOnlySpeciesRatesChanged;
+  // the virtual roots are not journaled
+  clearCompleteVirtualRoots();
+  discardCLVJournal();
+  return true;
+}
+
+template <class REAL, class Derived>
+void AbstractReconciliationModel<REAL, Derived>::beginSpeciesTreeTrial()
+{
+  endSpeciesTreeTrial(false);
+  // in the other modes, all the species entries are 
+  // recomputed at each computation anyway
+  if (_likelihoodMode != PartialLikelihoodMode::PartialSpecies) {
+    return;
+  }
+  _speciesTreeTrial = true;
+  _trialInvalidatedSpeciesNodes = _invalidatedSpeciesNodes;
+  _trialAllSpeciesNodesInvalid = _allSpeciesNodesInvalid;
+  _trialOnlySpeciesRatesChanged = _onlySpeciesRatesChanged;
+  _trialGeneRoot = _geneRoot;
+  // _onlySpeciesRatesChanged is only set by an exact computation,
+  // and reset by the gene and species tree changes
+  _isTrialLogLikelihoodValid = _onlySpeciesRatesChanged 
+    && !_allSpeciesNodesInvalid
+    && _invalidatedSpeciesNodes.empty() 
+    && _invalidatedNodes.empty();
+  _trialLogLikelihood = _lastLogLikelihood;
+}
+
+template <class REAL, class Derived>
+void AbstractReconciliationModel<REAL, Derived>::endSpeciesTreeTrial(bool revert)
+{
+  if (revert && _speciesTreeTrial) {
+    // the species tree structures were already rebuilt 
+    // by onSpeciesTreeChange when the caller reverted the tree
+    std::swap(_invalidatedSpeciesNodes, _trialInvalidatedSpeciesNodes);
+    _allSpeciesNodesInvalid = _trialAllSpeciesNodesInvalid;
+    _onlySpeciesRatesChanged = _trialOnlySpeciesRatesChanged;
+    _geneRoot = _trialGeneRoot;
+    // the virtual roots computed at the beginning of the trial 
+    // might not be the ones of the last computation
+    clearCompleteVirtualRoots();
+  } else {
+    _isTrialLogLikelihoodValid = false;
+  }
+  _trialInvalidatedSpeciesNodes.clear();
+  _speciesTreeTrial = false;
+}
+
+template <class REAL, class Derived>
+void AbstractReconciliationModel<REAL, Derived>::discardCLVJournal()
+{
+  if (!_isJournalOpen) {
+    return;
+  }
+  for (auto gid: _journaledCLVs) {
+    _isCLVJournaled[gid] = false;
+  }
+  _journaledCLVs.clear();
+  _journaledCladeIds.clear();
+  derived().clearSavedCLVs();
+  _isJournalOpen = false;
+}
+
+template <class REAL, class Derived>
+void AbstractReconciliationModel<REAL, Derived>::setTreeDuplicates(const std::shared_ptr<const TreeDuplicates> &duplicates,
+    unsigned int family)
+{
+  assert(family < duplicates->subtreeIds.size());
+  _treeDuplicates = duplicates;
+  _subtreeIds = &duplicates->subtreeIds[family];
+}
+
+template <class REAL, class Derived>
+const SharedCLV<REAL> *AbstractReconciliationModel<REAL, Derived>::getSharedCLV(unsigned int geneId, 
+    unsigned long version, 
+    int scaler) const
+{
+  const SharedCLV<REAL> *res = nullptr;
+  if (_sharedCLVs && !_pruneSpeciesTree && _likelihoodMode == PartialLikelihoodMode::PartialSpecies
+      && geneId < _subtreeIds->size()) { // virtual roots are not shared
+    res = _sharedCLVs->getValue((*_subtreeIds)[geneId], version);
+  } else if (geneId < _cladeIds.size() && _cladeIds[geneId] != NO_CLADE) {
+    res = _cladeCLVs.getValue(_cladeIds[geneId], version);
+  }
+  return (res && res->scaler == scaler) ? res : nullptr;
+}
+
+template <class REAL, class Derived>
+SharedCLV<REAL> *AbstractReconciliationModel<REAL, Derived>::publishCLV(unsigned int geneId, 
+    unsigned long version, 
+    int scaler)
+{
+  SharedCLV<REAL> *res = nullptr;
+  if (_sharedCLVs && !_pruneSpeciesTree && _likelihoodMode == PartialLikelihoodMode::PartialSpecies
+      && geneId < _subtreeIds->size()) {
+    res = &_sharedCLVs->setValue((*_subtreeIds)[geneId], version);
+  } else if (geneId < _cladeIds.size() && _cladeIds[geneId] != NO_CLADE) {
+    res = &_cladeCLVs.setValue(_cladeIds[geneId], version);
+  } else {
+    return nullptr;
+  }
+  res->scaler = scaler;
+  return res;
+}
+
+template <class REAL, class Derived>
+void AbstractReconciliationModel<REAL, Derived>::updateCladeId(unsigned int gid)
+{
+  if (isGeneLeaf(gid)) {
+    // the species of a leaf does not change
+    if (_cladeIds[gid] == NO_CLADE) {
+      _cladeIds[gid] = addClade(_geneToSpecies[gid], _geneToSpecies[gid]);
+    }
+    return;
+  }
+  unsigned long left = _cladeIds[getLeftId(gid)];
+  unsigned long right = _cladeIds[getRightId(gid)];
+  if (left == NO_CLADE || right == NO_CLADE || _cladeSpecies[left] != _cladeSpecies[right]) {
+    _cladeIds[gid] = NO_CLADE;
+    return;
+  }
+  // the children order does not matter, and the leaf keys
+  // (species) cannot collide with the inner node keys
+  auto key = (std::min(left, right) << 32 | std::max(left, right)) + _allSpeciesNodesCount;
+  _cladeIds[gid] = addClade(key, _cladeSpecies[left]);
+}
+
+template <class REAL, class Derived>
+unsigned int AbstractReconciliationModel<REAL, Derived>::addClade(unsigned long key, unsigned int species)
+{
+  auto it = _cladeKeys.find(key);
+  if (it != _cladeKeys.end()) {
+    return it->second;
+  }
+  // the gene tree moves keep creating new clades: bound the
+  // memory to one CLV per gene node
+  if (_cladeSpecies.size() > _maxGeneId) {
+    resetClades();
+    return NO_CLADE;
+  }
+  auto res = static_cast<unsigned int>(_cladeSpecies.size());
+  _cladeKeys.insert({key, res});
+  _cladeSpecies.push_back(species);
+  _cladeCLVs.resize(res + 1);
+  return res;
+}
+
+template <class REAL, class Derived>
+void AbstractReconciliationModel<REAL, Derived>::resetClades()
 {
-  _isCLVUpdated = std::vector<bool>(_maxGeneId + 1, false);
+  _cladeKeys.clear();
+  _cladeSpecies.clear();
+  _cladeCLVs.resetAll();
+  _cladeIds.assign(_maxGeneId + 1, NO_CLADE);
+  for (auto node: _allNodes) {
+    if (!node->next) {
+      updateCladeId(node->node_index);
+    }
+  }
+  // the journaled inner nodes lose their clade until they are updated
+  for (unsigned int i = 0; i < _journaledCLVs.size(); ++i) {
+    _journaledCladeIds[i] = _cladeIds[_journaledCLVs[i]];
+  }
+}
+
+template <class REAL, class Derived>
+void AbstractReconciliationModel<REAL, Derived>::invalidateSpeciesRates(unsigned int speciesNodeIndex)
+{
+  // with a pruned species tree, the nodes to update are only searched
+  // in the pruned tree, but the entries of the pruned nodes are also computed
+  bool partial = _onlySpeciesRatesChanged && !_pruneSpeciesTree;
+  if (partial && _invalidatedSpeciesNodes.empty()) {
+    // first call since the last exact computation: the CLVs that 
+    // were valid hold the entries of all the species nodes. The 
+    // other ones (in rooted gene tree mode, the CLVs that the last
+    // root did not need) will be fully updated (see needsFullUpdate)
+    std::copy(_isCLVUpdated.begin(), _isCLVUpdated.end(), _isCLVComplete.begin());
+  }
+  invalidateAllCLVs();
+  endSpeciesTreeTrial(false);
+  if (!partial) {
+    invalidateAllSpeciesCLVs();
+    return;
+  }
+  for (auto node = _speciesTree.getNode(speciesNodeIndex); node; node = getSpeciesParent(node)) {
+    _invalidatedSpeciesNodes.insert(node->node_index);
+  }
+  _onlySpeciesRatesChanged = true;
 }
 
-template <class REAL>
-void AbstractReconciliationModel<REAL>::computeMLRoot(pll_unode_t *&bestGeneRoot, pll_rnode_t *&bestSpeciesRoot) 
+template <class REAL, class Derived>
+void AbstractReconciliationModel<REAL, Derived>::computeMLRoot(pll_unode_t *&bestGeneRoot, pll_rnode_t *&bestSpeciesRoot) 
 {
-  std::vector<pll_unode_t *> roots;
+  auto &roots = _roots;
   getRoots(roots, _geneIds);
+  auto referenceScaler = getMinRootScaler(roots);
   REAL max = REAL();
   for (auto root: roots) {
+    auto scaler = getRootScaler(root);
     for (auto speciesNode: _allSpeciesNodes) {
-      REAL ll = getRootLikelihood(root, speciesNode);
+      REAL ll = rescale(derived().getRootLikelihood(root, speciesNode), scaler, referenceScaler);
       if (max < ll) {
         max = ll;
         bestGeneRoot = root;
@@ -623,15 +1258,16 @@ void AbstractReconciliationModel<REAL>::computeMLRoot(pll_unode_t *&bestGeneRoot
   }
 }
 
-template <class REAL>
-pll_unode_t *AbstractReconciliationModel<REAL>::computeMLRoot()
+template <class REAL, class Derived>
+pll_unode_t *AbstractReconciliationModel<REAL, Derived>::computeMLRoot()
 {
   pll_unode_t *bestRoot = 0;
-  std::vector<pll_unode_t *> roots;
+  auto &roots = _roots;
   getRoots(roots, _geneIds);
+  auto referenceScaler = getMinRootScaler(roots);
   REAL max = REAL();
   for (auto root: roots) {
-    REAL rootProba = getRootLikelihood(root);
+    REAL rootProba = rescale(derived().getRootLikelihood(root), getRootScaler(root), referenceScaler);
     if (max < rootProba) {
       bestRoot = root;
       max = rootProba;
@@ -641,35 +1277,73 @@ pll_unode_t *AbstractReconciliationModel<REAL>::computeMLRoot()
   return bestRoot;
 }
 
-template <class REAL>
-double AbstractReconciliationModel<REAL>::getSumLikelihood()
+template <class REAL, class Derived>
+double AbstractReconciliationModel<REAL, Derived>::getSumLikelihood()
 {
   REAL total = REAL();
-  std::vector<pll_unode_t *> roots;
+  auto &roots = _roots;
   getRoots(roots, _geneIds);
+  auto referenceScaler = getMinRootScaler(roots);
   for (auto root: roots) {
-    total += getRootLikelihood(root);
+    total += rescale(derived().getRootLikelihood(root), getRootScaler(root), referenceScaler);
   }
-  return log(total) - log(getLikelihoodFactor()); 
+  auto factor = derived().getLikelihoodFactor();
+  // the scalers are constant factors: they do not change the derivatives
+  getLogRatioDerivatives(total, factor, _logLikelihoodGradient);
+  return log(total) + referenceScaler * log(JS_SCALE_THRESHOLD) - log(factor); 
+}
+
+template <class REAL, class Derived>
+int AbstractReconciliationModel<REAL, Derived>::getRootScaler(pll_unode_t *root) const
+{
+  return derived().getCLVScaler(root->node_index + _maxGeneId + 1);
+}
+
+template <class REAL, class Derived>
+int AbstractReconciliationModel<REAL, Derived>::getMinRootScaler(const std::vector<pll_unode_t *> &roots) const
+{
+  int res = 0;
+  for (unsigned int i = 0; i < roots.size(); ++i) {
+    res = i ? std::min(res, getRootScaler(roots[i])) : getRootScaler(roots[i]);
+  }
+  return res;
+}
+
+/**
+ *  Express a value stored with scaler in the referenceScaler frame,
+ *  to compare or sum values from different CLVs
+ */
+template <class REAL, class Derived>
+REAL AbstractReconciliationModel<REAL, Derived>::rescale(REAL value, int scaler, int referenceScaler) const
+{
+  CLVArena<REAL>::applyScaler(value, referenceScaler - scaler);
+  return value;
 }
 
 
-template <class REAL>
-void AbstractReconciliationModel<REAL>::computeLikelihoods()
+template <class REAL, class Derived>
+void AbstractReconciliationModel<REAL, Derived>::computeLikelihoods()
 {
-  std::vector<pll_unode_t *> roots;
+  auto &roots = _roots;
   getRoots(roots, _geneIds);
   for (auto root: roots) {
     pll_unode_t virtualRoot;
     virtualRoot.next = root;
     virtualRoot.node_index = root->node_index + _maxGeneId + 1;
-    computeRootLikelihood(&virtualRoot);
+    _geneLeft[virtualRoot.node_index] = root->node_index;
+    _geneRight[virtualRoot.node_index] = root->back->node_index;
+    derived().computeRootLikelihood(&virtualRoot);
+    if (!_fastMode) {
+      _computedVirtualRoots.push_back(virtualRoot.node_index);
+      _isCLVComplete[virtualRoot.node_index] = true;
+    }
   }
 }
 
   
-template <class REAL>
-bool AbstractReconciliationModel<REAL>::inferMLScenario(Scenario &scenario, bool stochastic)
+template <class REAL, class Derived>
+void AbstractReconciliationModel<REAL, Derived>::prepareScenarioInference(pll_unode_t *&geneRoot, 
+    pll_rnode_t *&speciesRoot)
 {
   // make sure the CLVs are filled
   invalidateAllCLVs();
@@ -678,11 +1352,79 @@ bool AbstractReconciliationModel<REAL>::inferMLScenario(Scenario &scenario, bool
   auto ll = getSumLikelihood();
   assert(std::isnormal(ll) && ll < 0.0);
 
-  pll_unode_t *geneRoot = 0;
-  pll_rnode_t *speciesRoot = 0;
+  geneRoot = 0;
+  speciesRoot = 0;
   computeMLRoot(geneRoot, speciesRoot);
   assert(geneRoot);
   assert(speciesRoot);
+}
+
+template <class REAL, class Derived>
+bool AbstractReconciliationModel<REAL, Derived>::inferMLScenario(Scenario &scenario, bool stochastic)
+{
+  pll_unode_t *geneRoot = 0;
+  pll_rnode_t *speciesRoot = 0;
+  prepareScenarioInference(geneRoot, speciesRoot);
+  return inferScenario(geneRoot, speciesRoot, scenario, _backtraceTasks, stochastic);
+}
+
+template <class REAL, class Derived>
+bool AbstractReconciliationModel<REAL, Derived>::sampleScenarios(unsigned int samples,
+    unsigned int seed,
+    ScenarioBatch &batch,
+    unsigned int threads)
+{
+  pll_unode_t *geneRoot = 0;
+  pll_rnode_t *speciesRoot = 0;
+  prepareScenarioInference(geneRoot, speciesRoot);
+  auto virtualRootIndex = geneRoot->node_index + _maxGeneId + 1;
+  batch.reset(geneRoot, _speciesTree.getRawPtr(), virtualRootIndex);
+  threads = std::max(1u, std::min(threads, samples));
+  // each thread draws a contiguous range of samples, and writes
+  // their events straight into its batch: the first thread into
+  // the output batch, the others into batches appended to it
+  std::vector<ScenarioBatch> threadBatches(threads - 1);
+  auto draw = [&](unsigned int thread) {
+    auto &threadBatch = thread ? threadBatches[thread - 1] : batch;
+    if (thread) {
+      threadBatch.reset(geneRoot, _speciesTree.getRawPtr(), virtualRootIndex);
+    }
+    Scenario scenario;
+    std::vector<BacktraceTask> tasks;
+    auto begin = (thread * samples) / threads;
+    auto end = ((thread + 1) * samples) / threads;
+    for (unsigned int i = begin; i < end; ++i) {
+      Random::Stream stream(seed, i);
+      scenario.reset();
+      bool isValid = inferScenario(geneRoot, speciesRoot, scenario, tasks, true);
+      threadBatch.addScenario(scenario.getEvents(), isValid);
+    }
+  };
+  std::vector<std::thread> workers;
+  for (unsigned int t = 1; t < threads; ++t) {
+    workers.push_back(std::thread(draw, t));
+  }
+  draw(0);
+  for (auto &worker: workers) {
+    worker.join();
+  }
+  for (auto &threadBatch: threadBatches) {
+    batch.append(threadBatch);
+  }
+  bool ok = true;
+  for (unsigned int i = 0; i < samples; ++i) {
+    ok &= batch.isValid(i);
+  }
+  return ok;
+}
+
+template <class REAL, class Derived>
+bool AbstractReconciliationModel<REAL, Derived>::inferScenario(pll_unode_t *geneRoot, 
+    pll_rnode_t *speciesRoot,
+    Scenario &scenario,
+    std::vector<BacktraceTask> &tasks,
+    bool stochastic)
+{
   scenario.setGeneRoot(geneRoot);
   scenario.setSpeciesTree(_speciesTree.getRawPtr());
   pll_unode_t virtualRoot;
@@ -690,7 +1432,7 @@ bool AbstractReconciliationModel<REAL>::inferMLScenario(Scenario &scenario, bool
   virtualRoot.node_index = geneRoot->node_index + _maxGeneId + 1;
   scenario.setVirtualRootIndex(virtualRoot.node_index);
   scenario.initBlackList(_maxGeneId, _speciesTree.getNodesNumber());
-  return backtrace(&virtualRoot, speciesRoot, scenario, true, stochastic);
+  return derived().backtrace(&virtualRoot, speciesRoot, scenario, tasks, true, stochastic);
 }
   
 
@@ -699,55 +1441,66 @@ static pll_unode_t *getOther(pll_unode_t *ref, pll_unode_t *n1, pll_unode_t *n2)
   return (ref == n1) ? n2 : n1;
 }
 
-template <class REAL>
-bool AbstractReconciliationModel<REAL>::backtrace(pll_unode_t *geneNode, pll_rnode_t *speciesNode, 
+template <class REAL, class Derived>
+bool AbstractReconciliationModel<REAL, Derived>::backtrace(pll_unode_t *geneNode, pll_rnode_t *speciesNode, 
       Scenario &scenario,
+      std::vector<BacktraceTask> &tasks,
       bool isVirtualRoot, 
       bool stochastic) 
 {
-  pll_unode_t *leftGeneNode = 0;     
-  pll_unode_t *rightGeneNode = 0;     
-  bool isGeneLeaf = !geneNode->next;
-  if (!isGeneLeaf) {
-    leftGeneNode = this->getLeft(geneNode, isVirtualRoot);
-    rightGeneNode = this->getRight(geneNode, isVirtualRoot);
-  }
-  REAL temp;
-  Scenario::Event event;
-  computeProbability(geneNode, speciesNode, temp, isVirtualRoot, &scenario, &event, stochastic);
-  scenario.addEvent(event);
+  // explicit stack instead of recursion: the children are pushed
+  // in reverse order, so that the events (and the random draws)
+  // come in the same order as with a recursive traversal
+  tasks.clear();
+  tasks.push_back({geneNode, speciesNode, isVirtualRoot});
   bool ok = true;
-  // safety check
-  switch(event.type) {
-  case ReconciliationEventType::EVENT_S:
-    if (!event.cross) {
-      ok &= backtrace(leftGeneNode, speciesNode->left, scenario, false, stochastic); 
-      ok &= backtrace(rightGeneNode, speciesNode->right, scenario, false, stochastic); 
-    } else {
-      ok &= backtrace(leftGeneNode, speciesNode->right, scenario, false, stochastic); 
-      ok &= backtrace(rightGeneNode, speciesNode->left, scenario, false, stochastic); 
+  REAL temp;
+  while (!tasks.empty()) {
+    auto task = tasks.back();
+    tasks.pop_back();
+    geneNode = task.geneNode;
+    speciesNode = task.speciesNode;
+    isVirtualRoot = task.isVirtualRoot;
+    pll_unode_t *leftGeneNode = 0;     
+    pll_unode_t *rightGeneNode = 0;     
+    bool isGeneLeaf = !geneNode->next;
+    if (!isGeneLeaf) {
+      leftGeneNode = this->getLeft(geneNode, isVirtualRoot);
+      rightGeneNode = this->getRight(geneNode, isVirtualRoot);
+    }
+    Scenario::Event event;
+    derived().computeProbability(geneNode, speciesNode, temp, isVirtualRoot, &scenario, &event, stochastic);
+    scenario.addEvent(event);
+    // safety check
+    switch(event.type) {
+    case ReconciliationEventType::EVENT_S:
+      if (!event.cross) {
+        tasks.push_back({rightGeneNode, speciesNode->right, false}); 
+        tasks.push_back({leftGeneNode, speciesNode->left, false}); 
+      } else {
+        tasks.push_back({rightGeneNode, speciesNode->left, false}); 
+        tasks.push_back({leftGeneNode, speciesNode->right, false}); 
+      }
+      break;
+    case ReconciliationEventType::EVENT_D:
+      tasks.push_back({rightGeneNode, speciesNode, false}); 
+      tasks.push_back({leftGeneNode, speciesNode, false}); 
+      break;
+    case ReconciliationEventType::EVENT_SL:
+    case ReconciliationEventType::EVENT_TL:
+      tasks.push_back({geneNode, event.pllDestSpeciesNode, isVirtualRoot}); 
+      break;
+    case ReconciliationEventType::EVENT_T:
+      tasks.push_back({getOther(event.pllTransferedGeneNode, leftGeneNode, rightGeneNode),
+          speciesNode, false});
+      tasks.push_back({event.pllTransferedGeneNode, event.pllDestSpeciesNode, false});
+      break;
+    case ReconciliationEventType::EVENT_None:
+      break;
+    default:
+      ok  = false;
+      break;
     }
-    break;
-  case ReconciliationEventType::EVENT_D:
-    ok &= backtrace(leftGeneNode, speciesNode, scenario, false, stochastic); 
-    ok &= backtrace(rightGeneNode, speciesNode, scenario, false, stochastic); 
-    break;
-  case ReconciliationEventType::EVENT_SL:
-    ok &= backtrace(geneNode, event.pllDestSpeciesNode, scenario, isVirtualRoot, stochastic); 
-    break;
-  case ReconciliationEventType::EVENT_T:
-    ok &= backtrace(event.pllTransferedGeneNode, event.pllDestSpeciesNode, scenario, false, stochastic);
-    ok &= backtrace(getOther(event.pllTransferedGeneNode, leftGeneNode, rightGeneNode),
-        speciesNode, scenario, false, stochastic);
-    break;
-  case ReconciliationEventType::EVENT_TL:
-    ok &= backtrace(geneNode, event.pllDestSpeciesNode, scenario, isVirtualRoot, stochastic);
-    break;
-  case ReconciliationEventType::EVENT_None:
-    break;
-  default:
-    ok  = false;
-    break;
   }
   return ok;
 }
@@ -0,0 +1,357 @@
+#pragma once
+
+#include <vector>
+#include <cstdlib>
+#include <cassert>
+#include <new>
+#include <algorithm>
+#include <maths/ScaledValue.hpp>
+
+const size_t CLV_ALIGNMENT = 64;
+
+/**
+ *  Minimal std allocator returning CLV_ALIGNMENT-aligned blocks
+ */
+template <class T>
+class AlignedAllocator {
+public:
+  typedef T value_type;
+  AlignedAllocator() {}
+  template <class U>
+  AlignedAllocator(const AlignedAllocator<U> &) {}
+
+  T *allocate(size_t n) {
+    void *ptr = nullptr;
+    if (posix_memalign(&ptr, CLV_ALIGNMENT, std::max<size_t>(n, 1) * sizeof(T))) {
+      throw std::bad_alloc();
+    }
+    return static_cast<T *>(ptr);
+  }
+
+  void deallocate(T *ptr, size_t) {
+    free(ptr);
+  }
+};
+
+template <class T, class U>
+bool operator==(const AlignedAllocator<T> &, const AlignedAllocator<U> &) {return true;}
+template <class T, class U>
+bool operator!=(const AlignedAllocator<T> &, const AlignedAllocator<U> &) {return false;}
+
+/**
+ *  Contiguous [gene node][species node] matrix holding the CLVs
+ *  of one gene family in a single aligned block.
+ *  Rows are padded to a multiple of the cache line size, so that
+ *  each gene node CLV starts on its own cache line.
+ *  arena[geneId][speciesId] is the entry of a gene and a species node
+ *
+ *  In block scaling mode, each row has its own scaler: the real
+ *  value of an entry is arena[row][e] * JS_SCALE_THRESHOLD^scaler(row).
+ *  The scaler of a row is the sum of the scalers of the rows it is
+ *  computed from, plus the number of times it was rescaled because
+ *  its maximum entry fell under JS_SCALE_THRESHOLD
+ */
+template <class REAL>
+class CLVArena {
+public:
+  CLVArena(): _rows(0), _columns(0), _stride(0) {}
+
+  void resize(unsigned int rows, unsigned int columns) {
+    const size_t perLine = std::max<size_t>(1, CLV_ALIGNMENT / sizeof(REAL));
+    _rows = rows;
+    _columns = columns;
+    _stride = static_cast<unsigned int>((columns + perLine - 1) / perLine * perLine);
+    _data.assign(static_cast<size_t>(_rows) * _stride, REAL());
+    _scalers.assign(_rows, 0);
+  }
+
+  REAL *operator[](unsigned int row) {
+    assert(row < _rows);
+    return &_data[static_cast<size_t>(row) * _stride];
+  }
+
+  const REAL *operator[](unsigned int row) const {
+    assert(row < _rows);
+    return &_data[static_cast<size_t>(row) * _stride];
+  }
+
+  int getScaler(unsigned int row) const {return _scalers[row];}
+  
+  /**
+   *  Set the scaler of a row whose entries are all
+   *  going to be recomputed
+   */
+  void setScaler(unsigned int row, int scaler) {_scalers[row] = scaler;}
+
+  /**
+   *  Express the entries of the row with another scaler
+   */
+  void rescale(unsigned int row, int scaler) {
+    if (scaler == _scalers[row]) {
+      return;
+    }
+    auto begin = (*this)[row];
+    for (auto it = begin; it != begin + _columns; ++it) {
+      applyScaler(*it, scaler - _scalers[row]);
+    }
+    _scalers[row] = scaler;
+  }
+
+  /**
+   *  Same as rescale(row, scaler), for a row whose entries are all
+   *  null, except for the given columns
+   */
+  void rescale(unsigned int row, int scaler, const std::vector<unsigned int> &columns) {
+    if (scaler == _scalers[row]) {
+      return;
+    }
+    auto begin = (*this)[row];
+    for (auto column: columns) {
+      applyScaler(begin[column], scaler - _scalers[row]);
+    }
+    _scalers[row] = scaler;
+  }
+  
+  /**
+   *  Rescale the row until its maximum entry is not under
+   *  JS_SCALE_THRESHOLD anymore (unless the row is null)
+   *  @return the number of rescalings
+   */
+  int normalize(unsigned int row) {
+    auto begin = (*this)[row];
+    int exponent = getNormalizationExponent(*std::max_element(begin, begin + _columns));
+    if (exponent) {
+      for (auto it = begin; it != begin + _columns; ++it) {
+        applyScaler(*it, exponent);
+      }
+      _scalers[row] += exponent;
+    }
+    return exponent;
+  }
+  
+  /**
+   *  Same as normalize(row), for a row whose entries are all
+   *  null, except for the given columns
+   */
+  int normalize(unsigned int row, const std::vector<unsigned int> &columns) {
+    auto begin = (*this)[row];
+    REAL max = REAL();
+    for (auto column: columns) {
+      if (max < begin[column]) {
+        max = begin[column];
+      }
+    }
+    int exponent = getNormalizationExponent(max);
+    if (exponent) {
+      for (auto column: columns) {
+        applyScaler(begin[column], exponent);
+      }
+      _scalers[row] += exponent;
+    }
+    return exponent;
+  }
+
+  /**
+   *  Multiply value by JS_SCALE_FACTOR^exponent, one factor at a 
+   *  time, so that null values never become NaN
+   */
+  static void applyScaler(REAL &value, int exponent) {
+    for (; exponent > 0; --exponent) {
+      value *= JS_SCALE_FACTOR;
+    }
+    for (; exponent < 0; ++exponent) {
+      value *= JS_SCALE_THRESHOLD;
+    }
+  }
+
+  unsigned int rows() const {return _rows;}
+  unsigned int columns() const {return _columns;}
+  unsigned int stride() const {return _stride;}
+private:
+  static int getNormalizationExponent(REAL max) {
+    int exponent = 0;
+    while (REAL() < max && max < REAL(JS_SCALE_THRESHOLD)) {
+      max *= JS_SCALE_FACTOR;
+      exponent++;
+    }
+    return exponent;
+  }
+  
+  unsigned int _rows;
+  unsigned int _columns;
+  unsigned int _stride;
+  std::vector<REAL, AlignedAllocator<REAL> > _data;
+  std::vector<int> _scalers;
+};
+
+/**
+ *  CLVs of the models with transfers, in structure-of-arrays form:
+ *  the per-species probabilities live in one arena, and the
+ *  per-gene transfer sums in parallel arrays indexed by gene id
+ */
+template <class REAL>
+struct TransferCLVArena {
+  void resize(unsigned int genes, unsigned int species) {
+    _uq.resize(genes, species);
+    _survivingTransferSums.assign(genes, REAL());
+    _survivingTransferSumsInvariant.assign(genes, REAL());
+    _survivingTransferSumsOneMore.assign(genes, REAL());
+  }
+
+  unsigned int size() const {return _uq.rows();}
+  
+  int getScaler(unsigned int gid) const {return _uq.getScaler(gid);}
+  
+  /**
+   *  Block scaling: see CLVArena. The transfer sums of a gene
+   *  node are scaled together with its row
+   */
+  void setScaler(unsigned int gid, int scaler) {_uq.setScaler(gid, scaler);}
+  void rescale(unsigned int gid, int scaler) {
+    scaleSums(gid, scaler - getScaler(gid));
+    _uq.rescale(gid, scaler);
+  }
+  void normalize(unsigned int gid) {
+    scaleSums(gid, _uq.normalize(gid));
+  }
+
+  // probability of a gene node rooted at a species node
+  CLVArena<REAL> _uq;
+  // sum of transfer probabilities. Can be computed only once
+  // for all species, to reduce computation complexity
+  std::vector<REAL> _survivingTransferSums;
+  // subsum of transfer probbabilities that did not change
+  // in case of partial likelihood recomputation
+  std::vector<REAL> _survivingTransferSumsInvariant;
+  // when computing the likelihood in slow mode, we update this value,
+  // because we need it to compute _survivingTransferSumsInvariant
+  // consistently in fast mode
+  std::vector<REAL> _survivingTransferSumsOneMore;
+private:
+  void scaleSums(unsigned int gid, int exponent) {
+    CLVArena<REAL>::applyScaler(_survivingTransferSums[gid], exponent);
+    CLVArena<REAL>::applyScaler(_survivingTransferSumsInvariant[gid], exponent);
+    CLVArena<REAL>::applyScaler(_survivingTransferSumsOneMore[gid], exponent);
+  }
+};
+
+/**
+ *  CLV row of a gene subtree, shared by the families that contain
+ *  this subtree (see SubtreeCache). The entries are taken before the 
+ *  normalization of the row: scaler is the sum of the scalers of
+ *  the children rows they were computed from
+ */
+template <class REAL>
+struct SharedCLV {
+  SharedCLV(): scaler(0) {}
+  std::vector<REAL> entries;
+  int scaler;
+  // models with transfers only
+  REAL survivingTransferSum;
+  REAL survivingTransferSumOneMore;
+};
+
+
+/**
+ *  Undo log of CLVArena rows: save the content of rows before
+ *  they are overwritten, and write them back in O(saved entries).
+ *  If columns are given, only these columns of the row are saved
+ *  and written back (for instance the non-null entries of a sparse
+ *  CLV, or the only entries that a partial update overwrites)
+ */
+template <class REAL>
+class CLVJournal {
+public:
+  void save(const CLVArena<REAL> &arena, unsigned int row,
+      const std::vector<unsigned int> *columns = nullptr) {
+    auto begin = arena[row];
+    _rows.push_back(row);
+    _scalers.push_back(arena.getScaler(row));
+    _offsets.push_back(static_cast<unsigned int>(_values.size()));
+    _columnOffsets.push_back(static_cast<unsigned int>(_columns.size()));
+    if (columns) {
+      for (auto column: *columns) {
+        _columns.push_back(column);
+        _values.push_back(begin[column]);
+      }
+    } else {
+      _values.insert(_values.end(), begin, begin + arena.columns());
+    }
+    _isPartial.push_back(columns != nullptr);
+  }
+
+  /**
+   *  Write back the saved rows and their scalers, most recent first
+   */
+  void rollback(CLVArena<REAL> &arena) const {
+    for (size_t i = _rows.size(); i-- > 0; ) {
+      auto begin = arena[_rows[i]];
+      auto values = &_values[_offsets[i]];
+      if (_isPartial[i]) {
+        auto end = (i + 1 < _rows.size()) ? _columnOffsets[i + 1] : _columns.size();
+        for (size_t c = _columnOffsets[i]; c < end; ++c) {
+          begin[_columns[c]] = *values++;
+        }
+      } else {
+        std::copy(values, values + arena.columns(), begin);
+      }
+      arena.setScaler(_rows[i], _scalers[i]);
+    }
+  }
+
+  void clear() {
+    _rows.clear();
+    _scalers.clear();
+    _offsets.clear();
+    _columnOffsets.clear();
+    _isPartial.clear();
+    _columns.clear();
+    _values.clear();
+  }
+
+  bool empty() const {return _rows.empty();}
+private:
+  std::vector<unsigned int> _rows;
+  std::vector<int> _scalers;
+  std::vector<unsigned int> _offsets;
+  std::vector<unsigned int> _columnOffsets;
+  std::vector<bool> _isPartial;
+  std::vector<unsigned int> _columns;
+  std::vector<REAL> _values;
+};
+
+/**
+ *  CLVJournal of a TransferCLVArena: the rows are saved
+ *  together with their transfer sums
+ */
+template <class REAL>
+class TransferCLVJournal {
+public:
+  void save(const TransferCLVArena<REAL> &arena, unsigned int gid) {
+    _uq.save(arena._uq, gid);
+    _genes.push_back(gid);
+    _sums.push_back(arena._survivingTransferSums[gid]);
+    _sums.push_back(arena._survivingTransferSumsInvariant[gid]);
+    _sums.push_back(arena._survivingTransferSumsOneMore[gid]);
+  }
+
+  void rollback(TransferCLVArena<REAL> &arena) const {
+    _uq.rollback(arena._uq);
+    for (unsigned int i = 0; i < _genes.size(); ++i) {
+      auto gid = _genes[i];
+      arena._survivingTransferSums[gid] = _sums[3 * i];
+      arena._survivingTransferSumsInvariant[gid] = _sums[3 * i + 1];
+      arena._survivingTransferSumsOneMore[gid] = _sums[3 * i + 2];
+    }
+  }
+
+  void clear() {
+    _uq.clear();
+    _genes.clear();
+    _sums.clear();
+  }
+private:
+  CLVJournal<REAL> _uq;
+  std::vector<unsigned int> _genes;
+  std::vector<REAL> _sums;
+};
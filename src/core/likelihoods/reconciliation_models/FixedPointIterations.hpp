@@ -0,0 +1,53 @@
+#pragma once
+
+/**
+ *  Stopping criterion of the fixed-point iterations used by the
+ *  models with transfers (extinction probabilities and CLVs),
+ *  and number of iterations actually performed
+ */
+class FixedPointIterations {
+public:
+  FixedPointIterations(unsigned int maxIterations = 5, double epsilon = 0.000001):
+    _maxIterations(maxIterations),
+    _epsilon(epsilon),
+    _calls(0),
+    _iterations(0)
+  {}
+
+  /**
+   *  Stop after maxIterations iterations, or as soon as the
+   *  relative change of all the values is under epsilon
+   */
+  void setParameters(unsigned int maxIterations, double epsilon) {
+    _maxIterations = maxIterations;
+    _epsilon = epsilon;
+  }
+  unsigned int getMaxIterations() const {return _maxIterations;}
+  double getEpsilon() const {return _epsilon;}
+
+  /**
+   *  Does not need any operator other than the ones
+   *  implemented by ScaledValue
+   */
+  template <class REAL>
+  bool isConverged(const REAL &previous, const REAL &value) const {
+    return !(previous * (1.0 + _epsilon) < value)
+      && !(value * (1.0 + _epsilon) < previous);
+  }
+
+  void addCall(unsigned int iterations) {
+    _calls++;
+    _iterations += iterations;
+  }
+  unsigned long getCalls() const {return _calls;}
+  unsigned long getIterations() const {return _iterations;}
+  double getAverageIterations() const {
+    return _calls ? static_cast<double>(_iterations) / static_cast<double>(_calls) : 0.0;
+  }
+private:
+  unsigned int _maxIterations;
+  double _epsilon;
+  unsigned long _calls;
+  unsigned long _iterations;
+};
+
@@ -0,0 +1,26 @@
+#pragma once
+
+/*
+ *  Raw view of a SpeciesLanes (see ReconciliationKernels.hpp), the
+ *  only type shared with the translation units compiled with
+ *  instruction set flags (-mavx2, -mavx512f...). It must stay free
+ *  of includes and of inline functions: any inline function emitted
+ *  out of line by these translation units could be picked by the
+ *  linker and executed on CPUs without the instruction set.
+ */
+struct LaneArrays {
+  const int *e;
+  const int *f;
+  const int *g;
+  // lanes of level l are [levelOffsets[l], levelOffsets[l + 1])
+  const unsigned int *levelOffsets;
+  unsigned int levelsNumber;
+  const double *ps;
+  const double *pd;
+  const double *pt;
+  const double *slLeft;
+  const double *slRight;
+  const double *tl;
+  const double *denominator;
+};
+
@@ -0,0 +1,189 @@
+#include "ReconciliationKernels.hpp"
+#include <likelihoods/reconciliation_models/ReconciliationKernelsImpl.hpp>
+#include <algorithm>
+
+#ifdef GENERAX_X86_KERNELS
+void updateDLSSE(const LaneArrays &lanes, const double *left, const double *right, double *clv);
+void updateDLAVX2(const LaneArrays &lanes, const double *left, const double *right, double *clv);
+void updateDLAVX512(const LaneArrays &lanes, const double *left, const double *right, double *clv);
+void updateDTLSSE(const LaneArrays &lanes, const double *left, const double *right,
+    double leftTransferSum, double rightTransferSum, double transferSum, double *clv);
+void updateDTLAVX2(const LaneArrays &lanes, const double *left, const double *right,
+    double leftTransferSum, double rightTransferSum, double transferSum, double *clv);
+void updateDTLAVX512(const LaneArrays &lanes, const double *left, const double *right,
+    double leftTransferSum, double rightTransferSum, double transferSum, double *clv);
+#endif
+
+void SpeciesLanes::clear()
+{
+  e.clear();
+  f.clear();
+  g.clear();
+  levelOffsets.clear();
+}
+
+void SpeciesLanes::sortInLevels(unsigned int speciesNumber)
+{
+  // level of the last lane writing each entry, and maximum
+  // level of the lanes reading it since this last write
+  lastWrite.assign(speciesNumber, -1);
+  lastRead.assign(speciesNumber, -1);
+  levels.resize(size());
+  int levelsNumber = 0;
+  for (unsigned int i = 0; i < size(); ++i) {
+    int level = std::max(lastWrite[e[i]] + 1, lastRead[e[i]]);
+    if (f[i] != e[i]) {
+      level = std::max(level, lastWrite[f[i]] + 1);
+      level = std::max(level, lastWrite[g[i]] + 1);
+      lastRead[f[i]] = std::max(lastRead[f[i]], level);
+      lastRead[g[i]] = std::max(lastRead[g[i]], level);
+    }
+    lastWrite[e[i]] = level;
+    levels[i] = level;
+    levelsNumber = std::max(levelsNumber, level + 1);
+  }
+  // stable counting sort of the lanes per level
+  levelOffsets.assign(levelsNumber + 1, 0);
+  for (auto level: levels) {
+    levelOffsets[level + 1]++;
+  }
+  for (int l = 0; l < levelsNumber; ++l) {
+    levelOffsets[l + 1] += levelOffsets[l];
+  }
+  positions.assign(levelOffsets.begin(), levelOffsets.end() - 1);
+  sortedE.resize(size());
+  sortedF.resize(size());
+  sortedG.resize(size());
+  for (unsigned int i = 0; i < size(); ++i) {
+    auto p = positions[levels[i]]++;
+    sortedE[p] = e[i];
+    sortedF[p] = f[i];
+    sortedG[p] = g[i];
+  }
+  e.swap(sortedE);
+  f.swap(sortedF);
+  g.swap(sortedG);
+  ps.resize(size());
+  pd.resize(size());
+  pt.resize(size());
+  slLeft.resize(size());
+  slRight.resize(size());
+  tl.resize(size());
+  denominator.resize(size());
+}
+
+LaneArrays SpeciesLanes::getArrays() const
+{
+  LaneArrays arrays;
+  arrays.e = e.data();
+  arrays.f = f.data();
+  arrays.g = g.data();
+  arrays.levelOffsets = levelOffsets.data();
+  arrays.levelsNumber = levelOffsets.size() ? 
+    static_cast<unsigned int>(levelOffsets.size() - 1) : 0;
+  arrays.ps = ps.data();
+  arrays.pd = pd.data();
+  arrays.pt = pt.data();
+  arrays.slLeft = slLeft.data();
+  arrays.slRight = slRight.data();
+  arrays.tl = tl.data();
+  arrays.denominator = denominator.data();
+  return arrays;
+}
+
+static KernelArch getBestKernelArch()
+{
+  KernelArch arch = KernelArch::Scalar;
+#ifdef GENERAX_X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    arch = KernelArch::AVX512;
+  } else if (__builtin_cpu_supports("avx2")) {
+    arch = KernelArch::AVX2;
+  } else if (__builtin_cpu_supports("sse3")) {
+    arch = KernelArch::SSE;
+  }
+#endif
+  return arch;
+}
+
+static KernelArch &currentArch()
+{
+  static KernelArch arch = getBestKernelArch();
+  return arch;
+}
+
+KernelArch ReconciliationKernels::getArch()
+{
+  return currentArch();
+}
+
+void ReconciliationKernels::setArch(KernelArch arch)
+{
+  currentArch() = std::min(arch, getBestKernelArch());
+}
+
+std::string ReconciliationKernels::getArchName(KernelArch arch)
+{
+  switch (arch) {
+  case KernelArch::Scalar:
+    return "scalar";
+  case KernelArch::SSE:
+    return "SSE";
+  case KernelArch::AVX2:
+    return "AVX2";
+  case KernelArch::AVX512:
+    return "AVX-512";
+  }
+  return "unknown";
+}
+
+void ReconciliationKernels::updateDL(const SpeciesLanes &speciesLanes,
+    const double *left,
+    const double *right,
+    double *clv)
+{
+  auto lanes = speciesLanes.getArrays();
+  switch (currentArch()) {
+#ifdef GENERAX_X86_KERNELS
+  case KernelArch::AVX512:
+    updateDLAVX512(lanes, left, right, clv);
+    break;
+  case KernelArch::AVX2:
+    updateDLAVX2(lanes, left, right, clv);
+    break;
+  case KernelArch::SSE:
+    updateDLSSE(lanes, left, right, clv);
+    break;
+#endif
+  default:
+    updateDLKernel<ScalarPolicy>(lanes, left, right, clv);
+  }
+}
+
+void ReconciliationKernels::updateDTL(const SpeciesLanes &speciesLanes,
+    const double *left,
+    const double *right,
+    double leftTransferSum,
+    double rightTransferSum,
+    double transferSum,
+    double *clv)
+{
+  auto lanes = speciesLanes.getArrays();
+  switch (currentArch()) {
+#ifdef GENERAX_X86_KERNELS
+  case KernelArch::AVX512:
+    updateDTLAVX512(lanes, left, right, leftTransferSum, rightTransferSum, transferSum, clv);
+    break;
+  case KernelArch::AVX2:
+    updateDTLAVX2(lanes, left, right, leftTransferSum, rightTransferSum, transferSum, clv);
+    break;
+  case KernelArch::SSE:
+    updateDTLSSE(lanes, left, right, leftTransferSum, rightTransferSum, transferSum, clv);
+    break;
+#endif
+  default:
+    updateDTLKernel<ScalarPolicy>(lanes, left, right, leftTransferSum, rightTransferSum, transferSum, clv);
+  }
+}
+
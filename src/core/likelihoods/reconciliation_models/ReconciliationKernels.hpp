@@ -0,0 +1,136 @@
+#pragma once
+
+#include <likelihoods/reconciliation_models/CLVArena.hpp>
+#include <likelihoods/reconciliation_models/LaneArrays.hpp>
+#include <vector>
+#include <string>
+#include <cassert>
+
+/**
+ *  Instruction sets of the vectorized reconciliation kernels
+ */
+enum class KernelArch {
+  Scalar = 0, SSE, AVX2, AVX512
+};
+
+typedef std::vector<int, AlignedAllocator<int> > LaneIndices;
+typedef std::vector<double, AlignedAllocator<double> > LaneValues;
+
+/**
+ *  The species nodes updated for one gene CLV, reordered into levels
+ *  of independent lanes: the lanes of a level only read CLV entries
+ *  written by previous levels, so they can be processed in parallel.
+ *  Each lane also stores the model coefficients it needs, so that the
+ *  kernels only perform contiguous loads and gathers.
+ */
+struct SpeciesLanes {
+  // lane i computes the entry of species e[i] from its children
+  // species f[i] and g[i] (f[i] == g[i] == e[i] for species leaves)
+  LaneIndices e;
+  LaneIndices f;
+  LaneIndices g;
+  // lanes of level l are [levelOffsets[l], levelOffsets[l + 1])
+  std::vector<unsigned int> levelOffsets;
+  // speciation probability (0 for species leaves)
+  LaneValues ps;
+  // duplication probability
+  LaneValues pd;
+  // transfer probability (only for models with transfers)
+  LaneValues pt;
+  // uE[g] * PS[e] and uE[f] * PS[e] (0 for species leaves)
+  LaneValues slLeft;
+  LaneValues slRight;
+  // uE[e] (only for models with transfers)
+  LaneValues tl;
+  // 1 - 2 * PD[e] * uE[e] (only for the DL model)
+  LaneValues denominator;
+  // buffers of sortInLevels, kept between calls to avoid reallocations
+  std::vector<int> lastWrite;
+  std::vector<int> lastRead;
+  std::vector<int> levels;
+  std::vector<unsigned int> positions;
+  LaneIndices sortedE;
+  LaneIndices sortedF;
+  LaneIndices sortedG;
+
+  unsigned int size() const {return static_cast<unsigned int>(e.size());}
+  void clear();
+  /**
+   *  Append a lane, in the sequential update order
+   */
+  void addLane(int speciesNode, int left, int right) {
+    e.push_back(speciesNode);
+    f.push_back(left);
+    g.push_back(right);
+  }
+  /**
+   *  Group the lanes into levels, such that processing the levels
+   *  in order gives the same result as the sequential update order.
+   *  Must be called after adding all the lanes and before setting
+   *  the coefficients
+   */
+  void sortInLevels(unsigned int speciesNumber);
+  /**
+   *  Raw pointers to the lanes, for the kernels
+   */
+  LaneArrays getArrays() const;
+};
+
+/**
+ *  Vectorized CLV update kernels for internal gene nodes,
+ *  in double precision. The kernel is selected at runtime
+ *  according to the host CPU capabilities.
+ */
+class ReconciliationKernels {
+public:
+  ReconciliationKernels() = delete;
+
+  static KernelArch getArch();
+  /**
+   *  Force the kernel instruction set (for instance Scalar to compare
+   *  against the generic implementation). Falls back to the best
+   *  supported instruction set if arch is not available
+   */
+  static void setArch(KernelArch arch);
+  static std::string getArchName(KernelArch arch);
+
+  /**
+   *  Undated DL update of the CLV of a gene node from the CLVs
+   *  of its left and right children
+   */
+  static void updateDL(const SpeciesLanes &lanes,
+      const double *left,
+      const double *right,
+      double *clv);
+
+  /**
+   *  Undated DTL update of the CLV of a gene node. The transfer
+   *  sums are the _survivingTransferSums of the three gene nodes
+   */
+  static void updateDTL(const SpeciesLanes &lanes,
+      const double *left,
+      const double *right,
+      double leftTransferSum,
+      double rightTransferSum,
+      double transferSum,
+      double *clv);
+
+  /**
+   *  Only the double precision is vectorized
+   */
+  template <class REAL>
+  static bool isSupported() {return false;}
+  template <class REAL>
+  static double toLaneValue(const REAL &) {assert(false); return 0.0;}
+  template <class REAL>
+  static void updateDL(const SpeciesLanes &, const REAL *, const REAL *, REAL *) {assert(false);}
+  template <class REAL>
+  static void updateDTL(const SpeciesLanes &, const REAL *, const REAL *,
+      const REAL &, const REAL &, const REAL &, REAL *) {assert(false);}
+};
+
+template <>
+inline bool ReconciliationKernels::isSupported<double>() {return true;}
+template <>
+inline double ReconciliationKernels::toLaneValue<double>(const double &value) {return value;}
+
@@ -0,0 +1,55 @@
+/*
+ *  AVX2 kernels. This file is compiled with -mavx2
+ */
+#ifdef __AVX2__
+
+#include <likelihoods/reconciliation_models/ReconciliationKernelsImpl.hpp>
+#include <immintrin.h>
+
+namespace {
+
+struct AVX2Policy {
+  typedef __m256d Vec;
+  static const unsigned int width = 4;
+  static inline Vec load(const double *p) {return _mm256_loadu_pd(p);}
+  static inline Vec set(double v) {return _mm256_set1_pd(v);}
+  static inline Vec gather(const double *base, const int *indices) {
+    return _mm256_i32gather_pd(base, 
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(indices)), 8);
+  }
+  static inline void scatter(double *base, const int *indices, Vec v) {
+    __m128d low = _mm256_castpd256_pd128(v);
+    __m128d high = _mm256_extractf128_pd(v, 1);
+    _mm_storel_pd(base + indices[0], low);
+    _mm_storeh_pd(base + indices[1], low);
+    _mm_storel_pd(base + indices[2], high);
+    _mm_storeh_pd(base + indices[3], high);
+  }
+  static inline Vec add(Vec a, Vec b) {return _mm256_add_pd(a, b);}
+  static inline Vec mul(Vec a, Vec b) {return _mm256_mul_pd(a, b);}
+  static inline Vec div(Vec a, Vec b) {return _mm256_div_pd(a, b);}
+};
+
+} // namespace
+
+void updateDLAVX2(const LaneArrays &lanes,
+    const double *left,
+    const double *right,
+    double *clv)
+{
+  updateDLKernel<AVX2Policy>(lanes, left, right, clv);
+}
+
+void updateDTLAVX2(const LaneArrays &lanes,
+    const double *left,
+    const double *right,
+    double leftTransferSum,
+    double rightTransferSum,
+    double transferSum,
+    double *clv)
+{
+  updateDTLKernel<AVX2Policy>(lanes, left, right, 
+      leftTransferSum, rightTransferSum, transferSum, clv);
+}
+
+#endif
@@ -0,0 +1,51 @@
+/*
+ *  AVX-512 kernels. This file is compiled with -mavx512f
+ */
+#ifdef __AVX512F__
+
+#include <likelihoods/reconciliation_models/ReconciliationKernelsImpl.hpp>
+#include <immintrin.h>
+
+namespace {
+
+struct AVX512Policy {
+  typedef __m512d Vec;
+  static const unsigned int width = 8;
+  static inline Vec load(const double *p) {return _mm512_loadu_pd(p);}
+  static inline Vec set(double v) {return _mm512_set1_pd(v);}
+  static inline Vec gather(const double *base, const int *indices) {
+    return _mm512_i32gather_pd(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(indices)), base, 8);
+  }
+  static inline void scatter(double *base, const int *indices, Vec v) {
+    _mm512_i32scatter_pd(base, 
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(indices)), v, 8);
+  }
+  static inline Vec add(Vec a, Vec b) {return _mm512_add_pd(a, b);}
+  static inline Vec mul(Vec a, Vec b) {return _mm512_mul_pd(a, b);}
+  static inline Vec div(Vec a, Vec b) {return _mm512_div_pd(a, b);}
+};
+
+} // namespace
+
+void updateDLAVX512(const LaneArrays &lanes,
+    const double *left,
+    const double *right,
+    double *clv)
+{
+  updateDLKernel<AVX512Policy>(lanes, left, right, clv);
+}
+
+void updateDTLAVX512(const LaneArrays &lanes,
+    const double *left,
+    const double *right,
+    double leftTransferSum,
+    double rightTransferSum,
+    double transferSum,
+    double *clv)
+{
+  updateDTLKernel<AVX512Policy>(lanes, left, right, 
+      leftTransferSum, rightTransferSum, transferSum, clv);
+}
+
+#endif
@@ -0,0 +1,140 @@
+#pragma once
+
+/*
+ *  Kernel bodies shared by the per-instruction-set translation
+ *  units. Each of them includes this file with its own compiler
+ *  flags and instantiates the kernels with its vector policy.
+ *
+ *  A vector policy V provides:
+ *  - Vec, width
+ *  - Vec load(const double *), Vec set(double)
+ *  - Vec gather(const double *base, const int *indices)
+ *  - void scatter(double *base, const int *indices, Vec v)
+ *  - Vec add(Vec, Vec), Vec mul(Vec, Vec), Vec div(Vec, Vec)
+ *
+ *  The operations are performed in the same order as in the
+ *  scalar computeProbability implementations, so that all
+ *  policies give the same results.
+ *
+ *  Everything is in an anonymous namespace: each translation unit
+ *  must keep its own copy, compiled for its own instruction set.
+ *  For the same reason, this file must only include LaneArrays.hpp.
+ */
+
+#include <likelihoods/reconciliation_models/LaneArrays.hpp>
+
+namespace {
+
+struct ScalarPolicy {
+  typedef double Vec;
+  static const unsigned int width = 1;
+  static inline Vec load(const double *p) {return *p;}
+  static inline Vec set(double v) {return v;}
+  static inline Vec gather(const double *base, const int *indices) {return base[*indices];}
+  static inline void scatter(double *base, const int *indices, Vec v) {base[*indices] = v;}
+  static inline Vec add(Vec a, Vec b) {return a + b;}
+  static inline Vec mul(Vec a, Vec b) {return a * b;}
+  static inline Vec div(Vec a, Vec b) {return a / b;}
+};
+
+template <class V>
+inline void dlLanes(const LaneArrays &lanes,
+    unsigned int i,
+    const double *left,
+    const double *right,
+    double *clv)
+{
+  const int *e = &lanes.e[i];
+  const int *f = &lanes.f[i];
+  const int *g = &lanes.g[i];
+  auto ps = V::load(&lanes.ps[i]);
+  // S event
+  auto proba = V::mul(V::mul(V::gather(left, f), V::gather(right, g)), ps);
+  proba = V::add(proba, V::mul(V::mul(V::gather(left, g), V::gather(right, f)), ps));
+  // D event
+  proba = V::add(proba, V::mul(V::mul(V::gather(left, e), V::gather(right, e)),
+        V::load(&lanes.pd[i])));
+  // SL event
+  proba = V::add(proba, V::mul(V::gather(clv, f), V::load(&lanes.slLeft[i])));
+  proba = V::add(proba, V::mul(V::gather(clv, g), V::load(&lanes.slRight[i])));
+  // DL event
+  proba = V::div(proba, V::load(&lanes.denominator[i]));
+  V::scatter(clv, e, proba);
+}
+
+template <class V>
+inline void dtlLanes(const LaneArrays &lanes,
+    unsigned int i,
+    const double *left,
+    const double *right,
+    double leftTransferSum,
+    double rightTransferSum,
+    double transferSum,
+    double *clv)
+{
+  const int *e = &lanes.e[i];
+  const int *f = &lanes.f[i];
+  const int *g = &lanes.g[i];
+  auto ps = V::load(&lanes.ps[i]);
+  auto pt = V::load(&lanes.pt[i]);
+  auto leftE = V::gather(left, e);
+  auto rightE = V::gather(right, e);
+  // S event
+  auto proba = V::mul(V::mul(V::gather(left, f), V::gather(right, g)), ps);
+  proba = V::add(proba, V::mul(V::mul(V::gather(left, g), V::gather(right, f)), ps));
+  // D event
+  proba = V::add(proba, V::mul(V::mul(leftE, rightE), V::load(&lanes.pd[i])));
+  // T event
+  proba = V::add(proba, V::mul(V::mul(V::set(leftTransferSum), pt), rightE));
+  proba = V::add(proba, V::mul(V::mul(V::set(rightTransferSum), pt), leftE));
+  // SL event
+  proba = V::add(proba, V::mul(V::gather(clv, f), V::load(&lanes.slLeft[i])));
+  proba = V::add(proba, V::mul(V::gather(clv, g), V::load(&lanes.slRight[i])));
+  // TL event
+  proba = V::add(proba, V::mul(V::mul(V::set(transferSum), pt), V::load(&lanes.tl[i])));
+  V::scatter(clv, e, proba);
+}
+
+template <class V>
+void updateDLKernel(const LaneArrays &lanes,
+    const double *left,
+    const double *right,
+    double *clv)
+{
+  for (unsigned int l = 0; l < lanes.levelsNumber; ++l) {
+    auto i = lanes.levelOffsets[l];
+    auto end = lanes.levelOffsets[l + 1];
+    for (; i + V::width <= end; i += V::width) {
+      dlLanes<V>(lanes, i, left, right, clv);
+    }
+    for (; i < end; ++i) {
+      dlLanes<ScalarPolicy>(lanes, i, left, right, clv);
+    }
+  }
+}
+
+template <class V>
+void updateDTLKernel(const LaneArrays &lanes,
+    const double *left,
+    const double *right,
+    double leftTransferSum,
+    double rightTransferSum,
+    double transferSum,
+    double *clv)
+{
+  for (unsigned int l = 0; l < lanes.levelsNumber; ++l) {
+    auto i = lanes.levelOffsets[l];
+    auto end = lanes.levelOffsets[l + 1];
+    for (; i + V::width <= end; i += V::width) {
+      dtlLanes<V>(lanes, i, left, right,
+          leftTransferSum, rightTransferSum, transferSum, clv);
+    }
+    for (; i < end; ++i) {
+      dtlLanes<ScalarPolicy>(lanes, i, left, right,
+          leftTransferSum, rightTransferSum, transferSum, clv);
+    }
+  }
+}
+
+} // namespace
+
@@ -0,0 +1,50 @@
+/*
+ *  SSE kernels. This file is compiled with -msse3
+ */
+#ifdef __SSE3__
+
+#include <likelihoods/reconciliation_models/ReconciliationKernelsImpl.hpp>
+#include <immintrin.h>
+
+namespace {
+
+struct SSEPolicy {
+  typedef __m128d Vec;
+  static const unsigned int width = 2;
+  static inline Vec load(const double *p) {return _mm_loadu_pd(p);}
+  static inline Vec set(double v) {return _mm_set1_pd(v);}
+  static inline Vec gather(const double *base, const int *indices) {
+    return _mm_set_pd(base[indices[1]], base[indices[0]]);
+  }
+  static inline void scatter(double *base, const int *indices, Vec v) {
+    _mm_storel_pd(base + indices[0], v);
+    _mm_storeh_pd(base + indices[1], v);
+  }
+  static inline Vec add(Vec a, Vec b) {return _mm_add_pd(a, b);}
+  static inline Vec mul(Vec a, Vec b) {return _mm_mul_pd(a, b);}
+  static inline Vec div(Vec a, Vec b) {return _mm_div_pd(a, b);}
+};
+
+} // namespace
+
+void updateDLSSE(const LaneArrays &lanes,
+    const double *left,
+    const double *right,
+    double *clv)
+{
+  updateDLKernel<SSEPolicy>(lanes, left, right, clv);
+}
+
+void updateDTLSSE(const LaneArrays &lanes,
+    const double *left,
+    const double *right,
+    double leftTransferSum,
+    double rightTransferSum,
+    double transferSum,
+    double *clv)
+{
+  updateDTLKernel<SSEPolicy>(lanes, left, right, 
+      leftTransferSum, rightTransferSum, transferSum, clv);
+}
+
+#endif
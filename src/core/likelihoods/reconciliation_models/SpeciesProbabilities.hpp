@@ -0,0 +1,179 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <trees/PLLRootedTree.hpp>
+#include <maths/DualValue.hpp>
+
+typedef std::vector< std::vector <double> > RatesVector;
+
+/**
+ *  Type of the event probabilities of a model templated on REAL:
+ *  plain doubles, unless the derivatives with respect to 
+ *  the rates are propagated
+ */
+template <class REAL>
+struct RateType {
+  typedef double type;
+};
+
+template <unsigned int N>
+struct RateType<DualValue<N> > {
+  typedef DualValue<N> type;
+};
+
+inline void seedRate(double &, unsigned int) {}
+
+template <unsigned int N>
+inline void seedRate(DualValue<N> &rate, unsigned int dimension) {
+  rate.seed(dimension);
+}
+
+// The extinction probabilities of the models with transfers are
+// computed once per rates or species tree change, and are not 
+// refined at each likelihood computation anymore: iterate longer
+const unsigned int EXTINCTION_MAX_ITERATIONS = 50;
+
+/**
+ *  Probabilities of a reconciliation model that only depend on
+ *  the species tree and on the rates: normalized event probabilities
+ *  and extinction probabilities, per species branch.
+ *
+ *  The models of the same type that use the same rates on the same
+ *  (unpruned) species tree share one table, so that it is only
+ *  computed and stored once per rank and per rates or species
+ *  tree change. Models with a pruned species tree keep a private table.
+ *
+ *  The models of one rank can run on several threads (see 
+ *  MoveEvaluationPool): a table is only published once it is
+ *  computed, and is never changed afterwards.
+ */
+template <class REAL>
+class SpeciesProbabilities {
+public:
+  typedef typename RateType<REAL>::type Rate;
+
+  SpeciesProbabilities():
+    transferExtinctionSum(REAL()),
+    _speciesTree(nullptr),
+    _speciesTreeVersion(0),
+    _version(0)
+  {}
+
+  /**
+   *  Make probabilities point to a table computed from these rates
+   *  and from the current topology of speciesTree.
+   *  If shareable is set, look for this table among the ones
+   *  published by the other models of type Model
+   *  @return true if the table is up to date, false if the caller
+   *  must (re)compute it and then call publish. In the latter case, 
+   *  the table is a private copy of the previous one, which can be 
+   *  used as a starting point
+   */
+  template <class Model>
+  static bool acquire(std::shared_ptr<SpeciesProbabilities> &probabilities,
+      const RatesVector &rates,
+      const PLLRootedTree &speciesTree,
+      bool shareable)
+  {
+    if (probabilities && probabilities->isUpToDate(rates, speciesTree)) {
+      return true;
+    }
+    std::lock_guard<std::mutex> lock(getMutex());
+    auto &lastShared = getLastShared<Model>();
+    if (shareable) {
+      auto candidate = lastShared.lock();
+      if (candidate && candidate->isUpToDate(rates, speciesTree)) {
+        probabilities = candidate;
+        return true;
+      }
+    }
+    // other models might still use the current table, or 
+    // find it among the published ones
+    if (!probabilities) {
+      probabilities = std::make_shared<SpeciesProbabilities>();
+    } else if (probabilities.use_count() > 1 || lastShared.lock() == probabilities) {
+      probabilities = std::make_shared<SpeciesProbabilities>(*probabilities);
+    }
+    probabilities->_rates = rates;
+    probabilities->_speciesTree = &speciesTree;
+    probabilities->_speciesTreeVersion = speciesTree.getTopologyVersion();
+    probabilities->_version = ++getLastVersion();
+    return false;
+  }
+
+  /**
+   *  Publish the table computed after acquire returned false to the
+   *  other models of type Model, if shareable is set
+   */
+  template <class Model>
+  static void publish(const std::shared_ptr<SpeciesProbabilities> &probabilities,
+      bool shareable)
+  {
+    if (shareable) {
+      std::lock_guard<std::mutex> lock(getMutex());
+      getLastShared<Model>() = probabilities;
+    }
+  }
+
+  /**
+   *  Set table to the rates of one dimension (D, L, T...). With dual 
+   *  numbers, the rates of this dimension are the independent variable
+   *  of the derivatives in this direction (global rates)
+   */
+  static void copyRates(const RatesVector &rates, unsigned int dimension,
+      std::vector<Rate> &table)
+  {
+    table.resize(rates[dimension].size());
+    for (unsigned int e = 0; e < table.size(); ++e) {
+      table[e] = Rate(rates[dimension][e]);
+      seedRate(table[e], dimension);
+    }
+  }
+
+  std::vector<Rate> PD; // Duplication probability, per species branch
+  std::vector<Rate> PL; // Loss probability, per species branch
+  std::vector<Rate> PT; // Transfer probability, per species branch
+  std::vector<Rate> PS; // Speciation probability, per species branch
+  std::vector<Rate> PI; // ILS probability, per species branch
+  std::vector<REAL> uE; // Extinction probability, per species branch
+  REAL transferExtinctionSum;
+
+  /**
+   *  Unique identifier of the content of the table: changes each 
+   *  time acquire asks to (re)compute it, and is never reused
+   */
+  unsigned long getVersion() const {return _version;}
+private:
+  bool isUpToDate(const RatesVector &rates, const PLLRootedTree &speciesTree) const {
+    return _speciesTree == &speciesTree
+      && _speciesTreeVersion == speciesTree.getTopologyVersion()
+      && _rates == rates;
+  }
+
+  // last table published by a model of type Model
+  template <class Model>
+  static std::weak_ptr<SpeciesProbabilities> &getLastShared() {
+    static std::weak_ptr<SpeciesProbabilities> lastShared;
+    return lastShared;
+  }
+
+  // protects the published tables
+  static std::mutex &getMutex() {
+    static std::mutex mutex;
+    return mutex;
+  }
+
+  static std::atomic<unsigned long> &getLastVersion() {
+    static std::atomic<unsigned long> lastVersion(0);
+    return lastVersion;
+  }
+
+  RatesVector _rates;
+  const PLLRootedTree *_speciesTree;
+  unsigned long _speciesTreeVersion;
+  unsigned long _version;
+};
+
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <likelihoods/reconciliation_models/AbstractReconciliationModel.hpp>
+#include <likelihoods/reconciliation_models/CLVArena.hpp>
+#include <likelihoods/reconciliation_models/ReconciliationKernels.hpp>
 #include <likelihoods/LibpllEvaluation.hpp>
 #include <IO/GeneSpeciesMapping.hpp>
 #include <IO/Logger.hpp>
@@ -19,12 +21,16 @@
 * allows a lot of algorithmic shortcuts
 */
 template <class REAL>
-class UndatedDLModel: public AbstractReconciliationModel<REAL> {
+class UndatedDLModel final: public AbstractReconciliationModel<REAL, UndatedDLModel<REAL> > {
+  friend class AbstractReconciliationModel<REAL, UndatedDLModel<REAL> >;
 public:
   UndatedDLModel(PLLRootedTree &speciesTree, const GeneSpeciesMapping &geneSpeciesMappingp, 
       bool rootedGeneTree,
       bool pruneSpeciesTree):
-    AbstractReconciliationModel<REAL>(speciesTree, geneSpeciesMappingp, rootedGeneTree, pruneSpeciesTree) {}
+    AbstractReconciliationModel<REAL, UndatedDLModel<REAL> >(speciesTree, geneSpeciesMappingp, rootedGeneTree, pruneSpeciesTree),
+    _lastTopologyVersion(0),
+    _sameAncestors(false),
+    _trialTopologyVersion(0) {}
   
   
   UndatedDLModel(const UndatedDLModel &) = delete;
@@ -35,44 +41,120 @@ public:
   
   // overloaded from parent
   virtual void setRates(const RatesVector &rates);
+  // overloaded from parent
+  virtual void setRatesForSpecies(const RatesVector &rates, unsigned int speciesNodeIndex);
+  // overloaded from parent
+  virtual void beginSpeciesTreeTrial();
+  // overloaded from parent
+  virtual void endSpeciesTreeTrial(bool revert);
+  // overloaded from parent
+  virtual void setTreeDuplicates(const std::shared_ptr<const TreeDuplicates> &duplicates,
+      unsigned int family);
 protected:
   // overload from parent
   virtual void setInitialGeneTree(pll_utree_t *tree);
   // overload from parent
-  virtual void updateCLV(pll_unode_t *geneNode);
+  void updateCLV(pll_unode_t *geneNode);
   // overload from parent
-  virtual REAL getRootLikelihood(pll_unode_t *root) const;
-  virtual REAL getRootLikelihood(pll_unode_t *root, pll_rnode_t *speciesRoot) {
+  REAL getRootLikelihood(pll_unode_t *root) const;
+  REAL getRootLikelihood(pll_unode_t *root, pll_rnode_t *speciesRoot) {
     return _dlclvs[root->node_index + this->_maxGeneId + 1][speciesRoot->node_index];
   }
 
   // overload from parent
-  virtual void recomputeSpeciesProbabilities();
-  virtual REAL getLikelihoodFactor() const;
+  void beforeComputeLogLikelihood();
+  // overload from parent
+  void recomputeSpeciesProbabilities();
+  REAL getLikelihoodFactor() const;
   // overload from parent
-  virtual void computeRootLikelihood(pll_unode_t *virtualRoot);
+  int getCLVScaler(unsigned int geneId) const {return _dlclvs.getScaler(geneId);}
+  // overload from parent
+  void saveCLV(unsigned int geneId);
+  void restoreSavedCLVs();
+  void clearSavedCLVs();
+  // overload from parent
+  void computeRootLikelihood(pll_unode_t *virtualRoot);
   // overlead from parent
-  virtual void computeProbability(pll_unode_t *geneNode, pll_rnode_t *speciesNode, 
+  void computeProbability(pll_unode_t *geneNode, pll_rnode_t *speciesNode, 
       REAL &proba,
       bool isVirtualRoot = false,
       Scenario *scenario = nullptr,
       Scenario::Event *event = nullptr,
       bool stochastic = false);
 private:
-  std::vector<double> _PD; // Duplication probability, per species branch
-  std::vector<double> _PL; // Loss probability, per species branch
-  std::vector<double> _PS; // Speciation probability, per species branch
-  std::vector<double> _uE; // Extinction probability, per species branch
+  typedef typename RateType<REAL>::type Rate;
+  RatesVector _rates;
+  // duplication, loss, speciation and extinction probabilities, 
+  // per species branch
+  std::shared_ptr<SpeciesProbabilities<Rate> > _probabilities;
   
   // uq[geneId][speciesId] = probability of a gene node rooted at a species node
   // to produce the subtree of this gene node
-  typedef std::vector<REAL> DLCLV;
-  std::vector<DLCLV> _dlclvs;
+  CLVArena<REAL> _dlclvs;
+  // species nodes to update, sorted for the vectorized kernels
+  SpeciesLanes _lanes;
+  // A gene subtree can only be rooted at the ancestors of the LCA 
+  // of its species: _ancestors[geneId] holds the ids of these species
+  // nodes, from the LCA to the root of the species tree
+  std::vector<std::vector<unsigned int> > _ancestors;
+  std::vector<unsigned int> _ancestorsBuffer;
+  // true if the CLV entries that are not in _ancestors[geneId] are null
+  std::vector<bool> _isSparseCLV;
+  std::vector<pll_rnode_t *> _speciesNodesById;
+  // is the species node in getSpeciesNodesToUpdate()?
+  std::vector<bool> _isSpeciesNodeToUpdate;
+  // species tree topology of the last computation, and true if 
+  // the current one is a partial update on the same topology, 
+  // in which case the _ancestors are still valid
+  unsigned long _lastTopologyVersion;
+  bool _sameAncestors;
+  // ids of the species nodes in getSpeciesNodesToUpdate()
+  std::vector<unsigned int> _speciesIdsToUpdate;
+  
+  /**
+   *  CLV entries saved before being overwritten, and per 
+   *  saved gene node, its id, sparsity and ancestors
+   */
+  struct SavedCLVs {
+    CLVJournal<REAL> entries;
+    std::vector<unsigned int> genes;
+    std::vector<bool> isSparse;
+    std::vector<unsigned int> ancestorsOffsets;
+    std::vector<unsigned int> ancestors;
+    void clear() {
+      entries.clear();
+      genes.clear();
+      isSparse.clear();
+      ancestorsOffsets.clear();
+      ancestors.clear();
+    }
+  };
+  // CLV journal (see beginCLVJournal)
+  SavedCLVs _journal;
+  // species tree trial: CLVs (including the virtual roots), 
+  // probabilities and topology of the beginning of the trial
+  SavedCLVs _trialCLVs;
+  std::vector<bool> _isTrialCLVSaved;
+  std::shared_ptr<SpeciesProbabilities<Rate> > _trialProbabilities;
+  unsigned long _trialTopologyVersion;
  
 private:
   std::vector<pll_rnode_s *> &getSpeciesNodesToUpdate() {
     return this->_speciesNodesToUpdate;
   }
+  void updateLanes();
+  void updateCLVEntries(pll_unode_t *geneNode, bool isVirtualRoot);
+  void computeAncestors(pll_unode_t *geneNode, 
+      std::vector<unsigned int> &ancestors);
+  bool useSparseCLV(size_t ancestorsNumber) const;
+  void clearCLV(unsigned int geneId);
+  /**
+   *  Save the CLV of geneId: its ancestors entries if it is sparse,
+   *  else the given columns (all of them if columns is null)
+   */
+  void saveCLVTo(SavedCLVs &saved, unsigned int geneId, 
+      const std::vector<unsigned int> *columns);
+  void restoreCLVsFrom(SavedCLVs &saved);
 
 };
 
@@ -80,59 +162,138 @@ private:
 template <class REAL>
 void UndatedDLModel<REAL>::setInitialGeneTree(pll_utree_t *tree)
 {
-  AbstractReconciliationModel<REAL>::setInitialGeneTree(tree);
+  AbstractReconciliationModel<REAL, UndatedDLModel<REAL> >::setInitialGeneTree(tree);
   assert(this->_allSpeciesNodesCount);
   assert(this->_maxGeneId);
-  std::vector<REAL> zeros(this->_allSpeciesNodesCount);
-  _dlclvs = std::vector<std::vector<REAL> >(2 * (this->_maxGeneId + 1),zeros);
+  _dlclvs.resize(2 * (this->_maxGeneId + 1), this->_allSpeciesNodesCount);
+  _ancestors = std::vector<std::vector<unsigned int> >(2 * (this->_maxGeneId + 1));
+  _isSparseCLV = std::vector<bool>(2 * (this->_maxGeneId + 1), false);
+  _isTrialCLVSaved = std::vector<bool>(2 * (this->_maxGeneId + 1), false);
+  _speciesNodesById = std::vector<pll_rnode_t *>(this->_allSpeciesNodesCount, nullptr);
+  for (auto speciesNode: this->_allSpeciesNodes) {
+    _speciesNodesById[speciesNode->node_index] = speciesNode;
+  }
 }
 
-static double solveSecondDegreePolynome(double a, double b, double c) 
+// with the vectorized kernels, sparse CLVs are only computed if the
+// ancestor path is this many times shorter than the species tree
+static const size_t SPARSE_CLV_KERNEL_RATIO = 8;
+
+template <class Rate>
+static Rate solveSecondDegreePolynome(const Rate &a, const Rate &b, const Rate &c) 
 {
-  return 2 * c / (-b + sqrt(b * b - 4 * a * c));
+  return 2.0 * c / (-b + sqrt(b * b - 4.0 * a * c));
 }
 
 template <class REAL>
 void UndatedDLModel<REAL>::setRates(const RatesVector &rates)
 {
   assert(rates.size() == 2);
-  auto &dupRates = rates[0];
-  auto &lossRates = rates[1];
-  assert(this->_allSpeciesNodesCount == dupRates.size());
-  assert(this->_allSpeciesNodesCount == lossRates.size());
-  _PD = dupRates;
-  _PL = lossRates;
-  _PS = std::vector<double>(this->_allSpeciesNodesCount, 1.0);
+  assert(this->_allSpeciesNodesCount == rates[0].size());
+  assert(this->_allSpeciesNodesCount == rates[1].size());
+  _rates = rates;
   this->_geneRoot = 0;
-  for (auto speciesNode: this->_allSpeciesNodes) {
-    auto e = speciesNode->node_index;
-    double sum = _PD[e] + _PL[e] + _PS[e];
-    _PD[e] /= sum;
-    _PL[e] /= sum;
-    _PS[e] /= sum;
-  }
   recomputeSpeciesProbabilities();
   this->invalidateAllCLVs();
   this->invalidateAllSpeciesCLVs();
 }
 
+template <class REAL>
+void UndatedDLModel<REAL>::setRatesForSpecies(const RatesVector &rates, unsigned int speciesNodeIndex)
+{
+  assert(rates.size() == 2);
+  assert(this->_allSpeciesNodesCount == rates[0].size());
+  assert(this->_allSpeciesNodesCount == rates[1].size());
+  _rates = rates;
+  this->_geneRoot = 0;
+  // without transfers, the extinction probabilities and the CLV 
+  // entries of a species node only depend on its subtree
+  this->invalidateSpeciesRates(speciesNodeIndex);
+}
+
+template <class REAL>
+void UndatedDLModel<REAL>::beforeComputeLogLikelihood()
+{
+  AbstractReconciliationModel<REAL, UndatedDLModel<REAL> >::beforeComputeLogLikelihood();
+  _isSpeciesNodeToUpdate.assign(this->_allSpeciesNodesCount, false);
+  _speciesIdsToUpdate.clear();
+  for (auto speciesNode: getSpeciesNodesToUpdate()) {
+    _isSpeciesNodeToUpdate[speciesNode->node_index] = true;
+    _speciesIdsToUpdate.push_back(speciesNode->node_index);
+  }
+  // the gene trees do not change between partial updates
+  auto topologyVersion = this->getSpeciesTree().getTopologyVersion();
+  _sameAncestors = (topologyVersion == _lastTopologyVersion)
+    && (getSpeciesNodesToUpdate().size() != this->_allSpeciesNodes.size());
+  _lastTopologyVersion = topologyVersion;
+}
+
 template <class REAL>
 void UndatedDLModel<REAL>::recomputeSpeciesProbabilities()
 {
-  if (!_uE.size()) {
-    _uE = std::vector<double>(this->_allSpeciesNodesCount, 0.0);
+  if (SpeciesProbabilities<Rate>::template acquire<UndatedDLModel<REAL> >(_probabilities,
+        _rates, this->getSpeciesTree(), this->hasShareableSpeciesProbabilities())) {
+    updateLanes();
+    return;
   }
-  for (auto speciesNode: getSpeciesNodesToUpdate()) {
+  auto &p = *_probabilities;
+  p.copyRates(_rates, 0, p.PD);
+  p.copyRates(_rates, 1, p.PL);
+  p.PS = std::vector<Rate>(this->_allSpeciesNodesCount, Rate(1.0));
+  for (auto speciesNode: this->_allSpeciesNodes) {
+    auto e = speciesNode->node_index;
+    Rate sum = p.PD[e] + p.PL[e] + p.PS[e];
+    p.PD[e] /= sum;
+    p.PL[e] /= sum;
+    p.PS[e] /= sum;
+  }
+  p.uE = std::vector<Rate>(this->_allSpeciesNodesCount, Rate());
+  for (auto speciesNode: this->_allSpeciesNodes) {
     auto e = speciesNode->node_index;
-    double a = _PD[e];
-    double b = -1.0;
-    double c = _PL[e];
+    Rate a = p.PD[e];
+    Rate b = -1.0;
+    Rate c = p.PL[e];
     if (this->getSpeciesLeft(speciesNode)) {
-      c += _PS[e] * _uE[this->getSpeciesLeft(speciesNode)->node_index]  * _uE[this->getSpeciesRight(speciesNode)->node_index];
+      c += p.PS[e] * p.uE[this->getSpeciesLeft(speciesNode)->node_index]  * p.uE[this->getSpeciesRight(speciesNode)->node_index];
     }
-    double proba = solveSecondDegreePolynome(a, b, c);
+    Rate proba = solveSecondDegreePolynome(a, b, c);
     ASSERT_PROBA(proba)
-    _uE[speciesNode->node_index] = proba;
+    p.uE[e] = proba;
+  }
+  SpeciesProbabilities<Rate>::template publish<UndatedDLModel<REAL> >(_probabilities,
+      this->hasShareableSpeciesProbabilities());
+  updateLanes();
+}
+
+template <class REAL>
+void UndatedDLModel<REAL>::updateLanes()
+{
+  if (!ReconciliationKernels::isSupported<REAL>()) {
+    return;
+  }
+  _lanes.clear();
+  for (auto speciesNode: getSpeciesNodesToUpdate()) {
+    int e = speciesNode->node_index;
+    if (this->getSpeciesLeft(speciesNode)) {
+      _lanes.addLane(e, this->getSpeciesLeft(speciesNode)->node_index,
+          this->getSpeciesRight(speciesNode)->node_index);
+    } else {
+      _lanes.addLane(e, e, e);
+    }
+  }
+  _lanes.sortInLevels(this->_allSpeciesNodesCount);
+  for (unsigned int i = 0; i < _lanes.size(); ++i) {
+    auto e = _lanes.e[i];
+    auto f = _lanes.f[i];
+    auto g = _lanes.g[i];
+    bool isSpeciesLeaf = (e == f);
+    auto &p = *_probabilities;
+    auto lane = [](const Rate &value) {return ReconciliationKernels::toLaneValue(value);};
+    _lanes.ps[i] = isSpeciesLeaf ? 0.0 : lane(p.PS[e]);
+    _lanes.pd[i] = lane(p.PD[e]);
+    _lanes.slLeft[i] = isSpeciesLeaf ? 0.0 : lane(p.uE[g] * p.PS[e]);
+    _lanes.slRight[i] = isSpeciesLeaf ? 0.0 : lane(p.uE[f] * p.PS[e]);
+    _lanes.denominator[i] = lane(1.0 - 2.0 * p.PD[e] * p.uE[e]);
   }
 }
 
@@ -143,10 +304,237 @@ template <class REAL>
 void UndatedDLModel<REAL>::updateCLV(pll_unode_t *geneNode)
 {
   assert(geneNode);
-  for (auto speciesNode: getSpeciesNodesToUpdate()) {
-    computeProbability(geneNode, 
-        speciesNode, 
-        _dlclvs[geneNode->node_index][speciesNode->node_index]);
+  updateCLVEntries(geneNode, false);
+}
+
+template <class REAL>
+void UndatedDLModel<REAL>::computeAncestors(pll_unode_t *geneNode, 
+    std::vector<unsigned int> &ancestors)
+{
+  auto gid = geneNode->node_index;
+  ancestors.clear();
+  if (this->isGeneLeaf(gid)) {
+    // the ancestors are taken in the unpruned species tree, because
+    // the species nodes that are pruned are still computed
+    auto speciesNode = _speciesNodesById[this->_geneToSpecies[gid]];
+    for (; speciesNode; speciesNode = speciesNode->parent) {
+      ancestors.push_back(speciesNode->node_index);
+    }
+    return;
+  }
+  // both paths end at the species root: the LCA is the first
+  // node of their common suffix
+  auto &left = _ancestors[this->getLeftId(gid)];
+  auto &right = _ancestors[this->getRightId(gid)];
+  auto itLeft = left.rbegin();
+  auto itRight = right.rbegin();
+  while (itLeft != left.rend() && itRight != right.rend() && *itLeft == *itRight) {
+    ++itLeft;
+    ++itRight;
+  }
+  ancestors.assign(itLeft.base(), left.end());
+}
+
+template <class REAL>
+bool UndatedDLModel<REAL>::useSparseCLV(size_t ancestorsNumber) const
+{
+  // the vectorized kernels update all the species nodes faster than 
+  // the scalar code updates a few of them
+  if (ReconciliationKernels::isSupported<REAL>()) {
+    return ancestorsNumber * SPARSE_CLV_KERNEL_RATIO < this->_allSpeciesNodesCount;
+  }
+  return ancestorsNumber < this->_allSpeciesNodesCount;
+}
+
+template <class REAL>
+void UndatedDLModel<REAL>::saveCLVTo(SavedCLVs &saved, unsigned int geneId,
+    const std::vector<unsigned int> *columns)
+{
+  auto &ancestors = _ancestors[geneId];
+  saved.genes.push_back(geneId);
+  saved.isSparse.push_back(_isSparseCLV[geneId]);
+  saved.ancestorsOffsets.push_back(static_cast<unsigned int>(saved.ancestors.size()));
+  saved.ancestors.insert(saved.ancestors.end(), ancestors.begin(), ancestors.end());
+  saved.entries.save(_dlclvs, geneId, _isSparseCLV[geneId] ? &ancestors : columns);
+}
+
+template <class REAL>
+void UndatedDLModel<REAL>::restoreCLVsFrom(SavedCLVs &saved)
+{
+  for (unsigned int i = 0; i < saved.genes.size(); ++i) {
+    auto gid = saved.genes[i];
+    // the saved entries of a sparse CLV are written back on a null CLV
+    if (saved.isSparse[i]) {
+      clearCLV(gid);
+    }
+    auto begin = saved.ancestors.begin() + saved.ancestorsOffsets[i];
+    auto end = (i + 1 < saved.genes.size()) ?
+      saved.ancestors.begin() + saved.ancestorsOffsets[i + 1] : saved.ancestors.end();
+    _ancestors[gid].assign(begin, end);
+    _isSparseCLV[gid] = saved.isSparse[i];
+  }
+  saved.entries.rollback(_dlclvs);
+}
+
+template <class REAL>
+void UndatedDLModel<REAL>::saveCLV(unsigned int geneId)
+{
+  saveCLVTo(_journal, geneId, nullptr);
+}
+
+template <class REAL>
+void UndatedDLModel<REAL>::restoreSavedCLVs()
+{
+  restoreCLVsFrom(_journal);
+}
+
+template <class REAL>
+void UndatedDLModel<REAL>::clearSavedCLVs()
+{
+  _journal.clear();
+}
+
+template <class REAL>
+void UndatedDLModel<REAL>::beginSpeciesTreeTrial()
+{
+  AbstractReconciliationModel<REAL, UndatedDLModel<REAL> >::beginSpeciesTreeTrial();
+  if (this->isSpeciesTreeTrialOpen()) {
+    // the next recomputeSpeciesProbabilities copies the table
+    // before changing it, because it is not the only owner anymore
+    _trialProbabilities = _probabilities;
+    _trialTopologyVersion = _lastTopologyVersion;
+  }
+}
+
+template <class REAL>
+void UndatedDLModel<REAL>::endSpeciesTreeTrial(bool revert)
+{
+  if (this->isSpeciesTreeTrialOpen()) {
+    if (revert) {
+      restoreCLVsFrom(_trialCLVs);
+      _probabilities = _trialProbabilities;
+      // the restored ancestors are the ones of this topology
+      _lastTopologyVersion = _trialTopologyVersion;
+    }
+    for (auto gid: _trialCLVs.genes) {
+      _isTrialCLVSaved[gid] = false;
+    }
+    _trialCLVs.clear();
+    _trialProbabilities.reset();
+  }
+  AbstractReconciliationModel<REAL, UndatedDLModel<REAL> >::endSpeciesTreeTrial(revert);
+}
+
+template <class REAL>
+void UndatedDLModel<REAL>::setTreeDuplicates(const std::shared_ptr<const TreeDuplicates> &duplicates,
+    unsigned int family)
+{
+  AbstractReconciliationModel<REAL, UndatedDLModel<REAL> >::setTreeDuplicates(duplicates, family);
+  SubtreeCache<SharedCLV<REAL> >::template acquire<UndatedDLModel<REAL> >(this->_sharedCLVs, 
+      duplicates, this->_blockScaling);
+}
+
+template <class REAL>
+void UndatedDLModel<REAL>::clearCLV(unsigned int geneId)
+{
+  auto clv = _dlclvs[geneId];
+  if (_isSparseCLV[geneId]) {
+    for (auto e: _ancestors[geneId]) {
+      clv[e] = REAL();
+    }
+  } else {
+    std::fill(clv, clv + this->_allSpeciesNodesCount, REAL());
+  }
+}
+
+template <class REAL>
+void UndatedDLModel<REAL>::updateCLVEntries(pll_unode_t *geneNode, bool isVirtualRoot)
+{
+  auto gid = geneNode->node_index;
+  bool allSpecies = (getSpeciesNodesToUpdate().size() == this->_allSpeciesNodes.size());
+  bool fullUpdate = allSpecies || this->needsFullUpdate(gid);
+  if (this->isSpeciesTreeTrialOpen() && !_isTrialCLVSaved[gid]) {
+    // without block scaling, a partial update only 
+    // writes the entries of the species nodes to update
+    bool partial = !fullUpdate && !this->_blockScaling;
+    saveCLVTo(_trialCLVs, gid, partial ? &_speciesIdsToUpdate : nullptr);
+    _isTrialCLVSaved[gid] = true;
+  }
+  // in sparse mode, only the ancestors of the LCA are computed,
+  // and the other entries are set to zero. A partial update keeps
+  // a sparse CLV sparse if its ancestors did not change
+  bool sparse = _isSparseCLV[gid];
+  if (!_sameAncestors || fullUpdate || _ancestors[gid].empty()) {
+    computeAncestors(geneNode, _ancestorsBuffer);
+    sparse = fullUpdate ? useSparseCLV(_ancestorsBuffer.size()) 
+      : (sparse && _ancestorsBuffer == _ancestors[gid]);
+    if (fullUpdate && sparse) {
+      clearCLV(gid);
+    }
+    // copied rather than swapped, so that each buffer keeps 
+    // the capacity it needs and stops reallocating
+    _ancestors[gid].assign(_ancestorsBuffer.begin(), _ancestorsBuffer.end());
+    _isSparseCLV[gid] = sparse;
+  }
+  auto scaler = this->_blockScaling ? this->getChildrenScaler(gid) : 0;
+  if (this->_blockScaling) {
+    if (fullUpdate) {
+      _dlclvs.setScaler(gid, scaler);
+    } else if (sparse) {
+      _dlclvs.rescale(gid, scaler, _ancestors[gid]);
+    } else {
+      // the entries that are not recomputed must be expressed
+      // with the same scaler as the products of the children entries
+      _dlclvs.rescale(gid, scaler);
+    }
+  }
+  // sparse CLVs are cheap enough to be computed by each family
+  auto version = _probabilities->getVersion();
+  auto shared = sparse ? nullptr : this->getSharedCLV(gid, version, scaler);
+  if (sparse) {
+    for (auto e: _ancestors[gid]) {
+      if (fullUpdate || _isSpeciesNodeToUpdate[e]) {
+        computeProbability(geneNode, _speciesNodesById[e], _dlclvs[gid][e], isVirtualRoot);
+      }
+    }
+  } else if (shared) {
+    auto clv = _dlclvs[gid];
+    if (fullUpdate) {
+      std::copy(shared->entries.begin(), shared->entries.end(), clv);
+    } else {
+      for (auto e: _speciesIdsToUpdate) {
+        clv[e] = shared->entries[e];
+      }
+    }
+  } else {
+    // _lanes only holds the species nodes to update
+    if (!this->isGeneLeaf(gid) && allSpecies == fullUpdate 
+        && ReconciliationKernels::isSupported<REAL>()) {
+      ReconciliationKernels::updateDL(_lanes,
+          _dlclvs[this->getLeftId(gid)],
+          _dlclvs[this->getRightId(gid)],
+          _dlclvs[gid]);
+    } else {
+      auto &speciesNodes = fullUpdate ? this->_allSpeciesNodes : getSpeciesNodesToUpdate();
+      for (auto speciesNode: speciesNodes) {
+        computeProbability(geneNode, 
+            speciesNode, 
+            _dlclvs[gid][speciesNode->node_index],
+            isVirtualRoot);
+      }
+    }
+    // the entries that were not recomputed are still valid
+    auto published = this->publishCLV(gid, version, scaler);
+    if (published) {
+      published->entries.assign(_dlclvs[gid], _dlclvs[gid] + this->_allSpeciesNodesCount);
+    }
+  }
+  if (this->_blockScaling) {
+    if (sparse) {
+      _dlclvs.normalize(gid, _ancestors[gid]);
+    } else {
+      _dlclvs.normalize(gid);
+    }
   }
 }
 
@@ -154,20 +542,14 @@ void UndatedDLModel<REAL>::updateCLV(pll_unode_t *geneNode)
 template <class REAL>
 void UndatedDLModel<REAL>::computeProbability(pll_unode_t *geneNode, pll_rnode_t *speciesNode, 
       REAL &proba,
-      bool isVirtualRoot,
+      bool,
       Scenario *,
       Scenario::Event *event,
       bool stochastic)
   
 {
   auto gid = geneNode->node_index;
-  pll_unode_t *leftGeneNode = 0;     
-  pll_unode_t *rightGeneNode = 0;     
-  bool isGeneLeaf = !geneNode->next;
-  if (!isGeneLeaf) {
-    leftGeneNode = this->getLeft(geneNode, isVirtualRoot);
-    rightGeneNode = this->getRight(geneNode, isVirtualRoot);
-  }
+  bool isGeneLeaf = this->isGeneLeaf(gid);
   bool isSpeciesLeaf = !this->getSpeciesLeft(speciesNode);
   auto e = speciesNode->node_index;
   unsigned int f = 0;
@@ -188,7 +570,7 @@ void UndatedDLModel<REAL>::computeProbability(pll_unode_t *geneNode, pll_rnode_t
   if (isSpeciesLeaf and isGeneLeaf) {
     // present
     if (e == this->_geneToSpecies[gid]) {
-      proba = REAL(_PS[e]);
+      proba = REAL(_probabilities->PS[e]);
     } else {
       proba = REAL();
     }
@@ -201,16 +583,16 @@ void UndatedDLModel<REAL>::computeProbability(pll_unode_t *geneNode, pll_rnode_t
   values[4] = values[5] = values[6] = values[7] = REAL();
   
   if (not isGeneLeaf) {
-    auto u_left = leftGeneNode->node_index;
-    auto u_right = rightGeneNode->node_index;
+    auto u_left = this->getLeftId(gid);
+    auto u_right = this->getRightId(gid);
     if (not isSpeciesLeaf) {
       // S event
       values[0] = _dlclvs[u_left][f];
       values[1] = _dlclvs[u_left][g];
       values[0] *= _dlclvs[u_right][g];
       values[1] *= _dlclvs[u_right][f];
-      values[0] *= _PS[e]; 
-      values[1] *= _PS[e]; 
+      values[0] *= _probabilities->PS[e]; 
+      values[1] *= _probabilities->PS[e]; 
       scale(values[0]);
       scale(values[1]);
       proba += values[0];
@@ -219,23 +601,23 @@ void UndatedDLModel<REAL>::computeProbability(pll_unode_t *geneNode, pll_rnode_t
     // D event
     values[2] = _dlclvs[u_left][e];
     values[2] *= _dlclvs[u_right][e];
-    values[2] *= _PD[e];
+    values[2] *= _probabilities->PD[e];
     scale(values[2]);
     proba += values[2];
   }
   if (not isSpeciesLeaf) {
     // SL event
     values[3] = _dlclvs[gid][f];
-    values[3] *= (_uE[g] * _PS[e]);
+    values[3] *= (_probabilities->uE[g] * _probabilities->PS[e]);
     scale(values[3]);
     values[4] = _dlclvs[gid][g];
-    values[4] *=  (_uE[f] * _PS[e]);
+    values[4] *=  (_probabilities->uE[f] * _probabilities->PS[e]);
     scale(values[4]);
     proba += values[3];
     proba += values[4];
   }
   // DL event
-  proba /= (1.0 - 2.0 * _PD[e] * _uE[e]); 
+  proba /= (1.0 - 2.0 * _probabilities->PD[e] * _probabilities->uE[e]); 
   //ASSERT_PROBA(proba);
   
   if (event) {
@@ -284,6 +666,14 @@ REAL UndatedDLModel<REAL>::getRootLikelihood(pll_unode_t *root) const
 {
   REAL sum = REAL();
   auto u = root->node_index + this->_maxGeneId + 1;
+  // the null entries of a sparse CLV can be skipped, unless the
+  // species tree is pruned (the sum is over the pruned species nodes)
+  if (_isSparseCLV[u] && !this->isSpeciesTreePruned()) {
+    for (auto e: _ancestors[u]) {
+      sum += _dlclvs[u][e];
+    }
+    return sum;
+  }
   for (auto speciesNode: this->_allSpeciesNodes) {
     auto e = speciesNode->node_index;
     sum += _dlclvs[u][e];
@@ -294,11 +684,7 @@ REAL UndatedDLModel<REAL>::getRootLikelihood(pll_unode_t *root) const
 template <class REAL>
 void UndatedDLModel<REAL>::computeRootLikelihood(pll_unode_t *virtualRoot)
 {
-  auto u = virtualRoot->node_index;
-  for (auto speciesNode: getSpeciesNodesToUpdate()) {
-    auto e = speciesNode->node_index;
-    computeProbability(virtualRoot, speciesNode, _dlclvs[u][e], true);
-  }
+  updateCLVEntries(virtualRoot, true);
 }
 
 template <class REAL>
@@ -307,7 +693,7 @@ REAL UndatedDLModel<REAL>::getLikelihoodFactor() const
   REAL factor(0.0);
   for (auto speciesNode: this->_allSpeciesNodes) {
     auto e = speciesNode->node_index;
-    factor += (REAL(1.0) - REAL(_uE[e]));
+    factor += (REAL(1.0) - REAL(_probabilities->uE[e]));
   }
   return factor;
 }
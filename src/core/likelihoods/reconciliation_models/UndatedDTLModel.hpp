@@ -1,6 +1,9 @@
 #pragma once
 
 #include <likelihoods/reconciliation_models/AbstractReconciliationModel.hpp>
+#include <likelihoods/reconciliation_models/CLVArena.hpp>
+#include <likelihoods/reconciliation_models/FixedPointIterations.hpp>
+#include <likelihoods/reconciliation_models/ReconciliationKernels.hpp>
 #include <likelihoods/LibpllEvaluation.hpp>
 #include <IO/GeneSpeciesMapping.hpp>
 #include <IO/Logger.hpp>
@@ -16,11 +19,17 @@
 * In addition, we forbid transfers to parent species
 */
 template <class REAL>
-class UndatedDTLModel: public AbstractReconciliationModel<REAL> {
+class UndatedDTLModel final: public AbstractReconciliationModel<REAL, UndatedDTLModel<REAL> > {
+  friend class AbstractReconciliationModel<REAL, UndatedDTLModel<REAL> >;
 public:
   UndatedDTLModel(PLLRootedTree &speciesTree, const GeneSpeciesMapping &geneSpeciesMappingp, bool rootedGeneTree, bool pruneSpeciesTree):
     
-    AbstractReconciliationModel<REAL>(speciesTree, geneSpeciesMappingp, rootedGeneTree, pruneSpeciesTree)
+    AbstractReconciliationModel<REAL, UndatedDTLModel<REAL> >(speciesTree, geneSpeciesMappingp, rootedGeneTree, pruneSpeciesTree),
+    _exactCLVs(false),
+    _exactCLVsBackup(false),
+    _trialSwapped(false),
+    _extinctionIterations(EXTINCTION_MAX_ITERATIONS),
+    _lanesValid(false)
   {
   } 
   UndatedDTLModel(const UndatedDTLModel &) = delete;
@@ -31,87 +40,99 @@ public:
   
   // overloaded from parent
   virtual void setRates(const RatesVector &rates);
-  
-  virtual void rollbackToLastState();
+  // overloaded from parent
+  virtual void beginSpeciesTreeTrial();
+  // overloaded from parent
+  virtual void endSpeciesTreeTrial(bool revert);
+  // overloaded from parent
+  virtual void setTreeDuplicates(const std::shared_ptr<const TreeDuplicates> &duplicates,
+      unsigned int family);
+  // overloaded from parent
+  virtual void setFixedPointParameters(unsigned int maxIterations, double epsilon) {
+    _extinctionIterations.setParameters(EXTINCTION_MAX_ITERATIONS, epsilon);
+    _clvIterations.setParameters(maxIterations, epsilon);
+  }
+  // overloaded from parent
+  virtual double getAverageCLVIterations() const {
+    return _clvIterations.getAverageIterations();
+  }
+  // overloaded from parent
+  virtual double getAverageExtinctionIterations() const {
+    return _extinctionIterations.getAverageIterations();
+  }
 protected:
   // overloaded from parent
   virtual void setInitialGeneTree(pll_utree_t *tree);
   // overloaded from parent
-  virtual void updateCLV(pll_unode_t *geneNode);
+  void updateCLV(pll_unode_t *geneNode);
   // overload from parent
-  virtual void recomputeSpeciesProbabilities();
+  void recomputeSpeciesProbabilities();
   // overloaded from parent
-  virtual REAL getRootLikelihood(pll_unode_t *root) const;
+  REAL getRootLikelihood(pll_unode_t *root) const;
   // overload from parent
-  virtual void computeRootLikelihood(pll_unode_t *virtualRoot);
-  virtual REAL getRootLikelihood(pll_unode_t *root, pll_rnode_t *speciesRoot) {
-    return _dtlclvs[root->node_index + this->_maxGeneId + 1]._uq[speciesRoot->node_index];
-  }
-  virtual REAL getLikelihoodFactor() const;
-  virtual void beforeComputeLogLikelihood(); 
-  virtual void afterComputeLogLikelihood(); 
-  virtual void computeProbability(pll_unode_t *geneNode, pll_rnode_t *speciesNode, 
+  void computeRootLikelihood(pll_unode_t *virtualRoot);
+  REAL getRootLikelihood(pll_unode_t *root, pll_rnode_t *speciesRoot) {
+    return _dtlclvs._uq[root->node_index + this->_maxGeneId + 1][speciesRoot->node_index];
+  }
+  REAL getLikelihoodFactor() const;
+  int getCLVScaler(unsigned int geneId) const {return _dtlclvs.getScaler(geneId);}
+  // overload from parent
+  void saveCLV(unsigned int geneId) {_journal.save(_dtlclvs, geneId);}
+  void restoreSavedCLVs() {_journal.rollback(_dtlclvs);}
+  void clearSavedCLVs() {_journal.clear();}
+  void beforeComputeLogLikelihood(); 
+  void afterComputeLogLikelihood(); 
+  // overload from parent
+  bool isApproxLikelihoodAvailable() const;
+  void computeProbability(pll_unode_t *geneNode, pll_rnode_t *speciesNode, 
       REAL &proba,
       bool isVirtualRoot = false,
       Scenario *scenario = nullptr,
       Scenario::Event *event = nullptr,
       bool stochastic = false);
 private:
-  // model
-  std::vector<double> _PD; // Duplication probability, per branch
-  std::vector<double> _PL; // Loss probability, per branch
-  std::vector<double> _PT; // Transfer probability, per branch
-  std::vector<double> _PS; // Speciation probability, per branch
-  // SPECIES
-  std::vector<REAL> _uE; // Probability for a gene to become extinct on each brance
-  REAL _transferExtinctionSum;
-  REAL _transferExtinctionSumBackup;
+  RatesVector _rates;
+  // duplication, loss, transfer, speciation and extinction 
+  // probabilities, per species branch
+  std::shared_ptr<SpeciesProbabilities<REAL> > _probabilities;
 
   
   /**
    *  All intermediate results needed to compute the reconciliation likelihood
-   *  each gene node has one DTLCLV object
-   *  Each DTLCLV gene  object is a function of the DTLCLVs of the direct children genes
+   *  each gene node has one row in the arena
+   *  Each row is a function of the rows of the direct children genes
    */
-  struct DTLCLV {
-    DTLCLV():
-      _survivingTransferSums(REAL()),
-      _survivingTransferSumsInvariant(REAL()),
-      _survivingTransferSumsOneMore(REAL())
-    {}
-
-    DTLCLV(unsigned int speciesNumber):
-      _uq(speciesNumber, REAL()),
-      _survivingTransferSums(REAL()),
-      _survivingTransferSumsInvariant(REAL()),
-      _survivingTransferSumsOneMore(REAL())
-    {}
-    // probability of a gene node rooted at a species node
-    std::vector<REAL> _uq;
-    // sum of transfer probabilities. Can be computed only once
-    // for all species, to reduce computation complexity
-    REAL _survivingTransferSums;
-    // subsum of transfer probbabilities that did not change
-    // in case of partial likelihood recomputation
-    REAL _survivingTransferSumsInvariant;
-    // when computing the likelihood in slow mode, we update this value,
-    // because we need it to compute _survivingTransferSumsInvariant
-    // consistently in fast mode
-    REAL _survivingTransferSumsOneMore;
-  };
-
-  // Current DTLCLV values
-  std::vector<DTLCLV> _dtlclvs;
-  // Previous DTLCVL values, to rollback to a consistent state
+  // Current CLV values
+  TransferCLVArena<REAL> _dtlclvs;
+  // Previous CLV values, to rollback to a consistent state
   // after a fast likelihood computation
-  std::vector<DTLCLV> _dtlclvsBackup;
+  TransferCLVArena<REAL> _dtlclvsBackup;
+  // do _dtlclvs and _dtlclvsBackup hold the converged CLVs of an
+  // exact computation in PartialSpecies mode, from which the
+  // fast mode can start?
+  bool _exactCLVs;
+  bool _exactCLVsBackup;
+  // CLV journal (only used in PartialGenes mode)
+  TransferCLVJournal<REAL> _journal;
+  // species tree trial: probabilities at the beginning of the trial,
+  // and true if _dtlclvsBackup holds the CLVs of the beginning of the
+  // trial, because an exact computation swapped them
+  std::shared_ptr<SpeciesProbabilities<REAL> > _trialProbabilities;
+  bool _trialSwapped;
+  // copy of the CLV being updated, to check the convergence
+  std::vector<REAL> _previousCLV;
+  FixedPointIterations _extinctionIterations;
+  FixedPointIterations _clvIterations;
+  // all species nodes, sorted for the vectorized kernels
+  SpeciesLanes _lanes;
+  bool _lanesValid;
 private:
   void updateTransferSums(REAL &transferExtinctionSum,
     const REAL &transferSumBackup,
-    const std::vector<REAL> &probabilities);
+    const REAL *probabilities);
   void resetTransferSums(const REAL &transferSum,
     REAL &transferSumBackup,
-    const std::vector<REAL> &probabilities);
+    const REAL *probabilities);
   void getBestTransfer(pll_unode_t *parentGeneNode, 
     pll_rnode_t *originSpeciesNode,
     bool isVirtualRoot,
@@ -126,18 +147,34 @@ private:
     pll_rnode_t *&recievingSpecies,
     REAL &proba,
     bool stochastic = false);
-  unsigned int getIterationsNumber() const { return this->_fastMode ? 1 : 5;}    
+  unsigned int getIterationsNumber(const FixedPointIterations &iterations) const { 
+    return this->_fastMode ? 1 : iterations.getMaxIterations();
+  }
   REAL getCorrectedTransferExtinctionSum(unsigned int speciesId) const {
-    return _transferExtinctionSum * _PT[speciesId];
+    return _probabilities->transferExtinctionSum * _probabilities->PT[speciesId];
   }
 
   REAL getCorrectedTransferSum(unsigned int geneId, unsigned int speciesId) const
   {
-    return _dtlclvs[geneId]._survivingTransferSums * _PT[speciesId];
+    return _dtlclvs._survivingTransferSums[geneId] * _probabilities->PT[speciesId];
   }
   std::vector<pll_rnode_s *> &getSpeciesNodesToUpdate() {
     return (this->_fastMode ? this->_speciesNodesToUpdate : this->_allSpeciesNodes);
   }
+  bool useKernels() const {
+    return ReconciliationKernels::isSupported<REAL>() && _lanesValid && !this->_fastMode;
+  }
+  void updateLanes();
+  void beginCLVUpdate(pll_unode_t *geneNode);
+  void iterateCLV(pll_unode_t *geneNode, bool isVirtualRoot);
+  void endCLVUpdate(unsigned int geneId);
+  /**
+   *  CLVs shared with the other families, only in exact mode: copy
+   *  the CLV of an identical subtree if another family already 
+   *  computed it, or publish the CLV that was just computed
+   */
+  bool copySharedCLV(unsigned int geneId);
+  void publishSharedCLV(unsigned int geneId);
 };
 
 
@@ -147,19 +184,19 @@ const unsigned int CACHE_SIZE = 100000;
 template <class REAL>
 void UndatedDTLModel<REAL>::setInitialGeneTree(pll_utree_t *tree)
 {
-  AbstractReconciliationModel<REAL>::setInitialGeneTree(tree);
+  AbstractReconciliationModel<REAL, UndatedDTLModel<REAL> >::setInitialGeneTree(tree);
   assert(this->_allSpeciesNodesCount);
   assert(this->_maxGeneId);
-  std::vector<REAL> zeros(this->_allSpeciesNodesCount);
-  DTLCLV nullCLV(this->_allSpeciesNodesCount);
-  _dtlclvs = std::vector<DTLCLV>(2 * (this->_maxGeneId + 1), nullCLV);
-  _dtlclvsBackup = std::vector<DTLCLV>(2 * (this->_maxGeneId + 1), nullCLV);
+  _dtlclvs.resize(2 * (this->_maxGeneId + 1), this->_allSpeciesNodesCount);
+  _dtlclvsBackup.resize(2 * (this->_maxGeneId + 1), this->_allSpeciesNodesCount);
+  _exactCLVs = _exactCLVsBackup = false;
+  _previousCLV.resize(this->_allSpeciesNodesCount);
 }
 
   template <class REAL>
 void UndatedDTLModel<REAL>::resetTransferSums(const REAL &transferSum,
     REAL &transferSumInvariant,
-    const std::vector<REAL> &probabilities)
+    const REAL *probabilities)
 {
   if (this->_fastMode) {
     REAL diff = REAL();
@@ -174,7 +211,7 @@ void UndatedDTLModel<REAL>::resetTransferSums(const REAL &transferSum,
 template <class REAL>
 void UndatedDTLModel<REAL>::updateTransferSums(REAL &transferSum,
     const REAL &transferSumInvariant,
-    const std::vector<REAL> &probabilities)
+    const REAL *probabilities)
 {
   transferSum = REAL();
   for (auto speciesNode:  getSpeciesNodesToUpdate()) {
@@ -193,24 +230,11 @@ void UndatedDTLModel<REAL>::setRates(const RatesVector &rates)
 {
   this->_geneRoot = 0;
   assert(rates.size() == 3);
-  auto &dupRates = rates[0];
-  auto &lossRates = rates[1];
-  auto &transferRates = rates[2];
-  assert(this->_allSpeciesNodesCount == dupRates.size());
-  assert(this->_allSpeciesNodesCount == lossRates.size());
-  assert(this->_allSpeciesNodesCount == transferRates.size());
-  _PD = dupRates;
-  _PL = lossRates;
-  _PT = transferRates;
-  _PS.resize(this->_allSpeciesNodesCount);
-  for (auto speciesNode: this->_allSpeciesNodes) {
-    auto e = speciesNode->node_index;
-    auto sum = _PD[e] + _PL[e] + _PT[e] + 1.0;
-    _PD[e] /= sum;
-    _PL[e] /= sum;
-    _PT[e] /= sum;
-    _PS[e] = 1.0 / sum;
-  } 
+  for (auto &r: rates) {
+    assert(this->_allSpeciesNodesCount == r.size());
+  }
+  _rates = rates;
+  _exactCLVs = _exactCLVsBackup = false;
   recomputeSpeciesProbabilities();
   this->invalidateAllCLVs();
   this->invalidateAllSpeciesCLVs();
@@ -222,53 +246,222 @@ UndatedDTLModel<REAL>::~UndatedDTLModel() { }
 template <class REAL>
 void UndatedDTLModel<REAL>::recomputeSpeciesProbabilities()
 {
-  _uE.resize(this->_allSpeciesNodesCount);
-  REAL unused = REAL(1.0);
-  resetTransferSums(_transferExtinctionSum, unused, _uE);
-  for (unsigned int it = 0; it < getIterationsNumber(); ++it) {
-    for (auto speciesNode: getSpeciesNodesToUpdate()) {
+  if (SpeciesProbabilities<REAL>::template acquire<UndatedDTLModel<REAL> >(_probabilities,
+        _rates, this->getSpeciesTree(), this->hasShareableSpeciesProbabilities())) {
+    updateLanes();
+    return;
+  }
+  auto &p = *_probabilities;
+  p.copyRates(_rates, 0, p.PD);
+  p.copyRates(_rates, 1, p.PL);
+  p.copyRates(_rates, 2, p.PT);
+  p.PS.resize(this->_allSpeciesNodesCount);
+  for (auto speciesNode: this->_allSpeciesNodes) {
+    auto e = speciesNode->node_index;
+    auto sum = p.PD[e] + p.PL[e] + p.PT[e] + 1.0;
+    p.PD[e] /= sum;
+    p.PL[e] /= sum;
+    p.PT[e] /= sum;
+    p.PS[e] = 1.0 / sum;
+  }
+  // start from the previous extinction probabilities, if any
+  p.uE.resize(this->_allSpeciesNodesCount);
+  unsigned int it = 0;
+  bool converged = false;
+  // the table can be shared, so it is not computed in fast mode
+  while (!converged && it < _extinctionIterations.getMaxIterations()) {
+    converged = true;
+    for (auto speciesNode: this->_allSpeciesNodes) {
       auto e = speciesNode->node_index;
-      REAL proba(_PL[e]);
-      REAL temp = _uE[e] * _uE[e] * _PD[e];
+      REAL proba(p.PL[e]);
+      REAL temp = p.uE[e] * p.uE[e] * p.PD[e];
       scale(temp);
       proba += temp;
-      temp = getCorrectedTransferExtinctionSum(e) * _uE[e];
+      temp = getCorrectedTransferExtinctionSum(e) * p.uE[e];
       scale(temp);
       proba += temp;
       if (this->getSpeciesLeft(speciesNode)) {
-        temp = _uE[this->getSpeciesLeft(speciesNode)->node_index]  * _uE[this->getSpeciesRight(speciesNode)->node_index] * _PS[e];
+        temp = p.uE[this->getSpeciesLeft(speciesNode)->node_index]  * p.uE[this->getSpeciesRight(speciesNode)->node_index] * p.PS[e];
         scale(temp);
         proba += temp;
       }
       //PRINT_ERROR_PROBA(proba)
-      _uE[speciesNode->node_index] = proba;
+      converged &= _extinctionIterations.isConverged(p.uE[e], proba);
+      p.uE[speciesNode->node_index] = proba;
+    }
+    p.transferExtinctionSum = REAL();
+    for (auto speciesNode: this->_allSpeciesNodes) {
+      p.transferExtinctionSum += p.uE[speciesNode->node_index];
+    }
+    p.transferExtinctionSum /= this->_allSpeciesNodes.size();
+    ++it;
+  }
+  _extinctionIterations.addCall(it);
+  SpeciesProbabilities<REAL>::template publish<UndatedDTLModel<REAL> >(_probabilities,
+      this->hasShareableSpeciesProbabilities());
+  updateLanes();
+}
+
+template <class REAL>
+void UndatedDTLModel<REAL>::updateLanes()
+{
+  // the kernels only process all the species nodes at once
+  _lanesValid = !this->_fastMode && ReconciliationKernels::isSupported<REAL>();
+  if (!_lanesValid) {
+    return;
+  }
+  _lanes.clear();
+  for (auto speciesNode: getSpeciesNodesToUpdate()) {
+    int e = speciesNode->node_index;
+    if (this->getSpeciesLeft(speciesNode)) {
+      _lanes.addLane(e, this->getSpeciesLeft(speciesNode)->node_index,
+          this->getSpeciesRight(speciesNode)->node_index);
+    } else {
+      _lanes.addLane(e, e, e);
+    }
+  }
+  _lanes.sortInLevels(this->_allSpeciesNodesCount);
+  for (unsigned int i = 0; i < _lanes.size(); ++i) {
+    auto e = _lanes.e[i];
+    auto f = _lanes.f[i];
+    auto g = _lanes.g[i];
+    bool isSpeciesLeaf = (e == f);
+    auto &p = *_probabilities;
+    auto uE = [&p](int species) {return ReconciliationKernels::toLaneValue(p.uE[species]);};
+    double ps = ReconciliationKernels::toLaneValue(p.PS[e]);
+    _lanes.ps[i] = isSpeciesLeaf ? 0.0 : ps;
+    _lanes.pd[i] = ReconciliationKernels::toLaneValue(p.PD[e]);
+    _lanes.pt[i] = ReconciliationKernels::toLaneValue(p.PT[e]);
+    _lanes.slLeft[i] = isSpeciesLeaf ? 0.0 : uE(g) * ps;
+    _lanes.slRight[i] = isSpeciesLeaf ? 0.0 : uE(f) * ps;
+    _lanes.tl[i] = uE(e);
+  }
+}
+
+
+template <class REAL>
+void UndatedDTLModel<REAL>::beginCLVUpdate(pll_unode_t *geneNode)
+{
+  if (this->_blockScaling) {
+    auto gid = geneNode->node_index;
+    auto scaler = this->getChildrenScaler(gid);
+    if (this->_fastMode) {
+      // only some entries will be recomputed
+      _dtlclvs.rescale(gid, scaler);
+    } else {
+      _dtlclvs.setScaler(gid, scaler);
     }
-    updateTransferSums(_transferExtinctionSum, unused, _uE);
   }
 }
 
+template <class REAL>
+void UndatedDTLModel<REAL>::endCLVUpdate(unsigned int geneId)
+{
+  // also in fast mode: the parent CLVs are computed with this scaler
+  if (this->_blockScaling) {
+    _dtlclvs.normalize(geneId);
+  }
+}
+
+template <class REAL>
+void UndatedDTLModel<REAL>::iterateCLV(pll_unode_t *geneNode, bool isVirtualRoot)
+{
+  auto gid = geneNode->node_index;
+  auto clv = _dtlclvs._uq[gid];
+  auto maxIterations = getIterationsNumber(_clvIterations);
+  unsigned int it = 0;
+  bool converged = false;
+  while (!converged && it < maxIterations) {
+    updateTransferSums(_dtlclvs._survivingTransferSums[gid], _dtlclvs._survivingTransferSumsInvariant[gid], clv);
+    bool checkConvergence = (it + 1 < maxIterations);
+    if (checkConvergence) {
+      std::copy(clv, clv + _previousCLV.size(), _previousCLV.begin());
+    }
+    if (!this->isGeneLeaf(gid) && useKernels()) {
+      auto left = this->getLeftId(gid);
+      auto right = this->getRightId(gid);
+      ReconciliationKernels::updateDTL(_lanes, _dtlclvs._uq[left], _dtlclvs._uq[right],
+          _dtlclvs._survivingTransferSums[left], _dtlclvs._survivingTransferSums[right],
+          _dtlclvs._survivingTransferSums[gid], clv);
+    } else {
+      for (auto speciesNode: getSpeciesNodesToUpdate()) { 
+        computeProbability(geneNode, speciesNode, clv[speciesNode->node_index], isVirtualRoot);
+      }
+    }
+    ++it;
+    if (checkConvergence) {
+      converged = true;
+      for (auto speciesNode: getSpeciesNodesToUpdate()) {
+        auto e = speciesNode->node_index;
+        converged &= _clvIterations.isConverged(_previousCLV[e], clv[e]);
+      }
+    }
+  }
+  _clvIterations.addCall(it);
+}
 
 template <class REAL>
 void UndatedDTLModel<REAL>::updateCLV(pll_unode_t *geneNode)
 {
   auto gid = geneNode->node_index;
-  resetTransferSums(this->_fastMode ? _dtlclvs[gid]._survivingTransferSumsOneMore : _dtlclvs[gid]._survivingTransferSums, _dtlclvs[gid]._survivingTransferSumsInvariant, _dtlclvs[gid]._uq);
+  beginCLVUpdate(geneNode);
+  if (copySharedCLV(gid)) {
+    endCLVUpdate(gid);
+    return;
+  }
+  resetTransferSums(this->_fastMode ? _dtlclvs._survivingTransferSumsOneMore[gid] : _dtlclvs._survivingTransferSums[gid], _dtlclvs._survivingTransferSumsInvariant[gid], _dtlclvs._uq[gid]);
   
   if (!this->_fastMode) {
     for (auto speciesNode: getSpeciesNodesToUpdate()) {
-      _dtlclvs[gid]._uq[speciesNode->node_index] = REAL();
-    }
-  }
-  for (unsigned int it = 0; it < getIterationsNumber(); ++it) {
-    updateTransferSums(_dtlclvs[gid]._survivingTransferSums, _dtlclvs[gid]._survivingTransferSumsInvariant, _dtlclvs[gid]._uq);
-    for (auto speciesNode: getSpeciesNodesToUpdate()) { 
-      computeProbability(geneNode, 
-          speciesNode, 
-          _dtlclvs[gid]._uq[speciesNode->node_index]);
+      _dtlclvs._uq[gid][speciesNode->node_index] = REAL();
     }
   }
+  iterateCLV(geneNode, false);
   if (this->_likelihoodMode == PartialLikelihoodMode::PartialSpecies && !this->_fastMode) {
-    updateTransferSums(_dtlclvs[gid]._survivingTransferSumsOneMore, _dtlclvs[gid]._survivingTransferSumsInvariant, _dtlclvs[gid]._uq);
+    updateTransferSums(_dtlclvs._survivingTransferSumsOneMore[gid], _dtlclvs._survivingTransferSumsInvariant[gid], _dtlclvs._uq[gid]);
+  }
+  publishSharedCLV(gid);
+  endCLVUpdate(gid);
+}
+
+template <class REAL>
+void UndatedDTLModel<REAL>::setTreeDuplicates(const std::shared_ptr<const TreeDuplicates> &duplicates,
+    unsigned int family)
+{
+  AbstractReconciliationModel<REAL, UndatedDTLModel<REAL> >::setTreeDuplicates(duplicates, family);
+  SubtreeCache<SharedCLV<REAL> >::template acquire<UndatedDTLModel<REAL> >(this->_sharedCLVs, 
+      duplicates, this->_blockScaling);
+}
+
+template <class REAL>
+bool UndatedDTLModel<REAL>::copySharedCLV(unsigned int geneId)
+{
+  if (this->_fastMode) {
+    return false;
+  }
+  // beginCLVUpdate set the scaler of the children
+  auto shared = this->getSharedCLV(geneId, _probabilities->getVersion(), _dtlclvs.getScaler(geneId));
+  if (!shared) {
+    return false;
+  }
+  std::copy(shared->entries.begin(), shared->entries.end(), _dtlclvs._uq[geneId]);
+  _dtlclvs._survivingTransferSums[geneId] = shared->survivingTransferSum;
+  _dtlclvs._survivingTransferSumsOneMore[geneId] = shared->survivingTransferSumOneMore;
+  return true;
+}
+
+template <class REAL>
+void UndatedDTLModel<REAL>::publishSharedCLV(unsigned int geneId)
+{
+  if (this->_fastMode) {
+    return;
+  }
+  auto shared = this->publishCLV(geneId, _probabilities->getVersion(), _dtlclvs.getScaler(geneId));
+  if (shared) {
+    auto clv = _dtlclvs._uq[geneId];
+    shared->entries.assign(clv, clv + this->_allSpeciesNodesCount);
+    shared->survivingTransferSum = _dtlclvs._survivingTransferSums[geneId];
+    shared->survivingTransferSumOneMore = _dtlclvs._survivingTransferSumsOneMore[geneId];
   }
 }
 
@@ -284,7 +477,7 @@ void UndatedDTLModel<REAL>::computeProbability(pll_unode_t *geneNode, pll_rnode_
   
   auto gid = geneNode->node_index;
   auto e = speciesNode->node_index;
-  bool isGeneLeaf = !geneNode->next;
+  bool isGeneLeaf = this->isGeneLeaf(gid);
   bool isSpeciesLeaf = !this->getSpeciesLeft(speciesNode);
   
 
@@ -295,7 +488,7 @@ void UndatedDTLModel<REAL>::computeProbability(pll_unode_t *geneNode, pll_rnode_
   }
 
   if (isSpeciesLeaf and isGeneLeaf and e == this->_geneToSpecies[gid]) {
-    proba = REAL(_PS[e]);
+    proba = REAL(_probabilities->PS[e]);
     return;
   }
   typedef std::array<REAL, 8>  ValuesArray;
@@ -305,12 +498,6 @@ void UndatedDTLModel<REAL>::computeProbability(pll_unode_t *geneNode, pll_rnode_
   
   proba = REAL();
   
-  pll_unode_t *leftGeneNode = 0;     
-  pll_unode_t *rightGeneNode = 0;     
-  if (!isGeneLeaf) {
-    leftGeneNode = this->getLeft(geneNode, isVirtualRoot);
-    rightGeneNode = this->getRight(geneNode, isVirtualRoot);
-  }
   unsigned int f = 0;
   unsigned int g = 0;
   if (!isSpeciesLeaf) {
@@ -319,52 +506,52 @@ void UndatedDTLModel<REAL>::computeProbability(pll_unode_t *geneNode, pll_rnode_
   }
   if (not isGeneLeaf) {
     // S event
-    auto u_left = leftGeneNode->node_index;
-    auto u_right = rightGeneNode->node_index;
+    auto u_left = this->getLeftId(gid);
+    auto u_right = this->getRightId(gid);
     if (not isSpeciesLeaf) {
       //  speciation event
-      values[0] = _dtlclvs[u_left]._uq[f];
-      values[1] = _dtlclvs[u_left]._uq[g];
-      values[0] *= _dtlclvs[u_right]._uq[g];
-      values[1] *= _dtlclvs[u_right]._uq[f];
-      values[0] *= _PS[e]; 
-      values[1] *= _PS[e]; 
+      values[0] = _dtlclvs._uq[u_left][f];
+      values[1] = _dtlclvs._uq[u_left][g];
+      values[0] *= _dtlclvs._uq[u_right][g];
+      values[1] *= _dtlclvs._uq[u_right][f];
+      values[0] *= _probabilities->PS[e]; 
+      values[1] *= _probabilities->PS[e]; 
       scale(values[0]);
       scale(values[1]);
       proba += values[0];
       proba += values[1];
     }
     // D event
-    values[2] = _dtlclvs[u_left]._uq[e];
-    values[2] *= _dtlclvs[u_right]._uq[e];
-    values[2] *= _PD[e];
+    values[2] = _dtlclvs._uq[u_left][e];
+    values[2] *= _dtlclvs._uq[u_right][e];
+    values[2] *= _probabilities->PD[e];
     scale(values[2]);
     proba += values[2];
     
     // T event
     values[5] = getCorrectedTransferSum(u_left, e);
-    values[5] *= _dtlclvs[u_right]._uq[e];
+    values[5] *= _dtlclvs._uq[u_right][e];
     scale(values[5]);
     values[6] = getCorrectedTransferSum(u_right, e);
-    values[6] *= _dtlclvs[u_left]._uq[e];
+    values[6] *= _dtlclvs._uq[u_left][e];
     scale(values[6]);
     proba += values[5];
     proba += values[6];
   }
   if (not isSpeciesLeaf) {
     // SL event
-    values[3] = _dtlclvs[gid]._uq[f];
-    values[3] *= (_uE[g] * _PS[e]);
+    values[3] = _dtlclvs._uq[gid][f];
+    values[3] *= (_probabilities->uE[g] * _probabilities->PS[e]);
     scale(values[3]);
-    values[4] = _dtlclvs[gid]._uq[g];
-    values[4]*= _uE[f] * _PS[e];
+    values[4] = _dtlclvs._uq[gid][g];
+    values[4]*= _probabilities->uE[f] * _probabilities->PS[e];
     scale(values[4]);
     proba += values[3];
     proba += values[4];
   }
   // TL event
   values[7] = getCorrectedTransferSum(gid, e);
-  values[7] *= _uE[e];
+  values[7] *= _probabilities->uE[e];
   scale(values[7]);
   proba += values[7];
   
@@ -442,23 +629,19 @@ template <class REAL>
 void UndatedDTLModel<REAL>::computeRootLikelihood(pll_unode_t *virtualRoot)
 {
   auto u = virtualRoot->node_index;
-  resetTransferSums(this->_fastMode ? _dtlclvs[u]._survivingTransferSumsOneMore : _dtlclvs[u]._survivingTransferSums, _dtlclvs[u]._survivingTransferSumsInvariant, _dtlclvs[u]._uq);
+  beginCLVUpdate(virtualRoot);
+  resetTransferSums(this->_fastMode ? _dtlclvs._survivingTransferSumsOneMore[u] : _dtlclvs._survivingTransferSums[u], _dtlclvs._survivingTransferSumsInvariant[u], _dtlclvs._uq[u]);
   if (!this->_fastMode) {
     for (auto speciesNode: getSpeciesNodesToUpdate()) {
       auto e = speciesNode->node_index;
-      _dtlclvs[u]._uq[e] = REAL();
-    }
-  }
-  for (unsigned int it = 0; it < getIterationsNumber(); ++it) {
-    updateTransferSums(_dtlclvs[u]._survivingTransferSums, _dtlclvs[u]._survivingTransferSumsInvariant, _dtlclvs[u]._uq);
-    for (auto speciesNode: getSpeciesNodesToUpdate()) {
-      unsigned int e = speciesNode->node_index;
-      computeProbability(virtualRoot, speciesNode, _dtlclvs[u]._uq[e], true);
+      _dtlclvs._uq[u][e] = REAL();
     }
   }
+  iterateCLV(virtualRoot, true);
   if (!this->_fastMode) {
-    updateTransferSums(_dtlclvs[u]._survivingTransferSumsOneMore, _dtlclvs[u]._survivingTransferSumsInvariant, _dtlclvs[u]._uq);
+    updateTransferSums(_dtlclvs._survivingTransferSumsOneMore[u], _dtlclvs._survivingTransferSumsInvariant[u], _dtlclvs._uq[u]);
   }
+  endCLVUpdate(u);
 }
 
 
@@ -469,7 +652,7 @@ REAL UndatedDTLModel<REAL>::getRootLikelihood(pll_unode_t *root) const
   auto u = root->node_index + this->_maxGeneId + 1;
   for (auto speciesNode: this->_allSpeciesNodes) {
     auto e = speciesNode->node_index;
-    sum += _dtlclvs[u]._uq[e];
+    sum += _dtlclvs._uq[u][e];
   }
   PRINT_ERROR_PROBA(sum);
   assert(IS_PROBA(sum));
@@ -482,7 +665,7 @@ REAL UndatedDTLModel<REAL>::getLikelihoodFactor() const
   REAL factor(0.0);
   for (auto speciesNode: this->_allSpeciesNodes) {
     auto e = speciesNode->node_index;
-    factor += (REAL(1.0) - _uE[e]);
+    factor += (REAL(1.0) - _probabilities->uE[e]);
   }
   return factor;
       
@@ -491,45 +674,91 @@ REAL UndatedDTLModel<REAL>::getLikelihoodFactor() const
 template <class REAL>
 void UndatedDTLModel<REAL>::beforeComputeLogLikelihood()
 {
-  AbstractReconciliationModel<REAL>::beforeComputeLogLikelihood();
+  AbstractReconciliationModel<REAL, UndatedDTLModel<REAL> >::beforeComputeLogLikelihood();
   if (this->_likelihoodMode == PartialLikelihoodMode::PartialSpecies) {
     if (this->_fastMode) {
-      _transferExtinctionSumBackup = _transferExtinctionSum;
+      // only save the entries that will change. The other entries of
+      // the backup are not valid anymore
+      _exactCLVsBackup = false;
       for (unsigned int gid = 0; gid < _dtlclvs.size(); ++gid) {
-        _dtlclvsBackup[gid]._survivingTransferSums = _dtlclvs[gid]._survivingTransferSums;
+        _dtlclvsBackup.setScaler(gid, _dtlclvs.getScaler(gid));
+        _dtlclvsBackup._survivingTransferSums[gid] = _dtlclvs._survivingTransferSums[gid];
         for (auto speciesNode: getSpeciesNodesToUpdate()) {
           auto e = speciesNode->node_index;
-          _dtlclvsBackup[gid]._uq[e] = _dtlclvs[gid]._uq[e];
+          _dtlclvsBackup._uq[gid][e] = _dtlclvs._uq[gid][e];
         }
       }
-    } else { 
+    } else if (!_trialSwapped) { 
+      // during a species tree trial, keep the CLVs of its beginning
       std::swap(_dtlclvs, _dtlclvsBackup);
+      std::swap(_exactCLVs, _exactCLVsBackup);
+      _trialSwapped = this->isSpeciesTreeTrialOpen();
     }
   }
+  if (!this->_fastMode) {
+    _exactCLVs = false;
+  }
 }
 
 template <class REAL>
 void UndatedDTLModel<REAL>::afterComputeLogLikelihood()
 {
-  AbstractReconciliationModel<REAL>::afterComputeLogLikelihood();
+  AbstractReconciliationModel<REAL, UndatedDTLModel<REAL> >::afterComputeLogLikelihood();
   if (this->_likelihoodMode == PartialLikelihoodMode::PartialSpecies) {
     if (this->_fastMode) {
-      _transferExtinctionSum = _transferExtinctionSumBackup;
       for (unsigned int gid = 0; gid < _dtlclvs.size(); ++gid) {
-        _dtlclvs[gid]._survivingTransferSums = _dtlclvsBackup[gid]._survivingTransferSums;
+        _dtlclvs.rescale(gid, _dtlclvsBackup.getScaler(gid));
+        _dtlclvs._survivingTransferSums[gid] = _dtlclvsBackup._survivingTransferSums[gid];
         for (auto speciesNode: getSpeciesNodesToUpdate()) {
           auto e = speciesNode->node_index;
-          _dtlclvs[gid]._uq[e] = _dtlclvsBackup[gid]._uq[e];
+          _dtlclvs._uq[gid][e] = _dtlclvsBackup._uq[gid][e];
         }
       }
+    } else {
+      _exactCLVs = true;
     }
   }
 }
 
 template <class REAL>
-void UndatedDTLModel<REAL>::rollbackToLastState()
+bool UndatedDTLModel<REAL>::isApproxLikelihoodAvailable() const
 {
-  std::swap(_dtlclvs, _dtlclvsBackup);
+  // with a pruned species tree, the species nodes 
+  // of the CLVs change with the species tree
+  // after an exact computation in a species tree trial, the
+  // backup cannot store the entries overwritten in fast mode
+  return this->_likelihoodMode == PartialLikelihoodMode::PartialSpecies
+    && !this->isSpeciesTreePruned()
+    && _exactCLVs
+    && !_trialSwapped;
+}
+
+template <class REAL>
+void UndatedDTLModel<REAL>::beginSpeciesTreeTrial()
+{
+  AbstractReconciliationModel<REAL, UndatedDTLModel<REAL> >::beginSpeciesTreeTrial();
+  if (this->isSpeciesTreeTrialOpen()) {
+    // the next recomputeSpeciesProbabilities copies the table
+    // before changing it, because it is not the only owner anymore
+    _trialProbabilities = _probabilities;
+  }
+}
+
+template <class REAL>
+void UndatedDTLModel<REAL>::endSpeciesTreeTrial(bool revert)
+{
+  if (this->isSpeciesTreeTrialOpen()) {
+    if (revert) {
+      _probabilities = _trialProbabilities;
+      if (_trialSwapped) {
+        std::swap(_dtlclvs, _dtlclvsBackup);
+        std::swap(_exactCLVs, _exactCLVsBackup);
+      }
+    }
+    _trialProbabilities.reset();
+    _trialSwapped = false;
+  }
+  AbstractReconciliationModel<REAL, UndatedDTLModel<REAL> >::endSpeciesTreeTrial(revert);
 }
 
 template <class REAL>
@@ -553,16 +782,16 @@ void UndatedDTLModel<REAL>::getBestTransfer(pll_unode_t *parentGeneNode,
     parents.insert(this->getSpeciesParent(parent)->node_index);
   }
   std::vector<REAL> transferProbas(speciesNumber * 2, REAL());
-  double factor = _PT[e] / static_cast<double>(speciesNumber);
+  auto factor = _probabilities->PT[e] / static_cast<double>(speciesNumber);
   for (auto species: this->_allSpeciesNodes) {
     auto h = species->node_index;
     if (parents.count(h)) {
       continue;
     }
-    transferProbas[h] = (_dtlclvs[u_left->node_index]._uq[h] 
-        * _dtlclvs[u_right->node_index]._uq[e]) * factor;
-    transferProbas[h + speciesNumber] = (_dtlclvs[u_right->node_index]._uq[h] 
-        * _dtlclvs[u_left->node_index]._uq[e]) * factor;
+    transferProbas[h] = (_dtlclvs._uq[u_left->node_index][h] 
+        * _dtlclvs._uq[u_right->node_index][e]) * factor;
+    transferProbas[h + speciesNumber] = (_dtlclvs._uq[u_right->node_index][h] 
+        * _dtlclvs._uq[u_left->node_index][e]) * factor;
   }
   if (stochastic) {
     // stochastic sample: proba will be set to the sum of probabilities
@@ -623,13 +852,13 @@ void UndatedDTLModel<REAL>::getBestTransferLoss(Scenario &scenario,
   for (auto parent = originSpeciesNode; this->getSpeciesParent(parent) != 0; parent = this->getSpeciesParent(parent)) {
     parents.insert(this->getSpeciesParent(parent)->node_index);
   }
-  REAL factor = _uE[e] * (_PT[e] / static_cast<double>(this->_allSpeciesNodes.size()));
+  REAL factor = _probabilities->uE[e] * (_probabilities->PT[e] / static_cast<double>(this->_allSpeciesNodes.size()));
   for (auto species: this->_allSpeciesNodes) {
     auto h = species->node_index;
     if (parents.count(h)) {
       continue;
     }
-    transferProbas[h] = _dtlclvs[u]._uq[h] * factor;
+    transferProbas[h] = _dtlclvs._uq[u][h] * factor;
   }
   if (!stochastic) {
     for (auto species: this->_allSpeciesNodes) {
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <likelihoods/reconciliation_models/AbstractReconciliationModel.hpp>
+#include <likelihoods/reconciliation_models/CLVArena.hpp>
+#include <likelihoods/reconciliation_models/FixedPointIterations.hpp>
 #include <likelihoods/LibpllEvaluation.hpp>
 #include <IO/GeneSpeciesMapping.hpp>
 #include <IO/Logger.hpp>
@@ -12,11 +14,16 @@
 * and ILS with depth 1
 */
 template <class REAL>
-class UndatedIDTLModel: public AbstractReconciliationModel<REAL> {
+class UndatedIDTLModel final: public AbstractReconciliationModel<REAL, UndatedIDTLModel<REAL> > {
+  friend class AbstractReconciliationModel<REAL, UndatedIDTLModel<REAL> >;
 public:
   UndatedIDTLModel(PLLRootedTree &speciesTree, const GeneSpeciesMapping &geneSpeciesMappingp, bool rootedGeneTree, bool pruneSpeciesTree):
     
-    AbstractReconciliationModel<REAL>(speciesTree, geneSpeciesMappingp, rootedGeneTree, pruneSpeciesTree)
+    AbstractReconciliationModel<REAL, UndatedIDTLModel<REAL> >(speciesTree, geneSpeciesMappingp, rootedGeneTree, pruneSpeciesTree),
+    _exactCLVs(false),
+    _exactCLVsBackup(false),
+    _trialSwapped(false),
+    _extinctionIterations(EXTINCTION_MAX_ITERATIONS)
   {
   } 
   UndatedIDTLModel(const UndatedIDTLModel &) = delete;
@@ -27,88 +34,96 @@ public:
   
   // overloaded from parent
   virtual void setRates(const RatesVector &rates);
-  
-  virtual void rollbackToLastState();
+  // overloaded from parent
+  virtual void beginSpeciesTreeTrial();
+  // overloaded from parent
+  virtual void endSpeciesTreeTrial(bool revert);
+  // overloaded from parent
+  virtual void setTreeDuplicates(const std::shared_ptr<const TreeDuplicates> &duplicates,
+      unsigned int family);
+  // overloaded from parent
+  virtual void setFixedPointParameters(unsigned int maxIterations, double epsilon) {
+    _extinctionIterations.setParameters(EXTINCTION_MAX_ITERATIONS, epsilon);
+    _clvIterations.setParameters(maxIterations, epsilon);
+  }
+  // overloaded from parent
+  virtual double getAverageCLVIterations() const {
+    return _clvIterations.getAverageIterations();
+  }
+  // overloaded from parent
+  virtual double getAverageExtinctionIterations() const {
+    return _extinctionIterations.getAverageIterations();
+  }
 protected:
   // overloaded from parent
   virtual void setInitialGeneTree(pll_utree_t *tree);
   // overloaded from parent
-  virtual void updateCLV(pll_unode_t *geneNode);
+  void updateCLV(pll_unode_t *geneNode);
   // overload from parent
-  virtual void recomputeSpeciesProbabilities();
+  void recomputeSpeciesProbabilities();
   // overloaded from parent
-  virtual REAL getRootLikelihood(pll_unode_t *root) const;
+  REAL getRootLikelihood(pll_unode_t *root) const;
   // overload from parent
-  virtual void computeRootLikelihood(pll_unode_t *virtualRoot);
-  virtual REAL getRootLikelihood(pll_unode_t *root, pll_rnode_t *speciesRoot) {
-    return _dtlclvs[root->node_index + this->_maxGeneId + 1]._uq[speciesRoot->node_index];
-  }
-  virtual REAL getLikelihoodFactor() const;
-  virtual void beforeComputeLogLikelihood(); 
-  virtual void afterComputeLogLikelihood(); 
-  virtual void computeProbability(pll_unode_t *geneNode, pll_rnode_t *speciesNode, 
+  void computeRootLikelihood(pll_unode_t *virtualRoot);
+  REAL getRootLikelihood(pll_unode_t *root, pll_rnode_t *speciesRoot) {
+    return _dtlclvs._uq[root->node_index + this->_maxGeneId + 1][speciesRoot->node_index];
+  }
+  REAL getLikelihoodFactor() const;
+  int getCLVScaler(unsigned int geneId) const {return _dtlclvs.getScaler(geneId);}
+  // overload from parent
+  void saveCLV(unsigned int geneId) {_journal.save(_dtlclvs, geneId);}
+  void restoreSavedCLVs() {_journal.rollback(_dtlclvs);}
+  void clearSavedCLVs() {_journal.clear();}
+  void beforeComputeLogLikelihood(); 
+  void afterComputeLogLikelihood(); 
+  // overload from parent
+  bool isApproxLikelihoodAvailable() const;
+  void computeProbability(pll_unode_t *geneNode, pll_rnode_t *speciesNode, 
       REAL &proba,
       bool isVirtualRoot = false,
       Scenario *scenario = nullptr,
       Scenario::Event *event = nullptr,
       bool stochastic = false);
 private:
-  // model
-  std::vector<double> _PD; // Duplication probability, per branch
-  std::vector<double> _PL; // Loss probability, per branch
-  std::vector<double> _PT; // Transfer probability, per branch
-  std::vector<double> _PS; // Speciation probability, per branch
-  std::vector<double> _PI; // ILS probability, per branch
-  // SPECIES
-  std::vector<REAL> _uE; // Probability for a gene to become extinct on each brance
-  REAL _transferExtinctionSum;
-  REAL _transferExtinctionSumBackup;
+  RatesVector _rates;
+  // duplication, loss, transfer, speciation, ILS and extinction 
+  // probabilities, per species branch
+  std::shared_ptr<SpeciesProbabilities<REAL> > _probabilities;
 
   
   /**
    *  All intermediate results needed to compute the reconciliation likelihood
-   *  each gene node has one DTLCLV object
-   *  Each DTLCLV gene  object is a function of the DTLCLVs of the direct children genes
+   *  each gene node has one row in the arena
+   *  Each row is a function of the rows of the direct children genes
    */
-  struct DTLCLV {
-    DTLCLV():
-      _survivingTransferSums(REAL()),
-      _survivingTransferSumsInvariant(REAL()),
-      _survivingTransferSumsOneMore(REAL())
-    {}
-
-    DTLCLV(unsigned int speciesNumber):
-      _uq(speciesNumber, REAL()),
-      _survivingTransferSums(REAL()),
-      _survivingTransferSumsInvariant(REAL()),
-      _survivingTransferSumsOneMore(REAL())
-    {}
-    // probability of a gene node rooted at a species node
-    std::vector<REAL> _uq;
-    // sum of transfer probabilities. Can be computed only once
-    // for all species, to reduce computation complexity
-    REAL _survivingTransferSums;
-    // subsum of transfer probbabilities that did not change
-    // in case of partial likelihood recomputation
-    REAL _survivingTransferSumsInvariant;
-    // when computing the likelihood in slow mode, we update this value,
-    // because we need it to compute _survivingTransferSumsInvariant
-    // consistently in fast mode
-    REAL _survivingTransferSumsOneMore;
-  };
-
-  // Current DTLCLV values
-  std::vector<DTLCLV> _dtlclvs;
-  // Previous DTLCVL values, to rollback to a consistent state
+  // Current CLV values
+  TransferCLVArena<REAL> _dtlclvs;
+  // Previous CLV values, to rollback to a consistent state
   // after a fast likelihood computation
-  std::vector<DTLCLV> _dtlclvsBackup;
+  TransferCLVArena<REAL> _dtlclvsBackup;
+  // do _dtlclvs and _dtlclvsBackup hold the converged CLVs of an
+  // exact computation in PartialSpecies mode, from which the
+  // fast mode can start?
+  bool _exactCLVs;
+  bool _exactCLVsBackup;
+  // CLV journal (only used in PartialGenes mode)
+  TransferCLVJournal<REAL> _journal;
+  // species tree trial: probabilities at the beginning of the trial,
+  // and true if _dtlclvsBackup holds the CLVs of the beginning of the
+  // trial, because an exact computation swapped them
+  std::shared_ptr<SpeciesProbabilities<REAL> > _trialProbabilities;
+  bool _trialSwapped;
+  // copy of the CLV being updated, to check the convergence
+  std::vector<REAL> _previousCLV;
+  FixedPointIterations _extinctionIterations;
+  FixedPointIterations _clvIterations;
 private:
   void updateTransferSums(REAL &transferExtinctionSum,
     const REAL &transferSumBackup,
-    const std::vector<REAL> &probabilities);
+    const REAL *probabilities);
   void resetTransferSums(const REAL &transferSum,
     REAL &transferSumBackup,
-    const std::vector<REAL> &probabilities);
+    const REAL *probabilities);
   void getBestTransfer(pll_unode_t *parentGeneNode, 
     pll_rnode_t *originSpeciesNode,
     bool isVirtualRoot,
@@ -123,18 +138,30 @@ private:
     pll_rnode_t *&recievingSpecies,
     REAL &proba,
     bool stochastic = false);
-  unsigned int getIterationsNumber() const { return this->_fastMode ? 1 : 5;}    
+  unsigned int getIterationsNumber(const FixedPointIterations &iterations) const { 
+    return this->_fastMode ? 1 : iterations.getMaxIterations();
+  }
   REAL getCorrectedTransferExtinctionSum(unsigned int speciesId) const {
-    return _transferExtinctionSum * _PT[speciesId];
+    return _probabilities->transferExtinctionSum * _probabilities->PT[speciesId];
   }
 
   REAL getCorrectedTransferSum(unsigned int geneId, unsigned int speciesId) const
   {
-    return _dtlclvs[geneId]._survivingTransferSums * _PT[speciesId];
+    return _dtlclvs._survivingTransferSums[geneId] * _probabilities->PT[speciesId];
   }
   std::vector<pll_rnode_s *> &getSpeciesNodesToUpdate() {
     return (this->_fastMode ? this->_speciesNodesToUpdate : this->_allSpeciesNodes);
   }
+  void beginCLVUpdate(pll_unode_t *geneNode);
+  void iterateCLV(pll_unode_t *geneNode, bool isVirtualRoot);
+  void endCLVUpdate(unsigned int geneId);
+  /**
+   *  CLVs shared with the other families, only in exact mode: copy
+   *  the CLV of an identical subtree if another family already 
+   *  computed it, or publish the CLV that was just computed
+   */
+  bool copySharedCLV(unsigned int geneId);
+  void publishSharedCLV(unsigned int geneId);
 };
 
 
@@ -143,19 +170,19 @@ private:
 template <class REAL>
 void UndatedIDTLModel<REAL>::setInitialGeneTree(pll_utree_t *tree)
 {
-  AbstractReconciliationModel<REAL>::setInitialGeneTree(tree);
+  AbstractReconciliationModel<REAL, UndatedIDTLModel<REAL> >::setInitialGeneTree(tree);
   assert(this->_allSpeciesNodesCount);
   assert(this->_maxGeneId);
-  std::vector<REAL> zeros(this->_allSpeciesNodesCount);
-  DTLCLV nullCLV(this->_allSpeciesNodesCount);
-  _dtlclvs = std::vector<DTLCLV>(2 * (this->_maxGeneId + 1), nullCLV);
-  _dtlclvsBackup = std::vector<DTLCLV>(2 * (this->_maxGeneId + 1), nullCLV);
+  _dtlclvs.resize(2 * (this->_maxGeneId + 1), this->_allSpeciesNodesCount);
+  _dtlclvsBackup.resize(2 * (this->_maxGeneId + 1), this->_allSpeciesNodesCount);
+  _exactCLVs = _exactCLVsBackup = false;
+  _previousCLV.resize(this->_allSpeciesNodesCount);
 }
 
   template <class REAL>
 void UndatedIDTLModel<REAL>::resetTransferSums(const REAL &transferSum,
     REAL &transferSumInvariant,
-    const std::vector<REAL> &probabilities)
+    const REAL *probabilities)
 {
   if (this->_fastMode) {
     REAL diff = REAL();
@@ -170,7 +197,7 @@ void UndatedIDTLModel<REAL>::resetTransferSums(const REAL &transferSum,
 template <class REAL>
 void UndatedIDTLModel<REAL>::updateTransferSums(REAL &transferSum,
     const REAL &transferSumInvariant,
-    const std::vector<REAL> &probabilities)
+    const REAL *probabilities)
 {
   transferSum = REAL();
   for (auto speciesNode:  getSpeciesNodesToUpdate()) {
@@ -187,41 +214,13 @@ void UndatedIDTLModel<REAL>::updateTransferSums(REAL &transferSum,
 template <class REAL>
 void UndatedIDTLModel<REAL>::setRates(const RatesVector &rates)
 {
-  assert(rates.size() == 4);
-  auto &dupRates = rates[0];
-  auto &lossRates = rates[1];
-  auto &transferRates = rates[2];
-  auto &ilsRates = rates[3];
   this->_geneRoot = 0;
-  assert(this->_allSpeciesNodesCount == dupRates.size());
-  assert(this->_allSpeciesNodesCount == lossRates.size());
-  assert(this->_allSpeciesNodesCount == transferRates.size());
-  assert(this->_allSpeciesNodesCount == ilsRates.size());
-  _PD = dupRates;
-  _PL = lossRates;
-  _PT = transferRates;
-  _PI = ilsRates;
-  _PS.resize(this->_allSpeciesNodesCount);
-  for (auto speciesNode: this->_allSpeciesNodes) {
-    auto e = speciesNode->node_index;
-    _PS[e] = 1.0;
-    if (!speciesNode->left || !speciesNode->parent) {
-      _PI[e] = 0.0;
-    }
-    auto sum = _PD[e] + _PL[e] + _PT[e] + _PS[e];
-    if (speciesNode->left) {
-      auto f = speciesNode->left->node_index;
-      auto g = speciesNode->right->node_index;
-      sum += _PI[f] + _PI[g];
-      _PI[f] /= sum;
-      _PI[g] /= sum;
-    }
-    _PD[e] /= sum;
-    _PL[e] /= sum;
-    _PT[e] /= sum;
-    _PS[e] /= sum;
-  } 
-
+  assert(rates.size() == 4);
+  for (auto &r: rates) {
+    assert(this->_allSpeciesNodesCount == r.size());
+  }
+  _rates = rates;
+  _exactCLVs = _exactCLVsBackup = false;
   recomputeSpeciesProbabilities();
   this->invalidateAllCLVs();
   this->invalidateAllSpeciesCLVs();
@@ -233,21 +232,53 @@ UndatedIDTLModel<REAL>::~UndatedIDTLModel() { }
 template <class REAL>
 void UndatedIDTLModel<REAL>::recomputeSpeciesProbabilities()
 {
-  _uE.resize(this->_allSpeciesNodesCount);
-  REAL unused = REAL(1.0);
-  resetTransferSums(_transferExtinctionSum, unused, _uE);
-  for (unsigned int it = 0; it < getIterationsNumber(); ++it) {
-    for (auto speciesNode: getSpeciesNodesToUpdate()) {
+  if (SpeciesProbabilities<REAL>::template acquire<UndatedIDTLModel<REAL> >(_probabilities,
+        _rates, this->getSpeciesTree(), this->hasShareableSpeciesProbabilities())) {
+    return;
+  }
+  auto &p = *_probabilities;
+  p.copyRates(_rates, 0, p.PD);
+  p.copyRates(_rates, 1, p.PL);
+  p.copyRates(_rates, 2, p.PT);
+  p.copyRates(_rates, 3, p.PI);
+  p.PS.resize(this->_allSpeciesNodesCount);
+  for (auto speciesNode: this->_allSpeciesNodes) {
+    auto e = speciesNode->node_index;
+    p.PS[e] = 1.0;
+    if (!speciesNode->left || !speciesNode->parent) {
+      p.PI[e] = 0.0;
+    }
+    auto sum = p.PD[e] + p.PL[e] + p.PT[e] + p.PS[e];
+    if (speciesNode->left) {
+      auto f = speciesNode->left->node_index;
+      auto g = speciesNode->right->node_index;
+      sum += p.PI[f] + p.PI[g];
+      p.PI[f] /= sum;
+      p.PI[g] /= sum;
+    }
+    p.PD[e] /= sum;
+    p.PL[e] /= sum;
+    p.PT[e] /= sum;
+    p.PS[e] /= sum;
+  }
+  // start from the previous extinction probabilities, if any
+  p.uE.resize(this->_allSpeciesNodesCount);
+  unsigned int it = 0;
+  bool converged = false;
+  // the table can be shared, so it is not computed in fast mode
+  while (!converged && it < _extinctionIterations.getMaxIterations()) {
+    converged = true;
+    for (auto speciesNode: this->_allSpeciesNodes) {
       auto e = speciesNode->node_index;
-      REAL proba(_PL[e]);
-      REAL temp = _uE[e] * _uE[e] * _PD[e];
+      REAL proba(p.PL[e]);
+      REAL temp = p.uE[e] * p.uE[e] * p.PD[e];
       scale(temp);
       proba += temp;
-      temp = getCorrectedTransferExtinctionSum(e) * _uE[e];
+      temp = getCorrectedTransferExtinctionSum(e) * p.uE[e];
       scale(temp);
       proba += temp;
       if (this->getSpeciesLeft(speciesNode)) {
-        temp = _uE[this->getSpeciesLeft(speciesNode)->node_index]  * _uE[this->getSpeciesRight(speciesNode)->node_index] * _PS[e];
+        temp = p.uE[this->getSpeciesLeft(speciesNode)->node_index]  * p.uE[this->getSpeciesRight(speciesNode)->node_index] * p.PS[e];
         scale(temp);
         proba += temp;
 
@@ -257,43 +288,146 @@ void UndatedIDTLModel<REAL>::recomputeSpeciesProbabilities()
         if (this->getSpeciesLeft(left)) {
           auto leftleft = this->getSpeciesLeft(left);
           auto leftright = this->getSpeciesRight(left);
-          proba += _uE[leftleft->node_index] * _uE[leftright->node_index] * _uE[right->node_index] * _PI[left->node_index];
+          proba += p.uE[leftleft->node_index] * p.uE[leftright->node_index] * p.uE[right->node_index] * p.PI[left->node_index];
         }
         if (this->getSpeciesLeft(right)) {
           auto rightleft = this->getSpeciesLeft(right);
           auto rightright = this->getSpeciesRight(right);
-          proba += _uE[rightleft->node_index] * _uE[rightright->node_index] * _uE[left->node_index] * _PI[right->node_index];        
+          proba += p.uE[rightleft->node_index] * p.uE[rightright->node_index] * p.uE[left->node_index] * p.PI[right->node_index];        
         }
       }
       //PRINT_ERROR_PROBA(proba)
-      _uE[speciesNode->node_index] = proba;
+      converged &= _extinctionIterations.isConverged(p.uE[e], proba);
+      p.uE[speciesNode->node_index] = proba;
+    }
+    p.transferExtinctionSum = REAL();
+    for (auto speciesNode: this->_allSpeciesNodes) {
+      p.transferExtinctionSum += p.uE[speciesNode->node_index];
     }
-    updateTransferSums(_transferExtinctionSum, unused, _uE);
+    p.transferExtinctionSum /= this->_allSpeciesNodes.size();
+    ++it;
   }
+  _extinctionIterations.addCall(it);
+  SpeciesProbabilities<REAL>::template publish<UndatedIDTLModel<REAL> >(_probabilities,
+      this->hasShareableSpeciesProbabilities());
 }
 
 
+template <class REAL>
+void UndatedIDTLModel<REAL>::beginCLVUpdate(pll_unode_t *geneNode)
+{
+  if (this->_blockScaling) {
+    auto gid = geneNode->node_index;
+    auto scaler = this->getChildrenScaler(gid);
+    if (this->_fastMode) {
+      // only some entries will be recomputed
+      _dtlclvs.rescale(gid, scaler);
+    } else {
+      _dtlclvs.setScaler(gid, scaler);
+    }
+  }
+}
+
+template <class REAL>
+void UndatedIDTLModel<REAL>::endCLVUpdate(unsigned int geneId)
+{
+  // also in fast mode: the parent CLVs are computed with this scaler
+  if (this->_blockScaling) {
+    _dtlclvs.normalize(geneId);
+  }
+}
+
+template <class REAL>
+void UndatedIDTLModel<REAL>::iterateCLV(pll_unode_t *geneNode, bool isVirtualRoot)
+{
+  auto gid = geneNode->node_index;
+  auto clv = _dtlclvs._uq[gid];
+  auto maxIterations = getIterationsNumber(_clvIterations);
+  unsigned int it = 0;
+  bool converged = false;
+  while (!converged && it < maxIterations) {
+    updateTransferSums(_dtlclvs._survivingTransferSums[gid], _dtlclvs._survivingTransferSumsInvariant[gid], clv);
+    bool checkConvergence = (it + 1 < maxIterations);
+    if (checkConvergence) {
+      std::copy(clv, clv + _previousCLV.size(), _previousCLV.begin());
+    }
+    for (auto speciesNode: getSpeciesNodesToUpdate()) { 
+      computeProbability(geneNode, speciesNode, clv[speciesNode->node_index], isVirtualRoot);
+    }
+    ++it;
+    if (checkConvergence) {
+      converged = true;
+      for (auto speciesNode: getSpeciesNodesToUpdate()) {
+        auto e = speciesNode->node_index;
+        converged &= _clvIterations.isConverged(_previousCLV[e], clv[e]);
+      }
+    }
+  }
+  _clvIterations.addCall(it);
+}
+
 template <class REAL>
 void UndatedIDTLModel<REAL>::updateCLV(pll_unode_t *geneNode)
 {
   auto gid = geneNode->node_index;
-  resetTransferSums(this->_fastMode ? _dtlclvs[gid]._survivingTransferSumsOneMore : _dtlclvs[gid]._survivingTransferSums, _dtlclvs[gid]._survivingTransferSumsInvariant, _dtlclvs[gid]._uq);
+  beginCLVUpdate(geneNode);
+  if (copySharedCLV(gid)) {
+    endCLVUpdate(gid);
+    return;
+  }
+  resetTransferSums(this->_fastMode ? _dtlclvs._survivingTransferSumsOneMore[gid] : _dtlclvs._survivingTransferSums[gid], _dtlclvs._survivingTransferSumsInvariant[gid], _dtlclvs._uq[gid]);
   
   if (!this->_fastMode) {
     for (auto speciesNode: getSpeciesNodesToUpdate()) {
-      _dtlclvs[gid]._uq[speciesNode->node_index] = REAL();
-    }
-  }
-  for (unsigned int it = 0; it < getIterationsNumber(); ++it) {
-    updateTransferSums(_dtlclvs[gid]._survivingTransferSums, _dtlclvs[gid]._survivingTransferSumsInvariant, _dtlclvs[gid]._uq);
-    for (auto speciesNode: getSpeciesNodesToUpdate()) { 
-      computeProbability(geneNode, 
-          speciesNode, 
-          _dtlclvs[gid]._uq[speciesNode->node_index]);
+      _dtlclvs._uq[gid][speciesNode->node_index] = REAL();
     }
   }
+  iterateCLV(geneNode, false);
   if (this->_likelihoodMode == PartialLikelihoodMode::PartialSpecies && !this->_fastMode) {
-    updateTransferSums(_dtlclvs[gid]._survivingTransferSumsOneMore, _dtlclvs[gid]._survivingTransferSumsInvariant, _dtlclvs[gid]._uq);
+    updateTransferSums(_dtlclvs._survivingTransferSumsOneMore[gid], _dtlclvs._survivingTransferSumsInvariant[gid], _dtlclvs._uq[gid]);
+  }
+  publishSharedCLV(gid);
+  endCLVUpdate(gid);
+}
+
+template <class REAL>
+void UndatedIDTLModel<REAL>::setTreeDuplicates(const std::shared_ptr<const TreeDuplicates> &duplicates,
+    unsigned int family)
+{
+  AbstractReconciliationModel<REAL, UndatedIDTLModel<REAL> >::setTreeDuplicates(duplicates, family);
+  SubtreeCache<SharedCLV<REAL> >::template acquire<UndatedIDTLModel<REAL> >(this->_sharedCLVs, 
+      duplicates, this->_blockScaling);
+}
+
+template <class REAL>
+bool UndatedIDTLModel<REAL>::copySharedCLV(unsigned int geneId)
+{
+  if (this->_fastMode) {
+    return false;
+  }
+  // beginCLVUpdate set the scaler of the children
+  auto shared = this->getSharedCLV(geneId, _probabilities->getVersion(), _dtlclvs.getScaler(geneId));
+  if (!shared) {
+    return false;
+  }
+  std::copy(shared->entries.begin(), shared->entries.end(), _dtlclvs._uq[geneId]);
+  _dtlclvs._survivingTransferSums[geneId] = shared->survivingTransferSum;
+  _dtlclvs._survivingTransferSumsOneMore[geneId] = shared->survivingTransferSumOneMore;
+  return true;
+}
+
+template <class REAL>
+void UndatedIDTLModel<REAL>::publishSharedCLV(unsigned int geneId)
+{
+  if (this->_fastMode) {
+    return;
+  }
+  auto shared = this->publishCLV(geneId, _probabilities->getVersion(), _dtlclvs.getScaler(geneId));
+  if (shared) {
+    auto clv = _dtlclvs._uq[geneId];
+    shared->entries.assign(clv, clv + this->_allSpeciesNodesCount);
+    shared->survivingTransferSum = _dtlclvs._survivingTransferSums[geneId];
+    shared->survivingTransferSumOneMore = _dtlclvs._survivingTransferSumsOneMore[geneId];
   }
 }
 
@@ -309,7 +443,7 @@ void UndatedIDTLModel<REAL>::computeProbability(pll_unode_t *geneNode, pll_rnode
   
   auto gid = geneNode->node_index;
   auto e = speciesNode->node_index;
-  bool isGeneLeaf = !geneNode->next;
+  bool isGeneLeaf = this->isGeneLeaf(gid);
   bool isSpeciesLeaf = !this->getSpeciesLeft(speciesNode);
   
 
@@ -320,7 +454,7 @@ void UndatedIDTLModel<REAL>::computeProbability(pll_unode_t *geneNode, pll_rnode
   }
 
   if (isSpeciesLeaf and isGeneLeaf and e == this->_geneToSpecies[gid]) {
-    proba = REAL(_PS[e]);
+    proba = REAL(_probabilities->PS[e]);
     return;
   }
   typedef std::array<REAL, 9>  ValuesArray;
@@ -330,12 +464,6 @@ void UndatedIDTLModel<REAL>::computeProbability(pll_unode_t *geneNode, pll_rnode
   values[8] = REAL();
   proba = REAL();
   
-  pll_unode_t *leftGeneNode = 0;     
-  pll_unode_t *rightGeneNode = 0;     
-  if (!isGeneLeaf) {
-    leftGeneNode = this->getLeft(geneNode, isVirtualRoot);
-    rightGeneNode = this->getRight(geneNode, isVirtualRoot);
-  }
   unsigned int f = 0;
   unsigned int g = 0;
   if (!isSpeciesLeaf) {
@@ -344,55 +472,62 @@ void UndatedIDTLModel<REAL>::computeProbability(pll_unode_t *geneNode, pll_rnode
   }
   if (not isGeneLeaf) {
     // S event
-    auto u_left = leftGeneNode->node_index;
-    auto u_right = rightGeneNode->node_index;
+    auto u_left = this->getLeftId(gid);
+    auto u_right = this->getRightId(gid);
     if (not isSpeciesLeaf) {
       //  speciation event
-      values[0] = _dtlclvs[u_left]._uq[f];
-      values[1] = _dtlclvs[u_left]._uq[g];
-      values[0] *= _dtlclvs[u_right]._uq[g];
-      values[1] *= _dtlclvs[u_right]._uq[f];
-      values[0] *= _PS[e]; 
-      values[1] *= _PS[e]; 
+      values[0] = _dtlclvs._uq[u_left][f];
+      values[1] = _dtlclvs._uq[u_left][g];
+      values[0] *= _dtlclvs._uq[u_right][g];
+      values[1] *= _dtlclvs._uq[u_right][f];
+      values[0] *= _probabilities->PS[e]; 
+      values[1] *= _probabilities->PS[e]; 
       scale(values[0]);
       scale(values[1]);
       proba += values[0];
       proba += values[1];
       // ILS event
-      pll_unode_t *sonGeneNodes[2] = {leftGeneNode, rightGeneNode};
+      unsigned int sonGeneIds[2] = {u_left, u_right};
       pll_rnode_s *sonSpeciesNodes[2] = {
         this->getSpeciesLeft(speciesNode),
         this->getSpeciesRight(speciesNode)
       };
-      pll_unode_t *grandSonGeneNodes[2][2] = {{0, 0}, {0, 0}};
+      unsigned int grandSonGeneIds[2][2] = {{NO_GENE, NO_GENE}, {NO_GENE, NO_GENE}};
       pll_rnode_t *grandSonSpeciesNodes[2][2] = {{0, 0}, {0, 0}};
       for (unsigned int i = 0; i < 2; ++i) {
+        if (!this->isGeneLeaf(sonGeneIds[i])) {
+          // right child first, like getSpeciesSon(node, 0)
+          grandSonGeneIds[i][0] = this->getRightId(sonGeneIds[i]);
+          grandSonGeneIds[i][1] = this->getLeftId(sonGeneIds[i]);
+        }
         for (unsigned int j = 0; j < 2; ++j) {
-          if (sonGeneNodes[i]->next) {
-            grandSonGeneNodes[i][j] = this->getGeneSon(sonGeneNodes[i], j); 
-          }
           grandSonSpeciesNodes[i][j] = this->getSpeciesSon(sonSpeciesNodes[i], j); 
         }
       }
       for (bool ilsSpecies: {false, true}) {
         for (bool ilsGene: {false, true}) {
           if (!(grandSonSpeciesNodes[ilsSpecies][0] 
-              && grandSonGeneNodes[!ilsGene][0])) {
+              && grandSonGeneIds[!ilsGene][0] != NO_GENE)) {
             continue;
           }
           
           for (bool lrgene: {false, true}) {
             for (bool lrspecies: {false, true}) {
-              unsigned int g1 = sonGeneNodes[ilsGene]->node_index;
+              unsigned int g1 = sonGeneIds[ilsGene];
               unsigned int s1 = grandSonSpeciesNodes[ilsSpecies][lrspecies]->node_index;
-              unsigned int g2 = grandSonGeneNodes[!ilsGene][lrgene]->node_index;
+              unsigned int g2 = grandSonGeneIds[!ilsGene][lrgene];
               unsigned int s2 = grandSonSpeciesNodes[ilsSpecies][!lrspecies]->node_index;
-              unsigned int g3 = grandSonGeneNodes[!ilsGene][!lrgene]->node_index;
+              unsigned int g3 = grandSonGeneIds[!ilsGene][!lrgene];
               unsigned int s3 = sonSpeciesNodes[!ilsSpecies]->node_index;
-              REAL t = _dtlclvs[g1]._uq[s1];
-              t *= _dtlclvs[g2]._uq[s2];
-              t *= _dtlclvs[g3]._uq[s3];
-              t *= _PI[sonSpeciesNodes[ilsSpecies]->node_index];
+              REAL t = _dtlclvs._uq[g1][s1];
+              t *= _dtlclvs._uq[g2][s2];
+              t *= _dtlclvs._uq[g3][s3];
+              t *= _probabilities->PI[sonSpeciesNodes[ilsSpecies]->node_index];
+              // block scaling: the grandchildren CLVs do not 
+              // include the rescalings of their parent CLV
+              auto scalerDiff = this->getCLVScaler(u_left) + this->getCLVScaler(u_right)
+                - this->getCLVScaler(g1) - this->getCLVScaler(g2) - this->getCLVScaler(g3);
+              CLVArena<REAL>::applyScaler(t, scalerDiff);
               scale(t);
               values[8] += t;
             }
@@ -402,36 +537,36 @@ void UndatedIDTLModel<REAL>::computeProbability(pll_unode_t *geneNode, pll_rnode
       proba += values[8];
     }
     // D event
-    values[2] = _dtlclvs[u_left]._uq[e];
-    values[2] *= _dtlclvs[u_right]._uq[e];
-    values[2] *= _PD[e];
+    values[2] = _dtlclvs._uq[u_left][e];
+    values[2] *= _dtlclvs._uq[u_right][e];
+    values[2] *= _probabilities->PD[e];
     scale(values[2]);
     proba += values[2];
     
     // T event
     values[5] = getCorrectedTransferSum(u_left, e);
-    values[5] *= _dtlclvs[u_right]._uq[e];
+    values[5] *= _dtlclvs._uq[u_right][e];
     scale(values[5]);
     values[6] = getCorrectedTransferSum(u_right, e);
-    values[6] *= _dtlclvs[u_left]._uq[e];
+    values[6] *= _dtlclvs._uq[u_left][e];
     scale(values[6]);
     proba += values[5];
     proba += values[6];
   }
   if (not isSpeciesLeaf) {
     // SL event
-    values[3] = _dtlclvs[gid]._uq[f];
-    values[3] *= (_uE[g] * _PS[e]);
+    values[3] = _dtlclvs._uq[gid][f];
+    values[3] *= (_probabilities->uE[g] * _probabilities->PS[e]);
     scale(values[3]);
-    values[4] = _dtlclvs[gid]._uq[g];
-    values[4]*= _uE[f] * _PS[e];
+    values[4] = _dtlclvs._uq[gid][g];
+    values[4]*= _probabilities->uE[f] * _probabilities->PS[e];
     scale(values[4]);
     proba += values[3];
     proba += values[4];
   }
   // TL event
   values[7] = getCorrectedTransferSum(gid, e);
-  values[7] *= _uE[e];
+  values[7] *= _probabilities->uE[e];
   scale(values[7]);
   proba += values[7];
   
@@ -509,23 +644,19 @@ template <class REAL>
 void UndatedIDTLModel<REAL>::computeRootLikelihood(pll_unode_t *virtualRoot)
 {
   auto u = virtualRoot->node_index;
-  resetTransferSums(this->_fastMode ? _dtlclvs[u]._survivingTransferSumsOneMore : _dtlclvs[u]._survivingTransferSums, _dtlclvs[u]._survivingTransferSumsInvariant, _dtlclvs[u]._uq);
+  beginCLVUpdate(virtualRoot);
+  resetTransferSums(this->_fastMode ? _dtlclvs._survivingTransferSumsOneMore[u] : _dtlclvs._survivingTransferSums[u], _dtlclvs._survivingTransferSumsInvariant[u], _dtlclvs._uq[u]);
   if (!this->_fastMode) {
     for (auto speciesNode: getSpeciesNodesToUpdate()) {
       auto e = speciesNode->node_index;
-      _dtlclvs[u]._uq[e] = REAL();
-    }
-  }
-  for (unsigned int it = 0; it < getIterationsNumber(); ++it) {
-    updateTransferSums(_dtlclvs[u]._survivingTransferSums, _dtlclvs[u]._survivingTransferSumsInvariant, _dtlclvs[u]._uq);
-    for (auto speciesNode: getSpeciesNodesToUpdate()) {
-      unsigned int e = speciesNode->node_index;
-      computeProbability(virtualRoot, speciesNode, _dtlclvs[u]._uq[e], true);
+      _dtlclvs._uq[u][e] = REAL();
     }
   }
+  iterateCLV(virtualRoot, true);
   if (!this->_fastMode) {
-    updateTransferSums(_dtlclvs[u]._survivingTransferSumsOneMore, _dtlclvs[u]._survivingTransferSumsInvariant, _dtlclvs[u]._uq);
+    updateTransferSums(_dtlclvs._survivingTransferSumsOneMore[u], _dtlclvs._survivingTransferSumsInvariant[u], _dtlclvs._uq[u]);
   }
+  endCLVUpdate(u);
 }
 
 
@@ -536,7 +667,7 @@ REAL UndatedIDTLModel<REAL>::getRootLikelihood(pll_unode_t *root) const
   auto u = root->node_index + this->_maxGeneId + 1;
   for (auto speciesNode: this->_allSpeciesNodes) {
     auto e = speciesNode->node_index;
-    sum += _dtlclvs[u]._uq[e];
+    sum += _dtlclvs._uq[u][e];
   }
   PRINT_ERROR_PROBA(sum);
   assert(IS_PROBA(sum));
@@ -549,7 +680,7 @@ REAL UndatedIDTLModel<REAL>::getLikelihoodFactor() const
   REAL factor(0.0);
   for (auto speciesNode: this->_allSpeciesNodes) {
     auto e = speciesNode->node_index;
-    factor += (REAL(1.0) - _uE[e]);
+    factor += (REAL(1.0) - _probabilities->uE[e]);
   }
   return factor;
       
@@ -558,45 +689,91 @@ REAL UndatedIDTLModel<REAL>::getLikelihoodFactor() const
 template <class REAL>
 void UndatedIDTLModel<REAL>::beforeComputeLogLikelihood()
 {
-  AbstractReconciliationModel<REAL>::beforeComputeLogLikelihood();
+  AbstractReconciliationModel<REAL, UndatedIDTLModel<REAL> >::beforeComputeLogLikelihood();
   if (this->_likelihoodMode == PartialLikelihoodMode::PartialSpecies) {
     if (this->_fastMode) {
-      _transferExtinctionSumBackup = _transferExtinctionSum;
+      // only save the entries that will change. The other entries of
+      // the backup are not valid anymore
+      _exactCLVsBackup = false;
       for (unsigned int gid = 0; gid < _dtlclvs.size(); ++gid) {
-        _dtlclvsBackup[gid]._survivingTransferSums = _dtlclvs[gid]._survivingTransferSums;
+        _dtlclvsBackup.setScaler(gid, _dtlclvs.getScaler(gid));
+        _dtlclvsBackup._survivingTransferSums[gid] = _dtlclvs._survivingTransferSums[gid];
         for (auto speciesNode: getSpeciesNodesToUpdate()) {
           auto e = speciesNode->node_index;
-          _dtlclvsBackup[gid]._uq[e] = _dtlclvs[gid]._uq[e];
+          _dtlclvsBackup._uq[gid][e] = _dtlclvs._uq[gid][e];
         }
       }
-    } else { 
+    } else if (!_trialSwapped) { 
+      // during a species tree trial, keep the CLVs of its beginning
       std::swap(_dtlclvs, _dtlclvsBackup);
+      std::swap(_exactCLVs, _exactCLVsBackup);
+      _trialSwapped = this->isSpeciesTreeTrialOpen();
     }
   }
+  if (!this->_fastMode) {
+    _exactCLVs = false;
+  }
 }
 
 template <class REAL>
 void UndatedIDTLModel<REAL>::afterComputeLogLikelihood()
 {
-  AbstractReconciliationModel<REAL>::afterComputeLogLikelihood();
+  AbstractReconciliationModel<REAL, UndatedIDTLModel<REAL> >::afterComputeLogLikelihood();
   if (this->_likelihoodMode == PartialLikelihoodMode::PartialSpecies) {
     if (this->_fastMode) {
-      _transferExtinctionSum = _transferExtinctionSumBackup;
       for (unsigned int gid = 0; gid < _dtlclvs.size(); ++gid) {
-        _dtlclvs[gid]._survivingTransferSums = _dtlclvsBackup[gid]._survivingTransferSums;
+        _dtlclvs.rescale(gid, _dtlclvsBackup.getScaler(gid));
+        _dtlclvs._survivingTransferSums[gid] = _dtlclvsBackup._survivingTransferSums[gid];
         for (auto speciesNode: getSpeciesNodesToUpdate()) {
           auto e = speciesNode->node_index;
-          _dtlclvs[gid]._uq[e] = _dtlclvsBackup[gid]._uq[e];
+          _dtlclvs._uq[gid][e] = _dtlclvsBackup._uq[gid][e];
         }
       }
+    } else {
+      _exactCLVs = true;
     }
   }
 }
 
 template <class REAL>
-void UndatedIDTLModel<REAL>::rollbackToLastState()
+bool UndatedIDTLModel<REAL>::isApproxLikelihoodAvailable() const
 {
-  std::swap(_dtlclvs, _dtlclvsBackup);
+  // with a pruned species tree, the species nodes 
+  // of the CLVs change with the species tree
+  // after an exact computation in a species tree trial, the
+  // backup cannot store the entries overwritten in fast mode
+  return this->_likelihoodMode == PartialLikelihoodMode::PartialSpecies
+    && !this->isSpeciesTreePruned()
+    && _exactCLVs
+    && !_trialSwapped;
+}
+
+template <class REAL>
+void UndatedIDTLModel<REAL>::beginSpeciesTreeTrial()
+{
+  AbstractReconciliationModel<REAL, UndatedIDTLModel<REAL> >::beginSpeciesTreeTrial();
+  if (this->isSpeciesTreeTrialOpen()) {
+    // the next recomputeSpeciesProbabilities copies the table
+    // before changing it, because it is not the only owner anymore
+    _trialProbabilities = _probabilities;
+  }
+}
+
+template <class REAL>
+void UndatedIDTLModel<REAL>::endSpeciesTreeTrial(bool revert)
+{
+  if (this->isSpeciesTreeTrialOpen()) {
+    if (revert) {
+      _probabilities = _trialProbabilities;
+      if (_trialSwapped) {
+        std::swap(_dtlclvs, _dtlclvsBackup);
+        std::swap(_exactCLVs, _exactCLVsBackup);
+      }
+    }
+    _trialProbabilities.reset();
+    _trialSwapped = false;
+  }
+  AbstractReconciliationModel<REAL, UndatedIDTLModel<REAL> >::endSpeciesTreeTrial(revert);
 }
 
 template <class REAL>
@@ -620,16 +797,16 @@ void UndatedIDTLModel<REAL>::getBestTransfer(pll_unode_t *parentGeneNode,
     parents.insert(this->getSpeciesParent(parent)->node_index);
   }
   std::vector<REAL> transferProbas(speciesNumber * 2, REAL());
-  double factor = _PT[e] / static_cast<double>(speciesNumber);
+  auto factor = _probabilities->PT[e] / static_cast<double>(speciesNumber);
   for (auto species: this->_allSpeciesNodes) {
     auto h = species->node_index;
     if (parents.count(h)) {
       continue;
     }
-    transferProbas[h] = (_dtlclvs[u_left->node_index]._uq[h] 
-        * _dtlclvs[u_right->node_index]._uq[e]) * factor;
-    transferProbas[h + speciesNumber] = (_dtlclvs[u_right->node_index]._uq[h] 
-        * _dtlclvs[u_left->node_index]._uq[e]) * factor;
+    transferProbas[h] = (_dtlclvs._uq[u_left->node_index][h] 
+        * _dtlclvs._uq[u_right->node_index][e]) * factor;
+    transferProbas[h + speciesNumber] = (_dtlclvs._uq[u_right->node_index][h] 
+        * _dtlclvs._uq[u_left->node_index][e]) * factor;
   }
   if (stochastic) {
     // stochastic sample: proba will be set to the sum of probabilities
@@ -690,13 +867,13 @@ void UndatedIDTLModel<REAL>::getBestTransferLoss(Scenario &scenario,
   for (auto parent = originSpeciesNode; this->getSpeciesParent(parent) != 0; parent = this->getSpeciesParent(parent)) {
     parents.insert(this->getSpeciesParent(parent)->node_index);
   }
-  REAL factor = _uE[e] * (_PT[e] / static_cast<double>(this->_allSpeciesNodes.size()));
+  REAL factor = _probabilities->uE[e] * (_probabilities->PT[e] / static_cast<double>(this->_allSpeciesNodes.size()));
   for (auto species: this->_allSpeciesNodes) {
     auto h = species->node_index;
     if (parents.count(h)) {
       continue;
     }
-    transferProbas[h] = _dtlclvs[u]._uq[h] * factor;
+    transferProbas[h] = _dtlclvs._uq[u][h] * factor;
   }
   if (!stochastic) {
     for (auto species: this->_allSpeciesNodes) {
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <cmath>
+#include <iostream>
+
+/*
+ *  Dual number for forward-mode differentiation: a double value and
+ *  its derivatives with respect to N independent variables.
+ *
+ *  Used as the REAL type of the reconciliation models to get the
+ *  exact derivatives of the likelihood with respect to the rates.
+ *  The comparison operators only look at the value, so that the
+ *  models take the same decisions as with plain doubles
+ */
+template <unsigned int N>
+class DualValue {
+public:
+  /**
+   *  Constructor for a constant (all derivatives are null)
+   */
+  DualValue(double v = 0.0): value(v) {
+    derivatives.fill(0.0);
+  }
+
+  /**
+   *  Set the value as the independent variable of direction i
+   */
+  void seed(unsigned int i) {
+    derivatives.fill(0.0);
+    derivatives[i] = 1.0;
+  }
+
+  inline DualValue& operator+=(const DualValue& v) {
+    value += v.value;
+    for (unsigned int i = 0; i < N; ++i) {
+      derivatives[i] += v.derivatives[i];
+    }
+    return *this;
+  }
+
+  inline DualValue& operator-=(const DualValue& v) {
+    value -= v.value;
+    for (unsigned int i = 0; i < N; ++i) {
+      derivatives[i] -= v.derivatives[i];
+    }
+    return *this;
+  }
+
+  inline DualValue& operator*=(const DualValue& v) {
+    for (unsigned int i = 0; i < N; ++i) {
+      derivatives[i] = derivatives[i] * v.value + value * v.derivatives[i];
+    }
+    value *= v.value;
+    return *this;
+  }
+
+  inline DualValue& operator*=(double v) {
+    value *= v;
+    for (auto &d: derivatives) {
+      d *= v;
+    }
+    return *this;
+  }
+
+  inline DualValue& operator/=(const DualValue& v) {
+    value /= v.value;
+    for (unsigned int i = 0; i < N; ++i) {
+      derivatives[i] = (derivatives[i] - value * v.derivatives[i]) / v.value;
+    }
+    return *this;
+  }
+
+  inline DualValue& operator/=(double v) {
+    value /= v;
+    for (auto &d: derivatives) {
+      d /= v;
+    }
+    return *this;
+  }
+
+  inline DualValue operator-() const {
+    DualValue res(*this);
+    res *= -1.0;
+    return res;
+  }
+
+  inline bool operator <(const DualValue& v) const {return value < v.value;}
+  inline bool operator <=(const DualValue& v) const {return value <= v.value;}
+  inline bool operator ==(const DualValue& v) const {return value == v.value;}
+
+  /**
+   *  std::ofstream operator
+   */
+  friend std::ostream& operator<<(std::ostream& os, const DualValue &v) {
+    os << "(" << v.value;
+    for (auto d: v.derivatives) {
+      os << "," << d;
+    }
+    os << ")";
+    return os;
+  }
+
+  double value;
+  std::array<double, N> derivatives;
+};
+
+template <unsigned int N>
+inline DualValue<N> operator+(DualValue<N> a, const DualValue<N> &b) {return a += b;}
+template <unsigned int N>
+inline DualValue<N> operator+(DualValue<N> a, double b) {return a += DualValue<N>(b);}
+template <unsigned int N>
+inline DualValue<N> operator+(double a, const DualValue<N> &b) {return b + a;}
+template <unsigned int N>
+inline DualValue<N> operator-(DualValue<N> a, const DualValue<N> &b) {return a -= b;}
+template <unsigned int N>
+inline DualValue<N> operator-(DualValue<N> a, double b) {return a -= DualValue<N>(b);}
+template <unsigned int N>
+inline DualValue<N> operator-(double a, const DualValue<N> &b) {return DualValue<N>(a) -= b;}
+template <unsigned int N>
+inline DualValue<N> operator*(DualValue<N> a, const DualValue<N> &b) {return a *= b;}
+template <unsigned int N>
+inline DualValue<N> operator*(DualValue<N> a, double b) {return a *= b;}
+template <unsigned int N>
+inline DualValue<N> operator*(double a, DualValue<N> b) {return b *= a;}
+template <unsigned int N>
+inline DualValue<N> operator/(DualValue<N> a, const DualValue<N> &b) {return a /= b;}
+template <unsigned int N>
+inline DualValue<N> operator/(DualValue<N> a, double b) {return a /= b;}
+template <unsigned int N>
+inline DualValue<N> operator/(double a, const DualValue<N> &b) {return DualValue<N>(a) /= b;}
+
+template <unsigned int N>
+inline DualValue<N> sqrt(const DualValue<N> &v) {
+  DualValue<N> res(std::sqrt(v.value));
+  for (unsigned int i = 0; i < N; ++i) {
+    res.derivatives[i] = v.derivatives[i] / (2.0 * res.value);
+  }
+  return res;
+}
+
+/**
+ *  Logarithm of the value only, see getLogRatioDerivatives
+ */
+template <unsigned int N>
+inline double log(const DualValue<N> &v) {
+  return std::log(v.value);
+}
+
+/**
+ *  Fill derivatives with the derivatives of log(numerator / denominator)
+ *  in each direction. Clear it for the types without derivatives
+ */
+template <class REAL>
+void getLogRatioDerivatives(const REAL &, const REAL &, std::vector<double> &derivatives)
+{
+  derivatives.clear();
+}
+
+template <unsigned int N>
+void getLogRatioDerivatives(const DualValue<N> &numerator,
+    const DualValue<N> &denominator,
+    std::vector<double> &derivatives)
+{
+  derivatives.resize(N);
+  for (unsigned int i = 0; i < N; ++i) {
+    derivatives[i] = numerator.derivatives[i] / numerator.value
+      - denominator.derivatives[i] / denominator.value;
+  }
+}
+
@@ -6,7 +6,12 @@
 #include <IO/Logger.hpp>
 #include <fstream>
 #include <cmath>
+#include <cassert>
+#include <algorithm>
 
+// bounds enforced by Parameters::ensurePositivity
+const double PARAMETERS_MIN_VALUE = 0.0000001;
+const double PARAMETERS_MAX_VALUE = 1.0;
 
 class Parameters {
 public:
@@ -65,8 +70,8 @@ public:
 
   void ensurePositivity() {
     for (auto &p: _parameters) {
-      p = std::max(0.0000001, p);
-      p = std::min(1.0, p);
+      p = std::max(PARAMETERS_MIN_VALUE, p);
+      p = std::min(PARAMETERS_MAX_VALUE, p);
     }
   }
 
@@ -3,6 +3,7 @@
 std::mt19937_64 Random::_rng;
 std::uniform_int_distribution<int> Random::_unii(0);
 std::uniform_real_distribution<double> Random::_uniproba;
+thread_local Random::Stream *Random::_stream = nullptr;
 
 void Random::setSeed(unsigned int seed)
 {
@@ -10,12 +11,30 @@ void Random::setSeed(unsigned int seed)
 }
 int Random::getInt() 
 {
+  if (_stream) {
+    return std::uniform_int_distribution<int>(0)(_stream->_rng);
+  }
   return _unii(_rng);
 }
 
 double Random::getProba() 
 {
+  if (_stream) {
+    return std::uniform_real_distribution<double>()(_stream->_rng);
+  }
   return _uniproba(_rng);
 }
 
+Random::Stream::Stream(unsigned int seed, unsigned int index):
+  _previous(Random::_stream)
+{
+  std::seed_seq seq{seed, index};
+  _rng.seed(seq);
+  Random::_stream = this;
+}
+
+Random::Stream::~Stream()
+{
+  Random::_stream = _previous;
+}
 
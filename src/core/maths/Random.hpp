@@ -8,8 +8,28 @@ public:
   static int getInt(); 
   static double getProba();
 
+  /**
+   *  Independent random stream, identified by a seed and an index.
+   *  While it is alive, the draws of the thread that created it
+   *  come from this stream instead of the global generator, so that
+   *  the draws can run on several threads and do not depend on 
+   *  the number of threads 
+   */
+  class Stream {
+  public:
+    Stream(unsigned int seed, unsigned int index);
+    ~Stream();
+    Stream(const Stream &) = delete;
+    Stream & operator = (const Stream &) = delete;
+  private:
+    friend class Random;
+    std::mt19937_64 _rng;
+    Stream *_previous;
+  };
+
 private:
   static std::mt19937_64 _rng;
   static std::uniform_int_distribution<int> _unii;
   static std::uniform_real_distribution<double> _uniproba;
+  static thread_local Stream *_stream;
 };
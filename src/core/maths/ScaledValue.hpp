@@ -2,6 +2,7 @@
 
 #include <limits>
 #include <climits>
+#include <cmath>
 #include <iostream>
 
 #define JS_SCALE_FACTOR \
@@ -28,77 +28,154 @@ static void updateLL(Parameters &rates, Evaluations &evaluations) {
   rates.setScore(ll);
 }
 
-static bool lineSearchParameters(Evaluations &evaluations, 
-    Parameters &currentRates, 
-    const Parameters &gradient, 
-    unsigned int &llComputationsLine)
+/**
+ *  Exact gradient of the score with respect to the global rates,
+ *  at the current rates of evaluations
+ *  @return false if the likelihood could not be computed with
+ *  derivatives, in which case the caller must fall back to finite differences
+ */
+static bool updateExactGradient(Evaluations &evaluations, Parameters &gradient)
+{
+  double ll = 0.0;
+  std::vector<double> sumGradient(gradient.dimensions(), 0.0);
+  std::vector<double> familyGradient;
+  for (auto evaluation: evaluations) {
+    ll += evaluation->evaluateWithGradient(familyGradient);
+    assert(familyGradient.size() == sumGradient.size());
+    for (unsigned int i = 0; i < sumGradient.size(); ++i) {
+      sumGradient[i] += familyGradient[i];
+    }
+  }
+  ParallelContext::sumDouble(ll);
+  ParallelContext::sumVectorDouble(sumGradient);
+  if (!isValidLikelihood(ll)) {
+    return false;
+  }
+  for (unsigned int i = 0; i < sumGradient.size(); ++i) {
+    if (!std::isfinite(sumGradient[i])) {
+      return false;
+    }
+    gradient[i] = sumGradient[i];
+  }
+  return true;
+}
+
+/**
+ *  Gradient of the score of rates (which must already be set, and 
+ *  be the last score computed on evaluations) by finite differences,
+ *  one likelihood evaluation per dimension.
+ *  With per-species rates, each evaluation only changes the rates
+ *  of one species node, so that the models without transfers only 
+ *  recompute this node and its ancestors
+ */
+static void updateFiniteDifferencesGradient(const Parameters &rates, 
+    Evaluations &evaluations,
+    unsigned int freeParameters,
+    Parameters &gradient)
 {
-  double alpha = 0.1; 
   double epsilon = 0.0000001;
-  const double minAlpha = epsilon; //(dimensions == 2 ? epsilon : 0.001);
-  const double minImprovement = 0.1;
-  Parameters currentGradient(gradient);
-  bool stop = true;
-  while (alpha > minAlpha) {
-    currentGradient.normalize(alpha);
-    Parameters proposal = currentRates + (currentGradient * alpha);
-    updateLL(proposal, evaluations);
-    llComputationsLine++;
-    if (currentRates.getScore() + minImprovement < proposal.getScore()) {
-      currentRates = proposal;
-      stop = false;
-      alpha *= 1.5;
-    } else {
-      alpha *= 0.5;
-      if (!stop) {
-        return !stop;
+  if (rates.dimensions() == freeParameters) {
+    for (unsigned int i = 0; i < rates.dimensions(); ++i) {
+      Parameters closeRates = rates;
+      closeRates[i] += epsilon;
+      updateLL(closeRates, evaluations);
+      gradient[i] = (rates.getScore() - closeRates.getScore()) / (-epsilon);
+    }
+    return;
+  }
+  unsigned int speciesNumber = rates.dimensions() / freeParameters;
+  for (unsigned int e = 0; e < speciesNumber; ++e) {
+    Parameters speciesRates = rates.getSubParameters(e * freeParameters, freeParameters);
+    for (unsigned int d = 0; d < freeParameters; ++d) {
+      Parameters closeRates = speciesRates;
+      closeRates[d] += epsilon;
+      closeRates.ensurePositivity();
+      double ll = 0.0;
+      for (auto evaluation: evaluations) {
+        evaluation->setRatesForSpecies(e, closeRates);
+        ll += evaluation->evaluate();
       }
+      ParallelContext::sumDouble(ll);
+      if (!isValidLikelihood(ll)) {
+        ll = -std::numeric_limits<double>::infinity();
+      }
+      gradient[e * freeParameters + d] = (rates.getScore() - ll) / (-epsilon);
+    }
+    for (auto evaluation: evaluations) {
+      evaluation->setRatesForSpecies(e, speciesRates);
     }
   }
-  return !stop;
 }
 
-
 Parameters DTLOptimizer::optimizeParameters(PerCoreEvaluations &evaluations,
-    const Parameters &startingParameters)
+    const Parameters &startingParameters,
+    LBFGSBOptimizer *optimizer)
 {
-  double epsilon = 0.0000001;
-  Parameters currentRates = startingParameters;
-  updateLL(currentRates, evaluations);
-  unsigned int llComputationsGrad = 0;
-  unsigned int llComputationsLine = 0;
+  LBFGSBOptimizer localOptimizer;
+  if (!optimizer) {
+    optimizer = &localOptimizer;
+  }
   unsigned int dimensions = startingParameters.dimensions();
-  Parameters gradient(dimensions);
-  do {
-    std::vector<Parameters> closeRates(dimensions, currentRates);
-    for (unsigned int i = 0; i < dimensions; ++i) {
-      Parameters closeRates = currentRates;
-      closeRates[i] += epsilon;
-      updateLL(closeRates, evaluations);
-      llComputationsGrad++;
-      gradient[i] = (currentRates.getScore() - closeRates.getScore()) / (-epsilon);
+  unsigned int freeParameters = 0;
+  unsigned int transfers = 0;
+  if (evaluations.size()) {
+    freeParameters = Enums::freeParameters(evaluations[0]->getRecModel());
+    transfers = evaluations[0]->implementsTransfers() ? 1 : 0;
+  }
+  ParallelContext::maxUInt(freeParameters);
+  ParallelContext::maxUInt(transfers);
+  // the exact gradient is only available for global rates: with 
+  // per-species rates, it would require one derivative direction
+  // per parameter. The dual numbers do not use the vectorized 
+  // kernels: with transfers, one exact gradient costs about ten 
+  // likelihood evaluations, against one per dimension for the
+  // finite differences
+  bool exactGradient = (dimensions == freeParameters) && !transfers;
+  auto score = [&evaluations](Parameters &rates) {
+    updateLL(rates, evaluations);
+  };
+  // rates is always the last point scored by the optimizer
+  auto gradient = [&evaluations, &exactGradient, freeParameters](Parameters &rates, 
+      Parameters &gradient) {
+    if (exactGradient) {
+      exactGradient = updateExactGradient(evaluations, gradient);
+      if (!exactGradient) {
+        Logger::info << "Warning: could not compute the exact rate gradient at " 
+          << rates << ", falling back to finite differences" << std::endl;
+      }
+    }
+    if (!exactGradient) {
+      updateFiniteDifferencesGradient(rates, evaluations, freeParameters, gradient);
     }
-  } while (lineSearchParameters(evaluations, currentRates, gradient, llComputationsLine));
-  return currentRates;
+    return isValidLikelihood(rates.getScore());
+  };
+  return optimizer->maximize(startingParameters, score, gradient);
 }
 
 ModelParameters DTLOptimizer::optimizeModelParameters(PerCoreEvaluations &evaluations,
     bool optimizeFromStartingParameters,
-    const ModelParameters &startingParameters)
+    const ModelParameters &startingParameters,
+    std::vector<LBFGSBOptimizer> *optimizers)
 {
-
+  std::vector<LBFGSBOptimizer> localOptimizers;
+  if (!optimizers) {
+    optimizers = &localOptimizers;
+  }
   ModelParameters res = startingParameters;
   if (!startingParameters.perFamilyRates) {
+    optimizers->resize(1);
     const Parameters *startingRates = optimizeFromStartingParameters ? &startingParameters.rates :  nullptr;
-    res.rates = DTLOptimizer::optimizeParametersGlobalDTL(evaluations, startingRates);
+    res.rates = DTLOptimizer::optimizeParametersGlobalDTL(evaluations, startingRates, &(*optimizers)[0]);
   } else {
+    // one curvature memory per family
+    optimizers->resize(evaluations.size());
     ParallelContext::pushSequentialContext(); // work locally
     for (unsigned int i = 0; i < evaluations.size(); ++i) {
       Parameters localRates = startingParameters.getRates(i);
       const Parameters *startingRates = optimizeFromStartingParameters ? &localRates : nullptr;
       PerCoreEvaluations localEvaluation;
       localEvaluation.push_back(evaluations[i]);
-      localRates = DTLOptimizer::optimizeParametersGlobalDTL(localEvaluation, startingRates);
+      localRates = DTLOptimizer::optimizeParametersGlobalDTL(localEvaluation, startingRates, &(*optimizers)[i]);
       res.setRates(i, localRates);
     }
     ParallelContext::popContext();
@@ -108,7 +185,8 @@ ModelParameters DTLOptimizer::optimizeModelParameters(PerCoreEvaluations &evalua
 
 
 Parameters DTLOptimizer::optimizeParametersGlobalDTL(PerCoreEvaluations &evaluations, 
-    const Parameters *startingParameters)
+    const Parameters *startingParameters,
+    LBFGSBOptimizer *optimizer)
 {
   unsigned int freeParameters = 0;
   if (evaluations.size()) {
@@ -139,7 +217,7 @@ Parameters DTLOptimizer::optimizeParametersGlobalDTL(PerCoreEvaluations &evaluat
   Parameters best;
   best.setScore(-10000000000);
   for (auto rates: startingRates) {
-    Parameters newRates = optimizeParameters(evaluations, rates);
+    Parameters newRates = optimizeParameters(evaluations, rates, optimizer);
     bool stop = (fabs(newRates.getScore() - best.getScore()) < 3.0);
     if (newRates.getScore() > best.getScore()) {
       best = newRates;
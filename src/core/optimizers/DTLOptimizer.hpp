@@ -7,7 +7,9 @@ class PerCoreGeneTrees;
 #include <util/enums.hpp>
 #include <maths/Parameters.hpp>
 #include <maths/ModelParameters.hpp>
+#include <optimizers/LBFGSBOptimizer.hpp>
 #include <memory>
+#include <vector>
 
 class RootedTree;
 
@@ -23,10 +25,13 @@ public:
    *  @param evaluations the subset of functions allocated to the
    *                     current core
    *  @param startingParameters starting parameters
+   *  @param optimizer if set, reuse the curvature information of this
+   *                   optimizer, and update it and its statistics
    *  @return The parameters that maximize the function
    */
   static Parameters optimizeParameters(PerCoreEvaluations &evaluations, 
-      const Parameters &startingParameters);
+      const Parameters &startingParameters,
+      LBFGSBOptimizer *optimizer = nullptr);
  
   /**
    *  Finds the global parameters that maximize evaluations. Global 
@@ -35,17 +40,22 @@ public:
    *                     current core
    *  @param startingParameters if not set, several preselected starting
    *                            parameters will be tried
+   *  @param optimizer see optimizeParameters
    *  @return The parameters that maximize the function
    */
   static Parameters optimizeParametersGlobalDTL(PerCoreEvaluations &evaluations, 
-      const Parameters *startingParameters = nullptr);
+      const Parameters *startingParameters = nullptr,
+      LBFGSBOptimizer *optimizer = nullptr);
 
   /**
    * Same as optimizeParameters, but with a ModelParameters as input.
+   * If optimizers is set, it holds one optimizer (global rates) or one
+   * optimizer per family (per-family rates), reused between the calls
    */
   static ModelParameters optimizeModelParameters(PerCoreEvaluations &evaluations, 
       bool optimizeFromStartingParameters,
-      const ModelParameters &startingParameters);
+      const ModelParameters &startingParameters,
+      std::vector<LBFGSBOptimizer> *optimizers = nullptr);
 
   /**
    * Finds the per-species parameters that maximize  evaluations
@@ -0,0 +1,191 @@
+#include "LBFGSBOptimizer.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+// stop when an iteration improves the score by less than this
+static const double MIN_IMPROVEMENT = 0.1;
+static const unsigned int MAX_ITERATIONS = 100;
+static const unsigned int MAX_BACKTRACKS = 10;
+// sufficient increase constant of the Armijo condition
+static const double ARMIJO = 0.0001;
+// without curvature information, the first step moves the
+// parameters by at most this value
+static const double FIRST_STEP = 0.1;
+
+static double dot(const Parameters &a, const Parameters &b, const std::vector<bool> &isFree)
+{
+  double res = 0.0;
+  for (unsigned int i = 0; i < a.dimensions(); ++i) {
+    if (isFree[i]) {
+      res += a[i] * b[i];
+    }
+  }
+  return res;
+}
+
+static Parameters project(const Parameters &x)
+{
+  Parameters res(x);
+  for (unsigned int i = 0; i < res.dimensions(); ++i) {
+    res[i] = std::min(PARAMETERS_MAX_VALUE, std::max(PARAMETERS_MIN_VALUE, res[i]));
+  }
+  return res;
+}
+
+/**
+ *  The variables at a bound whose gradient points outside of
+ *  the box are fixed for this iteration
+ */
+static std::vector<bool> getFreeVariables(const Parameters &x, const Parameters &gradient)
+{
+  std::vector<bool> isFree(x.dimensions(), true);
+  for (unsigned int i = 0; i < x.dimensions(); ++i) {
+    if ((x[i] <= PARAMETERS_MIN_VALUE && gradient[i] <= 0.0)
+        || (x[i] >= PARAMETERS_MAX_VALUE && gradient[i] >= 0.0)) {
+      isFree[i] = false;
+    }
+  }
+  return isFree;
+}
+
+LBFGSBOptimizer::LBFGSBOptimizer(unsigned int memorySize):
+  _memorySize(memorySize),
+  _iterations(0),
+  _scoreEvaluations(0),
+  _gradientEvaluations(0)
+{
+}
+
+void LBFGSBOptimizer::reset()
+{
+  _s.clear();
+  _y.clear();
+}
+
+void LBFGSBOptimizer::addCurvaturePair(const Parameters &s, const Parameters &y)
+{
+  if (s.dimensions() != y.dimensions() ||
+      (_s.size() && _s.back().dimensions() != s.dimensions())) {
+    reset();
+  }
+  // keep the inverse Hessian approximation positive definite
+  std::vector<bool> all(s.dimensions(), true);
+  if (dot(s, y, all) <= 0.0000000001 * dot(y, y, all)) {
+    return;
+  }
+  _s.push_back(s);
+  _y.push_back(y);
+  if (_s.size() > _memorySize) {
+    _s.pop_front();
+    _y.pop_front();
+  }
+}
+
+void LBFGSBOptimizer::getDirection(const Parameters &gradient,
+    const std::vector<bool> &isFree,
+    Parameters &direction) const
+{
+  // two-loop recursion, restricted to the free variables.
+  // The pairs describe the curvature of -score
+  direction = gradient;
+  for (unsigned int i = 0; i < direction.dimensions(); ++i) {
+    if (!isFree[i]) {
+      direction[i] = 0.0;
+    }
+  }
+  if (_s.empty() || _s.back().dimensions() != gradient.dimensions()) {
+    return;
+  }
+  std::vector<double> alphas(_s.size(), 0.0);
+  std::vector<double> rhos(_s.size(), 0.0);
+  for (int k = static_cast<int>(_s.size()) - 1; k >= 0; --k) {
+    double sy = dot(_s[k], _y[k], isFree);
+    rhos[k] = (sy > 0.0) ? 1.0 / sy : 0.0;
+    alphas[k] = rhos[k] * dot(_s[k], direction, isFree);
+    direction = direction - _y[k] * alphas[k];
+  }
+  double yy = dot(_y.back(), _y.back(), isFree);
+  if (yy > 0.0) {
+    direction = direction * (dot(_s.back(), _y.back(), isFree) / yy);
+  }
+  for (unsigned int k = 0; k < _s.size(); ++k) {
+    double beta = rhos[k] * dot(_y[k], direction, isFree);
+    direction = direction + _s[k] * (alphas[k] - beta);
+  }
+  for (unsigned int i = 0; i < direction.dimensions(); ++i) {
+    if (!isFree[i]) {
+      direction[i] = 0.0;
+    }
+  }
+}
+
+Parameters LBFGSBOptimizer::maximize(const Parameters &start,
+    ScoreFunction score,
+    GradientFunction gradient)
+{
+  Parameters x = project(start);
+  score(x);
+  _scoreEvaluations++;
+  Parameters g(x.dimensions());
+  _gradientEvaluations++;
+  if (!gradient(x, g)) {
+    return x;
+  }
+  for (unsigned int it = 0; it < MAX_ITERATIONS; ++it) {
+    auto isFree = getFreeVariables(x, g);
+    Parameters direction;
+    getDirection(g, isFree, direction);
+    bool withCurvature = !_s.empty();
+    if (dot(direction, g, isFree) <= 0.0) {
+      // not an ascent direction: the curvature pairs are outdated
+      reset();
+      getDirection(g, isFree, direction);
+      withCurvature = false;
+    }
+    double maxComponent = 0.0;
+    for (unsigned int i = 0; i < direction.dimensions(); ++i) {
+      maxComponent = std::max(maxComponent, std::fabs(direction[i]));
+    }
+    if (maxComponent == 0.0) {
+      break; // the projected gradient is null
+    }
+    // projected backtracking line search
+    double step = withCurvature ? 1.0 : FIRST_STEP / maxComponent;
+    bool accepted = false;
+    Parameters proposal;
+    for (unsigned int b = 0; b < MAX_BACKTRACKS && !accepted; ++b, step *= 0.5) {
+      proposal = project(x + direction * step);
+      score(proposal);
+      _scoreEvaluations++;
+      std::vector<bool> all(x.dimensions(), true);
+      double expected = dot(g, proposal - x, all);
+      accepted = proposal.getScore() >= x.getScore() + ARMIJO * expected
+        && proposal.getScore() > x.getScore();
+    }
+    if (!accepted) {
+      if (withCurvature) {
+        // retry from the gradient direction
+        reset();
+        continue;
+      }
+      break;
+    }
+    _iterations++;
+    if (proposal.getScore() - x.getScore() < MIN_IMPROVEMENT) {
+      x = proposal;
+      break;
+    }
+    Parameters newG(x.dimensions());
+    _gradientEvaluations++;
+    if (!gradient(proposal, newG)) {
+      x = proposal;
+      break;
+    }
+    addCurvaturePair(proposal - x, g - newG);
+    x = proposal;
+    g = newG;
+  }
+  return x;
+}
+
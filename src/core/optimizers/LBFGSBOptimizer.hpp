@@ -0,0 +1,70 @@
+#pragma once
+
+#include <maths/Parameters.hpp>
+#include <functional>
+#include <vector>
+#include <deque>
+
+/**
+ *  Bounded limited-memory BFGS maximizer (L-BFGS-B, projected
+ *  active-set variant) over Parameters, within the bounds
+ *  enforced by Parameters::ensurePositivity.
+ *
+ *  The curvature pairs are kept between the maximize calls, so
+ *  that successive optimizations of similar functions (for instance
+ *  the rates after each species tree search round) start with
+ *  a good approximation of the inverse Hessian.
+ */
+class LBFGSBOptimizer {
+public:
+  /**
+   *  Set the score of the parameters
+   */
+  typedef std::function<void(Parameters &)> ScoreFunction;
+  /**
+   *  Fill the gradient of the score at the parameters,
+   *  whose score is already set: it is always called on the
+   *  last parameters passed to the score function
+   *  @return false if the gradient could not be computed
+   */
+  typedef std::function<bool(Parameters &, Parameters &)> GradientFunction;
+
+  LBFGSBOptimizer(unsigned int memorySize = 5);
+
+  /**
+   *  Maximize the score from a starting point
+   *  @param start starting parameters (the score does not need to be set)
+   *  @param score function computing the score
+   *  @param gradient function computing the gradient
+   *  @return The best parameters found, with their score
+   */
+  Parameters maximize(const Parameters &start,
+      ScoreFunction score,
+      GradientFunction gradient);
+
+  /**
+   *  Forget the curvature information
+   */
+  void reset();
+
+  /**
+   *  Statistics accumulated over all the maximize calls
+   */
+  unsigned int getIterations() const {return _iterations;}
+  unsigned int getScoreEvaluations() const {return _scoreEvaluations;}
+  unsigned int getGradientEvaluations() const {return _gradientEvaluations;}
+private:
+  void getDirection(const Parameters &gradient,
+      const std::vector<bool> &isFree,
+      Parameters &direction) const;
+  void addCurvaturePair(const Parameters &s, const Parameters &y);
+
+  unsigned int _memorySize;
+  // last position and gradient differences, oldest first
+  std::deque<Parameters> _s;
+  std::deque<Parameters> _y;
+  unsigned int _iterations;
+  unsigned int _scoreEvaluations;
+  unsigned int _gradientEvaluations;
+};
+
@@ -4,6 +4,7 @@
 #include <IO/FileSystem.hpp>
 #include <routines/Routines.hpp>
 #include <algorithm>
+#include <random>
 #include <trees/TreeDuplicatesFinder.hpp>
 #include <likelihoods/reconciliation_models/UndatedDTLModel.hpp>
 
@@ -23,6 +24,9 @@ SpeciesTreeOptimizer::SpeciesTreeOptimizer(const std::string speciesTreeFile,
     bool userDTLRates,
     bool pruneSpeciesTree,
     double supportThreshold,
+    unsigned int approxLikelihoodSamples,
+    unsigned int fixedPointMaxIterations,
+    double fixedPointEpsilon,
     const std::string &outputDir,
     const std::string &execPath):
   _speciesTree(nullptr),
@@ -33,6 +37,10 @@ SpeciesTreeOptimizer::SpeciesTreeOptimizer(const std::string speciesTreeFile,
   _execPath(execPath),
   _geneTreeIteration(1000000000), // we need to find a better way for avoiding directories collision
   _supportThreshold(supportThreshold),
+  _approxLikelihoodSamples(approxLikelihoodSamples),
+  _approxLikelihoodMargin(0.0),
+  _fixedPointMaxIterations(fixedPointMaxIterations),
+  _fixedPointEpsilon(fixedPointEpsilon),
   _lastRecLL(-std::numeric_limits<double>::infinity()),
   _lastLibpllLL(-std::numeric_limits<double>::infinity()),
   _bestRecLL(-std::numeric_limits<double>::infinity()),
@@ -147,20 +155,18 @@ bool SpeciesTreeOptimizer::testPruning(unsigned int prune,
   bool check = false;
   // Apply the move
   //Logger::info << "Before move " << *_speciesTree << std::endl;
+  _speciesTree->beginTrial();
   auto rollback = SpeciesTreeOperator::applySPRMove(*_speciesTree, prune, regraft);
  // Logger::info << "After move " << *_speciesTree << std::endl;
   _stats.testedTrees++;
   bool canTestMove = true;
   // Discard bad moves with an approximation of the likelihood function
   double approxRecLL;
-  bool needFullRollback = false;
   if (tryApproxFirst) {
     approxRecLL = computeApproxRecLikelihood();
     //Logger::info << approxRecLL << std::endl;
-    if (approxRecLL - _bestRecLL < 0.0) {
+    if (approxRecLL + _approxLikelihoodMargin < _bestRecLL) {
       canTestMove = false;
-    } else {
-      needFullRollback = true;
     }
   }
   if (canTestMove) {
@@ -168,17 +174,15 @@ bool SpeciesTreeOptimizer::testPruning(unsigned int prune,
     _lastRecLL = computeRecLikelihood();
     if (_lastRecLL > _bestRecLL) {
       // Better tree found! keep it and return
+      _speciesTree->acceptTrial();
       newBestTreeCallback();
       return true;
     }
   }
-  // we do not keep the tree
+  // we do not keep the tree: the evaluations swap back
+  // their state instead of recomputing it
   SpeciesTreeOperator::reverseSPRMove(*_speciesTree, prune, rollback);
-  if (needFullRollback) {
-    for (auto &evaluation: _evaluations) {
-      evaluation->rollbackToLastState();
-    }
-  }
+  _speciesTree->revertTrial();
   // ensure that we correctly reverted
   if (check) {
     auto hash2 = _speciesTree->getNodeIndexHash(); 
@@ -258,6 +262,8 @@ double SpeciesTreeOptimizer::fastTransfersRound(MovesBlackList &blacklist)
   Routines::getTransfersFrequencies(speciesTreeFile,
     _currentFamilies,
     _modelRates,
+    _fixedPointMaxIterations,
+    _fixedPointEpsilon,
     frequencies,
     _outputDir);
   unsigned int transfers = 0;
@@ -365,6 +371,7 @@ std::vector<EvaluatedMove> SpeciesTreeOptimizer::getSortedCandidateMoves(unsigne
     std::vector<unsigned int> regrafts;
     SpeciesTreeOperator::getPossibleRegrafts(*_speciesTree, prune, speciesRadius, regrafts);
     for (auto regraft: regrafts) {
+      _speciesTree->beginTrial();
       unsigned int rollback = SpeciesTreeOperator::applySPRMove(*_speciesTree, prune, regraft);
       EvaluatedMove em;
       em.prune = prune;
@@ -372,6 +379,7 @@ std::vector<EvaluatedMove> SpeciesTreeOptimizer::getSortedCandidateMoves(unsigne
       em.ll = computeRecLikelihood();
       evaluatedMoves.push_back(em);
       SpeciesTreeOperator::reverseSPRMove(*_speciesTree, em.prune, rollback);
+      _speciesTree->revertTrial();
     }
   }
   std::sort(evaluatedMoves.begin(), evaluatedMoves.end(), less_than_evaluatedmove());
@@ -434,6 +442,8 @@ double SpeciesTreeOptimizer::transferSearch()
   auto bestLL = computeRecLikelihood();
   Logger::timed << getStepTag(true) << " Starting species transfer search, bestLL=" 
     << bestLL << ")" <<std::endl;
+  // the transfers can be regrafted anywhere
+  validateApproxRecLikelihood(_speciesTree->getTree().getNodesNumber(), _approxLikelihoodSamples);
   double newLL = bestLL;
   MovesBlackList blacklist;
   do {
@@ -454,6 +464,9 @@ double SpeciesTreeOptimizer::sprSearch(unsigned int radius, bool doOptimizeGeneT
   double bestLL = doOptimizeGeneTrees ? computeLikelihood(geneRadius) : computeRecLikelihood();
   Logger::timed << getStepTag(!doOptimizeGeneTrees) << " Starting species SPR search, radius=" 
     << radius << ", bestLL=" << bestLL << ")" <<std::endl;
+  if (!doOptimizeGeneTrees) {
+    validateApproxRecLikelihood(radius, _approxLikelihoodSamples);
+  }
   double newLL = bestLL;
   do {
     bestLL = newLL;
@@ -469,6 +482,20 @@ double SpeciesTreeOptimizer::sprSearch(unsigned int radius, bool doOptimizeGeneT
   return newLL;
 }
   
+/**
+ *  Iterations, likelihood and gradient evaluations of the optimizers
+ */
+static std::vector<unsigned int> getStatistics(const std::vector<LBFGSBOptimizer> &optimizers)
+{
+  std::vector<unsigned int> res(3, 0);
+  for (auto &optimizer: optimizers) {
+    res[0] += optimizer.getIterations();
+    res[1] += optimizer.getScoreEvaluations();
+    res[2] += optimizer.getGradientEvaluations();
+  }
+  return res;
+}
+
 ModelParameters SpeciesTreeOptimizer::computeOptimizedRates() 
 {
   if (_userDTLRates) {
@@ -476,9 +503,20 @@ ModelParameters SpeciesTreeOptimizer::computeOptimizedRates()
   }
   Logger::timed << "optimize rates " << std::endl;
   auto rates = _modelRates;
-  rates =  DTLOptimizer::optimizeModelParameters(_evaluations, !_firstOptimizeRatesCall, rates);
+  std::vector<unsigned int> statistics = getStatistics(_ratesOptimizers);
+  rates =  DTLOptimizer::optimizeModelParameters(_evaluations, !_firstOptimizeRatesCall, rates, &_ratesOptimizers);
+  auto newStatistics = getStatistics(_ratesOptimizers);
+  for (unsigned int i = 0; i < statistics.size(); ++i) {
+    statistics[i] = newStatistics[i] - statistics[i];
+    if (rates.perFamilyRates) {
+      // each rank optimized its own families
+      ParallelContext::sumUInt(statistics[i]);
+    }
+  }
   _firstOptimizeRatesCall = false;
-  Logger::timed << "optimize rates done" << std::endl;
+  Logger::timed << "optimize rates done (" << statistics[0] << " iterations, " 
+    << statistics[1] << " likelihood and " << statistics[2] 
+    << " gradient evaluations)" << std::endl;
   return rates;
 }
   
@@ -521,6 +559,12 @@ double SpeciesTreeOptimizer::optimizeGeneTrees(unsigned int radius)
   unsigned int iterationsNumber = 1;
   bool inPlace = false; 
   bool perFamilyDTLRates = false;
+  unsigned int searchThreads = 1;
+  unsigned int screeningTopK = 0;
+  double screeningDelta = -1.0;
+  bool moveCache = false;
+  bool batchMoves = false;
+  bool safeMode = false;
   assert(perFamilyDTLRates == false);
   if (radius == 1) {
     iterationsNumber = 2;
@@ -530,7 +574,8 @@ double SpeciesTreeOptimizer::optimizeGeneTrees(unsigned int radius)
     Routines::optimizeGeneTrees(_currentFamilies, 
       _modelRates.model, rates.rates, _outputDir, resultName, 
       _execPath, speciesTree, recOpt, perFamilyDTLRates, rootedGeneTree, 
-      _supportThreshold, recWeight, true, true, radius, _geneTreeIteration, 
+      _supportThreshold, recWeight, true, true, radius, searchThreads, screeningTopK, screeningDelta, moveCache, batchMoves, safeMode,
+      _fixedPointMaxIterations, _fixedPointEpsilon, _geneTreeIteration, 
         useSplitImplem, sumElapsedSPR, inPlace);
     _geneTreeIteration++;
     Logger::unmute();
@@ -583,6 +628,54 @@ double SpeciesTreeOptimizer::computeApproxRecLikelihood()
   return ll;
 }
 
+double SpeciesTreeOptimizer::validateApproxRecLikelihood(unsigned int radius, unsigned int samples)
+{
+  if (!Enums::implementsApproxLikelihood(_modelRates.model) || !samples) {
+    return _approxLikelihoodMargin;
+  }
+  std::vector<std::pair<unsigned int, unsigned int> > moves;
+  std::vector<unsigned int> prunes;
+  SpeciesTreeOperator::getPossiblePrunes(*_speciesTree, prunes);
+  for (auto prune: prunes) {
+    std::vector<unsigned int> regrafts;
+    SpeciesTreeOperator::getPossibleRegrafts(*_speciesTree, prune, radius, regrafts);
+    for (auto regraft: regrafts) {
+      moves.push_back(std::make_pair(prune, regraft));
+    }
+  }
+  // fixed seed: all the ranks must sample the same moves
+  std::shuffle(moves.begin(), moves.end(), std::mt19937(42));
+  moves.resize(std::min(moves.size(), static_cast<size_t>(samples)));
+  if (moves.empty()) {
+    return _approxLikelihoodMargin;
+  }
+  // the approximation starts from the CLVs of an exact computation
+  computeRecLikelihood();
+  std::vector<double> errors;
+  for (auto &move: moves) {
+    _speciesTree->beginTrial();
+    auto rollback = SpeciesTreeOperator::applySPRMove(*_speciesTree, move.first, move.second);
+    auto approxLL = computeApproxRecLikelihood();
+    errors.push_back(computeRecLikelihood() - approxLL);
+    SpeciesTreeOperator::reverseSPRMove(*_speciesTree, move.first, rollback);
+    _speciesTree->revertTrial();
+  }
+  std::sort(errors.begin(), errors.end());
+  double sum = 0.0;
+  for (auto error: errors) {
+    sum += error;
+  }
+  auto n = errors.size();
+  Logger::timed << "Approximated reconciliation likelihood error (exact - approx) on " 
+    << n << " SPR moves: min=" << errors.front() 
+    << " mean=" << sum / static_cast<double>(n)
+    << " median=" << errors[n / 2] 
+    << " 90%=" << errors[n * 9 / 10] 
+    << " max=" << errors.back() << std::endl;
+  _approxLikelihoodMargin = std::max(0.0, errors.back());
+  return _approxLikelihoodMargin;
+}
+
 void SpeciesTreeOptimizer::newBestTreeCallback()
 {
   saveCurrentSpeciesTreeId();
@@ -594,7 +687,9 @@ void SpeciesTreeOptimizer::newBestTreeCallback()
 void SpeciesTreeOptimizer::setGeneTreesFromFamilies(const Families &families)
 {
   _geneTrees = std::make_unique<PerCoreGeneTrees>(families);
-  //TreeDuplicatesFinder::findDuplicates(*_geneTrees);
+  auto duplicates = std::make_shared<TreeDuplicates>();
+  TreeDuplicatesFinder::findDuplicates(*_geneTrees, *duplicates);
+  _treeDuplicates = duplicates;
   updateEvaluations();
 }
   
@@ -606,8 +701,10 @@ void SpeciesTreeOptimizer::updateEvaluations()
   for (unsigned int i = 0; i < trees.size(); ++i) {
     auto &tree = trees[i];
     _evaluations[i] = std::make_shared<ReconciliationEvaluation>(_speciesTree->getTree(), *tree.geneTree, tree.mapping, _modelRates.model, false, _pruneSpeciesTree);
+    _evaluations[i]->setFixedPointParameters(_fixedPointMaxIterations, _fixedPointEpsilon);
     _evaluations[i]->setRates(_modelRates.getRates(i));
     _evaluations[i]->setPartialLikelihoodMode(PartialLikelihoodMode::PartialSpecies);
+    _evaluations[i]->setTreeDuplicates(_treeDuplicates, i);
   }
 }
 
@@ -618,5 +715,19 @@ void SpeciesTreeOptimizer::onSpeciesTreeChange(const std::unordered_set<pll_rnod
   }
 }
 
+void SpeciesTreeOptimizer::onSpeciesTreeTrialBegin()
+{
+  for (auto &evaluation: _evaluations) {
+    evaluation->beginSpeciesTreeTrial();
+  }
+}
+
+void SpeciesTreeOptimizer::onSpeciesTreeTrialEnd(bool revert)
+{
+  for (auto &evaluation: _evaluations) {
+    evaluation->endSpeciesTreeTrial(revert);
+  }
+}
+
 
 
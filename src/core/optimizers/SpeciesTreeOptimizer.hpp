@@ -2,12 +2,14 @@
 
 #include <trees/SpeciesTree.hpp>
 #include <parallelization/PerCoreGeneTrees.hpp>
+#include <trees/TreeDuplicatesFinder.hpp>
 #include <string>
 #include <maths/Parameters.hpp>
 #include <util/enums.hpp>
 #include <IO/Families.hpp>
 #include <memory>
 #include <maths/ModelParameters.hpp>
+#include <optimizers/LBFGSBOptimizer.hpp>
 
 struct EvaluatedMove {
   unsigned int prune;
@@ -26,15 +28,15 @@ struct SpeciesSearchStats {
   unsigned int acceptedTransfers;
   SpeciesSearchStats() { reset(); }
 
-  friend std::ostream& operator<<(std::ostream& os , const SpeciesSearchStats &) {
+  friend std::ostream& operator<<(std::ostream& os , const SpeciesSearchStats &stats) {
     /*
     os << "Tested trees: " << stats.testedTrees << std::endl;
     os << "Accepted trees: " << stats.acceptedTrees << std::endl;
     os << "Tested transfers: " << stats.testedTransfers << std::endl;
     os << "Accepted transfers trees: " << stats.acceptedTransfers << std::endl;
     */
-    //os << "Approx likelihood calls: " << stats.approxLikelihoodCalls << std::endl;
-    //os << "Exact likelihood calls: " << stats.exactLikelihoodCalls << std::endl;
+    os << "Approx likelihood calls: " << stats.approxLikelihoodCalls << std::endl;
+    os << "Exact likelihood calls: " << stats.exactLikelihoodCalls << std::endl;
     return os;
   }
   void reset() {
@@ -57,6 +59,9 @@ public:
       bool userDTLRates,
       bool pruneSpeciesTree,
       double supportThreshold,
+      unsigned int approxLikelihoodSamples,
+      unsigned int fixedPointMaxIterations,
+      double fixedPointEpsilon,
       const std::string &outputDir,
       const std::string &execPath);
   
@@ -68,6 +73,8 @@ public:
   virtual ~SpeciesTreeOptimizer(); 
     
   virtual void onSpeciesTreeChange(const std::unordered_set<pll_rnode_t *> *nodesToInvalidate);
+  virtual void onSpeciesTreeTrialBegin();
+  virtual void onSpeciesTreeTrialEnd(bool revert);
 
   void rootExhaustiveSearch(bool doOptimizeGeneTrees);
   double fastTransfersRound(MovesBlackList &blacklist);
@@ -94,12 +101,26 @@ public:
   double computeRecLikelihood();
   double computeApproxRecLikelihood();
 
+  /**
+   *  Validation mode of the approximated reconciliation likelihood
+   *  used to discard the bad SPR moves: compare it to the exact
+   *  likelihood on a sample of SPR moves, log the error distribution,
+   *  and use the largest underestimation as the screening margin
+   *  @param radius the SPR radius of the sampled moves
+   *  @param samples the maximum number of sampled moves
+   *  @return the new screening margin
+   */
+  double validateApproxRecLikelihood(unsigned int radius, unsigned int samples);
+
   const Parameters getGlobalRates() {return _globalRates;}
 
 private:
   std::unique_ptr<SpeciesTree> _speciesTree;
   std::unique_ptr<PerCoreGeneTrees> _geneTrees;
   PerCoreEvaluations _evaluations; 
+  // identical gene subtrees of the families of this rank,
+  // whose CLVs are shared by the evaluations
+  std::shared_ptr<const TreeDuplicates> _treeDuplicates;
   Families _initialFamilies;
   Families _currentFamilies;
   RecModel _recModel;
@@ -107,6 +128,12 @@ private:
   std::string _execPath;
   unsigned int _geneTreeIteration;
   double _supportThreshold;
+  unsigned int _approxLikelihoodSamples;
+  // measured upper bound of exact - approximated likelihood
+  double _approxLikelihoodMargin;
+  // see ReconciliationEvaluation::setFixedPointParameters
+  unsigned int _fixedPointMaxIterations;
+  double _fixedPointEpsilon;
   double _lastRecLL;
   double _lastLibpllLL;
   double _bestRecLL;
@@ -117,6 +144,8 @@ private:
   bool _pruneSpeciesTree;
   Parameters _globalRates;
   ModelParameters _modelRates;
+  // keep the curvature information between rate optimizations
+  std::vector<LBFGSBOptimizer> _ratesOptimizers;
 private:
   ModelParameters computeOptimizedRates(); 
   void updateEvaluations();
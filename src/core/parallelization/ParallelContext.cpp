@@ -102,6 +102,24 @@ unsigned int ParallelContext::getSize()
   return 1;
 #endif
 }
+
+unsigned int ParallelContext::getLocalSize() 
+{
+#ifdef WITH_MPI
+  if (!_mpiEnabled) {
+    return 1;
+  }
+  MPI_Comm localComm;
+  MPI_Comm_split_type(getComm(), MPI_COMM_TYPE_SHARED, 
+      static_cast<int>(getRank()), MPI_INFO_NULL, &localComm);
+  int size = 0;
+  MPI_Comm_size(localComm, &size);
+  MPI_Comm_free(&localComm);
+  return static_cast<unsigned int>(size);
+#else
+  return 1;
+#endif
+}
   
 void ParallelContext::setOwnMPIContext(bool own)
 {
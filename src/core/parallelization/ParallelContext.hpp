@@ -38,6 +38,11 @@ public:
    */
   static unsigned int getSize();
 
+  /**
+   *  @return the number of MPI ranks running on the node of this rank
+   */
+  static unsigned int getLocalSize();
+
   /**
    * Gather the values of each rank into a global std::vector
    *  @param localValue input value for this rank
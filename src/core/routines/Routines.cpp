@@ -14,6 +14,8 @@
 #include <routines/scheduled_routines/RaxmlMaster.hpp>
 #include <routines/scheduled_routines/GeneRaxMaster.hpp>
 #include <maths/Random.hpp>
+#include <util/ScenarioBatch.hpp>
+#include <thread>
 
 
 void Routines::runRaxmlOptimization(Families &families,
@@ -45,6 +47,14 @@ void Routines::optimizeGeneTrees(Families &families,
     bool enableRec,
     bool enableLibpll,
     unsigned int sprRadius,
+    unsigned int searchThreads,
+    unsigned int screeningTopK,
+    double screeningDelta,
+    bool moveCache,
+    bool batchMoves,
+    bool safeMode,
+    unsigned int fixedPointMaxIterations,
+    double fixedPointEpsilon,
     unsigned int iteration,
     bool schedulerSplitImplem,
     long &elapsed,
@@ -65,6 +75,14 @@ void Routines::optimizeGeneTrees(Families &families,
       enableRec,
       enableLibpll,
       sprRadius,
+      searchThreads,
+      screeningTopK,
+      screeningDelta,
+      moveCache,
+      batchMoves,
+      safeMode,
+      fixedPointMaxIterations,
+      fixedPointEpsilon,
       iteration,
       schedulerSplitImplem,
       elapsed,
@@ -76,6 +94,8 @@ void Routines::optimizeRates(bool userDTLRates,
     RecModel recModel,
     bool rootedGeneTree,
     bool pruneSpeciesTree,
+    unsigned int fixedPointMaxIterations,
+    double fixedPointEpsilon,
     Families &families,
     bool perSpeciesRates, 
     Parameters &rates,
@@ -93,7 +113,8 @@ void Routines::optimizeRates(bool userDTLRates,
   }
   PLLRootedTree speciesTree(speciesTreeFile);
   PerCoreEvaluations evaluations;
-  buildEvaluations(geneTrees, speciesTree, recModel, rootedGeneTree, pruneSpeciesTree, evaluations);
+  buildEvaluations(geneTrees, speciesTree, recModel, rootedGeneTree, pruneSpeciesTree, 
+      fixedPointMaxIterations, fixedPointEpsilon, evaluations);
   if (perSpeciesRates) {
     rates = DTLOptimizer::optimizeParametersPerSpecies(evaluations, speciesTree.getNodesNumber());
   } else {
@@ -121,10 +142,23 @@ static std::string getTransfersFile(const std::string &outputDir, const std::str
   return res;
 }
 
+/**
+ *  Number of threads for the reconciliation sampling: 
+ *  the ranks of a node share its cores.
+ *  Collective call: all ranks must call it
+ */
+static unsigned int getSamplingThreads()
+{
+  auto cores = std::thread::hardware_concurrency();
+  return std::max(1u, cores / ParallelContext::getLocalSize());
+}
+
 void Routines::inferReconciliation(
     const std::string &speciesTreeFile,
     Families &families,
     const ModelParameters &modelRates,
+    unsigned int fixedPointMaxIterations,
+    double fixedPointEpsilon,
     const std::string &outputDir,
     bool bestReconciliation,
     unsigned int reconciliationSamples,
@@ -138,6 +172,7 @@ void Routines::inferReconciliation(
   std::string reconciliationsDir = FileSystem::joinPaths(outputDir, "reconciliations");
   FileSystem::mkdir(reconciliationsDir, true);
   std::vector<double> dup_count(speciesTree.getNodesNumber(), 0.0);
+  auto samplingThreads = getSamplingThreads();
   ParallelContext::barrier();
   for (unsigned int i = 0; i  < geneTrees.getTrees().size(); ++i) {
     auto &tree = geneTrees.getTrees()[i];
@@ -152,6 +187,7 @@ void Routines::inferReconciliation(
           tree.name + "_reconciliated.xml");
       Scenario scenario;
       ReconciliationEvaluation evaluation(speciesTree, *tree.geneTree, tree.mapping, modelRates.model, true);
+      evaluation.setFixedPointParameters(fixedPointMaxIterations, fixedPointEpsilon);
       evaluation.setRates(modelRates.getRates(i));
       evaluation.inferMLScenario(scenario);
       if (!saveTransfersOnly) {
@@ -165,20 +201,23 @@ void Routines::inferReconciliation(
       scenario.saveTransfers(transfersFile, false);
     }
     if (reconciliationSamples) {
-      Scenario scenario;
       ReconciliationEvaluation evaluation(speciesTree, *tree.geneTree, tree.mapping, modelRates.model, true);
+      evaluation.setFixedPointParameters(fixedPointMaxIterations, fixedPointEpsilon);
       evaluation.setRates(modelRates.getRates(i));
+      // the CLVs are filled once for all the samples
+      ScenarioBatch samples;
+      auto seed = static_cast<unsigned int>(Random::getInt());
+      evaluation.sampleScenarios(reconciliationSamples, seed, samples, samplingThreads);
       std::string nhxSamples = FileSystem::joinPaths(reconciliationsDir, tree.name + "_samples.nhx");
       ParallelOfstream nhxOs(nhxSamples, false);
-      for (unsigned int i = 0; i < reconciliationSamples; ++i) {
-        bool stochastic = true;
-        evaluation.inferMLScenario(scenario, stochastic);
+      for (unsigned int i = 0; i < samples.size(); ++i) {
+        Scenario scenario;
+        samples.fillScenario(i, scenario);
         std::string transfersFile = getTransfersFile(outputDir, tree.name, i);
         if (!saveTransfersOnly) {
           scenario.saveReconciliation(nhxOs, ReconciliationFormat::NHX);
         }
         scenario.saveTransfers(transfersFile, false);
-        scenario.resetBlackList();
         nhxOs << "\n";
       }
     }
@@ -364,40 +403,41 @@ void mpiMergeTransferFrequencies(TransferFrequencies &frequencies,
 void Routines::getTransfersFrequencies(const std::string &speciesTreeFile,
     Families &families,
     const ModelParameters &modelRates,
+    unsigned int fixedPointMaxIterations,
+    double fixedPointEpsilon,
     TransferFrequencies &transferFrequencies,
     const std::string &outputDir)
 {
-  int samples = 5;
-  inferReconciliation(speciesTreeFile, families, modelRates, outputDir, false, samples, true);
-  
-  SpeciesTree speciesTree(speciesTreeFile);
-  for (int i = 0; i < samples; ++i) {
-    auto begin = ParallelContext::getBegin(families.size());
-    auto end = ParallelContext::getEnd(families.size());
-    for (unsigned int j = begin; j < end; ++j) {
-      auto &family = families[j];
-      std::string transfersFile = getTransfersFile(outputDir, family.name, i);
-      std::string line;
-      std::ifstream is(transfersFile);
-      if (!is.good()) {
-        Logger::info << "ERROR " << transfersFile << std::endl;
-      }
-      assert(is.good());
-      while (std::getline(is, line))
-      {
-        std::istringstream iss(line);
-        std::string label1;
-        std::string label2;
-        iss >> label1 >> label2;
-        std::string key = getTransferKey(label1, label2);
-        if (transferFrequencies.end() == transferFrequencies.find(key)) {
-          transferFrequencies.insert(std::pair<std::string, unsigned int>(key, 1));
-        } else {
-          transferFrequencies[key]++;
+  unsigned int samples = 5;
+  auto consistentSeed = Random::getInt();
+  ParallelContext::barrier();
+  PLLRootedTree speciesTree(speciesTreeFile);
+  PerCoreGeneTrees geneTrees(families);
+  auto threads = getSamplingThreads();
+  // count the transfers of the sampled scenarios 
+  // in memory, instead of writing and parsing them
+  ScenarioBatch batch;
+  for (unsigned int i = 0; i < geneTrees.getTrees().size(); ++i) {
+    auto &tree = geneTrees.getTrees()[i];
+    ReconciliationEvaluation evaluation(speciesTree, *tree.geneTree, tree.mapping, modelRates.model, true);
+    evaluation.setFixedPointParameters(fixedPointMaxIterations, fixedPointEpsilon);
+    evaluation.setRates(modelRates.getRates(i));
+    auto seed = static_cast<unsigned int>(Random::getInt());
+    evaluation.sampleScenarios(samples, seed, batch, threads);
+    auto nodes = batch.getSpeciesTree()->nodes;
+    for (unsigned int s = 0; s < batch.size(); ++s) {
+      for (auto event = batch.beginEvents(s); event != batch.endEvents(s); ++event) {
+        if (event->type != ReconciliationEventType::EVENT_T 
+            && event->type != ReconciliationEventType::EVENT_TL) {
+          continue;
         }
+        std::string key = getTransferKey(nodes[event->speciesNode]->label, 
+            nodes[event->destSpeciesNode]->label);
+        transferFrequencies[key]++;
       }
     }
   }
+  Random::setSeed(consistentSeed);
   mpiMergeTransferFrequencies(transferFrequencies, outputDir);
   ParallelContext::barrier();
   Logger::timed <<"Finished writing transfers frequencies" << std::endl;
@@ -432,6 +472,8 @@ void Routines::buildEvaluations(PerCoreGeneTrees &geneTrees,
     RecModel recModel, 
     bool rootedGeneTree, 
     bool pruneSpeciesTree, 
+    unsigned int fixedPointMaxIterations,
+    double fixedPointEpsilon,
     Evaluations &evaluations)
 {
   auto &trees = geneTrees.getTrees();
@@ -444,6 +486,7 @@ void Routines::buildEvaluations(PerCoreGeneTrees &geneTrees,
         recModel, 
         rootedGeneTree, 
         pruneSpeciesTree);
+    evaluations[i]->setFixedPointParameters(fixedPointMaxIterations, fixedPointEpsilon);
   }
 }
 
@@ -58,6 +58,14 @@ public:
     bool enableRec,
     bool enableLibpll,
     unsigned int sprRadius,
+    unsigned int searchThreads,
+    unsigned int screeningTopK,
+    double screeningDelta,
+    bool moveCache,
+    bool batchMoves,
+    bool safeMode,
+    unsigned int fixedPointMaxIterations,
+    double fixedPointEpsilon,
     unsigned int iteration,
     bool schedulerSplitImplem,
     long &elapsed,
@@ -71,6 +79,8 @@ public:
     RecModel recModel,
     bool rootedGeneTree,
     bool pruneSpeciesTree,
+    unsigned int fixedPointMaxIterations,
+    double fixedPointEpsilon,
     Families &families,
     bool perSpeciesRates, 
     Parameters &rates,
@@ -79,6 +89,8 @@ public:
   static void getTransfersFrequencies(const std::string &speciesTreeFile,
     Families &families,
     const ModelParameters &modelRates,
+    unsigned int fixedPointMaxIterations,
+    double fixedPointEpsilon,
     TransferFrequencies &frequencies,
     const std::string &outputDir);
   
@@ -99,6 +111,8 @@ public:
     const std::string &speciesTreeFile,
     Families &families,
     const ModelParameters &modelRates,
+    unsigned int fixedPointMaxIterations,
+    double fixedPointEpsilon,
     const std::string &outputDir,
     bool bestReconciliation,
     unsigned int reconciliationSamples,
@@ -137,6 +151,8 @@ public:
     RecModel recModel, 
     bool rootedGeneTree, 
     bool pruneSpeciesTree, 
+    unsigned int fixedPointMaxIterations,
+    double fixedPointEpsilon,
     Evaluations &evaluations);
 
 private:
@@ -29,6 +29,14 @@ void GeneRaxMaster::optimizeGeneTrees(Families &families,
     bool enableRec,
     bool enableLibpll,
     unsigned int sprRadius,
+    unsigned int searchThreads,
+    unsigned int screeningTopK,
+    double screeningDelta,
+    bool moveCache,
+    bool batchMoves,
+    bool safeMode,
+    unsigned int fixedPointMaxIterations,
+    double fixedPointEpsilon,
     unsigned int iteration,
     bool schedulerSplitImplem,
     long &elapsed,
@@ -88,6 +96,14 @@ void GeneRaxMaster::optimizeGeneTrees(Families &families,
     os << static_cast<int>(enableRec)  << " ";
     os << static_cast<int>(enableLibpll)  << " ";
     os << sprRadius  << " ";
+    os << searchThreads  << " ";
+    os << screeningTopK  << " ";
+    os << screeningDelta  << " ";
+    os << static_cast<int>(moveCache)  << " ";
+    os << static_cast<int>(batchMoves)  << " ";
+    os << static_cast<int>(safeMode)  << " ";
+    os << fixedPointMaxIterations  << " ";
+    os << fixedPointEpsilon  << " ";
     os << geneTreePath << " ";
     os << outputStats <<  std::endl;
     family.startingGeneTree = geneTreePath;
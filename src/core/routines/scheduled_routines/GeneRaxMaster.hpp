@@ -26,6 +26,14 @@ public:
     bool enableRec,
     bool enableLibpll,
     unsigned int sprRadius,
+    unsigned int searchThreads,
+    unsigned int screeningTopK,
+    double screeningDelta,
+    bool moveCache,
+    bool batchMoves,
+    bool safeMode,
+    unsigned int fixedPointMaxIterations,
+    double fixedPointEpsilon,
     unsigned int iteration,
     bool schedulerSplitImplem,
     long &elapsed,
@@ -10,6 +10,9 @@
 #include <maths/Parameters.hpp>
 #include <trees/JointTree.hpp>
 #include <search/SPRSearch.hpp>
+#include <search/MoveEvaluationPool.hpp>
+#include <search/MoveScreening.hpp>
+#include <search/SPRMoveCache.hpp>
 #include <IO/FileSystem.hpp>
 #include <IO/ParallelOfstream.hpp>
 #include <../../ext/MPIScheduler/src/mpischeduler.hpp>
@@ -49,6 +52,14 @@ static void optimizeGeneTreesSlave(const std::string &startingGeneTreeFile,
     bool enableRec,
     bool enableLibpll,
     int sprRadius,
+    unsigned int searchThreads,
+    unsigned int screeningTopK,
+    double screeningDelta,
+    bool moveCache,
+    bool batchMoves,
+    bool safeMode,
+    unsigned int fixedPointMaxIterations,
+    double fixedPointEpsilon,
     const std::string &outputGeneTree,
     const std::string &outputStats) 
 {
@@ -58,7 +69,8 @@ static void optimizeGeneTreesSlave(const std::string &startingGeneTreeFile,
   getTreeStrings(startingGeneTreeFile, geneTreeStrings);
   assert(geneTreeStrings.size() == 1);
   Parameters ratesVector(ratesFile);
-  auto jointTree = std::make_unique<JointTree>(geneTreeStrings[0],
+  auto createJointTree = [&]() {
+    auto res = std::make_unique<JointTree>(geneTreeStrings[0],
       alignmentFile,
       speciesTreeFile,
       mappingFile,
@@ -68,10 +80,15 @@ static void optimizeGeneTreesSlave(const std::string &startingGeneTreeFile,
       rootedGeneTree,
       supportThreshold,
       recWeight,
-      false, //check
+      safeMode, //check
       perFamilyDTLRates, // optimize DTL
       ratesVector
       );
+    res->getReconciliationEvaluation().setFixedPointParameters(
+        fixedPointMaxIterations, fixedPointEpsilon);
+    return res;
+  };
+  auto jointTree = createJointTree();
   jointTree->enableReconciliation(enableRec);
   jointTree->enableLibpll(enableLibpll);
   Logger::info << "Taxa number: " << jointTree->getGeneTaxaNumber() << std::endl;
@@ -80,7 +97,19 @@ static void optimizeGeneTreesSlave(const std::string &startingGeneTreeFile,
   jointTree->printLoglk();
   Logger::info << "Initial ll = " << bestLoglk << std::endl;
   if (sprRadius > 0) {
-    while(SPRSearch::applySPRRound(*jointTree, sprRadius, bestLoglk, true)) {} 
+    // a random starting tree can not be built again with 
+    // the same node indices for the worker threads
+    if (geneTreeStrings[0] == "__random__") {
+      searchThreads = 1;
+    }
+    std::unique_ptr<MoveEvaluationPool> pool;
+    if (searchThreads > 1) {
+      pool = std::make_unique<MoveEvaluationPool>(createJointTree, searchThreads);
+    }
+    MoveScreening screening(screeningTopK, screeningDelta);
+    SPRMoveCache cache;
+    while(SPRSearch::applySPRRound(*jointTree, sprRadius, bestLoglk, true, 
+          pool.get(), &screening, moveCache ? &cache : nullptr, batchMoves)) {} 
   }
   jointTree->printLoglk();
   if (outputGeneTree.size() && ParallelContext::getRank() == 0) {
@@ -100,6 +129,15 @@ static void optimizeGeneTreesSlave(const std::string &startingGeneTreeFile,
     }
     stats.close();
   }
+  auto &reconciliationEvaluation = jointTree->getReconciliationEvaluation();
+  Logger::info << "Reconciliation CLV precision: " 
+    << Enums::getPrecisionName(reconciliationEvaluation.getPrecision()) << std::endl;
+  if (reconciliationEvaluation.implementsTransfers()) {
+    Logger::info << "Average fixed-point iterations: " 
+      << reconciliationEvaluation.getAverageCLVIterations() << " per CLV update, "
+      << reconciliationEvaluation.getAverageExtinctionIterations() 
+      << " per extinction probabilities computation" << std::endl;
+  }
   Logger::timed << "End of optimizing gene tree" << std::endl;
   ParallelContext::barrier();
 }
@@ -111,7 +149,7 @@ static std::string getArg(const std::string &str)
 
 int GeneRaxSlave::optimizeGeneTreesMain(int argc, char** argv, void* comm)
 {
-  assert(argc == 19);
+  assert(argc == 27);
   ParallelContext::init(comm);
   Logger::timed << "Starting optimizeGeneTreesSlave" << std::endl;
   int i = 2;
@@ -131,6 +169,14 @@ int GeneRaxSlave::optimizeGeneTreesMain(int argc, char** argv, void* comm)
   bool enableRec = bool(atoi(argv[i++]));
   bool enableLibpll = bool(atoi(argv[i++]));
   int sprRadius = atoi(argv[i++]);
+  unsigned int searchThreads = static_cast<unsigned int>(atoi(argv[i++]));
+  unsigned int screeningTopK = static_cast<unsigned int>(atoi(argv[i++]));
+  double screeningDelta = double(atof(argv[i++]));
+  bool moveCache = bool(atoi(argv[i++]));
+  bool batchMoves = bool(atoi(argv[i++]));
+  bool safeMode = bool(atoi(argv[i++]));
+  unsigned int fixedPointMaxIterations = static_cast<unsigned int>(atoi(argv[i++]));
+  double fixedPointEpsilon = double(atof(argv[i++]));
   std::string outputGeneTree(argv[i++]);
   std::string outputStats(argv[i++]);
   optimizeGeneTreesSlave(startingGeneTreeFile,
@@ -148,6 +194,14 @@ int GeneRaxSlave::optimizeGeneTreesMain(int argc, char** argv, void* comm)
       enableRec,
       enableLibpll,
       sprRadius,
+      searchThreads,
+      screeningTopK,
+      screeningDelta,
+      moveCache,
+      batchMoves,
+      safeMode,
+      fixedPointMaxIterations,
+      fixedPointEpsilon,
       outputGeneTree,
       outputStats);
   ParallelContext::finalize();
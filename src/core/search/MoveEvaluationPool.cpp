@@ -0,0 +1,97 @@
+#include "MoveEvaluationPool.hpp"
+#include <trees/JointTree.hpp>
+
+
+MoveEvaluationPool::MoveEvaluationPool(const JointTreeFactory &factory,
+    unsigned int threads):
+  _task(nullptr),
+  _syncWorkers(false),
+  _syncedTree(nullptr),
+  _syncedStateVersion(0),
+  _batch(0),
+  _pendingWorkers(0),
+  _stop(false)
+{
+  for (unsigned int i = 1; i < threads; ++i) {
+    _workerTrees.push_back(factory());
+  }
+  for (unsigned int i = 0; i < _workerTrees.size(); ++i) {
+    _threads.push_back(std::thread(&MoveEvaluationPool::workerLoop, this, i));
+  }
+}
+
+MoveEvaluationPool::~MoveEvaluationPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stop = true;
+  }
+  _batchReady.notify_all();
+  for (auto &thread: _threads) {
+    thread.join();
+  }
+}
+
+void MoveEvaluationPool::run(JointTree &jointTree, const Task &task)
+{
+  // for instance, the screening and the evaluation of the 
+  // same moves run on the same tree
+  bool sync = (&jointTree != _syncedTree) 
+    || (jointTree.getStateVersion() != _syncedStateVersion);
+  // the copies only read jointTree: they must be done before
+  // the calling thread starts modifying it
+  if (sync) {
+    for (auto &workerTree: _workerTrees) {
+      workerTree->copyStateFrom(jointTree);
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _task = &task;
+    _syncWorkers = sync;
+    _pendingWorkers = static_cast<unsigned int>(_workerTrees.size());
+    ++_batch;
+  }
+  _batchReady.notify_all();
+  task(jointTree, 0);
+  std::unique_lock<std::mutex> lock(_mutex);
+  _batchDone.wait(lock, [this]() {return _pendingWorkers == 0;});
+  _task = nullptr;
+  // the tasks rolled back their moves
+  _syncedTree = &jointTree;
+  _syncedStateVersion = jointTree.getStateVersion();
+}
+
+void MoveEvaluationPool::workerLoop(unsigned int worker)
+{
+  auto &workerTree = *_workerTrees[worker];
+  unsigned long lastBatch = 0;
+  while (true) {
+    const Task *task = nullptr;
+    bool sync = false;
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _batchReady.wait(lock, [&]() {return _stop || _batch != lastBatch;});
+      if (_stop) {
+        return;
+      }
+      lastBatch = _batch;
+      task = _task;
+      sync = _syncWorkers;
+    }
+    // recompute all the CLVs, so that the moves only update
+    // the CLVs they invalidate
+    if (sync) {
+      workerTree.computeJointLoglk();
+    }
+    (*task)(workerTree, worker + 1);
+    bool done = false;
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      done = (--_pendingWorkers == 0);
+    }
+    if (done) {
+      _batchDone.notify_one();
+    }
+  }
+}
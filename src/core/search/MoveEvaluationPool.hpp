@@ -0,0 +1,75 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class JointTree;
+
+/**
+ *  Threads to test the moves of a search in parallel inside a rank.
+ *  Each additional thread works on its own JointTree, built with the
+ *  same inputs as the searched tree (and thus with the same node
+ *  indices) and synchronized with it before a batch of moves if 
+ *  the searched tree changed since the previous batch.
+ *  The calling thread works on the searched tree itself.
+ *  The threads are started once, and wait for the next batch 
+ *  of moves between two calls to run.
+ */
+class MoveEvaluationPool {
+public:
+  typedef std::function<std::unique_ptr<JointTree>()> JointTreeFactory;
+  typedef std::function<void(JointTree &tree, unsigned int thread)> Task;
+
+  /**
+   *  @param factory builds a JointTree from the inputs of the searched tree
+   *  @param threads total number of threads, including the calling one
+   */
+  MoveEvaluationPool(const JointTreeFactory &factory, unsigned int threads);
+  ~MoveEvaluationPool();
+
+  MoveEvaluationPool(const MoveEvaluationPool &) = delete;
+  MoveEvaluationPool & operator = (const MoveEvaluationPool &) = delete;
+
+  unsigned int getThreadsNumber() const {
+    return static_cast<unsigned int>(_workerTrees.size()) + 1;
+  }
+
+  /**
+   *  Synchronize the worker trees with jointTree if its state 
+   *  changed since the last call, and run task(tree, thread) on 
+   *  each thread (thread 0 being the calling thread, with 
+   *  tree = jointTree). Returns when all the tasks are done.
+   *  The tasks must leave the trees in their initial state 
+   *  (by rolling back the moves they apply).
+   */
+  void run(JointTree &jointTree, const Task &task);
+
+private:
+  void workerLoop(unsigned int worker);
+
+  std::vector<std::unique_ptr<JointTree> > _workerTrees;
+  std::vector<std::thread> _threads;
+  std::mutex _mutex;
+  // signals a new batch (or the end) to the workers
+  std::condition_variable _batchReady;
+  // signals the end of the batch to the calling thread
+  std::condition_variable _batchDone;
+  const Task *_task;
+  // true if the workers must recompute their CLVs 
+  // before the current batch
+  bool _syncWorkers;
+  // tree and state (see JointTree::getStateVersion) that 
+  // the worker trees are synchronized with
+  const JointTree *_syncedTree;
+  unsigned long _syncedStateVersion;
+  // incremented at each batch
+  unsigned long _batch;
+  // workers that did not finish the current batch
+  unsigned int _pendingWorkers;
+  bool _stop;
+};
+
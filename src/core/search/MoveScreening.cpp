@@ -0,0 +1,62 @@
+#include "MoveScreening.hpp"
+#include <IO/Logger.hpp>
+#include <algorithm>
+#include <numeric>
+
+MoveScreening::MoveScreening(unsigned int topK, double delta):
+  _topK(topK),
+  _delta(delta),
+  _rounds(0),
+  _topOneHits(0),
+  _maxScreeningRank(0),
+  _screened(0),
+  _evaluated(0)
+{
+}
+
+void MoveScreening::selectMoves(const std::vector<double> &scores,
+    std::vector<unsigned int> &selected,
+    std::vector<unsigned int> &screeningRanks) const
+{
+  auto size = static_cast<unsigned int>(scores.size());
+  std::vector<unsigned int> order(size);
+  std::iota(order.begin(), order.end(), 0);
+  // on ties, the first moves come first
+  std::stable_sort(order.begin(), order.end(), [&scores](unsigned int a, unsigned int b) {
+      return scores[a] > scores[b];
+  });
+  screeningRanks.resize(size);
+  selected.clear();
+  for (unsigned int rank = 0; rank < size; ++rank) {
+    auto move = order[rank];
+    screeningRanks[move] = rank;
+    bool inTopK = rank < _topK;
+    bool inDelta = _delta >= 0.0 && scores[move] >= scores[order[0]] - _delta;
+    if (inTopK || inDelta) {
+      selected.push_back(move);
+    }
+  }
+  std::sort(selected.begin(), selected.end());
+}
+
+void MoveScreening::addRound(unsigned int screened,
+    unsigned int evaluated,
+    unsigned int bestMoveScreeningRank)
+{
+  _screened += screened;
+  _evaluated += evaluated;
+  Logger::info << "Move screening: fully evaluated " << evaluated
+    << "/" << screened << " moves";
+  if (bestMoveScreeningRank != static_cast<unsigned int>(-1)) {
+    _rounds++;
+    _topOneHits += (bestMoveScreeningRank == 0);
+    _maxScreeningRank = std::max(_maxScreeningRank, bestMoveScreeningRank);
+    Logger::info << ", best move screening rank " << bestMoveScreeningRank;
+  } else {
+    Logger::info << ", no better move";
+  }
+  Logger::info << " (since start: top-1 hit rate " << _topOneHits << "/" << _rounds
+    << ", max best move screening rank " << _maxScreeningRank
+    << ", fully evaluated " << _evaluated << "/" << _screened << ")" << std::endl;
+}
+
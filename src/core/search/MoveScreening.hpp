@@ -0,0 +1,66 @@
+#pragma once
+
+#include <vector>
+
+/**
+ *  Two-stage evaluation of the moves of a search round (see
+ *  SearchUtils::findBestMove). All the moves are first screened:
+ *  they are scored with the reconciliation likelihood plus the
+ *  libpll likelihood without branch length optimization. Only the
+ *  best screened moves are then fully evaluated (branch length
+ *  optimization and joint likelihood).
+ *
+ *  The selection is done on the scores of the moves of all the
+ *  ranks, and the selected moves are then split between the ranks.
+ *  It also keeps statistics to tune the parameters: the screening
+ *  rank of the best move of each round tells how deep in the
+ *  screening order the selection had to go.
+ */
+class MoveScreening {
+public:
+  /**
+   *  @param topK fully evaluate the topK best screened moves (0: none)
+   *  @param delta also fully evaluate the moves with a screening
+   *    score within delta of the best one (negative: none)
+   */
+  MoveScreening(unsigned int topK = 0, double delta = -1.0);
+
+  /**
+   *  Without any criterion, all the moves are fully evaluated
+   */
+  bool isEnabled() const {return _topK > 0 || _delta >= 0.0;}
+
+  /**
+   *  Select the moves to fully evaluate
+   *  @param scores screening scores of the moves
+   *  @param selected indices (in scores) of the moves to fully
+   *    evaluate, in increasing order
+   *  @param screeningRanks rank of each move in the decreasing
+   *    order of the screening scores
+   */
+  void selectMoves(const std::vector<double> &scores,
+      std::vector<unsigned int> &selected,
+      std::vector<unsigned int> &screeningRanks) const;
+
+  /**
+   *  Record the statistics of a round and log them
+   *  @param screened number of screened moves (all ranks)
+   *  @param evaluated number of fully evaluated moves (all ranks)
+   *  @param bestMoveScreeningRank screening rank of the best
+   *    move, or -1 if no move improved the likelihood
+   */
+  void addRound(unsigned int screened,
+      unsigned int evaluated,
+      unsigned int bestMoveScreeningRank);
+
+private:
+  unsigned int _topK;
+  double _delta;
+  // statistics over the rounds with an improving move
+  unsigned int _rounds;
+  unsigned int _topOneHits;
+  unsigned int _maxScreeningRank;
+  unsigned long _screened;
+  unsigned long _evaluated;
+};
+
@@ -26,14 +26,29 @@ std::unique_ptr<Move> Move::createSPRMove(unsigned int pruneIndex,
 }
 
 
+// the CLVs of the region of a move, in all their directions
+static void invalidateBranches(JointTree &tree,
+    const std::vector<pll_unode_t *> &branches)
+{
+  for (auto branch: branches) {
+    tree.invalidateLibpllCLV(branch);
+    tree.invalidateLibpllCLV(branch->back);
+  }
+}
+
+/**
+ *  Optimize the branches one by one, with the treeinfo rooted at
+ *  the optimized branch. All the branches are in the region of the
+ *  move, whose CLVs are invalid: each incremental likelihood
+ *  computation only updates this region and reuses the other CLVs.
+ *  The region is invalidated again after each branch length change.
+ */
 static void optimizeBranchesSlow(JointTree &tree,
     const std::vector<pll_unode_t *> &nodesToOptimize)
 {
     auto root = tree.getTreeInfo()->root;
-    // could be incremental and thus faster
     unsigned int params_indices[4] = {0,0,0,0};
     auto treeinfo = tree.getTreeInfo();
-    tree.computeLibpllLoglk(); // update CLVs
     for (unsigned int j = 0; j < 2; ++j) {
       for (unsigned int i = 0; i < nodesToOptimize.size(); ++i) {
           pllmod_treeinfo_set_root(treeinfo, nodesToOptimize[i]);
@@ -49,6 +64,7 @@ static void optimizeBranchesSlow(JointTree &tree,
               0,
               true);
          assert(oldLoglk <= newLoglk);
+         invalidateBranches(tree, nodesToOptimize);
       }
     }
     pllmod_treeinfo_set_root(treeinfo, root);
@@ -69,6 +85,9 @@ std::unique_ptr<Rollback> SPRMove::applyMove(JointTree &tree)
   auto regraft = tree.getNode(regraftIndex_);
   assert (prune && prune->next);
   assert (regraft && regraft);
+  // the reconciliation CLVs overwritten from now on can be
+  // restored by the rollback
+  tree.getReconciliationEvaluation().beginCLVJournal();
   tree.invalidateCLV(prune->next->back);
   tree.invalidateCLV(prune->next->next);
   tree.invalidateCLV(prune->next);
@@ -81,7 +100,9 @@ std::unique_ptr<Rollback> SPRMove::applyMove(JointTree &tree)
   }
   pll_tree_rollback_t pll_rollback;
   std::vector<SavedBranch> savedBranches;
-    
+  // the move might have been applied to another tree 
+  // (see MoveEvaluationPool) and not optimized
+  branchesToOptimize_.clear();
   branchesToOptimize_.push_back(prune);
   branchesToOptimize_.push_back(regraft->back);
   branchesToOptimize_.push_back(regraft);
@@ -109,6 +130,13 @@ void SPRMove::optimizeMove(JointTree &tree)
   branchesToOptimize_.clear();
 }
 
+pll_unode_t *SPRMove::getLocalRoot(JointTree &tree)
+{
+  // after the move, the pruned node is between 
+  // the two invalidated regraft nodes
+  return tree.getNode(pruneIndex_);
+}
+
 std::ostream& SPRMove::print(std::ostream & os) const {
   os << "SPR(";
   os << "prune:" <<pruneIndex_ << ", regraft:" << regraftIndex_;
@@ -20,6 +20,13 @@ public:
   virtual std::unique_ptr<Rollback> applyMove(JointTree &tree) = 0;
   
   virtual void optimizeMove(JointTree &tree) = 0;
+
+  /**
+   *  Node in the region modified by the move, once applied: the
+   *  libpll likelihood can be incrementally computed from there
+   *  (see JointTree::computeLocalLibpllLoglk)
+   */
+  virtual pll_unode_t *getLocalRoot(JointTree &tree) = 0;
     
   friend std::ostream & operator <<( std::ostream &os, const Move &move ) {
     return move.print(os);
@@ -34,6 +41,7 @@ public:
   virtual ~SPRMove() {}
   virtual std::unique_ptr<Rollback> applyMove(JointTree &tree);
   virtual void optimizeMove(JointTree &tree);
+  virtual pll_unode_t *getLocalRoot(JointTree &tree);
   virtual std::ostream& print(std::ostream & os) const;
 private:
   unsigned int pruneIndex_;
@@ -22,5 +22,8 @@ void SPRRollback::applyRollback() {
   tree_.invalidateCLV(regraft);
   tree_.invalidateCLV(regraft->back);
   tree_.setRoot(root_);
+  // restore the reconciliation CLVs saved since the move, if possible.
+  // Else, the invalidated CLVs are recomputed at the next evaluation
+  tree_.getReconciliationEvaluation().rollbackCLVJournal();
 }
 
@@ -0,0 +1,23 @@
+#include "SPRMoveCache.hpp"
+
+bool SPRMoveCache::isNonImproving(unsigned int pruneIndex,
+    unsigned int regraftIndex,
+    size_t localHash) const
+{
+  auto it = _entries.find(getKey(pruneIndex, regraftIndex));
+  if (it == _entries.end() || it->second.localHash != localHash) {
+    return false;
+  }
+  return it->second.loglkDiff <= 0.0;
+}
+
+void SPRMoveCache::setLoglkDiff(unsigned int pruneIndex,
+    unsigned int regraftIndex,
+    size_t localHash,
+    double loglkDiff)
+{
+  auto &entry = _entries[getKey(pruneIndex, regraftIndex)];
+  entry.localHash = localHash;
+  entry.loglkDiff = loglkDiff;
+}
+
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <unordered_map>
+
+/**
+ *  Likelihood changes of the SPR moves tested in the previous rounds
+ *  of a search. A move is identified by its prune and regraft nodes
+ *  and by a hash of the topology and of the branch lengths around it
+ *  (see SPRSearch::applySPRRound). A move that did not improve the
+ *  likelihood, and whose neighbourhood did not change since it was
+ *  tested, is only tested again if no other move of the round
+ *  improves the likelihood.
+ *
+ *  The cache must be cleared when the model parameters change.
+ */
+class SPRMoveCache {
+public:
+  SPRMoveCache() {}
+
+  void clear() {_entries.clear();}
+
+  /**
+   *  @return true if the move was tested with the same local
+   *  topology and did not improve the likelihood
+   */
+  bool isNonImproving(unsigned int pruneIndex,
+      unsigned int regraftIndex,
+      size_t localHash) const;
+
+  /**
+   *  Save the likelihood change of a tested move
+   */
+  void setLoglkDiff(unsigned int pruneIndex,
+      unsigned int regraftIndex,
+      size_t localHash,
+      double loglkDiff);
+
+private:
+  struct Entry {
+    size_t localHash;
+    double loglkDiff;
+  };
+  static unsigned long getKey(unsigned int pruneIndex, unsigned int regraftIndex) {
+    return (static_cast<unsigned long>(pruneIndex) << 32) | regraftIndex;
+  }
+  std::unordered_map<unsigned long, Entry> _entries;
+};
+
@@ -2,11 +2,15 @@
 #include <trees/JointTree.hpp>
 #include <search/Moves.hpp>
 #include <search/SearchUtils.hpp>
+#include <search/SPRMoveCache.hpp>
 #include <IO/Logger.hpp>
 #include <parallelization/ParallelContext.hpp>
 
 #include <unordered_set>
 #include <array>
+#include <functional>
+#include <cmath>
+#include <algorithm>
 
 struct SPRMoveDesc {
   SPRMoveDesc(unsigned int prune, unsigned int regraft, const std::vector<unsigned int> &edges):
@@ -88,11 +92,177 @@ static void getRegrafts(JointTree &jointTree, unsigned int pruneIndex, int maxRa
   getRegraftsRec(pruneIndex, pruneNode->next->next->back, maxRadius, supportThreshold, path, moves);
 }
 
-bool SPRSearch::applySPRRound(JointTree &jointTree, int radius, double &bestLoglk, bool blo) {
+// save the likelihood changes of the fully evaluated moves
+static void updateCache(SPRMoveCache &cache,
+    const std::vector<const SPRMoveDesc *> &descs,
+    const std::vector<size_t> &hashes,
+    const std::vector<double> &loglkDiffs)
+{
+  for (unsigned int i = 0; i < loglkDiffs.size(); ++i) {
+    if (!std::isnan(loglkDiffs[i])) {
+      cache.setLoglkDiff(descs[i]->pruneIndex, descs[i]->regraftIndex, 
+          hashes[i], loglkDiffs[i]);
+    }
+  }
+}
+
+static void hashCombine(size_t &hash, size_t value)
+{
+  hash ^= value + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+}
+
+// hash the topology and the branch lengths of the subtree 
+// pointed by node, up to the given depth
+static void localHashRec(pll_unode_t *node, unsigned int depth, size_t &hash)
+{
+  hashCombine(hash, node->node_index);
+  hashCombine(hash, node->back->node_index);
+  hashCombine(hash, std::hash<double>()(node->length));
+  auto back = node->back;
+  if (depth && back->next) {
+    localHashRec(back->next, depth - 1, hash);
+    localHashRec(back->next->next, depth - 1, hash);
+  }
+}
+
+// hash of the neighbourhood of an SPR move: a move with the same
+// hash as in a previous round has the same local topology and 
+// branch lengths
+static size_t getLocalHash(JointTree &jointTree, const SPRMoveDesc &move)
+{
+  const unsigned int depth = 2;
+  size_t hash = 0;
+  auto prune = jointTree.getNode(move.pruneIndex);
+  localHashRec(prune, depth, hash);
+  localHashRec(prune->next, depth, hash);
+  localHashRec(prune->next->next, depth, hash);
+  auto regraft = jointTree.getNode(move.regraftIndex);
+  localHashRec(regraft, depth, hash);
+  localHashRec(regraft->back, depth, hash);
+  for (auto nodeIndex: move.path) {
+    auto node = jointTree.getNode(nodeIndex);
+    hashCombine(hash, node->node_index);
+    hashCombine(hash, node->back->node_index);
+    hashCombine(hash, std::hash<double>()(node->length));
+  }
+  return hash;
+}
+
+static void addTriplet(pll_unode_t *node, std::vector<unsigned int> &region)
+{
+  region.push_back(node->node_index);
+  if (node->next) {
+    region.push_back(node->next->node_index);
+    region.push_back(node->next->next->node_index);
+  }
+}
+
+// nodes whose neighbours or branch lengths might be changed by the move
+static void getMoveRegion(JointTree &jointTree, const SPRMoveDesc &move,
+    std::vector<unsigned int> &region)
+{
+  auto prune = jointTree.getNode(move.pruneIndex);
+  addTriplet(prune, region);
+  addTriplet(prune->back, region);
+  addTriplet(prune->next->back, region);
+  addTriplet(prune->next->next->back, region);
+  auto regraft = jointTree.getNode(move.regraftIndex);
+  addTriplet(regraft, region);
+  addTriplet(regraft->back, region);
+  for (auto nodeIndex: move.path) {
+    auto node = jointTree.getNode(nodeIndex);
+    addTriplet(node, region);
+    addTriplet(node->back, region);
+  }
+}
+
+// Apply together the improving moves whose regions do not overlap, 
+// in decreasing order of likelihood improvement. The batch is kept 
+// if it improves bestLoglk (the likelihood of the best single move),
+// and rolled back otherwise
+static bool applyMoveBatch(JointTree &jointTree,
+    std::vector<std::unique_ptr<Move> > &moves,
+    const std::vector<const SPRMoveDesc *> &descs,
+    const std::vector<double> &loglkDiffs,
+    bool blo,
+    double &bestLoglk)
+{
+  std::vector<unsigned int> improving;
+  for (unsigned int i = 0; i < loglkDiffs.size(); ++i) {
+    if (!std::isnan(loglkDiffs[i]) && loglkDiffs[i] > 0.0) {
+      improving.push_back(i);
+    }
+  }
+  std::stable_sort(improving.begin(), improving.end(), [&loglkDiffs](unsigned int a, unsigned int b) {
+      return loglkDiffs[a] > loglkDiffs[b];
+  });
+  std::vector<bool> usedNodes(jointTree.getTreeInfo()->subnode_count, false);
+  std::vector<unsigned int> batch;
+  std::vector<unsigned int> region;
+  for (auto i: improving) {
+    region.clear();
+    getMoveRegion(jointTree, *descs[i], region);
+    bool overlaps = false;
+    for (auto node: region) {
+      overlaps |= usedNodes[node];
+    }
+    if (!overlaps) {
+      for (auto node: region) {
+        usedNodes[node] = true;
+      }
+      batch.push_back(i);
+    }
+  }
+  if (batch.size() < 2) {
+    return false;
+  }
+  bool check = jointTree.isSafeMode();
+  double initialLoglk = check ? jointTree.computeJointLoglk() : 0.0;
+  for (auto i: batch) {
+    jointTree.applyMove(*moves[i]);
+    if (blo) {
+      jointTree.optimizeMove(*moves[i]);
+    }
+  }
+  double loglk = jointTree.computeJointLoglk();
+  Logger::info << "Batch of " << batch.size() << " improving moves: ll=" << loglk 
+    << " (best move ll=" << bestLoglk << ")";
+  if (loglk > bestLoglk) {
+    Logger::info << ", accepted" << std::endl;
+    jointTree.acceptMoves();
+    bestLoglk = loglk;
+    return true;
+  }
+  Logger::info << ", rejected" << std::endl;
+  for (unsigned int i = 0; i < batch.size(); ++i) {
+    jointTree.rollbackLastMove();
+  }
+  if (check) {
+    auto rbLoglk = jointTree.computeJointLoglk();
+    if (fabs(initialLoglk - rbLoglk) > 0.000001) {
+      std::cerr.precision(17);
+      std::cerr << "batch rollback lead to different likelihoods: " << initialLoglk
+        << " " << rbLoglk << std::endl;
+      std::cerr << " rank " << ParallelContext::getRank() << std::endl;
+      exit(1);
+    }
+  }
+  return false;
+}
+
+bool SPRSearch::applySPRRound(JointTree &jointTree, int radius, double &bestLoglk, bool blo,
+    MoveEvaluationPool *pool, MoveScreening *screening, SPRMoveCache *cache, bool batch) {
   std::vector<unsigned int> allNodes;
   getAllPruneIndices(jointTree, allNodes);
   std::vector<SPRMoveDesc> potentialMoves;
   std::vector<std::unique_ptr<Move> > allMoves;
+  // moves not tested in the first pass, because the cache 
+  // tells that they do not improve the likelihood
+  std::vector<std::unique_ptr<Move> > skippedMoves;
+  std::vector<const SPRMoveDesc *> allDescs;
+  std::vector<const SPRMoveDesc *> skippedDescs;
+  std::vector<size_t> allHashes;
+  std::vector<size_t> skippedHashes;
   for (unsigned int i = 0; i < allNodes.size(); ++i) {
       auto pruneIndex = allNodes[i];
       getRegrafts(jointTree, pruneIndex, radius, potentialMoves);
@@ -121,25 +291,71 @@ bool SPRSearch::applySPRRound(JointTree &jointTree, int radius, double &bestLogl
       redundantNNIMoves[nniBranchIndex][nniType] = true; 
     }
 
-    allMoves.push_back(std::move(Move::createSPRMove(pruneIndex, regraftIndex, move.path)));
+    auto localHash = cache ? getLocalHash(jointTree, move) : 0;
+    auto newMove = Move::createSPRMove(pruneIndex, regraftIndex, move.path);
+    if (cache && cache->isNonImproving(pruneIndex, regraftIndex, localHash)) {
+      skippedMoves.push_back(std::move(newMove));
+      skippedDescs.push_back(&move);
+      skippedHashes.push_back(localHash);
+    } else {
+      allMoves.push_back(std::move(newMove));
+      allDescs.push_back(&move);
+      allHashes.push_back(localHash);
+    }
   }
   
   Logger::info << "Start SPR round " 
     << "(std::hash=" << jointTree.getUnrootedTreeHash() << ", (best ll=" 
-    << bestLoglk << ", radius=" << radius << ", possible moves: " << allMoves.size() << ")"
-    << std::endl;
+    << bestLoglk << ", radius=" << radius << ", possible moves: " 
+    << allMoves.size() + skippedMoves.size();
+  if (cache) {
+    auto total = allMoves.size() + skippedMoves.size();
+    Logger::info << ", reused scores: " << skippedMoves.size() 
+      << " (" << (total ? 100.0 * skippedMoves.size() / total : 0.0) << "%)";
+  }
+  Logger::info << ")" << std::endl;
   unsigned int bestMoveIndex = static_cast<unsigned int>(-1);
+  std::vector<double> loglkDiffs;
   auto foundBetterMove = SearchUtils::findBestMove(jointTree, 
       allMoves, 
       bestLoglk, 
       bestMoveIndex, 
       blo, 
-      jointTree.isSafeMode()); 
+      jointTree.isSafeMode(),
+      pool,
+      screening,
+      (cache || batch) ? &loglkDiffs : nullptr); 
+  if (cache) {
+    updateCache(*cache, allDescs, allHashes, loglkDiffs);
+  }
+  if (!foundBetterMove && skippedMoves.size()) {
+    // the skipped moves are only approximately non-improving:
+    // test them before concluding that the search converged
+    Logger::info << "No better move, testing the " << skippedMoves.size() 
+      << " moves with reused scores" << std::endl;
+    foundBetterMove = SearchUtils::findBestMove(jointTree, 
+        skippedMoves, 
+        bestLoglk, 
+        bestMoveIndex, 
+        blo, 
+        jointTree.isSafeMode(),
+        pool,
+        screening,
+        &loglkDiffs); 
+    updateCache(*cache, skippedDescs, skippedHashes, loglkDiffs);
+    allMoves.swap(skippedMoves);
+    allDescs.swap(skippedDescs);
+  }
+  if (foundBetterMove && batch 
+      && applyMoveBatch(jointTree, allMoves, allDescs, loglkDiffs, blo, bestLoglk)) {
+    return true;
+  }
   if (foundBetterMove) {
     jointTree.applyMove(*allMoves[bestMoveIndex]);
     if (blo) {
       jointTree.optimizeMove(*allMoves[bestMoveIndex]);
     }
+    jointTree.acceptMoves();
     double ll = jointTree.computeJointLoglk();
     double error = fabs(ll - bestLoglk);
     if (error > 0.01) {
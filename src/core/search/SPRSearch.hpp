@@ -1,11 +1,16 @@
 #pragma once
 
 class JointTree;
+class MoveEvaluationPool;
+class MoveScreening;
+class SPRMoveCache;
 
 class SPRSearch {
 public:
   virtual ~SPRSearch() {}
     static void applySPRSearch(JointTree &jointTree);
-    static bool applySPRRound(JointTree &jointTree, int radius, double &bestLoglk, bool blo = true);
+    static bool applySPRRound(JointTree &jointTree, int radius, double &bestLoglk, bool blo = true,
+        MoveEvaluationPool *pool = nullptr, MoveScreening *screening = nullptr,
+        SPRMoveCache *cache = nullptr, bool batch = false);
 };
 
@@ -2,6 +2,11 @@
 #include <trees/JointTree.hpp>
 #include <parallelization/ParallelContext.hpp>
 #include <IO/Logger.hpp>
+#include <search/MoveEvaluationPool.hpp>
+#include <search/MoveScreening.hpp>
+#include <atomic>
+#include <functional>
+#include <limits>
 
 
 
@@ -43,20 +48,64 @@ void SearchUtils::testMove(JointTree &jointTree,
   if (blo) {
     jointTree.optimizeMove(move);
   }
-  newLoglk = recLoglk +  jointTree.computeLibpllLoglk(false);
+  auto localLibpllLoglk = jointTree.computeLocalLibpllLoglk(move.getLocalRoot(jointTree));
+  if (check) {
+    checkLocalLibpllLoglk(jointTree, move, localLibpllLoglk);
+  }
+  newLoglk = recLoglk + localLibpllLoglk;
   jointTree.rollbackLastMove();
   if(check) {
-    auto rbLoglk = jointTree.computeJointLoglk();
-    if (fabs(initialLoglk - rbLoglk) > 0.000001) {
-      jointTree.printLoglk();
-      std::cerr.precision(17);
-      std::cerr << "rollback lead to different likelihoods: " << initialLoglk
-        << " " << rbLoglk << std::endl;
-      std::cerr << "recomputing the ll again: " << jointTree.computeJointLoglk() << std::endl;
-      std::cerr << " rank " << ParallelContext::getRank() << std::endl;
-      std::cerr << "Move: " << move << std::endl;
-      exit(1);
-    }
+    checkRollback(jointTree, move, initialLoglk);
+  }
+}
+
+double SearchUtils::screenMove(JointTree &jointTree,
+    Move &move,
+    double initialLoglk,
+    bool check)
+{
+  jointTree.applyMove(move);
+  auto localLibpllLoglk = jointTree.computeLocalLibpllLoglk(move.getLocalRoot(jointTree));
+  if (check) {
+    checkLocalLibpllLoglk(jointTree, move, localLibpllLoglk);
+  }
+  double loglk = jointTree.computeReconciliationLoglk() + localLibpllLoglk;
+  jointTree.rollbackLastMove();
+  if (check) {
+    checkRollback(jointTree, move, initialLoglk);
+  }
+  return loglk;
+}
+
+void SearchUtils::checkRollback(JointTree &jointTree,
+    Move &move,
+    double initialLoglk)
+{
+  auto rbLoglk = jointTree.computeJointLoglk();
+  if (fabs(initialLoglk - rbLoglk) > 0.000001) {
+    jointTree.printLoglk();
+    std::cerr.precision(17);
+    std::cerr << "rollback lead to different likelihoods: " << initialLoglk
+      << " " << rbLoglk << std::endl;
+    std::cerr << "recomputing the ll again: " << jointTree.computeJointLoglk() << std::endl;
+    std::cerr << " rank " << ParallelContext::getRank() << std::endl;
+    std::cerr << "Move: " << move << std::endl;
+    exit(1);
+  }
+}
+
+void SearchUtils::checkLocalLibpllLoglk(JointTree &jointTree,
+    Move &move,
+    double localLoglk)
+{
+  auto loglk = jointTree.computeLibpllLoglk(false);
+  if (fabs(localLoglk - loglk) > 0.000001) {
+    std::cerr.precision(17);
+    std::cerr << "incremental libpll likelihood differs from the full one: " << localLoglk
+      << " " << loglk << std::endl;
+    std::cerr << " rank " << ParallelContext::getRank() << std::endl;
+    std::cerr << "Move: " << move << std::endl;
+    exit(1);
   }
 }
 
@@ -67,13 +116,15 @@ bool SearchUtils::findBestMove(JointTree &jointTree,
     double &bestLoglk,
     unsigned int &bestMoveIndex,
     bool blo,
-    bool check)
+    bool check,
+    MoveEvaluationPool *pool,
+    MoveScreening *screening,
+    std::vector<double> *loglkDiffs)
 {
   bestMoveIndex = static_cast<unsigned int>(-1);
   double initialLoglk = bestLoglk; //jointTree.computeJointLoglk();
   double initialReconciliationLoglk = jointTree.computeReconciliationLoglk();
   double initialLibpllLoglk = jointTree.computeLibpllLoglk();
-  double averageReconciliationDiff = 0;
   double error = fabs(initialLoglk - 
       (initialReconciliationLoglk + initialLibpllLoglk));
   if (error > 0.01)
@@ -95,33 +146,110 @@ bool SearchUtils::findBestMove(JointTree &jointTree,
     }
   }
 #endif
-  for (auto i = begin; i < end; ++i) {
-    auto loglk = bestLoglk;
-    SearchUtils::testMove(jointTree, *allMoves[i], 
+  // indices of the moves that this rank fully evaluates, and 
+  // screening rank of each move (over all the ranks)
+  std::vector<unsigned int> toEvaluate;
+  std::vector<unsigned int> screeningRanks;
+  unsigned int threads = pool ? pool->getThreadsNumber() : 1;
+  // call f(tree, thread, i) for i in [0, tasks), the 
+  // threads pulling the tasks from a shared counter
+  auto runTasks = [&](unsigned int tasks, 
+      const std::function<void(JointTree &, unsigned int, unsigned int)> &f) {
+    std::atomic<unsigned int> nextTask(0);
+    auto pullTasks = [&](JointTree &tree, unsigned int thread) {
+      for (auto i = nextTask++; i < tasks; i = nextTask++) {
+        f(tree, thread, i);
+      }
+    };
+    if (pool) {
+      pool->run(jointTree, pullTasks);
+    } else {
+      pullTasks(jointTree, 0);
+    }
+  };
+  bool screen = blo && screening && screening->isEnabled();
+  if (screen) {
+    // each rank screens its moves, and the moves to evaluate are
+    // selected from the scores of all the ranks
+    std::vector<double> scores(allMoves.size(), 0.0);
+    runTasks(end - begin, [&](JointTree &tree, unsigned int, unsigned int i) {
+      scores[begin + i] = screenMove(tree, *allMoves[begin + i], initialLoglk, check);
+    });
+    if (scores.size()) {
+      ParallelContext::sumVectorDouble(scores);
+    }
+    std::vector<unsigned int> selected;
+    screening->selectMoves(scores, selected, screeningRanks);
+    // all the ranks have the same tree: the selected 
+    // moves are split between them
+    auto selectedBegin = ParallelContext::getBegin(static_cast<unsigned int>(selected.size()));
+    auto selectedEnd = ParallelContext::getEnd(static_cast<unsigned int>(selected.size()));
+    toEvaluate.assign(selected.begin() + selectedBegin, selected.begin() + selectedEnd);
+  } else {
+    for (unsigned int i = begin; i < end; ++i) {
+      toEvaluate.push_back(i);
+    }
+  }
+  // each thread keeps its own best move
+  std::vector<double> threadBestLoglk(threads, initialLoglk);
+  std::vector<unsigned int> threadBestMoveIndex(threads, bestMoveIndex);
+  std::vector<double> averageReconciliationDiff(threads, 0.0);
+  // likelihood changes, and 1.0 for the tested moves
+  std::vector<double> diffs(loglkDiffs ? allMoves.size() : 0, 0.0);
+  std::vector<double> tested(diffs.size(), 0.0);
+  auto evaluated = static_cast<unsigned int>(toEvaluate.size());
+  runTasks(evaluated, [&](JointTree &tree, unsigned int thread, unsigned int task) {
+    auto i = toEvaluate[task];
+    auto loglk = initialLoglk;
+    SearchUtils::testMove(tree, *allMoves[i], 
         initialReconciliationLoglk,
         initialLibpllLoglk, 
-        averageReconciliationDiff,
+        averageReconciliationDiff[thread],
         loglk,
         blo,
         check);
-    if (loglk > bestLoglk) {
-      bestLoglk = loglk;
-      bestMoveIndex = i;
+    if (loglkDiffs) {
+      diffs[i] = loglk - initialLoglk;
+      tested[i] = 1.0;
     }
-#ifdef STOP
-    if ((begin - i) % 1 == 0) {
-      ParallelContext::getMax(bestLoglk, bestRank);
-      ParallelContext::broadcastUInt(bestRank, bestMoveIndex);
-      if (bestMoveIndex != static_cast<unsigned int>(-1)) {
-        return true;
+    if (loglk > threadBestLoglk[thread]) {
+      threadBestLoglk[thread] = loglk;
+      threadBestMoveIndex[thread] = i;
+    }
+  });
+  if (loglkDiffs) {
+    if (diffs.size()) {
+      ParallelContext::sumVectorDouble(diffs);
+      ParallelContext::sumVectorDouble(tested);
+    }
+    for (unsigned int i = 0; i < diffs.size(); ++i) {
+      if (tested[i] == 0.0) {
+        diffs[i] = std::numeric_limits<double>::quiet_NaN();
       }
     }
-#endif
+    *loglkDiffs = diffs;
+  }
+  // local reduction: on ties, keep the first move, as 
+  // a sequential search would do
+  for (unsigned int t = 0; t < threads; ++t) {
+    if (threadBestLoglk[t] > bestLoglk || (threadBestLoglk[t] == bestLoglk
+          && threadBestMoveIndex[t] < bestMoveIndex)) {
+      bestLoglk = threadBestLoglk[t];
+      bestMoveIndex = threadBestMoveIndex[t];
+    }
   }
   ParallelContext::getMax(bestLoglk, bestRank);
   ParallelContext::broadcastUInt(bestRank, bestMoveIndex);
+  if (screen) {
+    unsigned int bestMoveScreeningRank = static_cast<unsigned int>(-1);
+    if (bestMoveIndex != static_cast<unsigned int>(-1)) {
+      bestMoveScreeningRank = screeningRanks[bestMoveIndex];
+    }
+    ParallelContext::sumUInt(evaluated);
+    screening->addRound(static_cast<unsigned int>(allMoves.size()), 
+        evaluated, bestMoveScreeningRank);
+  }
   Logger::info << "best;; " << bestLoglk << " " << bestRank << std::endl;
-  jointTree.getReconciliationEvaluation().invalidateAllCLVs();
   return bestMoveIndex != static_cast<unsigned int>(-1);
 }
 
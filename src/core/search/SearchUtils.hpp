@@ -7,6 +7,8 @@
 
 
 class JointTree;
+class MoveEvaluationPool;
+class MoveScreening;
 
 class SearchUtils {
 public:
@@ -20,11 +22,41 @@ public:
     bool check
     );
  
+  /**
+   *  Score a move without optimizing its branches
+   *  @return the joint likelihood after the move
+   */
+  static double screenMove(JointTree &jointTree,
+    Move &move,
+    double initialLoglk,
+    bool check);
+ 
+  /**
+   *  Test the moves of this rank, on the threads of pool if it is 
+   *  not null, and find the best move over all the ranks.
+   *  With branch length optimization and an enabled screening, only
+   *  the moves selected by screening (over all the ranks) are 
+   *  fully tested.
+   *  If loglkDiffs is not null, it receives the likelihood change 
+   *  of each move (on all the ranks), or NaN if it was not fully 
+   *  tested.
+   *  @return true if a move improves bestLoglk
+   */
   static bool findBestMove(JointTree &jointTree,
     std::vector<std::unique_ptr<Move> > &allMoves,
     double &bestLoglk,
     unsigned int &bestMoveIndex,
     bool blo,
-    bool check);
+    bool check,
+    MoveEvaluationPool *pool = nullptr,
+    MoveScreening *screening = nullptr,
+    std::vector<double> *loglkDiffs = nullptr);
+private:
+  static void checkRollback(JointTree &jointTree,
+    Move &move,
+    double initialLoglk);
+  static void checkLocalLibpllLoglk(JointTree &jointTree,
+    Move &move,
+    double localLoglk);
 };
 
@@ -132,7 +132,8 @@ JointTree::JointTree(const std::string &newickString,
   _enableLibpll(true),
   _recOpt(reconciliationOpt),
   _recWeight(recWeight),
-  _supportThreshold(supportThreshold)
+  _supportThreshold(supportThreshold),
+  _stateVersion(0)
 {
 
   _geneSpeciesMap.fill(geneSpeciesMapfile, newickString);
@@ -157,6 +158,7 @@ void JointTree::printLibpllTree() const {
 
 
 void JointTree::optimizeParameters(bool felsenstein, bool reconciliation) {
+  ++_stateVersion;
   if (felsenstein && _enableLibpll) {
     _libpllEvaluation.optimizeAllParameters();
   }
@@ -176,6 +178,18 @@ double JointTree::computeLibpllLoglk(bool incremental) {
   return _libpllEvaluation.computeLikelihood(incremental);
 }
 
+double JointTree::computeLocalLibpllLoglk(pll_unode_t *localRoot) {
+  if (!_enableLibpll) {
+    return 1.0;
+  }
+  auto treeinfo = getTreeInfo();
+  auto root = treeinfo->root;
+  pllmod_treeinfo_set_root(treeinfo, localRoot);
+  auto res = _libpllEvaluation.computeLikelihood(true);
+  pllmod_treeinfo_set_root(treeinfo, root);
+  return res;
+}
+
 double JointTree::computeReconciliationLoglk () {
   if (!_enableReconciliation) {
     return 1.0;
@@ -204,10 +218,12 @@ pll_unode_t *JointTree::getNode(unsigned int index) {
 
 
 void JointTree::applyMove(Move &move) {
+  ++_stateVersion;
   _rollbacks.push(std::move(move.applyMove(*this)));
 }
 
 void JointTree::optimizeMove(Move &move) {
+  ++_stateVersion;
   if (_enableLibpll) {
     move.optimizeMove(*this);
   }
@@ -215,11 +231,19 @@ void JointTree::optimizeMove(Move &move) {
 
 
 void JointTree::rollbackLastMove() {
+  ++_stateVersion;
   assert(!_rollbacks.empty());
   _rollbacks.top()->applyRollback();
   _rollbacks.pop();
 }
 
+void JointTree::acceptMoves() {
+  ++_stateVersion;
+  while (!_rollbacks.empty()) {
+    _rollbacks.pop();
+  }
+}
+
 void JointTree::save(const std::string &fileName, bool append) {
   auto root = reconciliationEvaluation_->getRoot();
   if (!root) {
@@ -240,15 +264,35 @@ void JointTree::invalidateCLV(pll_unode_s *node)
   _libpllEvaluation.invalidateCLV(node->node_index);
 }
 
+void JointTree::invalidateLibpllCLV(pll_unode_s *node)
+{
+  _libpllEvaluation.invalidateCLV(node->node_index);
+}
+
 
 void JointTree::setRates(const Parameters &ratesVector)
 {
   _ratesVector = ratesVector;
+  ++_stateVersion;
   if (_enableReconciliation) {
     reconciliationEvaluation_->setRates(ratesVector);
   }
 }
 
+void JointTree::copyStateFrom(JointTree &other)
+{
+  assert(_rollbacks.empty() && other._rollbacks.empty());
+  _libpllEvaluation.copyStateFrom(other._libpllEvaluation);
+  _enableReconciliation = other._enableReconciliation;
+  _enableLibpll = other._enableLibpll;
+  reconciliationEvaluation_->raisePrecision(
+      other.getReconciliationEvaluation().getPrecision());
+  auto otherRoot = other.getRoot();
+  setRoot(otherRoot ? getNode(otherRoot->node_index) : nullptr);
+  setRates(other._ratesVector);
+  reconciliationEvaluation_->invalidateAllCLVs();
+  ++_stateVersion;
+}
 
 void JointTree::printInfo() 
 {
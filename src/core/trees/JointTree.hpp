@@ -39,6 +39,12 @@ public:
     void printLibpllTree() const;
     void optimizeParameters(bool felsenstein = true, bool reconciliation = true);
     double computeLibpllLoglk(bool incremental = false);
+    /**
+     *  Incremental libpll likelihood, computed from localRoot: after
+     *  a move, localRoot must be in the region whose CLVs the move
+     *  invalidated (see Move::getLocalRoot)
+     */
+    double computeLocalLibpllLoglk(pll_unode_t *localRoot);
     double computeReconciliationLoglk ();
     double computeJointLoglk();
     void printLoglk(bool libpll = true, bool rec = true, bool joint = true, Logger &os = Logger::info);
@@ -47,12 +53,32 @@ public:
     void optimizeMove(Move &move);
   
     void invalidateCLV(pll_unode_s *node);
+    /**
+     *  Only invalidate the libpll CLV and p-matrix, for instance
+     *  after a branch length change
+     */
+    void invalidateLibpllCLV(pll_unode_s *node);
     void printAllNodes(std::ostream &os);
     void printInfo();
     void rollbackLastMove();
+    /**
+     *  Keep the applied moves: their rollbacks are discarded
+     */
+    void acceptMoves();
     void save(const std::string &fileName, bool append);
     pllmod_treeinfo_t *getTreeInfo();
     void setRates(const Parameters &ratesVector);
+    /**
+     *  Copy the state (gene tree, libpll parameters and reconciliation
+     *  rates) of another JointTree built from the same inputs
+     */
+    void copyStateFrom(JointTree &other);
+    /**
+     *  Incremented by the methods that change the gene tree, its
+     *  branch lengths, the model parameters or the enabled 
+     *  likelihoods (see MoveEvaluationPool)
+     */
+    unsigned long getStateVersion() const {return _stateVersion;}
     PLLRootedTree &getSpeciesTree() {return _speciesTree;}
     size_t getUnrootedTreeHash();
     ReconciliationEvaluation &getReconciliationEvaluation() {return *reconciliationEvaluation_;}
@@ -65,8 +91,8 @@ public:
       reconciliationEvaluation_->inferMLScenario(scenario);
     }
     bool isSafeMode() {return _safeMode;}
-    void enableReconciliation(bool enable) {_enableReconciliation = enable;}
-    void enableLibpll(bool enable) {_enableLibpll = enable;}
+    void enableReconciliation(bool enable) {_enableReconciliation = enable; ++_stateVersion;}
+    void enableLibpll(bool enable) {_enableLibpll = enable; ++_stateVersion;}
     unsigned int getGeneTaxaNumber() {return getTreeInfo()->tip_count;}
     PLLUnrootedTree &getGeneTree() {return _libpllEvaluation.getGeneTree();}
     const GeneSpeciesMapping &getMappings() const {return _geneSpeciesMap;}
@@ -85,6 +111,7 @@ private:
     RecOpt _recOpt;
     double _recWeight;
     double _supportThreshold;
+    unsigned long _stateVersion;
 };
 
 
@@ -57,19 +57,29 @@ static pll_rtree_t *buildUtree(const std::string &str, bool isFile)
 }
 
 PLLRootedTree::PLLRootedTree(const std::string &str, bool isFile):
-  _tree(buildUtree(str, isFile), rtreeDestroy)
+  _tree(buildUtree(str, isFile), rtreeDestroy),
+  _topologyVersion(0)
 {
+  onTopologyChange();
   setMissingLabels();
   setMissingBranchLengths();
 }
 
 PLLRootedTree::PLLRootedTree(const std::unordered_set<std::string> &labels):
-  _tree(buildRandomTree(labels), rtreeDestroy)
+  _tree(buildRandomTree(labels), rtreeDestroy),
+  _topologyVersion(0)
 {
+  onTopologyChange();
   setMissingLabels();
   setMissingBranchLengths();
 }
 
+void PLLRootedTree::onTopologyChange()
+{
+  static unsigned long lastTopologyVersion = 0;
+  _topologyVersion = ++lastTopologyVersion;
+}
+
 void PLLRootedTree::save(const std::string &fileName) const
 {
   LibpllParsers::saveRtree(_tree->root, fileName);
@@ -85,6 +85,19 @@ public:
   
   static void setSon(pll_rnode_t *parent, pll_rnode_t *newSon, bool left);
   
+  /**
+   *  Identifier of the current topology, unique among all the 
+   *  trees of the process. onTopologyChange must be called after
+   *  each modification of the topology to renew it
+   */
+  unsigned long getTopologyVersion() const {return _topologyVersion;}
+  void onTopologyChange();
+  /**
+   *  Give back its version to a topology that was 
+   *  restored to its exact state at this version
+   */
+  void restoreTopologyVersion(unsigned long version) {_topologyVersion = version;}
+  
   friend std::ostream& operator<<(std::ostream& os, const PLLRootedTree &tree)
   {
     char *newick = pll_rtree_export_newick(tree.getRawPtr()->root, 0);
@@ -98,6 +111,7 @@ public:
 
 private:
   std::unique_ptr<pll_rtree_t, void(*)(pll_rtree_t*)> _tree;
+  unsigned long _topologyVersion;
 
   static pll_rtree_t *buildRandomTree(const std::unordered_set<std::string> &leafLabels);
 };
@@ -11,13 +11,15 @@
 
 
 SpeciesTree::SpeciesTree(const std::string &newick, bool fromFile):
-  _speciesTree(newick, fromFile)
+  _speciesTree(newick, fromFile),
+  _trialTopologyVersion(0)
 {
 }
 
 
 SpeciesTree::SpeciesTree(const std::unordered_set<std::string> &leafLabels):
-  _speciesTree(leafLabels)
+  _speciesTree(leafLabels),
+  _trialTopologyVersion(0)
 {
 }
   
@@ -28,7 +30,8 @@ std::unique_ptr<SpeciesTree> SpeciesTree::buildRandomTree() const
 
   
 SpeciesTree::SpeciesTree(const Families &families):
-  _speciesTree(getLabelsFromFamilies(families))
+  _speciesTree(getLabelsFromFamilies(families)),
+  _trialTopologyVersion(0)
 {
 }
 
@@ -61,10 +64,35 @@ void SpeciesTree::removeListener(Listener *listener)
 
 void SpeciesTree::onSpeciesTreeChange(const std::unordered_set<pll_rnode_t *> *nodesToInvalidate)
 {
+  _speciesTree.onTopologyChange();
   for (auto listener: _listeners) {
     listener->onSpeciesTreeChange(nodesToInvalidate);
   }
 }
+
+void SpeciesTree::beginTrial()
+{
+  _trialTopologyVersion = _speciesTree.getTopologyVersion();
+  for (auto listener: _listeners) {
+    listener->onSpeciesTreeTrialBegin();
+  }
+}
+
+void SpeciesTree::revertTrial()
+{
+  // the cached data of the initial topology are valid again
+  _speciesTree.restoreTopologyVersion(_trialTopologyVersion);
+  for (auto listener: _listeners) {
+    listener->onSpeciesTreeTrialEnd(true);
+  }
+}
+
+void SpeciesTree::acceptTrial()
+{
+  for (auto listener: _listeners) {
+    listener->onSpeciesTreeTrialEnd(false);
+  }
+}
   
 static void setRootAux(SpeciesTree &speciesTree, pll_rnode_t *root) {
   speciesTree.getTree().getRawPtr()->root = root; 
@@ -48,15 +48,32 @@ public:
   public:
     virtual ~Listener() {}
     virtual void onSpeciesTreeChange(const std::unordered_set<pll_rnode_t *> *nodesToInvalidate) = 0;
+    // see beginTrial
+    virtual void onSpeciesTreeTrialBegin() {}
+    virtual void onSpeciesTreeTrialEnd(bool) {}
   };
   void addListener(Listener *listener);
   void removeListener(Listener *listener);
   void onSpeciesTreeChange(const std::unordered_set<pll_rnode_t *> *nodesToInvalidate); // should be called when changing the species tree
 
+  /**
+   *  Trial topology changes: the listeners keep their state of
+   *  the beginning of the trial. revertTrial must be called once the
+   *  topology was restored to this state (for instance with
+   *  SpeciesTreeOperator::reverseSPRMove): the listeners then swap
+   *  their saved state back instead of recomputing it.
+   *  acceptTrial keeps the current topology
+   */
+  void beginTrial();
+  void revertTrial();
+  void acceptTrial();
+
 
 private:
   PLLRootedTree _speciesTree;
   std::vector<Listener *> _listeners;
+  // topology version at the beginning of the trial
+  unsigned long _trialTopologyVersion;
   void buildFromLabels(const std::unordered_set<std::string> &leafLabels);
   static std::unordered_set<std::string> getLabelsFromFamilies(const Families &families);
 };
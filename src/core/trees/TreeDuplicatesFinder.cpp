@@ -1,88 +1,89 @@
 #include "TreeDuplicatesFinder.hpp"
 #include <parallelization/PerCoreGeneTrees.hpp>
 #include <IO/Logger.hpp>
+#include <string>
+#include <algorithm>
 
-static bool hasParent(pll_unode_t *node) 
-{
-  return node->back->next;
-}
-
-static pll_unode_t *getParentLeft(pll_unode_t *node)
-{
-  return node->back->next;
-}
+static const unsigned int NO_SUBTREE_ID = static_cast<unsigned int>(-1);
 
-static pll_unode_t *getParentRight(pll_unode_t *node) 
-{
-  return node->back->next->next;
-}
-  
 void TreeDuplicatesFinder::findDuplicates(PerCoreGeneTrees &perCoreGeneTrees, TreeDuplicates &duplicates)
 {
-  std::vector<pll_unode_t *> currentDepthNodes;
-  std::vector <std::string> leafToSpecies;
-  unsigned int newClassIdentifier = 1;
-  Logger::info << "Families: " << perCoreGeneTrees.getTrees().size() << std::endl;
-  // fill leaves
-  for (auto &geneTree: perCoreGeneTrees.getTrees()) {
-    auto tree = geneTree.geneTree;
-    for (auto leaf: tree->getLeaves()) {
-      currentDepthNodes.push_back(leaf);
-      leafToSpecies.push_back(geneTree.mapping.getSpecies(leaf->label));
-    }
-  }
-  Logger::info << "Total number of leaves: " << currentDepthNodes.size() << std::endl;
-  while (currentDepthNodes.size()) {
-    std::vector<pll_unode_t *> nextDepthNodes;
-    std::unordered_map<std::string, unsigned int> stringToIdentifier;
-    // compute their identifiers
-    for (unsigned int i = 0; i < currentDepthNodes.size(); ++i) {
-      auto node = currentDepthNodes[i];
-      if (duplicates.find(node) != duplicates.end()) {
-        // we already processed this node
-        continue;
+  // hash-consing: a leaf is identified by its species, and an inner
+  // node by the unordered pair of the identifiers of its children
+  std::unordered_map<std::string, unsigned int> speciesToIdentifier;
+  std::unordered_map<unsigned long, unsigned int> childrenToIdentifier;
+  unsigned int newClassIdentifier = 0;
+  unsigned int subtrees = 0;
+  auto &trees = perCoreGeneTrees.getTrees();
+  duplicates.subtreeIds.resize(trees.size());
+  for (unsigned int family = 0; family < trees.size(); ++family) {
+    auto &geneTree = trees[family];
+    auto &ids = duplicates.subtreeIds[family];
+    // all the directed nodes of the tree
+    std::vector<pll_unode_t *> nodes;
+    for (auto node: geneTree.geneTree->getNodes()) {
+      nodes.push_back(node);
+      if (node->next) {
+        nodes.push_back(node->next);
+        nodes.push_back(node->next->next);
       }
-      std::string nodeClassString;
-      if (!node->next) {
-        nodeClassString = leafToSpecies[i];     
-      } else {
-        auto sonLeft = node->next->back;
-        auto sonRight = node->next->next->back;
-        unsigned int sonLeftId = duplicates[sonLeft];
-        unsigned int sonRightId = duplicates[sonRight];
-        // ordering does not matter for equality
-        if (sonLeftId > sonRightId) {
-          std::swap(sonLeftId, sonRightId);
+    }
+    unsigned int maxIndex = 0;
+    for (auto node: nodes) {
+      maxIndex = std::max(maxIndex, node->node_index);
+    }
+    ids.assign(maxIndex + 1, NO_SUBTREE_ID);
+    // postorder traversal from each node that was not reached yet
+    std::vector<pll_unode_t *> stack;
+    for (auto root: nodes) {
+      stack.push_back(root);
+      while (!stack.empty()) {
+        auto node = stack.back();
+        if (ids[node->node_index] != NO_SUBTREE_ID) {
+          stack.pop_back();
+          continue;
         }
-        nodeClassString = std::to_string(sonLeftId) + "-" + std::to_string(sonRightId);
-      }
-      if (stringToIdentifier.find(nodeClassString) == stringToIdentifier.end()) {
-        stringToIdentifier[nodeClassString] = newClassIdentifier++;
-      }
-      duplicates[node] = stringToIdentifier[nodeClassString];
-      if (hasParent(node)) {
-        nextDepthNodes.push_back(getParentLeft(node));
-        nextDepthNodes.push_back(getParentRight(node));
+        unsigned int identifier = 0;
+        if (!node->next) {
+          auto species = geneTree.mapping.getSpecies(node->label);
+          auto it = speciesToIdentifier.find(species);
+          if (it == speciesToIdentifier.end()) {
+            it = speciesToIdentifier.insert({species, newClassIdentifier++}).first;
+          }
+          identifier = it->second;
+        } else {
+          auto sonLeft = node->next->back;
+          auto sonRight = node->next->next->back;
+          unsigned long sonLeftId = ids[sonLeft->node_index];
+          unsigned long sonRightId = ids[sonRight->node_index];
+          if (sonLeftId == NO_SUBTREE_ID || sonRightId == NO_SUBTREE_ID) {
+            if (sonLeftId == NO_SUBTREE_ID) {
+              stack.push_back(sonLeft);
+            }
+            if (sonRightId == NO_SUBTREE_ID) {
+              stack.push_back(sonRight);
+            }
+            continue;
+          }
+          // ordering does not matter for equality
+          if (sonLeftId > sonRightId) {
+            std::swap(sonLeftId, sonRightId);
+          }
+          auto key = (sonLeftId << 32) | sonRightId;
+          auto it = childrenToIdentifier.find(key);
+          if (it == childrenToIdentifier.end()) {
+            it = childrenToIdentifier.insert({key, newClassIdentifier++}).first;
+          }
+          identifier = it->second;
+        }
+        ids[node->node_index] = identifier;
+        subtrees++;
+        stack.pop_back();
       }
     }
-    std::swap(currentDepthNodes, nextDepthNodes);
   }
-  Logger::info << "Subtrees: " << duplicates.size() << std::endl;
-  Logger::info << "Unique subtrees: " << newClassIdentifier << std::endl;
-}
-
-template<typename Value>
-SubtreeCache<Value>::SubtreeCache(const TreeDuplicates &duplicates):
-  _duplicates(duplicates),
-  _values(duplicates.size()),
-  _isValid(duplicates.size(), false)
-{
-
-}
-
-template<typename Value>
-void SubtreeCache<Value>::resetAll()
-{
-  std::fill(_isValid.begin(), _isValid.end(), false);
+  duplicates.subtreesNumber = newClassIdentifier;
+  Logger::info << "Unique gene subtrees: " << newClassIdentifier 
+    << " out of " << subtrees << " in " << trees.size() << " families" << std::endl;
 }
 
@@ -2,45 +2,109 @@
 
 #include <unordered_map>
 #include <vector>
+#include <memory>
+#include <cassert>
+#include <algorithm>
 
 typedef struct pll_unode_s pll_unode_t;
-typedef std::unordered_map<pll_unode_t*, unsigned int> TreeDuplicates;
 
 class PerCoreGeneTrees;
 
+/**
+ *  Identifiers of the gene subtrees of the families of a rank:
+ *  two directed gene nodes get the same identifier if their
+ *  subtrees are identical once each gene leaf is replaced by
+ *  its species, up to the order of the children
+ */
+struct TreeDuplicates {
+  TreeDuplicates(): subtreesNumber(0) {}
+  // subtreeIds[family][geneNode->node_index]
+  std::vector<std::vector<unsigned int> > subtreeIds;
+  unsigned int subtreesNumber;
+};
+
 class TreeDuplicatesFinder {
 public:
   static void findDuplicates(PerCoreGeneTrees &perCoreGeneTrees, TreeDuplicates &duplicates);
 };
 
 
-template <typename Value> 
+/**
+ *  One value per subtree identifier of a TreeDuplicates, shared by
+ *  all the occurrences of this subtree. Each value is only valid
+ *  for the version it was computed for (for instance, the version
+ *  of the species probabilities a CLV was computed from)
+ */
+template <typename Value>
 class SubtreeCache
 {
 public:
-  SubtreeCache(const TreeDuplicates &duplicates);
-  
-  void resetAll();
-  void resetNode(); 
-
-  bool isValueComputed(pll_unode_t *key) const {return _isValid[getIndex(key)];}
-  
-  void setValue(pll_unode_t *key, const Value &value) {
-    auto index = getIndex(key);
-    _values[index] = value;
-    _isValid[index] = true;
+  SubtreeCache(const std::shared_ptr<const TreeDuplicates> &duplicates):
+    _duplicates(duplicates),
+    _values(duplicates->subtreesNumber),
+    _versions(duplicates->subtreesNumber, 0)
+  {}
+
+  /**
+   *  Cache of subtrees that are not identified by a TreeDuplicates:
+   *  the caller makes room for its identifiers with resize
+   */
+  SubtreeCache() {}
+
+  /**
+   *  Make cache point to the cache of the subtrees of duplicates
+   *  shared by the models of type Model, with the same variant
+   *  (for instance, with or without block scaling)
+   */
+  template <class Model>
+  static void acquire(std::shared_ptr<SubtreeCache> &cache,
+      const std::shared_ptr<const TreeDuplicates> &duplicates,
+      unsigned int variant)
+  {
+    auto &lastShared = getLastShared<Model>(variant);
+    auto candidate = lastShared.lock();
+    if (candidate && candidate->_duplicates.lock() == duplicates) {
+      cache = candidate;
+      return;
+    }
+    cache = std::make_shared<SubtreeCache>(duplicates);
+    lastShared = cache;
+  }
+
+  void resetAll() {std::fill(_versions.begin(), _versions.end(), 0);}
+
+  void resize(unsigned int subtreesNumber) {
+    _values.resize(subtreesNumber);
+    _versions.resize(subtreesNumber, 0);
+  }
+
+  /**
+   *  @return the value of the subtree if it was computed for
+   *  this version, null otherwise
+   */
+  const Value *getValue(unsigned int subtree, unsigned long version) const {
+    assert(subtree < _values.size());
+    return (_versions[subtree] == version) ? &_values[subtree] : nullptr;
+  }
+
+  /**
+   *  @return the value of the subtree, to be filled for this version
+   */
+  Value &setValue(unsigned int subtree, unsigned long version) {
+    assert(subtree < _values.size());
+    _versions[subtree] = version;
+    return _values[subtree];
   }
-  const Value &getValue(pll_unode_t *key) const { 
-    auto index = getIndex(key);
-    assert(_isValid[index]);
-    return _values[index];
-  } 
 
 private:
-  unsigned int getIndex(pll_unode_t *key) const {return _duplicates.at(key);}
-  const TreeDuplicates &_duplicates;
+  template <class Model>
+  static std::weak_ptr<SubtreeCache> &getLastShared(unsigned int variant) {
+    static std::unordered_map<unsigned int, std::weak_ptr<SubtreeCache> > lastShared;
+    return lastShared[variant];
+  }
+
+  std::weak_ptr<const TreeDuplicates> _duplicates;
   std::vector<Value> _values;
-  std::vector<bool> _isValid;
+  std::vector<unsigned long> _versions;
 };
 
-
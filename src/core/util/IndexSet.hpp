@@ -0,0 +1,51 @@
+#pragma once
+
+#include <vector>
+#include <cassert>
+
+/**
+ *  Set of indices in [0, capacity) with constant time insertion and
+ *  lookup, iterated in insertion order. All the memory is allocated
+ *  by resize: clearing, copying to a set of the same capacity and
+ *  swapping do not allocate, which suits the sets that are filled
+ *  and emptied at each likelihood computation.
+ */
+class IndexSet {
+public:
+  IndexSet() {}
+
+  /**
+   *  Set the capacity and empty the set
+   */
+  void resize(unsigned int capacity) {
+    _indices.clear();
+    _indices.reserve(capacity);
+    _contains.assign(capacity, false);
+  }
+
+  void insert(unsigned int index) {
+    assert(index < _contains.size());
+    if (!_contains[index]) {
+      _contains[index] = true;
+      _indices.push_back(index);
+    }
+  }
+
+  bool contains(unsigned int index) const {return _contains[index];}
+
+  void clear() {
+    for (auto index: _indices) {
+      _contains[index] = false;
+    }
+    _indices.clear();
+  }
+
+  size_t size() const {return _indices.size();}
+  bool empty() const {return _indices.empty();}
+  std::vector<unsigned int>::const_iterator begin() const {return _indices.begin();}
+  std::vector<unsigned int>::const_iterator end() const {return _indices.end();}
+private:
+  std::vector<unsigned int> _indices;
+  std::vector<bool> _contains;
+};
+
@@ -5,6 +5,7 @@
 #include <vector>
 #include <string>
 #include <map>
+#include <algorithm>
 
 
 const char *Scenario::eventNames[]  = {"S", "SL", "D", "T", "TL", "L", "Leaf", "Invalid"};
@@ -39,11 +40,32 @@ void Scenario::addEvent(const Event &event)
   _events.push_back(event);
   assert(static_cast<int>(event.type) >= 0);
   _eventsCount[static_cast<unsigned int>(event.type)] ++;
-  if (_geneIdToEvents.size() <= static_cast<size_t>(event.geneNode)) {
-    _geneIdToEvents.resize(event.geneNode + 1);
+  if (_geneFirstEvent.size() <= static_cast<size_t>(event.geneNode)) {
+    _geneFirstEvent.resize(event.geneNode + 1, 0);
+    _geneEventsCount.resize(event.geneNode + 1, 0);
   }
-  _geneIdToEvents[event.geneNode].push_back(event);
+  auto &count = _geneEventsCount[event.geneNode];
+  if (!count) {
+    _geneFirstEvent[event.geneNode] = _events.size() - 1;
+  }
+  assert(_geneFirstEvent[event.geneNode] + count == _events.size() - 1);
+  count++;
+}
+
+Scenario::EventRange Scenario::getGeneEvents(unsigned int geneNode) const
+{
+  if (geneNode >= _geneEventsCount.size()) {
+    return EventRange(nullptr, 0);
+  }
+  return EventRange(_events.data() + _geneFirstEvent[geneNode], _geneEventsCount[geneNode]);
+}
 
+void Scenario::reset()
+{
+  _events.clear();
+  std::fill(_eventsCount.begin(), _eventsCount.end(), 0);
+  std::fill(_geneEventsCount.begin(), _geneEventsCount.end(), 0);
+  resetBlackList();
 }
 
 void Scenario::saveEventsCounts(const std::string &filename, bool masterRankOnly) {
@@ -109,14 +131,14 @@ void Scenario::saveReconciliation(ParallelOfstream &os, ReconciliationFormat for
     ReconciliationWriter::saveReconciliationNHX(_speciesTree, 
         _geneRoot, 
         _virtualRootIndex, 
-        _geneIdToEvents, 
+        *this, 
         os);
     break;
   case ReconciliationFormat::RecPhyloXML:
     ReconciliationWriter::saveReconciliationRecPhyloXML(_speciesTree, 
         _geneRoot, 
         _virtualRootIndex, 
-        _geneIdToEvents, 
+        *this, 
         os);
     break;
   }
@@ -174,7 +196,7 @@ void Scenario::saveAllOrthoGroups(std::string &filename, bool masterRankOnly) co
 
 OrthoGroup *Scenario::getLargestOrthoGroupRec(pll_unode_t *geneNode, bool isVirtualRoot) const
 {
-  auto &events = _geneIdToEvents[geneNode->node_index];
+  auto events = getGeneEvents(geneNode->node_index);
   for (auto &event: events) {
     if (event.type == ReconciliationEventType::EVENT_TL) {
       return new OrthoGroup();
@@ -250,7 +272,7 @@ void Scenario::getAllOrthoGroupRec(pll_unode_t *geneNode,
       OrthoGroupPtr &currentOrthoGroup,
       bool isVirtualRoot) const
 {
-  auto &events = _geneIdToEvents[geneNode->node_index];
+  auto events = getGeneEvents(geneNode->node_index);
   bool underTL = false;
   for (auto &event: events) {
     if (event.type == ReconciliationEventType::EVENT_TL) {
@@ -323,30 +345,41 @@ void Scenario::getAllOrthoGroupRec(pll_unode_t *geneNode,
 
 void Scenario::initBlackList(unsigned int genesNumber, unsigned int speciesNumber)
 {
-  std::vector<int>  blackListAux(speciesNumber, false);
-  _blacklist = std::make_unique<ScenarioBlackList>(genesNumber, blackListAux);
-  
+  if (_blacklist.size() == static_cast<size_t>(genesNumber) * speciesNumber 
+      && _blacklistSpecies == speciesNumber) {
+    resetBlackList();
+    return;
+  }
+  _blacklist.assign(static_cast<size_t>(genesNumber) * speciesNumber, false);
+  _blacklisted.clear();
+  _blacklistSpecies = speciesNumber;
 }
 
 void Scenario::blackList(unsigned int geneNode, unsigned int speciesNode)
 {
-  if (_blacklist && _blacklist->size() > geneNode) { // not true for virtual nodes
-    (*_blacklist)[geneNode][speciesNode] = true;
+  if (!_blacklistSpecies) {
+    return;
+  }
+  auto index = static_cast<size_t>(geneNode) * _blacklistSpecies + speciesNode;
+  if (index < _blacklist.size() && !_blacklist[index]) { // not true for virtual nodes
+    _blacklist[index] = true;
+    _blacklisted.push_back(index);
   }
 }
+
 bool Scenario::isBlacklisted(unsigned int geneNode, unsigned int speciesNode)
 {
-  if (_blacklist && _blacklist->size() > geneNode) { // not true for virtual nodes
-    return (*_blacklist)[geneNode][speciesNode];
+  if (!_blacklistSpecies) {
+    return false;
   }
-  return false;
+  auto index = static_cast<size_t>(geneNode) * _blacklistSpecies + speciesNode;
+  return index < _blacklist.size() && _blacklist[index]; // not true for virtual nodes
 }
 
 void Scenario::resetBlackList()
 {
-  for (auto &aux: *_blacklist) {
-    for (unsigned int i = 0; i < aux.size(); ++i) {
-      aux[i] = false;
-    }
+  for (auto index: _blacklisted) {
+    _blacklist[index] = false;
   }
+  _blacklisted.clear();
 }
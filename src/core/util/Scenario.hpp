@@ -61,6 +61,23 @@ public:
     bool isValid() const { return speciesNode != INVALID_NODE_ID; }
   };
 
+  /**
+   *  Contiguous range of the events attached to one gene node,
+   *  in the order they were added
+   */
+  class EventRange {
+  public:
+    EventRange(const Event *first, unsigned int size): _first(first), _size(size) {}
+    const Event *begin() const {return _first;}
+    const Event *end() const {return _first + _size;}
+    unsigned int size() const {return _size;}
+    const Event &operator[](unsigned int i) const {return _first[i];}
+    const Event &back() const {return _first[_size - 1];}
+  private:
+    const Event *_first;
+    unsigned int _size;
+  };
+
 
   /**
    * Default constructor
@@ -68,7 +85,8 @@ public:
   Scenario(): 
     _eventsCount(static_cast<unsigned int>(ReconciliationEventType::EVENT_Invalid), 0), 
     _geneRoot(nullptr), 
-    _virtualRootIndex(INVALID_NODE_ID) 
+    _virtualRootIndex(INVALID_NODE_ID),
+    _blacklistSpecies(0)
   {}
 
   // forbid copy
@@ -80,9 +98,18 @@ public:
   void setGeneRoot(pll_unode_t *geneRoot) {_geneRoot = geneRoot;}
   void setSpeciesTree(pll_rtree_t *speciesTree) {_speciesTree = speciesTree;}
   void setVirtualRootIndex(unsigned int virtualRootIndex) {_virtualRootIndex = virtualRootIndex;}
+  const std::vector<Event> &getEvents() const {return _events;}
+  EventRange getGeneEvents(unsigned int geneNode) const;
+
+  /**
+   *  Remove all the events and blacklisted couples, but keep
+   *  the allocated memory, so that the scenario can be reused
+   */
+  void reset();
 
   /**
    * Various methods to add an event in the Scnenario
+   * The events of a gene node must be added consecutively
    */
   void addEvent(const Event &event);
   void addEvent(ReconciliationEventType type, 
@@ -121,12 +148,18 @@ private:
   static const char *eventNames[];
   std::vector<Event> _events;
   std::vector<unsigned int> _eventsCount;
-  std::vector<std::vector<Event> > _geneIdToEvents;
+  // the events of gene node g are _events[_geneFirstEvent[g]] to
+  // _events[_geneFirstEvent[g] + _geneEventsCount[g] - 1]
+  std::vector<unsigned int> _geneFirstEvent;
+  std::vector<unsigned int> _geneEventsCount;
   pll_unode_t *_geneRoot;
   pll_rtree_t *_speciesTree;
   unsigned int _virtualRootIndex;
-  typedef std::vector< std::vector <int> > ScenarioBlackList;
-  std::unique_ptr<ScenarioBlackList> _blacklist;
+  // flat genes x species matrix, and the indices set in 
+  // this matrix, to reset it without scanning it
+  std::vector<bool> _blacklist;
+  std::vector<size_t> _blacklisted;
+  unsigned int _blacklistSpecies;
   OrthoGroup *getLargestOrthoGroupRec(pll_unode_t *geneNode, bool isVirtualRoot) const;
   void getAllOrthoGroupRec(pll_unode_t *geneNode,
       OrthoGroups &orthogroups,
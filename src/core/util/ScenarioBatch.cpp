@@ -0,0 +1,49 @@
+#include "util/ScenarioBatch.hpp"
+
+ScenarioBatch::ScenarioBatch():
+  _offsets(1, 0),
+  _geneRoot(nullptr),
+  _speciesTree(nullptr),
+  _virtualRootIndex(Scenario::INVALID_NODE_ID)
+{
+}
+
+void ScenarioBatch::reset(pll_unode_t *geneRoot, 
+    pll_rtree_t *speciesTree, 
+    unsigned int virtualRootIndex)
+{
+  _events.clear();
+  _offsets.assign(1, 0);
+  _isValid.clear();
+  _geneRoot = geneRoot;
+  _speciesTree = speciesTree;
+  _virtualRootIndex = virtualRootIndex;
+}
+
+void ScenarioBatch::addScenario(const std::vector<Scenario::Event> &events, bool isValid)
+{
+  _events.insert(_events.end(), events.begin(), events.end());
+  _offsets.push_back(_events.size());
+  _isValid.push_back(isValid);
+}
+
+void ScenarioBatch::append(const ScenarioBatch &other)
+{
+  auto shift = _events.size();
+  _events.insert(_events.end(), other._events.begin(), other._events.end());
+  for (unsigned int i = 1; i < other._offsets.size(); ++i) {
+    _offsets.push_back(shift + other._offsets[i]);
+  }
+  _isValid.insert(_isValid.end(), other._isValid.begin(), other._isValid.end());
+}
+
+void ScenarioBatch::fillScenario(unsigned int scenario, Scenario &output) const
+{
+  output.setGeneRoot(_geneRoot);
+  output.setSpeciesTree(_speciesTree);
+  output.setVirtualRootIndex(_virtualRootIndex);
+  for (auto event = beginEvents(scenario); event != endEvents(scenario); ++event) {
+    output.addEvent(*event);
+  }
+}
+
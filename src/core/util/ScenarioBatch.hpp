@@ -0,0 +1,63 @@
+#pragma once
+
+#include <util/Scenario.hpp>
+#include <vector>
+
+/**
+ *  Set of reconciliation scenarios sampled from the same CLVs
+ *  (see ReconciliationEvaluation::sampleScenarios). They share the
+ *  gene and species roots, and the events of all the scenarios are
+ *  stored contiguously, without the per-gene events and the 
+ *  blacklist of Scenario
+ */
+class ScenarioBatch {
+public:
+  ScenarioBatch();
+
+  /**
+   *  Remove all the scenarios, and set the roots of the next ones
+   */
+  void reset(pll_unode_t *geneRoot, 
+      pll_rtree_t *speciesTree, 
+      unsigned int virtualRootIndex);
+
+  /**
+   *  Append a scenario
+   */
+  void addScenario(const std::vector<Scenario::Event> &events, bool isValid);
+
+  /**
+   *  Append the scenarios of a batch sampled from the same roots
+   */
+  void append(const ScenarioBatch &other);
+
+  unsigned int size() const {return static_cast<unsigned int>(_isValid.size());}
+  bool isValid(unsigned int scenario) const {return _isValid[scenario];}
+  pll_rtree_t *getSpeciesTree() const {return _speciesTree;}
+
+  /**
+   *  Events of a scenario
+   */
+  const Scenario::Event *beginEvents(unsigned int scenario) const {
+    return _events.data() + _offsets[scenario];
+  }
+  const Scenario::Event *endEvents(unsigned int scenario) const {
+    return _events.data() + _offsets[scenario + 1];
+  }
+
+  /**
+   *  Add the events of a scenario to an empty Scenario, 
+   *  for instance to save it
+   */
+  void fillScenario(unsigned int scenario, Scenario &output) const;
+
+private:
+  std::vector<Scenario::Event> _events;
+  // the events of the i-th scenario are in [_offsets[i], _offsets[i + 1])
+  std::vector<size_t> _offsets;
+  std::vector<bool> _isValid;
+  pll_unode_t *_geneRoot;
+  pll_rtree_t *_speciesTree;
+  unsigned int _virtualRootIndex;
+};
+
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cassert>
+#include <string>
 
 
 /**
@@ -56,6 +57,15 @@ enum class ReconciliationEventType {
 };
 
 
+/*
+ * Floating point representation of the reconciliation CLVs
+ */
+enum class CLVPrecision {
+  Double = 0, // plain double, can underflow on large gene families
+  BlockScaled, // double, with one scaler per gene node CLV
+  Scaled // ScaledValue, with one scaler per CLV entry
+};
+
 /*
  * Defines how to reuse computations when computing
  * the reconciliation likelihood
@@ -125,6 +135,20 @@ public:
     return false;
   }
 
+  static std::string getPrecisionName(CLVPrecision p)
+  {
+    switch (p) {
+    case CLVPrecision::Double:
+      return "double";
+    case CLVPrecision::BlockScaled:
+      return "block-scaled double";
+    case CLVPrecision::Scaled:
+      return "scaled value";
+    }
+    assert(false);
+    return "";
+  }
+
 };
 
 
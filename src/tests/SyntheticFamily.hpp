@@ -0,0 +1,71 @@
+#pragma once
+
+#include <trees/PLLRootedTree.hpp>
+#include <trees/PLLUnrootedTree.hpp>
+#include <IO/GeneSpeciesMapping.hpp>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+/**
+ *  Species tree, gene tree and mapping of a family generated
+ *  without input files, for the unit tests:
+ *  - a balanced species tree with the leaves S0, S1, ...
+ *  - an unbalanced gene tree (with long paths from the leaves to
+ *  the roots) whose i-th gene maps to the species (i * speciesStep) % speciesNumber
+ */
+class SyntheticFamily {
+public:
+  SyntheticFamily(unsigned int speciesNumber,
+      unsigned int genesNumber,
+      unsigned int speciesStep):
+    speciesTree(buildSpeciesTreeStr(0, speciesNumber) + ";", false),
+    geneTreeStr(buildGeneTreeStr(buildLabels(speciesNumber, genesNumber, speciesStep),
+          0, genesNumber) + ";"),
+    geneTree(geneTreeStr, false)
+  {
+    mapping.fill("", geneTreeStr);
+  }
+
+  PLLRootedTree speciesTree;
+  std::string geneTreeStr;
+  PLLUnrootedTree geneTree;
+  GeneSpeciesMapping mapping;
+
+private:
+  static std::string buildSpeciesTreeStr(unsigned int first, unsigned int leaves)
+  {
+    if (leaves == 1) {
+      return "S" + std::to_string(first);
+    }
+    auto half = leaves / 2;
+    return "(" + buildSpeciesTreeStr(first, half) + ","
+      + buildSpeciesTreeStr(first + half, leaves - half) + ")";
+  }
+
+  static std::vector<std::string> buildLabels(unsigned int speciesNumber,
+      unsigned int genesNumber,
+      unsigned int speciesStep)
+  {
+    std::vector<std::string> labels;
+    for (unsigned int i = 0; i < genesNumber; ++i) {
+      labels.push_back("S" + std::to_string((i * speciesStep) % speciesNumber)
+          + "_" + std::to_string(i));
+    }
+    return labels;
+  }
+
+  // gene tree with the labels [first, first + leaves)
+  static std::string buildGeneTreeStr(const std::vector<std::string> &labels,
+      unsigned int first,
+      unsigned int leaves)
+  {
+    if (leaves == 1) {
+      return labels[first];
+    }
+    auto left = std::max(1u, leaves / 3);
+    return "(" + buildGeneTreeStr(labels, first, left) + ","
+      + buildGeneTreeStr(labels, first + left, leaves - left) + ")";
+  }
+};
+
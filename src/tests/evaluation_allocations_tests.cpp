@@ -0,0 +1,164 @@
+#include "SyntheticFamily.hpp"
+#include <likelihoods/ReconciliationEvaluation.hpp>
+#include <IO/ArgumentsHelper.hpp>
+#include <IO/Logger.hpp>
+#include <cassert>
+#include <cerrno>
+#include <cmath>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+/**
+ *  Check that ReconciliationEvaluation::evaluate does not allocate
+ *  once the model reached its steady state, and report the time
+ *  per evaluation. The global operator new (and posix_memalign with
+ *  the GNU C library) is hooked to count the allocations during the
+ *  evaluations only.
+ */
+
+static bool countAllocations = false;
+static unsigned long allocations = 0;
+static unsigned int evaluationsNumber = 0;
+
+void *operator new(std::size_t size)
+{
+  if (countAllocations) {
+    allocations++;
+  }
+  void *res = std::malloc(size ? size : 1);
+  if (!res) {
+    throw std::bad_alloc();
+  }
+  return res;
+}
+
+void operator delete(void *ptr) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept
+{
+  std::free(ptr);
+}
+
+#ifdef __GLIBC__
+// the CLVs and the vectorized kernel buffers are 
+// allocated by AlignedAllocator, with posix_memalign
+extern "C" int posix_memalign(void **ptr, size_t alignment, size_t size) noexcept
+{
+  if (countAllocations) {
+    allocations++;
+  }
+  *ptr = memalign(alignment, size ? size : 1);
+  return *ptr ? 0 : ENOMEM;
+}
+#endif
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static unsigned long evaluateAndCount(ReconciliationEvaluation &evaluation, double &ll)
+{
+  allocations = 0;
+  evaluationsNumber++;
+  countAllocations = true;
+  ll = evaluation.evaluate();
+  countAllocations = false;
+  return allocations;
+}
+
+/**
+ *  Evaluate the likelihood after the typical changes of a search:
+ *  partial update after a gene tree change (possibly rollbacked), 
+ *  full or partial update after a rates change, and no update
+ *  @return the number of allocations during the evaluations
+ */
+static unsigned long runEvaluations(ReconciliationEvaluation &evaluation,
+    const Parameters &rates,
+    unsigned int geneNodes,
+    unsigned int speciesNodes,
+    double &ll)
+{
+  const unsigned int iterations = 50;
+  unsigned long total = 0;
+  for (unsigned int i = 0; i < iterations; ++i) {
+    switch (i % 5) {
+    case 0:
+      evaluation.invalidateCLV(i % geneNodes);
+      break;
+    case 1:
+      evaluation.beginCLVJournal();
+      evaluation.invalidateCLV(i % geneNodes);
+      total += evaluateAndCount(evaluation, ll);
+      if (!evaluation.rollbackCLVJournal()) {
+        evaluation.invalidateAllCLVs();
+      }
+      break;
+    case 2:
+      evaluation.setRates(rates);
+      break;
+    case 3:
+      evaluation.setRatesForSpecies(i % speciesNodes, rates);
+      break;
+    default:
+      break;
+    }
+    total += evaluateAndCount(evaluation, ll);
+  }
+  return total;
+}
+
+static bool checkModel(PLLRootedTree &speciesTree,
+    PLLUnrootedTree &geneTree,
+    const GeneSpeciesMapping &mapping,
+    RecModel model,
+    bool rootedGeneTree)
+{
+  ReconciliationEvaluation evaluation(speciesTree, geneTree, mapping, model, rootedGeneTree);
+  Parameters rates(Enums::freeParameters(model));
+  for (unsigned int i = 0; i < rates.dimensions(); ++i) {
+    rates[i] = 0.1 + 0.05 * i;
+  }
+  evaluation.setRates(rates);
+  double ll = 0.0;
+  auto geneNodes = geneTree.getNodesNumber();
+  auto speciesNodes = speciesTree.getNodesNumber();
+  // warm up: the precision and the buffers reach their final state
+  runEvaluations(evaluation, rates, geneNodes, speciesNodes, ll);
+  evaluationsNumber = 0;
+  auto start = Clock::now();
+  auto total = runEvaluations(evaluation, rates, geneNodes, speciesNodes, ll);
+  double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+  std::cout << "model " << ArgumentsHelper::recModelToStr(model)
+    << " rooted " << rootedGeneTree
+    << " ll " << ll
+    << " allocations " << total
+    << " time per evaluation " << elapsed / evaluationsNumber << "s" << std::endl;
+  assert(std::isfinite(ll));
+  return total == 0;
+}
+
+int main(int, char**)
+{
+  Logger::init();
+  SyntheticFamily family(16, 60, 7);
+  bool ok = true;
+  for (auto model: {RecModel::UndatedDL, RecModel::UndatedDTL, RecModel::UndatedIDTL}) {
+    for (auto rooted: {false, true}) {
+      ok &= checkModel(family.speciesTree, family.geneTree, family.mapping, model, rooted);
+    }
+  }
+  if (!ok) {
+    std::cerr << "Error: evaluate allocated memory in steady state" << std::endl;
+    return 1;
+  }
+  std::cout << "Test evaluation allocations ok!" << std::endl;
+  return 0;
+}
@@ -0,0 +1,101 @@
+#include "SyntheticFamily.hpp"
+#include <likelihoods/ReconciliationEvaluation.hpp>
+#include <IO/ArgumentsHelper.hpp>
+#include <IO/Logger.hpp>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/**
+ *  Compare the exact rate gradient of ReconciliationEvaluation
+ *  (propagated with dual numbers, see evaluateWithGradient) with
+ *  central finite differences of the log likelihood
+ */
+
+static bool checkModel(PLLRootedTree &speciesTree,
+    PLLUnrootedTree &geneTree,
+    const GeneSpeciesMapping &mapping,
+    RecModel model,
+    bool rootedGeneTree)
+{
+  ReconciliationEvaluation evaluation(speciesTree, geneTree, mapping, model, rootedGeneTree);
+  // converge the fixed-point iterations of the models with
+  // transfers, so that the likelihood is a smooth function
+  evaluation.setFixedPointParameters(100, 1e-14);
+  Parameters rates(Enums::freeParameters(model));
+  for (unsigned int i = 0; i < rates.dimensions(); ++i) {
+    rates[i] = 0.2 + 0.1 * i;
+  }
+  evaluation.setRates(rates);
+  std::vector<double> gradient;
+  double ll = evaluation.evaluateWithGradient(gradient);
+  evaluation.setRates(rates);
+  double reference = evaluation.evaluate();
+  bool ok = std::fabs(ll - reference) < 1e-8 * std::fabs(reference)
+    && gradient.size() == rates.dimensions();
+  // in rooted mode, the likelihood is the one of the ML root found 
+  // by a local search from the current root: it is not differentiable 
+  // where this root changes, so we only use the finite differences 
+  // computed with the same root
+  auto root = evaluation.getRoot();
+  const double epsilon = 1e-6;
+  unsigned int checkedDimensions = 0;
+  std::cout << "model " << ArgumentsHelper::recModelToStr(model)
+    << " rooted " << rootedGeneTree << " ll " << ll << " gradient";
+  for (unsigned int i = 0; ok && i < rates.dimensions(); ++i) {
+    Parameters plus = rates;
+    Parameters minus = rates;
+    plus[i] += epsilon;
+    minus[i] -= epsilon;
+    evaluation.setRoot(root);
+    evaluation.setRates(plus);
+    double llPlus = evaluation.evaluate();
+    bool samePlusRoot = evaluation.getRoot() == root;
+    evaluation.setRoot(root);
+    evaluation.setRates(minus);
+    double llMinus = evaluation.evaluate();
+    bool sameMinusRoot = evaluation.getRoot() == root;
+    double finiteDifference = 0.0;
+    if (samePlusRoot && sameMinusRoot) {
+      finiteDifference = (llPlus - llMinus) / (2.0 * epsilon);
+    } else if (samePlusRoot) {
+      finiteDifference = (llPlus - reference) / epsilon;
+    } else if (sameMinusRoot) {
+      finiteDifference = (reference - llMinus) / epsilon;
+    } else {
+      std::cout << " " << gradient[i] << " (root changed)";
+      continue;
+    }
+    std::cout << " " << gradient[i] << " (" << finiteDifference << ")";
+    checkedDimensions++;
+    ok &= std::fabs(gradient[i] - finiteDifference)
+      < 1e-4 * std::max(1.0, std::fabs(finiteDifference));
+  }
+  std::cout << std::endl;
+  if (!checkedDimensions) {
+    std::cerr << "Error: the root changed in all the dimensions, no derivative was checked" << std::endl;
+    return false;
+  }
+  return ok;
+}
+
+int main(int, char**)
+{
+  Logger::init();
+  SyntheticFamily family(8, 20, 3);
+  bool ok = true;
+  for (auto model: {RecModel::UndatedDL, RecModel::UndatedDTL, RecModel::UndatedIDTL}) {
+    for (auto rooted: {false, true}) {
+      ok &= checkModel(family.speciesTree, family.geneTree, family.mapping, model, rooted);
+    }
+  }
+  if (!ok) {
+    std::cerr << "Error: the exact rate gradient differs from the finite differences" << std::endl;
+    return 1;
+  }
+  std::cout << "Test rate gradient ok!" << std::endl;
+  return 0;
+}
+
@@ -130,7 +130,7 @@ def check_reconciliation(test_output, model):
       return False;
   return True
 
-def run_generax(test_data, test_output, families_file, strategy, model, cores):
+def run_generax(test_data, test_output, families_file, strategy, model, cores, extra_args = []):
   command = []
   if (cores > 1):
     command.append("mpiexec")
@@ -147,10 +147,17 @@ def run_generax(test_data, test_output, families_file, strategy, model, cores):
   command.append(model)
   command.append("-p")
   command.append(os.path.join(test_output, "generax"))
+  command.extend(extra_args)
   logs_file_path = os.path.join(test_output, "tests_logs.txt")
   with open(logs_file_path, "w") as writer:
     subprocess.check_call(command, stdout = writer, stderr = writer)
 
+def get_final_joint_likelihood(test_output):
+  ll = None
+  for line in open(os.path.join(test_output, "tests_logs.txt")):
+    if ("Joint likelihood:" in line):
+      ll = float(line.split("Joint likelihood:")[1])
+  return ll
 
 def run_test(dataset, with_starting_tree, strategy, model, cores):
   test_name = get_test_name(dataset, with_starting_tree, strategy, model, cores)
@@ -183,6 +190,68 @@ def run_reconciliation_test(cores, model):
     print("Test " + test_name + ": FAILED")
   return ok
 
+# the gene tree search must find the same trees when 
+# testing the moves of each rank on several threads
+def run_gene_search_threads_test(dataset, model):
+  test_name = "gene_search_threads_" + dataset + "_" + model
+  test_data = os.path.join(DATA_DIR, dataset)
+  lls = []
+  try:
+    for threads in [1, 3]:
+      test_output = os.path.join(OUTPUT, test_name + "_" + str(threads))
+      reset_dir(test_output)
+      families_file = generate_families_file_data(test_data, True, test_output)
+      run_generax(test_data, test_output, families_file, "SPR", model, 1, 
+          ["--gene-search-threads", str(threads)])
+      lls.append(get_final_joint_likelihood(test_output))
+  except:
+    print("Test " + test_name + ": FAILED") 
+    return False
+  if (None in lls or abs(lls[0] - lls[1]) > 1e-6 * abs(lls[0])):
+    print("Test " + test_name + ": FAILED (joint likelihoods " + str(lls) + ")") 
+    return False
+  print("Test " + test_name + ": ok") 
+  return True
+
+# skipping the moves that did not improve the likelihood in their
+# unchanged neighbourhood must not end in a worse gene tree
+def run_move_cache_test(dataset, model):
+  test_name = "spr_move_cache_" + dataset + "_" + model
+  test_data = os.path.join(DATA_DIR, dataset)
+  lls = []
+  try:
+    for extra_args in [[], ["--spr-move-cache"]]:
+      test_output = os.path.join(OUTPUT, test_name + "_" + str(len(extra_args)))
+      reset_dir(test_output)
+      families_file = generate_families_file_data(test_data, True, test_output)
+      run_generax(test_data, test_output, families_file, "SPR", model, 1, extra_args)
+      lls.append(get_final_joint_likelihood(test_output))
+  except:
+    print("Test " + test_name + ": FAILED") 
+    return False
+  if (None in lls or lls[1] < lls[0] - 1e-6 * abs(lls[0])):
+    print("Test " + test_name + ": FAILED (joint likelihoods without and with the cache " + str(lls) + ")") 
+    return False
+  print("Test " + test_name + ": ok") 
+  return True
+
+# in safe mode, the search aborts if a rejected batch of moves
+# (or any other rolled back move) changes the likelihood
+def run_batch_moves_safe_mode_test(dataset, model):
+  test_name = "spr_batch_moves_safe_mode_" + dataset + "_" + model
+  test_data = os.path.join(DATA_DIR, dataset)
+  test_output = os.path.join(OUTPUT, test_name)
+  reset_dir(test_output)
+  try:
+    families_file = generate_families_file_data(test_data, True, test_output)
+    run_generax(test_data, test_output, families_file, "SPR", model, 1, 
+        ["--spr-batch-moves", "--safe-mode"])
+  except:
+    print("Test " + test_name + ": FAILED") 
+    return False
+  print("Test " + test_name + ": ok") 
+  return True
+
 dataset_set = ["simulated_2", "simulated_2_map_in_label"]
 with_starting_tree_set = [False, True]
 strategy_set = ["SPR", "EVAL"]
@@ -194,6 +263,10 @@ if (is_mpi_installed()):
 all_ok = True
 all_ok = all_ok and run_reconciliation_test(1, "UndatedDTL")
 all_ok = all_ok and run_reconciliation_test(1, "UndatedDL")
+for model in ["UndatedDL", "UndatedDTL"]:
+  all_ok = all_ok and run_gene_search_threads_test("simulated_2", model)
+  all_ok = all_ok and run_move_cache_test("simulated_2", model)
+  all_ok = all_ok and run_batch_moves_safe_mode_test("simulated_2", model)
 for dataset in dataset_set:
   for with_starting_tree in with_starting_tree_set:
     for strategy in strategy_set:
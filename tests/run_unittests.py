@@ -5,9 +5,13 @@ import subprocess
 script_dir = os.path.dirname(os.path.realpath(__file__))
 repo_dir = os.path.realpath(os.path.join(script_dir, os.pardir))
 species_tree_test = os.path.join(repo_dir, "build", "bin", "species_tree_tests")
+evaluation_allocations_test = os.path.join(repo_dir, "build", "bin", "evaluation_allocations_tests")
+rate_gradient_test = os.path.join(repo_dir, "build", "bin", "rate_gradient_tests")
 
 
 
 subprocess.check_call([species_tree_test])
+subprocess.check_call([evaluation_allocations_test])
+subprocess.check_call([rate_gradient_test])
 
 